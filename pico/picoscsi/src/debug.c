@@ -25,7 +25,9 @@
 ************************************************************************/
 
 // Global includes
+#include <pico/multicore.h>
 #include <pico/stdlib.h>
+#include <stdarg.h>
 #include <stdbool.h>
 #include <stdio.h>
 
@@ -33,50 +35,188 @@
 #include "debug.h"
 
 // Define default debug output flags
+#if DEBUG_LEVEL >= DEBUG_LEVEL_INFO
 volatile bool debugFlag_filesystem = true;
 volatile bool debugFlag_scsiCommands = true;
-volatile bool debugFlag_scsiBlocks = false;
 volatile bool debugFlag_scsiFcodes = true;
+#endif
+#if DEBUG_LEVEL >= DEBUG_LEVEL_VERBOSE
+volatile bool debugFlag_scsiBlocks = false;
 volatile bool debugFlag_scsiState = true;
+#endif
+
+// Binary trace ring (written by core 0, drained by core 1)
+debugTraceRecord_t debugTraceRing[DEBUG_TRACE_RING_LENGTH];
+volatile uint32_t debugTraceHead = 0;
+volatile uint32_t debugTraceTail = 0;
+volatile uint32_t debugTraceDropped = 0;
+
+// Text ring for debugPrintf() output (length must be a power of 2)
+#define DEBUG_TEXT_RING_LENGTH 4096
+static char debugTextRing[DEBUG_TEXT_RING_LENGTH];
+static volatile uint32_t debugTextHead = 0;
+static volatile uint32_t debugTextTail = 0;
+static volatile uint32_t debugTextDropped = 0;
+
+// Marker byte used to frame binary trace records in the debug UART stream.
+// debugPrintf() replaces any text byte with the top bit set, so the marker
+// cannot appear in text.
+#define DEBUG_TRACE_MARKER 0xFE
+
+// Send a binary trace record to the debug UART
+//
+// Frame format: marker, 12 byte little-endian record, XOR checksum
+static void debugSendTraceRecord(const debugTraceRecord_t *record) {
+    uint8_t frame[12];
+    uint8_t checksum = 0;
+
+    frame[0] = (uint8_t)(record->timestamp);
+    frame[1] = (uint8_t)(record->timestamp >> 8);
+    frame[2] = (uint8_t)(record->timestamp >> 16);
+    frame[3] = (uint8_t)(record->timestamp >> 24);
+    frame[4] = (uint8_t)(record->eventId);
+    frame[5] = (uint8_t)(record->eventId >> 8);
+    frame[6] = (uint8_t)(record->arg0);
+    frame[7] = (uint8_t)(record->arg0 >> 8);
+    frame[8] = (uint8_t)(record->arg1);
+    frame[9] = (uint8_t)(record->arg1 >> 8);
+    frame[10] = (uint8_t)(record->arg1 >> 16);
+    frame[11] = (uint8_t)(record->arg1 >> 24);
+
+    stdio_putchar_raw(DEBUG_TRACE_MARKER);
+    for (uint8_t i = 0; i < 12; i++) {
+        stdio_putchar_raw(frame[i]);
+        checksum ^= frame[i];
+    }
+    stdio_putchar_raw(checksum);
+}
+
+// Core 1 entry point - drains the text and trace rings to the debug UART so
+// that core 0 never waits for serial output
+static void debugDrainCore1(void) {
+    uint32_t reportedTraceDrops = 0;
+    uint32_t reportedTextDrops = 0;
+
+    while (1) {
+        bool idle = true;
+
+        // Drain any pending text
+        while (debugTextTail != debugTextHead) {
+            stdio_putchar_raw(
+                debugTextRing[debugTextTail & (DEBUG_TEXT_RING_LENGTH - 1)]);
+            debugTextTail++;
+            idle = false;
+        }
+
+        // Report any dropped text once the ring has drained (so the report
+        // follows the text that was kept)
+        if (debugTextDropped != reportedTextDrops) {
+            char text[48];
+            int length;
+
+            reportedTextDrops = debugTextDropped;
+            length = snprintf(text, sizeof(text),
+                              "debug: %u messages dropped (total)\r\n",
+                              (unsigned int)reportedTextDrops);
+            for (int i = 0; i < length && i < (int)sizeof(text) - 1; i++)
+                stdio_putchar_raw(text[i]);
+        }
+
+        // Drain any pending trace records
+        while (debugTraceTail != debugTraceHead) {
+            __dmb();
+            debugSendTraceRecord(
+                &debugTraceRing[debugTraceTail & (DEBUG_TRACE_RING_LENGTH - 1)]);
+            debugTraceTail++;
+            idle = false;
+        }
+
+        // Report any dropped trace records
+        if (debugTraceDropped != reportedTraceDrops) {
+            debugTraceRecord_t record;
+            reportedTraceDrops = debugTraceDropped;
+            record.timestamp = time_us_32();
+            record.eventId = TRACE_DROPPED;
+            record.arg0 = 0;
+            record.arg1 = reportedTraceDrops;
+            debugSendTraceRecord(&record);
+        }
+
+        if (idle) sleep_us(100);
+    }
+}
 
 void debugInitialise(void) {
     stdio_init_all();
+
+    // Start the debug output drain on core 1
+    multicore_launch_core1(debugDrainCore1);
 }
 
+#if DEBUG_LEVEL > DEBUG_LEVEL_NONE
+// Format the debug output and queue it for core 1.  Formatting is the only
+// cost to the caller; the (slow) UART output happens on core 1.  If the text
+// ring is full the output is dropped rather than stalling the caller.
 void debugPrintf(const char *format, ...) {
+    char text[160];
+    int length;
+    uint32_t head;
+
     va_list args;
     va_start(args, format);
-    vprintf(format, args);
+    length = vsnprintf(text, sizeof(text), format, args);
     va_end(args);
+
+    if (length <= 0) return;
+    if (length >= (int)sizeof(text)) length = sizeof(text) - 1;
+
+    head = debugTextHead;
+    if (DEBUG_TEXT_RING_LENGTH - (head - debugTextTail) < (uint32_t)length) {
+        debugTextDropped++;
+        return;
+    }
+
+    // Text is kept to 7-bit ASCII (raw bytes, such as a user code printed
+    // with %c, could otherwise be taken for a trace record marker)
+    for (int i = 0; i < length; i++)
+        debugTextRing[(head + i) & (DEBUG_TEXT_RING_LENGTH - 1)] =
+            ((uint8_t)text[i] & 0x80) ? '?' : text[i];
+
+    // Ensure the text is visible to core 1 before the head moves
+    __dmb();
+    debugTextHead = head + length;
 }
+#endif
 
 // This function outputs a hex dump of the passed buffer
 void debugSectorBufferHex(uint8_t *buffer, uint16_t numberOfBytes) {
+    char line[16 * 3 + 3 + 16 + 3];
     uint16_t i = 0;
     uint16_t index = 16;
-    uint16_t width = 16;  // Width of output in bytes
+    uint16_t position;
 
     for (uint16_t byteNumber = 0; byteNumber < numberOfBytes;
          byteNumber += 16) {
+        position = 0;
         for (i = 0; i < index; i++) {
-            printf("%02x ", buffer[i + byteNumber]);
+            position += sprintf(line + position, "%02x ",
+                                buffer[i + byteNumber]);
         }
-        for (uint16_t spacer = index; spacer < width; spacer++)
-            printf("	");
 
-        printf(": ");
+        position += sprintf(line + position, ": ");
 
         for (i = 0; i < index; i++) {
             if (buffer[i + byteNumber] < 32 || buffer[i + byteNumber] > 126)
-                printf(".");
+                line[position++] = '.';
             else
-                printf("%c", buffer[i + byteNumber]);
+                line[position++] = buffer[i + byteNumber];
         }
+        line[position] = 0;
 
-        printf("\r\n");
+        debugPrintf("%s\r\n", line);
     }
 
-    printf("\r\n");
+    debugPrintf("\r\n");
 }
 
 // This function decodes the contents of the LUN descriptor and outputs it to
@@ -27,16 +27,109 @@
 #ifndef DEBUG_H_
 #define DEBUG_H_
 
+#include "hardware/sync.h"
+
+// Compile-time debug levels (set with -DDEBUG_LEVEL=n, see CMakeLists.txt)
+//
+// Each debug category is assigned a level; categories above DEBUG_LEVEL are
+// compiled out completely.  Their flags become the constant 'false' so every
+// 'if (debugFlag_xxx) ...' guarded call is removed by the compiler and costs
+// nothing in the SCSI hot loops.
+#define DEBUG_LEVEL_NONE 0
+#define DEBUG_LEVEL_ERROR 1
+#define DEBUG_LEVEL_INFO 2
+#define DEBUG_LEVEL_VERBOSE 3
+
+#ifndef DEBUG_LEVEL
+#define DEBUG_LEVEL DEBUG_LEVEL_VERBOSE
+#endif
+
 // External globals
+#if DEBUG_LEVEL >= DEBUG_LEVEL_INFO
 extern volatile bool debugFlag_filesystem;
 extern volatile bool debugFlag_scsiCommands;
-extern volatile bool debugFlag_scsiBlocks;
 extern volatile bool debugFlag_scsiFcodes;
+#else
+#define debugFlag_filesystem false
+#define debugFlag_scsiCommands false
+#define debugFlag_scsiFcodes false
+#endif
+
+#if DEBUG_LEVEL >= DEBUG_LEVEL_VERBOSE
+extern volatile bool debugFlag_scsiBlocks;
 extern volatile bool debugFlag_scsiState;
+#else
+#define debugFlag_scsiBlocks false
+#define debugFlag_scsiState false
+#endif
+
+// Binary trace event identifiers
+//
+// Note: These values are decoded to text by vp415-host (tracedecoder.cpp) so
+// any changes here must be reflected there.
+#define TRACE_SCSI_BUSFREE 0x01    // No arguments
+#define TRACE_SCSI_SELECTED 0x02   // arg0 = host ID
+#define TRACE_SCSI_PHASE 0x03      // arg0 = information transfer phase
+#define TRACE_SCSI_CDB 0x04        // arg0 = CDB offset, arg1 = 4 CDB bytes
+#define TRACE_SCSI_BLOCK 0x05      // arg0 = bytes transferred, arg1 = block
+#define TRACE_SCSI_STATUS 0x06     // arg0 = status byte
+#define TRACE_SCSI_MESSAGE 0x07    // arg0 = message byte
+#define TRACE_SCSI_RESET 0x08      // No arguments
+#define TRACE_PICOM_REQUEST 0x10   // arg0 = tx length, arg1 = command code
+#define TRACE_PICOM_RESPONSE 0x11  // arg0 = rx length, arg1 = 1 if failed
+#define TRACE_DROPPED 0x7F         // arg1 = number of dropped trace records
+
+// Binary trace record
+//
+// Records are written to a RAM ring by core 0 and drained to the debug UART
+// by core 1 (see debugDrainCore1()).
+typedef struct {
+    uint32_t timestamp;  // time_us_32() when the event was recorded
+    uint16_t eventId;    // TRACE_xxx event identifier
+    uint16_t arg0;       // Event specific argument
+    uint32_t arg1;       // Event specific argument
+} debugTraceRecord_t;
+
+// Trace ring length in records (must be a power of 2)
+#define DEBUG_TRACE_RING_LENGTH 1024
+
+extern debugTraceRecord_t debugTraceRing[DEBUG_TRACE_RING_LENGTH];
+extern volatile uint32_t debugTraceHead;
+extern volatile uint32_t debugTraceTail;
+extern volatile uint32_t debugTraceDropped;
+
+// Record a binary trace event.  This only costs a few cycles (a timer read and
+// four stores) so it is safe to use inside the SCSI data path.  If the ring is
+// full the record is dropped and counted rather than waiting for core 1.
+//
+// Note: Must only be called from core 0 thread context (not from an ISR)
+static inline void debugTrace(uint16_t eventId, uint16_t arg0, uint32_t arg1) {
+    uint32_t head = debugTraceHead;
+
+    if (head - debugTraceTail >= DEBUG_TRACE_RING_LENGTH) {
+        debugTraceDropped++;
+        return;
+    }
+
+    debugTraceRecord_t *record =
+        &debugTraceRing[head & (DEBUG_TRACE_RING_LENGTH - 1)];
+    record->timestamp = time_us_32();
+    record->eventId = eventId;
+    record->arg0 = arg0;
+    record->arg1 = arg1;
+
+    // Ensure the record is visible to core 1 before the head moves
+    __dmb();
+    debugTraceHead = head + 1;
+}
 
 // Function prototypes
 void debugInitialise(void);
+#if DEBUG_LEVEL > DEBUG_LEVEL_NONE
 void debugPrintf(const char *format, ...);
+#else
+#define debugPrintf(...) ((void)0)
+#endif
 
 void debugSectorBufferHex(uint8_t *buffer, uint16_t numberOfBytes);
 void debugLunDescriptor(uint8_t *buffer);
@@ -516,10 +516,8 @@ void fcodeWriteBuffer(uint8_t lunNumber) {
         // Get the user code for the target LUN
         filesystemReadLunUserCode(lunNumber, userCode);
 
-        printf("<UCD>");
-        for (byteCounter = 0; byteCounter < 5; byteCounter++)
-            printf("%c", userCode[byteCounter]);
-        printf("</UCD>\r\n");
+        debugPrintf("<UCD>%c%c%c%c%c</UCD>\r\n", userCode[0], userCode[1],
+                    userCode[2], userCode[3], userCode[4]);
     }
 
     // Send the F-Code to the serial UART
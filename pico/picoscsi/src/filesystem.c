@@ -39,6 +39,7 @@
 struct filesystemStateStruct {
     bool fsMountState;  // File system mount state (true = mounted, false =
                         // dismounted)
+    bool fsMountPending;  // Mount deferred from a reset to the next idle
 
     uint8_t lunDirectory;  // Current LUN directory ID
     uint8_t lunNumber;     // Current LUN number
@@ -48,31 +49,92 @@ struct filesystemStateStruct {
     uint8_t fsLunUserCode[8][5];  // LUN 5-byte User code (used for F-Code
                                   // interactions - only present for laser disc
                                   // images)
+    uint8_t fsLunDescriptor[8][22];  // LUN descriptors (cached from the Pi)
+    bool fsLunDescriptorValid[8];    // LUN has EFM data and a descriptor
+    bool fsLunStateKnown[8];  // LUN table entry is populated (the Pi pushes
+                              // mount/eject/disc change events to keep it
+                              // up to date)
 
     uint8_t fsResult;  // File system result code
     uint8_t fsCounter;
 
+    bool fsReadBadSectorValid;  // The last read failed on a bad sector
+    uint32_t fsReadBadSector;
+
 } filesystemState;
 
 static char fileName[255];  // String for storing LFN filename
 
-static uint8_t sectorBuffer[SECTOR_BUFFER_SIZE];  // Buffer for reading sectors
-static bool lunOpenFlag = false;  // Flag to track when a LUN is open for
-                                  // read/write (to prevent multiple file opens)
-
-// Globals for multi-sector reading
-static uint32_t sectorsInBuffer = 0;
-static uint32_t currentBufferSector = 0;
-static uint32_t sectorsRemaining = 0;
-
-static void filesystemFlush(void) {
-    // If a LUN is open close it
-    if (lunOpenFlag) {
+static uint8_t sectorBuffer[SECTOR_BUFFER_SIZE];  // Buffer for descriptors
+
+// Per-LUN stream contexts.  Each LUN keeps its own position, buffered sectors
+// and prefetch so that interleaved access to several LUNs doesn't throw away
+// buffered data and restart the fetch from the Pi each time.
+//
+// Sectors are not copied out of (or into) the stream buffer; the SCSI layer
+// borrows a pointer to the sector slot and the data bus is driven straight
+// from it.  A lent slot is pinned (the buffer isn't refilled) until it is
+// released.
+//
+// Prefetching: SEEK and the end of a READ give a hint of the next sector the
+// host is likely to read; the hint is passed to the Pi (so it can cache the
+// extent) and the sectors are pulled into the LUN's prefetch buffer whilst the
+// bus is idle.  When a read starts at the prefetched sector the stream and
+// prefetch buffers are swapped rather than copied.
+typedef struct {
+    bool open;  // LUN is open for read/write
+
+    // Storage for the stream and prefetch buffers (swapped as the prefetched
+    // sectors are used)
+    uint8_t bufferStorage[2][SECTOR_BUFFER_SIZE];
+
+    // Multi-sector reading
+    uint8_t *buffer;
+    uint32_t bufferStartSector;    // First sector held in the buffer
+    uint32_t bufferValidSectors;   // Number of sectors held in the buffer
+    uint32_t sectorsInBuffer;      // Buffered sectors for the current read
+    uint32_t currentBufferSector;  // Next buffered sector for the current read
+    uint32_t sectorsRemaining;     // Sectors still to be fetched
+    uint32_t nextReadSector;       // Next sector to request from the Pi
+                                   // (or to write to when writing)
+    bool sectorLent;               // The current sector is lent to the SCSI
+                                   // layer (see filesystemAcquireReadSector())
+
+    // Prefetching
+    uint8_t *prefetchBuffer;
+    bool prefetchHintPending;          // Hint waiting to be sent to the Pi
+    bool prefetchFilling;              // Prefetch buffer is being filled
+    uint32_t prefetchSector;           // First sector of the hint
+    uint32_t prefetchSectorsInBuffer;  // Sectors in prefetch buffer
+} lunStream_t;
+
+static lunStream_t lunStream[8];
+
+// Prefetch counters (sent to the Pi with each hint so it can be tuned)
+static uint32_t prefetchHintCount = 0;
+static uint32_t prefetchSectorCount = 0;      // Sectors prefetched
+static uint32_t prefetchUsedSectorCount = 0;  // Prefetched sectors read
+
+// Close the stream for a LUN (buffered and prefetched sectors are kept)
+static void filesystemFlushLun(uint8_t lunNumber) {
+    // If the LUN is open close it
+    if (lunStream[lunNumber].open) {
         // Close the open file object
         //   f_close(&filesystemState.fileObject);
-        lunOpenFlag = false;
+        lunStream[lunNumber].open = false;
         if (debugFlag_filesystem)
-            debugPrintf("File system: filesystemFlush(): Completed\r\n");
+            debugPrintf(
+                "File system: filesystemFlushLun(): LUN %d completed\r\n",
+                lunNumber);
+    }
+}
+
+// Close the streams for all LUNs and discard any buffered data
+static void filesystemFlush(void) {
+    for (uint8_t lunNumber = 0; lunNumber < 8; lunNumber++) {
+        filesystemFlushLun(lunNumber);
+        lunStream[lunNumber].bufferValidSectors = 0;
+        filesystemPrefetchCancel(lunNumber);
     }
 }
 
@@ -85,14 +147,24 @@ void filesystemInitialise(void) {
     filesystemState.lunDirectory = 0;      // Default to LUN directory 0
     filesystemState.fsMountState = false;  // FS default state is unmounted
 
-    // Mount the file system
-    filesystemMount();
+    for (uint8_t lunNumber = 0; lunNumber < 8; lunNumber++) {
+        lunStream[lunNumber].buffer = lunStream[lunNumber].bufferStorage[0];
+        lunStream[lunNumber].prefetchBuffer =
+            lunStream[lunNumber].bufferStorage[1];
+    }
+
+    // Mount the file system (if the Pi isn't there yet the mount is retried
+    // once it responds)
+    if (!filesystemMount()) filesystemState.fsMountPending = true;
 }
 
 // Reset the file system (called when the host signals reset)
+//
+// The reset is answered entirely from the cached LUN table so that it never
+// waits on the Pi; if the file system isn't mounted the mount is retried when
+// the bus is next idle.
 void filesystemReset(void) {
     uint8_t lunNumber;
-    bool errorFlag = false;
 
     if (debugFlag_filesystem)
         debugPrintf(
@@ -105,37 +177,40 @@ void filesystemReset(void) {
                 "File system: filesystemReset(): File system is flagged as "
                 "mounted\r\n");
 
-        // Test mounted LUNs to make sure they are still available
-        // Note: This is in case the SD card has been removed or changed since
-        // the last reset.
+        // Test started LUNs to make sure they are still available
+        // Note: This is in case the disc has been ejected or changed since
+        // the last reset.  A LUN that is no longer available is stopped.
         for (lunNumber = 0; lunNumber < 8; lunNumber++) {
-            // If the LUN status is available, test it to make sure
             if (filesystemReadLunStatus(lunNumber)) {
-                if (!filesystemTestLunStatus(lunNumber)) errorFlag = true;
+                if (!filesystemTestLunStatus(lunNumber)) {
+                    debugPrintf(
+                        "File system: filesystemReset(): LUN %d is no longer "
+                        "available - stopping\r\n",
+                        lunNumber);
+                    filesystemState.fsLunStatus[lunNumber] = false;
+                }
             }
         }
-
-        // If any of the LUN's had an invalid status we should remount to ensure
-        // everything is ok.
-        if (errorFlag) {
-            debugPrintf(
-                "File system: filesystemReset(): LUN status flags are "
-                "incorrect!\r\n");
-
-            // Dismount and then mount file system to ensure it is correct
-            filesystemDismount();
-            filesystemMount();
-        }
     } else {
-        // If the file system is not currently mounted, attempt to mount it
+        // If the file system is not currently mounted, mount it once the bus
+        // is idle
         if (debugFlag_filesystem)
             debugPrintf(
                 "File system: filesystemReset(): File system is not mounted - "
-                "attempting to mount\r\n");
-        filesystemMount();
+                "mount deferred\r\n");
+        filesystemState.fsMountPending = true;
     }
 }
 
+// Process idle time (called when the Pi has responded to a poll).  A failed
+// mount stays pending, so it's retried on the next poll.
+void filesystemProcessIdle(void) {
+    if (!filesystemState.fsMountPending) return;
+
+    if (filesystemState.fsMountState == false && !filesystemMount()) return;
+    filesystemState.fsMountPending = false;
+}
+
 // File system mount and dismount functions
 // -------------------------------------------------------------------------------------------------------------------
 
@@ -294,6 +369,10 @@ bool filesystemDismount(void) {
     return true;
 }
 
+// Function to read the mount state (sent to the Pi when the link session is
+// resumed)
+bool filesystemReadMountState(void) { return filesystemState.fsMountState; }
+
 // LUN status control functions
 // -------------------------------------------------------------------------------------------------------------------------------
 
@@ -423,10 +502,26 @@ bool filesystemCheckLunImage(uint8_t lunNumber) {
         debugPrintf(
             "File system: filesystemCheckLunImage(): Flushing the file "
             "system\r\n");
-    filesystemFlush();
+    filesystemFlushLun(lunNumber);
+
+    // The first time a LUN is checked, ask the host for the disc descriptor
+    // and user code (this also tells us if EFM data exists for the disc).
+    // After that the LUN table is kept up to date by disc events pushed from
+    // the Pi, so LUN checks (at start, auto-start and after a reset) never
+    // need to wait for the link.
+    if (!filesystemState.fsLunStateKnown[lunNumber]) {
+        uint8_t pirResponse = picomGetDiscDescriptor(
+            lunNumber, filesystemState.fsLunDescriptor[lunNumber],
+            filesystemState.fsLunUserCode[lunNumber]);
+
+        // Don't cache a timeout; ask again next time
+        if (pirResponse != PIR_TIMEOUT)
+            filesystemState.fsLunStateKnown[lunNumber] = true;
+        filesystemState.fsLunDescriptorValid[lunNumber] =
+            (pirResponse == PIR_TRUE);
+    }
 
-    // Ask the host if EFM data exists for the disc
-    if (picomGetEfmDataPresent() == PIR_TRUE) {
+    if (filesystemState.fsLunDescriptorValid[lunNumber]) {
         if (debugFlag_filesystem)
             debugPrintf(
                 "File system: filesystemCheckLunImage(): EFM data is present "
@@ -438,12 +533,11 @@ bool filesystemCheckLunImage(uint8_t lunNumber) {
                 "present on the disc\r\n");
 
         // Exit with error
-        // f_close(&filesystemState.fileObject);
         return false;
     }
 
-    // Get the user code from the host
-    picomGetUserCode(filesystemState.fsLunUserCode[lunNumber]);
+    if (debugFlag_filesystem)
+        debugLunDescriptor(filesystemState.fsLunDescriptor[lunNumber]);
 
     if (debugFlag_filesystem) {
         // Show the user code
@@ -461,6 +555,53 @@ bool filesystemCheckLunImage(uint8_t lunNumber) {
     return true;
 }
 
+// Function to update the LUN table from a disc event pushed by the Pi (disc
+// mounted, ejected or changed)
+void filesystemUpdateLun(uint8_t lunNumber, bool efmDataPresent,
+                         uint8_t descriptor[22], uint8_t userCode[5]) {
+    if (lunNumber > 7) return;
+
+    filesystemState.fsLunStateKnown[lunNumber] = true;
+    filesystemState.fsLunDescriptorValid[lunNumber] = efmDataPresent;
+
+    // Any buffered or prefetched data is from the previous disc
+    lunStream[lunNumber].bufferValidSectors = 0;
+    filesystemPrefetchCancel(lunNumber);
+
+    if (efmDataPresent) {
+        memcpy(filesystemState.fsLunDescriptor[lunNumber], descriptor, 22);
+        memcpy(filesystemState.fsLunUserCode[lunNumber], userCode, 5);
+        if (debugFlag_filesystem)
+            debugPrintf(
+                "File system: filesystemUpdateLun(): LUN %d disc changed\r\n",
+                lunNumber);
+    } else {
+        // The disc has been ejected, so the LUN can no longer be started
+        filesystemState.fsLunStatus[lunNumber] = false;
+        if (debugFlag_filesystem)
+            debugPrintf(
+                "File system: filesystemUpdateLun(): LUN %d disc ejected\r\n",
+                lunNumber);
+    }
+}
+
+// Function to forget the whole LUN table (when the Pi changes the emulation
+// mode the LUNs refer to different images).  All LUNs are stopped and will ask
+// the Pi for their state when they are next checked.
+void filesystemResetLunTable(void) {
+    filesystemFlush();
+
+    for (uint8_t lunNumber = 0; lunNumber < 8; lunNumber++) {
+        filesystemState.fsLunStateKnown[lunNumber] = false;
+        filesystemState.fsLunDescriptorValid[lunNumber] = false;
+        filesystemState.fsLunStatus[lunNumber] = false;
+    }
+
+    if (debugFlag_filesystem)
+        debugPrintf(
+            "File system: filesystemResetLunTable(): LUN table cleared\r\n");
+}
+
 // Function to calculate the LUN image size from the LUN descriptor file
 // parameters
 uint32_t filesystemGetLunSizeFromDsc(uint8_t lunDirectory, uint8_t lunNumber) {
@@ -475,7 +616,7 @@ uint32_t filesystemGetLunSizeFromDsc(uint8_t lunDirectory, uint8_t lunNumber) {
         debugPrintf(
             "File system: filesystemGetLunSizeFromDsc(): Flushing the file "
             "system\r\n");
-    filesystemFlush();
+    filesystemFlushLun(lunNumber);
 
     // Assemble the DSC file name
     sprintf(fileName, "/BeebSCSI%d/scsi%d.dsc", lunDirectory, lunNumber);
@@ -540,7 +681,7 @@ bool filesystemCreateDscFromLunImage(uint8_t lunDirectory, uint8_t lunNumber,
         debugPrintf(
             "File system: filesystemCreateDscFromLunImage(): Flushing the file "
             "system\r\n");
-    filesystemFlush();
+    filesystemFlushLun(lunNumber);
 
     // Calculate the LUN file size in tracks (33 sectors per track, 256 bytes
     // per sector)
@@ -832,7 +973,7 @@ void filesystemGetUserCodeFromUcd(uint8_t lunDirectoryNumber,
         debugPrintf(
             "File system: filesystemGetUserCodeFromUcd(): Flushing the file "
             "system\r\n");
-    filesystemFlush();
+    filesystemFlushLun(lunNumber);
 
     // Assemble the UCD file name
     sprintf(fileName, "/BeebSCSI%d/scsi%d.ucd", lunDirectoryNumber, lunNumber);
@@ -895,89 +1036,31 @@ uint8_t filesystemGetLunDirectory(void) { return filesystemState.lunDirectory; }
 // Functions for creating LUNs and LUN descriptors
 // ------------------------------------------------------------------------------------------------------------
 
-// Function to create a new LUN image (makes an empty .dat file)
+// Function to create a new LUN image
+// Note: The Pi creates the .dat file when the LUN is formatted, so there is
+// nothing to do here
 bool filesystemCreateLunImage(uint8_t lunNumber) {
     if (debugFlag_filesystem)
         debugPrintf(
             "File system: filesystemCreateLunImage(): Flushing the file "
             "system\r\n");
-    filesystemFlush();
-
-    // Assemble the .dat file name
-    sprintf(fileName, "/BeebSCSI%d/scsi%d.dat", filesystemState.lunDirectory,
-            lunNumber);
-
-    filesystemState.fsResult =
-        -1;  // f_open(&filesystemState.fileObject, fileName, FA_READ);
-    if (filesystemState.fsResult == 0) {
-        // File opened ok - which means it already exists...
-        if (debugFlag_filesystem)
-            debugPrintf(
-                "File system: filesystemCreateLunImage(): .dat already exists "
-                "- ignoring request to create a new .dat\r\n");
-        // f_close(&filesystemState.fileObject);
-        return true;
-    }
-
-    // Create a new .dat file
-    filesystemState.fsResult =
-        -1;  // f_open(&filesystemState.fileObject, fileName, FA_CREATE_NEW);
-    if (filesystemState.fsResult != 0) {
-        // Create .dat file failed
-        if (debugFlag_filesystem)
-            debugPrintf(
-                "File system: filesystemCreateLunImage(): ERROR: Could not "
-                "create new .dat file!\r\n");
-        // f_close(&filesystemState.fileObject);
-        return false;
-    }
+    filesystemFlushLun(lunNumber);
 
-    // LUN .dat file created successfully
-    // f_close(&filesystemState.fileObject);
     if (debugFlag_filesystem)
         debugPrintf("File system: filesystemCreateLunImage(): Successful\r\n");
     return true;
 }
 
-// Function to create a new LUN descriptor (makes an empty .dsc file)
+// Function to create a new LUN descriptor
+// Note: The Pi creates the .dsc file when the descriptor is written, so there
+// is nothing to do here
 bool filesystemCreateLunDescriptor(uint8_t lunNumber) {
     if (debugFlag_filesystem)
         debugPrintf(
             "File system: filesystemCreateLunDescriptor(): Flushing the file "
             "system\r\n");
-    filesystemFlush();
+    filesystemFlushLun(lunNumber);
 
-    // Assemble the .dsc file name
-    sprintf(fileName, "/BeebSCSI%d/scsi%d.dsc", filesystemState.lunDirectory,
-            lunNumber);
-
-    filesystemState.fsResult =
-        -1;  // f_open(&filesystemState.fileObject, fileName, FA_READ);
-    if (filesystemState.fsResult == 0) {
-        // File opened ok - which means it already exists...
-        if (debugFlag_filesystem)
-            debugPrintf(
-                "File system: filesystemCreateLunDescriptor(): .dsc already "
-                "exists - ignoring request to create a new .dsc\r\n");
-        // f_close(&filesystemState.fileObject);
-        return true;
-    }
-
-    // Create a new .dsc file
-    filesystemState.fsResult =
-        -1;  // f_open(&filesystemState.fileObject, fileName, FA_CREATE_NEW);
-    if (filesystemState.fsResult != 0) {
-        // Create .dsc file failed
-        if (debugFlag_filesystem)
-            debugPrintf(
-                "File system: filesystemCreateLunDescriptor(): ERROR: Could "
-                "not create new .dsc file!\r\n");
-        // f_close(&filesystemState.fileObject);
-        return false;
-    }
-
-    // LUN DSC file created successfully
-    // f_close(&filesystemState.fileObject);
     if (debugFlag_filesystem)
         debugPrintf(
             "File system: filesystemCreateLunDescriptor(): Successful\r\n");
@@ -985,47 +1068,19 @@ bool filesystemCreateLunDescriptor(uint8_t lunNumber) {
 }
 
 // Function to read a LUN descriptor
+// Note: The descriptor is cached when the LUN is started, so this never needs
+// to communicate with the Pi
 bool filesystemReadLunDescriptor(uint8_t lunNumber, uint8_t buffer[]) {
-    if (debugFlag_filesystem)
+    if (!filesystemState.fsLunDescriptorValid[lunNumber]) {
         debugPrintf(
-            "File system: filesystemReadLunDescriptor(): Flushing the file "
-            "system\r\n");
-    filesystemFlush();
-
-    // Assemble the .dsc file name
-    sprintf(fileName, "/BeebSCSI%d/scsi%d.dsc", filesystemState.lunDirectory,
+            "File system: filesystemReadLunDescriptor(): ERROR: No descriptor "
+            "available for LUN %d\r\n",
             lunNumber);
-
-    filesystemState.fsResult =
-        -1;  // f_open(&filesystemState.fileObject, fileName, FA_READ);
-    if (filesystemState.fsResult == 0) {
-        // Read the .dsc data
-        filesystemState.fsResult =
-            -1;  // f_read(&filesystemState.fileObject, buffer, 22,
-                 // &filesystemState.fsCounter);
-
-        // Check that the file was read OK and is the correct length
-        if (filesystemState.fsResult != 0 && filesystemState.fsCounter == 22) {
-            // Something went wrong
-            if (debugFlag_filesystem)
-                debugPrintf(
-                    "File system: filesystemReadLunDescriptor(): ERROR: Could "
-                    "not read .dsc file for LUN\r\n");
-            // f_close(&filesystemState.fileObject);
-            return false;
-        }
-    } else {
-        // Looks like the .dsc file is not present on the file system
-        debugPrintf(
-            "File system: filesystemReadLunDescriptor(): ERROR: Could not open "
-            ".dsc file for LUN %d",
-            lunNumber);
-        // f_close(&filesystemState.fileObject);
         return false;
     }
 
-    // Descriptor read OK
-    // f_close(&filesystemState.fileObject);
+    memcpy(buffer, filesystemState.fsLunDescriptor[lunNumber], 22);
+
     if (debugFlag_filesystem)
         debugPrintf(
             "File system: filesystemReadLunDescriptor(): Successful\r\n");
@@ -1038,42 +1093,28 @@ bool filesystemWriteLunDescriptor(uint8_t lunNumber, uint8_t buffer[]) {
         debugPrintf(
             "File system: filesystemWriteLunDescriptor(): Flushing the file "
             "system\r\n");
-    filesystemFlush();
-
-    // Assemble the .dsc file name
-    sprintf(fileName, "/BeebSCSI%d/scsi%d.dsc", filesystemState.lunDirectory,
-            lunNumber);
+    filesystemFlushLun(lunNumber);
 
-    filesystemState.fsResult = -1;
-    ;  // f_open(&filesystemState.fileObject, fileName, FA_READ | FA_WRITE);
-    if (filesystemState.fsResult == 0) {
-        // Write the .dsc data
-        filesystemState.fsResult =
-            -1;  // f_write(&filesystemState.fileObject, buffer, 22,
-                 // &filesystemState.fsCounter);
-
-        // Check that the file was written OK and is the correct length
-        if (filesystemState.fsResult != 0 && filesystemState.fsCounter == 22) {
-            // Something went wrong
-            if (debugFlag_filesystem)
-                debugPrintf(
-                    "File system: filesystemWriteLunDescriptor(): ERROR: Could "
-                    "not write .dsc file for LUN\r\n");
-            // f_close(&filesystemState.fileObject);
-            return false;
-        }
-    } else {
-        // Looks like the .dsc file is not present on the file system
-        debugPrintf(
-            "File system: filesystemWriteLunDescriptor(): ERROR: Could not "
-            "open .dsc file for LUN %d",
-            lunNumber);
-        // f_close(&filesystemState.fileObject);
+    // Write the .dsc data on the Pi
+    if (picomWriteDescriptor(lunNumber, buffer) != PIR_OK) {
+        // Something went wrong
+        if (debugFlag_filesystem)
+            debugPrintf(
+                "File system: filesystemWriteLunDescriptor(): ERROR: Could "
+                "not write .dsc file for LUN\r\n");
         return false;
     }
 
+    // Update the LUN table locally (the descriptor is needed to format the
+    // LUN), so a later reset never has to ask the Pi for it.  Hard disc
+    // images have no user code.
+    if (!filesystemState.fsLunStateKnown[lunNumber])
+        memset(filesystemState.fsLunUserCode[lunNumber], 0, 5);
+    memcpy(filesystemState.fsLunDescriptor[lunNumber], buffer, 22);
+    filesystemState.fsLunDescriptorValid[lunNumber] = true;
+    filesystemState.fsLunStateKnown[lunNumber] = true;
+
     // Descriptor write OK
-    // f_close(&filesystemState.fileObject);
     if (debugFlag_filesystem)
         debugPrintf(
             "File system: filesystemWriteLunDescriptor(): Successful\r\n");
@@ -1087,7 +1128,7 @@ bool filesystemFormatLun(uint8_t lunNumber, uint8_t dataPattern) {
     if (debugFlag_filesystem)
         debugPrintf(
             "File system: filesystemFormatLun(): Flushing the file system\r\n");
-    filesystemFlush();
+    filesystemFlushLun(lunNumber);
 
     if (debugFlag_filesystem)
         debugPrintf(
@@ -1114,69 +1155,32 @@ bool filesystemFormatLun(uint8_t lunNumber, uint8_t dataPattern) {
         debugPrintf("File system: filesystemFormatLun(): Sectors required = %d",
                     requiredNumberOfSectors);
 
-    // Assemble the .dat file name
-    sprintf(fileName, "/BeebSCSI%d/scsi%d.dat", filesystemState.lunDirectory,
-            lunNumber);
-
-    // Note: We are using the expand FAT method to create the LUN image... the
-    // dataPattern byte will be ignored. Fill the sector buffer with the
-    // required data pattern for (counter = 0; counter < 256; counter++)
-    // sectorBuffer[counter] = dataPattern;
+    // Any buffered or prefetched data is about to be discarded
+    lunStream[lunNumber].bufferValidSectors = 0;
+    filesystemPrefetchCancel(lunNumber);
 
-    // Create the .dat file (the old .dat file, if present, will be unlinked
-    // (i.e. gone forever))
-    filesystemState.fsResult =
-        -1;  // f_open(&filesystemState.fileObject, fileName, FA_READ | FA_WRITE
-             // | FA_CREATE_ALWAYS);
-    if (filesystemState.fsResult == 0) {
-        // Write the required number of sectors to the DAT file
-        if (debugFlag_filesystem)
-            debugPrintf(
-                "File system: filesystemFormatLun(): Performing format...\r\n");
-
-        // If we try to write 512MBs of data to the SD card in 256 byte chunks
-        // via SPI it will take a very long time to complete...
-        //
-        // So instead we use the FAT FS expand command to allocate a file of the
-        // required LUN size
-        //
-        // Note: This allocates a contiguous area for the file which can help to
-        // speed up read/write times.  If you would prefer the file to be small
-        // and grow as used, just remove the f_expand and the fsResult check.
-        // Every thing will work fine without them.
-        //
-        // This ignores the data pattern (since the file is only allocated - not
-        // actually written).
-        filesystemState.fsResult =
-            -1;  // f_expand(&filesystemState.fileObject,
-                 // (FSIZE_t)(requiredNumberOfSectors * 256), 1);
-
-        if (debugFlag_filesystem)
-            debugPrintf(
-                "File system: filesystemFormatLun(): Format complete\r\n");
-
-        // Check that the file was written OK
-        if (filesystemState.fsResult != 0) {
-            // Something went wrong writing to the .dat
-            if (debugFlag_filesystem)
-                debugPrintf(
-                    "File system: filesystemFormatLun(): ERROR: Could not "
-                    "write .dat\r\n");
-            // f_close(&filesystemState.fileObject);
-            return false;
-        }
-    } else {
-        // Something went wrong opening the .dat
+    // Create the .dat file on the Pi (the old .dat file, if present, is
+    // replaced).  As with the FatFS f_expand method the file is only
+    // allocated, so the data pattern is ignored.
+    if (debugFlag_filesystem)
+        debugPrintf(
+            "File system: filesystemFormatLun(): Performing format...\r\n");
+    if (picomFormatLun(lunNumber, dataPattern, requiredNumberOfSectors) !=
+        PIR_OK) {
+        // Something went wrong creating the .dat
         if (debugFlag_filesystem)
             debugPrintf(
-                "File system: filesystemFormatLun(): ERROR: Could not open "
-                ".dat\r\n");
-        // f_close(&filesystemState.fileObject);
+                "File system: filesystemFormatLun(): ERROR: Could not "
+                "write .dat\r\n");
         return false;
     }
 
+    // The image now exists with the cached descriptor, so the LUN table is
+    // still up to date
+    filesystemState.fsLunDescriptorValid[lunNumber] = true;
+    filesystemState.fsLunStateKnown[lunNumber] = true;
+
     // Formatting successful
-    // f_close(&filesystemState.fileObject);
     if (debugFlag_filesystem)
         debugPrintf("File system: filesystemFormatLun(): Successful\r\n");
     return true;
@@ -1185,168 +1189,237 @@ bool filesystemFormatLun(uint8_t lunNumber, uint8_t dataPattern) {
 // Functions for reading and writing LUN images
 // ---------------------------------------------------------------------------------------------------------------
 
+// Function to read sectors into a LUN's buffer, using any prefetched sectors
+// before asking the Pi for the rest
+static bool filesystemReadSectors(uint8_t lunNumber, uint32_t startSector,
+                                  uint32_t numberOfSectors) {
+    lunStream_t *stream = &lunStream[lunNumber];
+    uint32_t sectorsPrefetched = 0;
+    uint8_t pirResponse;
+
+    filesystemState.fsReadBadSectorValid = false;
+
+    if (stream->prefetchSectorsInBuffer != 0 &&
+        startSector >= stream->prefetchSector &&
+        startSector <
+            stream->prefetchSector + stream->prefetchSectorsInBuffer) {
+        uint32_t offset = startSector - stream->prefetchSector;
+
+        sectorsPrefetched = stream->prefetchSectorsInBuffer - offset;
+        if (sectorsPrefetched > numberOfSectors)
+            sectorsPrefetched = numberOfSectors;
+
+        // The usual (sequential) case is a read starting at the prefetched
+        // sector, so the buffers are swapped; otherwise the wanted sectors
+        // are moved to the start of the stream buffer
+        if (offset == 0) {
+            uint8_t *buffer = stream->buffer;
+            stream->buffer = stream->prefetchBuffer;
+            stream->prefetchBuffer = buffer;
+        } else {
+            memcpy(stream->buffer, stream->prefetchBuffer + (offset * 256),
+                   sectorsPrefetched * 256);
+        }
+        prefetchUsedSectorCount += sectorsPrefetched;
+
+        if (debugFlag_filesystem)
+            debugPrintf(
+                "File system: filesystemReadSectors(): %ld sector(s) from "
+                "prefetch buffer\r\n",
+                sectorsPrefetched);
+    }
+
+    // The prefetched data has been used (or wasn't wanted)
+    stream->prefetchSectorsInBuffer = 0;
+    stream->prefetchFilling = false;
+
+    stream->bufferStartSector = startSector;
+    stream->bufferValidSectors = 0;
+    if (sectorsPrefetched != numberOfSectors) {
+        pirResponse = picomReadSectors(
+            lunNumber, startSector + sectorsPrefetched,
+            numberOfSectors - sectorsPrefetched,
+            stream->buffer + (sectorsPrefetched * 256),
+            &filesystemState.fsReadBadSector);
+        if (pirResponse == PIR_FALSE)
+            filesystemState.fsReadBadSectorValid = true;
+        if (pirResponse != PIR_OK) return false;
+    }
+
+    stream->bufferValidSectors = numberOfSectors;
+    return true;
+}
+
+// Function to get the sector a failed read stopped at, if the Pi reported it
+// as bad (rather than the read failing for some other reason)
+bool filesystemGetReadBadSector(uint32_t *badSector) {
+    if (!filesystemState.fsReadBadSectorValid) return false;
+
+    *badSector = filesystemState.fsReadBadSector;
+    return true;
+}
+
 // Function to open a LUN ready for reading
 // Note: The read functions use a multi-sector buffer to lower the number of
 // required reads from the physical media.  This is to allow more efficient
-// (larger) reads of data.
+// (larger) reads of data.  Each LUN has its own buffer; if the first requested
+// sector is already buffered it is used without asking the Pi.
 bool filesystemOpenLunForRead(uint8_t lunNumber, uint32_t startSector,
                               uint32_t requiredNumberOfSectors) {
+    lunStream_t *stream = &lunStream[lunNumber];
     uint32_t sectorsToRead = 0;
-    bool fastSeeking = false;
 
-    // Is the correct LUN already open?
-    if (lunOpenFlag && (filesystemState.lunNumber == lunNumber)) {
-        // Move to the correct point in the DAT file
-        // This is * 256 as each block is 256 bytes
-        filesystemState.fsResult =
-            -1;  // f_lseek(&filesystemState.fileObject, startSector * 256);
+    // Is the LUN already open?
+    if (stream->open) {
         if (debugFlag_filesystem)
             debugPrintf(
                 "File system: filesystemOpenLunForRead(): Using existing open "
                 "LUN image\r\n");
     } else {
-        // Required LUN is not open, so open it
-        if (debugFlag_filesystem)
-            debugPrintf(
-                "File system: filesystemOpenLunForRead(): Requested LUN not "
-                "open.  Flushing current LUN\r\n");
-        filesystemFlush();
-
         if (debugFlag_filesystem)
             debugPrintf(
                 "File system: filesystemOpenLunForRead(): Opening requested "
                 "LUN\r\n");
 
-        // Assemble the .dat file name
-        sprintf(fileName, "/BeebSCSI%d/scsi%d.dat",
-                filesystemState.lunDirectory, lunNumber);
-
-        // Open the DAT file
-        filesystemState.fsResult = -1;  // f_open(&filesystemState.fileObject,
-                                        // fileName, FA_READ | FA_WRITE);
-        if (filesystemState.fsResult == 0) {
-            // Move to the correct point in the DAT file
-            // This is * 256 as each block is 256 bytes
-            filesystemState.fsResult =
-                -1;  // f_lseek(&filesystemState.fileObject, startSector * 256);
-            filesystemState.lunNumber = lunNumber;
-            // Check that the file seek was OK
-            if (filesystemState.fsResult != 0) {
-                // Something went wrong with seeking, do not retry
-                if (debugFlag_filesystem && !fastSeeking)
-                    debugPrintf(
-                        "File system: filesystemOpenLunForRead(): ERROR: "
-                        "Unable to slow seek to required sector in LUN image "
-                        "file!\r\n");
-                if (debugFlag_filesystem && fastSeeking)
-                    debugPrintf(
-                        "File system: filesystemOpenLunForRead(): ERROR: "
-                        "Unable to fast seek to required sector in LUN image "
-                        "file!\r\n");
-                // f_close(&filesystemState.fileObject);
-                return false;
-            }
-        }
+        // Open the DAT file (the LUN image is served by the Pi, so there is
+        // nothing to open locally)
+        stream->open = true;
     }
+    filesystemState.lunNumber = lunNumber;
+    filesystemState.fsResult = 0;
+
+    // Is the start of the read already in the LUN's buffer?
+    if (stream->bufferValidSectors != 0 &&
+        startSector >= stream->bufferStartSector &&
+        startSector < stream->bufferStartSector + stream->bufferValidSectors) {
+        uint32_t offset = startSector - stream->bufferStartSector;
+        uint32_t sectorsBuffered = stream->bufferValidSectors - offset;
+        if (sectorsBuffered > requiredNumberOfSectors)
+            sectorsBuffered = requiredNumberOfSectors;
+
+        stream->currentBufferSector = offset;
+        stream->sectorsInBuffer = offset + sectorsBuffered;
+        stream->sectorsRemaining = requiredNumberOfSectors - sectorsBuffered;
+        stream->nextReadSector = startSector + sectorsBuffered;
 
-    // Fill the file system sector buffer
+        if (debugFlag_filesystem)
+            debugPrintf(
+                "File system: filesystemOpenLunForRead(): Successful (%ld "
+                "sector(s) already buffered)\r\n",
+                sectorsBuffered);
+        return true;
+    }
+
+    // Fill the LUN's sector buffer
     sectorsToRead = requiredNumberOfSectors;
     if (sectorsToRead > SECTOR_BUFFER_LENGTH)
         sectorsToRead = SECTOR_BUFFER_LENGTH;
 
-    sectorsInBuffer = sectorsToRead;
-    currentBufferSector = 0;
-    sectorsRemaining = requiredNumberOfSectors - sectorsInBuffer;
+    stream->sectorsInBuffer = sectorsToRead;
+    stream->currentBufferSector = 0;
+    stream->sectorsRemaining = requiredNumberOfSectors - sectorsToRead;
 
     // Read the required data into the sector buffer
     filesystemState.fsResult =
-        -1;  // f_read(&filesystemState.fileObject, sectorBuffer, sectorsToRead
-             // * 256, &filesystemState.fsCounter);
+        filesystemReadSectors(lunNumber, startSector, sectorsToRead) ? 0 : -1;
+    stream->nextReadSector = startSector + sectorsToRead;
 
     // Check that the file was read OK
     if (filesystemState.fsResult != 0) {
         // Something went wrong
         if (debugFlag_filesystem)
             debugPrintf(
-                "File system: filesystemReadNextSector(): ERROR: Cannot read "
+                "File system: filesystemOpenLunForRead(): ERROR: Cannot read "
                 "from LUN image!\r\n");
-        // f_close(&filesystemState.fileObject);
+        stream->open = false;
         return false;
     }
 
     // Exit with success
-    lunOpenFlag = true;
-    if (debugFlag_filesystem && fastSeeking)
-        debugPrintf(
-            "File system: filesystemOpenLunForRead(): Successful (with fast "
-            "seeking)\r\n");
-    if (debugFlag_filesystem && !fastSeeking)
-        debugPrintf(
-            "File system: filesystemOpenLunForRead(): Successful (with slow "
-            "seeking)\r\n");
+    if (debugFlag_filesystem)
+        debugPrintf("File system: filesystemOpenLunForRead(): Successful\r\n");
     return true;
 }
 
-// Function to read next sector from a LUN
-bool filesystemReadNextSector(uint8_t buffer[]) {
+// Function to borrow the next sector read from a LUN.  Returns a pointer to
+// the sector in the LUN's buffer (or NULL on error) which remains valid until
+// filesystemReleaseReadSector() is called.
+uint8_t *filesystemAcquireReadSector(void) {
+    lunStream_t *stream = &lunStream[filesystemState.lunNumber];
     uint32_t sectorsToRead = 0;
 
     // Ensure there is a LUN image open
-    if (!lunOpenFlag) {
+    if (!stream->open || stream->sectorLent) {
         if (debugFlag_filesystem)
             debugPrintf(
-                "File system: filesystemReadNextSector(): ERROR: No LUN image "
-                "open!\r\n");
-        return false;
+                "File system: filesystemAcquireReadSector(): ERROR: No LUN "
+                "image open (or sector already lent)!\r\n");
+        return NULL;
     }
 
-    // Is the required sector already in the sector buffer?
-    if (currentBufferSector < sectorsInBuffer) {
-        // Fill the function buffer from the sector buffer
-        memcpy(buffer, sectorBuffer + (currentBufferSector * 256), 256);
+    // Refill the sector buffer?  (This is done when the next sector is
+    // wanted rather than when the last one is released, as the buffer can't
+    // be refilled whilst a sector in it is lent)
+    if (stream->currentBufferSector == stream->sectorsInBuffer) {
+        // Ensure we have sectors remaining to be read
+        if (stream->sectorsRemaining == 0) {
+            if (debugFlag_filesystem)
+                debugPrintf(
+                    "File system: filesystemAcquireReadSector(): ERROR: Read "
+                    "past the requested sectors!\r\n");
+            return NULL;
+        }
 
-        // Move to the next sector
-        currentBufferSector++;
-    }
+        sectorsToRead = stream->sectorsRemaining;
+        if (stream->sectorsRemaining > SECTOR_BUFFER_LENGTH)
+            sectorsToRead = SECTOR_BUFFER_LENGTH;
 
-    // Refill the sector buffer?
-    if (currentBufferSector == sectorsInBuffer) {
-        // Ensure we have sectors remaining to be read
-        if (sectorsRemaining != 0) {
-            sectorsToRead = sectorsRemaining;
-            if (sectorsRemaining > SECTOR_BUFFER_LENGTH)
-                sectorsToRead = SECTOR_BUFFER_LENGTH;
-
-            sectorsInBuffer = sectorsToRead;
-            currentBufferSector = 0;
-            sectorsRemaining = sectorsRemaining - sectorsInBuffer;
-
-            // Read the required data into the sector buffer
-            filesystemState.fsResult =
-                -1;  // f_read(&filesystemState.fileObject, sectorBuffer,
-                     // sectorsToRead * 256, &filesystemState.fsCounter);
-
-            // Check that the file was read OK
-            if (filesystemState.fsResult != 0) {
-                // Something went wrong
-                if (debugFlag_filesystem)
-                    debugPrintf(
-                        "File system: filesystemReadNextSector(): ERROR: "
-                        "Cannot read from LUN image!\r\n");
-                // f_close(&filesystemState.fileObject);
-                return false;
-            }
+        stream->sectorsInBuffer = sectorsToRead;
+        stream->currentBufferSector = 0;
+        stream->sectorsRemaining -= sectorsToRead;
+
+        // Read the required data into the sector buffer
+        filesystemState.fsResult =
+            filesystemReadSectors(filesystemState.lunNumber,
+                                  stream->nextReadSector, sectorsToRead)
+                ? 0
+                : -1;
+        stream->nextReadSector += sectorsToRead;
+
+        // Check that the file was read OK
+        if (filesystemState.fsResult != 0) {
+            // Something went wrong
+            if (debugFlag_filesystem)
+                debugPrintf(
+                    "File system: filesystemAcquireReadSector(): ERROR: "
+                    "Cannot read from LUN image!\r\n");
+            // f_close(&filesystemState.fileObject);
+            return NULL;
         }
     }
 
-    // Exit with success
-    return true;
+    stream->sectorLent = true;
+    return stream->buffer + (stream->currentBufferSector * 256);
+}
+
+// Function to release a sector borrowed by filesystemAcquireReadSector()
+void filesystemReleaseReadSector(void) {
+    lunStream_t *stream = &lunStream[filesystemState.lunNumber];
+
+    if (!stream->sectorLent) return;
+
+    // Move to the next sector
+    stream->sectorLent = false;
+    stream->currentBufferSector++;
 }
 
 // Function to close a LUN for reading
 bool filesystemCloseLunForRead(void) {
+    // Any lent sector is returned
+    lunStream[filesystemState.lunNumber].sectorLent = false;
+
     // Ensure there is a LUN image open
-    if (!lunOpenFlag) {
+    if (!lunStream[filesystemState.lunNumber].open) {
         if (debugFlag_filesystem)
             debugPrintf(
                 "File system: filesystemCloseLunForRead(): ERROR: No LUN image "
@@ -1358,95 +1431,61 @@ bool filesystemCloseLunForRead(void) {
 // Function to open a LUN ready for writing
 bool filesystemOpenLunForWrite(uint8_t lunNumber, uint32_t startSector,
                                uint32_t requiredNumberOfSectors) {
-    bool fastSeeking = false;
+    lunStream_t *stream = &lunStream[lunNumber];
 
-    // Ensure there isn't already a LUN image open
-    if (lunOpenFlag) {
-        // check that it is the same LUN Number
-        if (filesystemState.lunNumber != lunNumber) {
-            if (debugFlag_filesystem)
-                debugPrintf(
-                    "File system: filesystemOpenLunForWrite(): Requested LUN "
-                    "not open.  Flushing current LUN\r\n");
-            filesystemFlush();
-        } else {
-            if (debugFlag_filesystem)
-                debugPrintf(
-                    "File system: filesystemOpenLunForWrite(): Using existing "
-                    "open LUN image\r\n");
-        }
-    }
+    // Any buffered or prefetched data could be overwritten
+    stream->bufferValidSectors = 0;
+    filesystemPrefetchCancel(lunNumber);
 
-    if (!lunOpenFlag) {
+    if (stream->open) {
+        if (debugFlag_filesystem)
+            debugPrintf(
+                "File system: filesystemOpenLunForWrite(): Using existing "
+                "open LUN image\r\n");
+    } else {
         if (debugFlag_filesystem)
             debugPrintf(
                 "File system: filesystemOpenLunForWrite(): Opening requested "
                 "LUN\r\n");
-        // Assemble the .dat file name
-        sprintf(fileName, "/BeebSCSI%d/scsi%d.dat",
-                filesystemState.lunDirectory, lunNumber);
-
-        // Open the DAT file
-        filesystemState.fsResult = -1;  // f_open(&filesystemState.fileObject,
-                                        // fileName,  FA_READ | FA_WRITE);
-        if (filesystemState.fsResult == 0) {
-            // Move to the correct point in the DAT file
-            // This is * 256 as each block is 256 bytes
-            filesystemState.fsResult =
-                -1;  // f_lseek(&filesystemState.fileObject, startSector * 256);
-            filesystemState.lunNumber = lunNumber;
-            // Check that the file seek was OK
-            if (filesystemState.fsResult != 0) {
-                // Something went wrong with seeking, do not retry
-                if (debugFlag_filesystem)
-                    debugPrintf(
-                        "File system: filesystemOpenLunForWrite(): ERROR: "
-                        "Unable to seek to required sector in LUN image "
-                        "file!\r\n");
-                // f_close(&filesystemState.fileObject);
-                return false;
-            }
-        }
-    } else
-        filesystemState.fsResult =
-            -1;  // f_lseek(&filesystemState.fileObject, startSector * 256);
+        // Open the DAT file (the LUN image is served by the Pi, so there is
+        // nothing to open locally; the start sector is sent with each write)
+        stream->open = true;
+    }
+    filesystemState.lunNumber = lunNumber;
+    filesystemState.fsResult = 0;
+
+    // The LUN's buffer collects the written sectors
+    stream->sectorLent = false;
+    stream->sectorsInBuffer = 0;
+    stream->currentBufferSector = 0;
+    stream->sectorsRemaining = requiredNumberOfSectors;
+    stream->nextReadSector = startSector;
 
     // Exit with success
-    lunOpenFlag = true;
-    if (debugFlag_filesystem && fastSeeking)
-        debugPrintf(
-            "File system: filesystemOpenLunForWrite(): Successful (with fast "
-            "seeking)\r\n");
-    if (debugFlag_filesystem && !fastSeeking)
-        debugPrintf(
-            "File system: filesystemOpenLunForWrite(): Successful (with slow "
-            "seeking)\r\n");
+    if (debugFlag_filesystem)
+        debugPrintf("File system: filesystemOpenLunForWrite(): Successful\r\n");
     return true;
 }
 
-// Function to write next sector to a LUN
-bool filesystemWriteNextSector(uint8_t buffer[]) {
-    // Ensure there is a LUN image open
-    if (!lunOpenFlag) {
-        if (debugFlag_filesystem)
-            debugPrintf(
-                "File system: filesystemWriteNextSector(): ERROR: No LUN image "
-                "open!\r\n");
-        return false;
-    }
-
+// Function to write the sectors collected in a LUN's buffer to the LUN image
+// on the Pi.  The sectors are sent in a single request straight from the
+// buffer; the last write of a command is committed (made durable) by the Pi.
+static bool filesystemWriteSectors(uint8_t lunNumber, uint32_t startSector,
+                                   uint32_t numberOfSectors, bool commit) {
     // Write the required data
-    filesystemState.fsResult = -1;  // f_write(&filesystemState.fileObject,
-                                    // buffer, 256, &filesystemState.fsCounter);
+    filesystemState.fsResult =
+        (picomWriteSectors(lunNumber, startSector, numberOfSectors,
+                           lunStream[lunNumber].buffer, commit) == PIR_OK)
+            ? 0
+            : -1;
 
     // Check that the file was written OK
     if (filesystemState.fsResult != 0) {
         // Something went wrong
         if (debugFlag_filesystem)
             debugPrintf(
-                "File system: filesystemWriteNextSector(): ERROR: Cannot write "
+                "File system: filesystemWriteSectors(): ERROR: Cannot write "
                 "to LUN image!\r\n");
-        // f_close(&filesystemState.fileObject);
         return false;
     }
 
@@ -1454,14 +1493,145 @@ bool filesystemWriteNextSector(uint8_t buffer[]) {
     return true;
 }
 
+// Function to borrow the slot for the next sector to be written to a LUN.
+// The SCSI layer receives the sector from the host straight into the slot and
+// then calls filesystemCommitWriteSector().
+uint8_t *filesystemAcquireWriteSector(void) {
+    lunStream_t *stream = &lunStream[filesystemState.lunNumber];
+
+    // Ensure there is a LUN image open
+    if (!stream->open || stream->sectorLent || stream->sectorsRemaining == 0) {
+        if (debugFlag_filesystem)
+            debugPrintf(
+                "File system: filesystemAcquireWriteSector(): ERROR: No LUN "
+                "image open (or no sectors left to write)!\r\n");
+        return NULL;
+    }
+
+    stream->sectorLent = true;
+    return stream->buffer + (stream->currentBufferSector * 256);
+}
+
+// Function to commit a sector received into the slot from
+// filesystemAcquireWriteSector().  The buffer is written once it is full or
+// the last sector of the write has been received.
+bool filesystemCommitWriteSector(void) {
+    lunStream_t *stream = &lunStream[filesystemState.lunNumber];
+
+    if (!stream->sectorLent) return false;
+    stream->sectorLent = false;
+    stream->currentBufferSector++;
+    stream->sectorsRemaining--;
+
+    if (stream->currentBufferSector < SECTOR_BUFFER_LENGTH &&
+        stream->sectorsRemaining != 0)
+        return true;
+
+    uint32_t sectorsToWrite = stream->currentBufferSector;
+    stream->currentBufferSector = 0;
+    if (!filesystemWriteSectors(filesystemState.lunNumber,
+                                stream->nextReadSector, sectorsToWrite,
+                                stream->sectorsRemaining == 0))
+        return false;
+    stream->nextReadSector += sectorsToWrite;
+    return true;
+}
+
 // Function to close a LUN for writing
 bool filesystemCloseLunForWrite(void) {
+    // Any lent slot is returned (and its sector discarded)
+    lunStream[filesystemState.lunNumber].sectorLent = false;
+
     // Ensure there is a LUN image open
-    if (!lunOpenFlag) {
+    if (!lunStream[filesystemState.lunNumber].open) {
         if (debugFlag_filesystem)
             debugPrintf(
                 "File system: filesystemCloseLunForWrite(): ERROR: No LUN "
                 "image open!\r\n");
     }
     return false;
-}
\ No newline at end of file
+}
+
+// Prefetch functions
+// -------------------------------------------------------------------------------------------------------------------
+
+// Function to hint that the host is likely to read from a sector next (called
+// on SEEK and at the end of a READ).  Nothing is sent to the Pi here; the hint
+// is processed when the bus is idle.
+void filesystemPrefetchHint(uint8_t lunNumber, uint32_t sector) {
+    lunStream_t *stream = &lunStream[lunNumber];
+
+    if (!filesystemReadLunStatus(lunNumber)) return;
+
+    // Already buffered or prefetching the same sectors?
+    if (stream->bufferValidSectors != 0 &&
+        sector >= stream->bufferStartSector &&
+        sector < stream->bufferStartSector + stream->bufferValidSectors)
+        return;
+    if ((stream->prefetchHintPending || stream->prefetchFilling ||
+         stream->prefetchSectorsInBuffer) &&
+        sector == stream->prefetchSector)
+        return;
+
+    stream->prefetchSector = sector;
+    stream->prefetchSectorsInBuffer = 0;
+    stream->prefetchFilling = false;
+    stream->prefetchHintPending = true;
+    prefetchHintCount++;
+}
+
+// Function to discard any prefetched data for a LUN
+void filesystemPrefetchCancel(uint8_t lunNumber) {
+    lunStream[lunNumber].prefetchHintPending = false;
+    lunStream[lunNumber].prefetchFilling = false;
+    lunStream[lunNumber].prefetchSectorsInBuffer = 0;
+}
+
+// Process a pending prefetch (called whilst the bus is idle).  Only one
+// transfer with the Pi is made per call so that selection isn't held off for
+// more than a single sector; LUNs are served in turn.  Returns true if the
+// link was used.
+bool filesystemProcessPrefetch(void) {
+    static uint8_t nextLun = 0;
+
+    for (uint8_t count = 0; count < 8; count++) {
+        uint8_t lunNumber = (nextLun + count) & 0x07;
+        lunStream_t *stream = &lunStream[lunNumber];
+
+        if (stream->prefetchHintPending) {
+            stream->prefetchHintPending = false;
+            nextLun = (lunNumber + 1) & 0x07;
+
+            if (picomPrefetchHint(lunNumber, stream->prefetchSector,
+                                  SECTOR_BUFFER_LENGTH, prefetchHintCount,
+                                  prefetchSectorCount,
+                                  prefetchUsedSectorCount) == PIR_OK)
+                stream->prefetchFilling = true;
+            return true;
+        }
+
+        if (stream->prefetchFilling) {
+            uint32_t badSector;
+            nextLun = (lunNumber + 1) & 0x07;
+
+            // A bad sector stops the prefetch; it's reported if it's read
+            if (picomReadSectors(
+                    lunNumber,
+                    stream->prefetchSector + stream->prefetchSectorsInBuffer, 1,
+                    stream->prefetchBuffer +
+                        (stream->prefetchSectorsInBuffer * 256),
+                    &badSector) != PIR_OK) {
+                stream->prefetchFilling = false;
+                return true;
+            }
+
+            stream->prefetchSectorsInBuffer++;
+            prefetchSectorCount++;
+            if (stream->prefetchSectorsInBuffer == SECTOR_BUFFER_LENGTH)
+                stream->prefetchFilling = false;
+            return true;
+        }
+    }
+
+    return false;
+}
@@ -38,9 +38,11 @@
 // External prototypes
 void filesystemInitialise(void);
 void filesystemReset(void);
+void filesystemProcessIdle(void);
 
 bool filesystemMount(void);
 bool filesystemDismount(void);
+bool filesystemReadMountState(void);
 
 void filesystemSetLunDirectory(uint8_t lunDirectoryNumber);
 uint8_t filesystemGetLunDirectory(void);
@@ -51,6 +53,9 @@ bool filesystemTestLunStatus(uint8_t lunNumber);
 void filesystemReadLunUserCode(uint8_t lunNumber, uint8_t userCode[5]);
 
 bool filesystemCheckLunImage(uint8_t lunNumber);
+void filesystemUpdateLun(uint8_t lunNumber, bool efmDataPresent,
+                         uint8_t descriptor[22], uint8_t userCode[5]);
+void filesystemResetLunTable(void);
 
 uint32_t filesystemGetLunSizeFromDsc(uint8_t lunDirectory, uint8_t lunNumber);
 bool filesystemCreateDscFromLunImage(uint8_t lunDirectory, uint8_t lunNumber,
@@ -67,11 +72,18 @@ bool filesystemFormatLun(uint8_t lunNumber, uint8_t dataPattern);
 
 bool filesystemOpenLunForRead(uint8_t lunNumber, uint32_t startSector,
                               uint32_t requiredNumberOfSectors);
-bool filesystemReadNextSector(uint8_t buffer[]);
+uint8_t *filesystemAcquireReadSector(void);
+void filesystemReleaseReadSector(void);
 bool filesystemCloseLunForRead(void);
+bool filesystemGetReadBadSector(uint32_t *badSector);
 bool filesystemOpenLunForWrite(uint8_t lunNumber, uint32_t startSector,
                                uint32_t requiredNumberOfSectors);
-bool filesystemWriteNextSector(uint8_t buffer[]);
+uint8_t *filesystemAcquireWriteSector(void);
+bool filesystemCommitWriteSector(void);
 bool filesystemCloseLunForWrite(void);
 
+void filesystemPrefetchHint(uint8_t lunNumber, uint32_t sector);
+void filesystemPrefetchCancel(uint8_t lunNumber);
+bool filesystemProcessPrefetch(void);
+
 #endif /* FILESYSTEM_H_ */
\ No newline at end of file
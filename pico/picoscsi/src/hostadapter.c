@@ -32,6 +32,7 @@
 // Local includes
 #include "debug.h"
 #include "hostadapter.h"
+#include "picom.h"
 
 // Timeout counter (used when interrupts are not available to ensure
 // DMA read and writes do not hang the AVR waiting for host response
@@ -41,6 +42,24 @@
 
 // Globals for the interrupt service routines
 volatile bool nrstFlag = false;
+volatile bool nrstCapturePending = false;
+volatile uint32_t nrstTime;   // Time of the last host reset
+volatile uint32_t nrstCount;  // Number of host resets (used to cancel Pi
+                              // requests that are in-flight when the host
+                              // resets)
+
+// Globals for the bus capture
+captureRecord_t captureRing[CAPTURE_RING_LENGTH];
+uint32_t captureHead = 0;
+volatile bool captureRunning = false;
+bool captureTriggered = false;
+uint16_t capturePostTriggerRemaining = 0;
+uint8_t captureTriggerMask = CAPTURE_TRIGGER_NONE;
+uint8_t captureTriggerCondition = CAPTURE_TRIGGER_NONE;
+uint32_t captureTriggerIndex = 0;
+bool captureUploaded = true;
+bool captureUploading = false;   // Upload started, one frame sent per idle call
+uint16_t captureUploadFrame = 0;  // Next frame to upload
 
 // Interrupt service functions to handle host adapter input signals
 // ---------------------
@@ -50,6 +69,12 @@ void nrst_isr(uint gpio, uint32_t events) {
     // Here we just set a flag to show the main code that the
     // ISR was serviced
     nrstFlag = true;
+    nrstTime = time_us_32();
+    nrstCount++;
+
+    // The capture ring is only written from the main loop, so the reset is
+    // recorded (with this timestamp) when the host adapter is reset
+    if (captureRunning) nrstCapturePending = true;
 }
 
 // Initialise the host adapter hardware (called on a cold-start of the AVR)
@@ -103,6 +128,13 @@ void hostadapterInitialise(void) {
 
 // Reset the host adapter (called when the host signals reset)
 void hostadapterReset(void) {
+    // Record the reset in the bus capture
+    if (nrstCapturePending) {
+        hostadapterCaptureAt(nrstTime, CAPTURE_EVENT_RESET, 0);
+        hostadapterCaptureTrigger(CAPTURE_TRIGGER_RESET);
+        nrstCapturePending = false;
+    }
+
     // Set the host adapter databus to input
     hostadapterDatabusInput();
 
@@ -183,30 +215,40 @@ inline uint8_t hostadapterReadByte(void) {
 
     // Set the REQuest signal
     gpio_put(STATUS_NREQ_PORT, 0);  // REQ = 0 (active)
+    hostadapterCapture(CAPTURE_EVENT_REQ, 1);
 
     // Wait for ACKnowledge
     while ((gpio_get(NACK_PORT) != 0) && nrstFlag == false);
+    hostadapterCapture(CAPTURE_EVENT_ACK, 1);
 
     // Clear the REQuest signal
     gpio_put(STATUS_NREQ_PORT, 1);  // REQ = 1 (inactive)
+    hostadapterCapture(CAPTURE_EVENT_REQ, 0);
 
     // Read the databus value
-    return hostadapterReadDatabus();
+    databusValue = hostadapterReadDatabus();
+    hostadapterCapture(CAPTURE_EVENT_DATA, databusValue);
+
+    return databusValue;
 }
 
 // Function to write a byte to the host (using REQ/ACK)
 inline void hostadapterWriteByte(uint8_t databusValue) {
     // Write the byte of data to the databus
     hostadapterWritedatabus(databusValue);
+    hostadapterCapture(CAPTURE_EVENT_DATA, databusValue);
 
     // Set the REQuest signal
     gpio_put(STATUS_NREQ_PORT, 0);  // REQ = 0 (active)
+    hostadapterCapture(CAPTURE_EVENT_REQ, 1);
 
     // Wait for ACKnowledge
     while ((gpio_get(NACK_PORT) != 0) && nrstFlag == false);
+    hostadapterCapture(CAPTURE_EVENT_ACK, 1);
 
     // Clear the REQuest signal
     gpio_put(STATUS_NREQ_PORT, 1);  // REQ = 1 (inactive)
+    hostadapterCapture(CAPTURE_EVENT_REQ, 0);
 }
 
 // Host DMA transfer functions
@@ -221,10 +263,12 @@ uint16_t hostadapterPerformReadDMA(uint8_t *dataBuffer) {
     // Loop to write bytes (unless a reset condition is detected)
     while (currentByte < 256 && timeoutCounter != TOC_MAX) {
         // Write the current byte to the databus and point to the next byte
-        hostadapterWritedatabus(dataBuffer[currentByte++]);
+        hostadapterWritedatabus(dataBuffer[currentByte]);
+        hostadapterCapture(CAPTURE_EVENT_DATA, dataBuffer[currentByte++]);
 
         // Set the REQuest signal
         gpio_put(STATUS_NREQ_PORT, 0);  // REQ = 0 (active)
+        hostadapterCapture(CAPTURE_EVENT_REQ, 1);
 
         // Wait for ACKnowledge
         timeoutCounter = 0;  // Reset timeout counter
@@ -233,12 +277,16 @@ uint16_t hostadapterPerformReadDMA(uint8_t *dataBuffer) {
             if (++timeoutCounter == TOC_MAX) {
                 // Set the host reset flag and quit
                 nrstFlag = true;
+                hostadapterCapture(CAPTURE_EVENT_TIMEOUT, 0);
+                hostadapterCaptureTrigger(CAPTURE_TRIGGER_TIMEOUT);
                 return currentByte - 1;
             }
         }
+        hostadapterCapture(CAPTURE_EVENT_ACK, 1);
 
         // Clear the REQuest signal
         gpio_put(STATUS_NREQ_PORT, 1);  // REQ = 1 (inactive)
+        hostadapterCapture(CAPTURE_EVENT_REQ, 0);
     }
 
     return currentByte - 1;
@@ -254,6 +302,7 @@ uint16_t hostadapterPerformWriteDMA(uint8_t *dataBuffer) {
     while (currentByte < 256 && timeoutCounter != TOC_MAX) {
         // Set the REQuest signal
         gpio_put(STATUS_NREQ_PORT, 0);  // REQ = 0 (active)
+        hostadapterCapture(CAPTURE_EVENT_REQ, 1);
 
         // Wait for ACKnowledge
         timeoutCounter = 0;  // Reset timeout counter
@@ -262,15 +311,20 @@ uint16_t hostadapterPerformWriteDMA(uint8_t *dataBuffer) {
             if (++timeoutCounter == TOC_MAX) {
                 // Set the host reset flag and quit
                 nrstFlag = true;
+                hostadapterCapture(CAPTURE_EVENT_TIMEOUT, 0);
+                hostadapterCaptureTrigger(CAPTURE_TRIGGER_TIMEOUT);
                 return currentByte;
             }
         }
+        hostadapterCapture(CAPTURE_EVENT_ACK, 1);
 
         // Read the current byte from the databus and point to the next byte
-        dataBuffer[currentByte++] = hostadapterReadDatabus();
+        dataBuffer[currentByte] = hostadapterReadDatabus();
+        hostadapterCapture(CAPTURE_EVENT_DATA, dataBuffer[currentByte++]);
 
         // Clear the REQuest signal
         gpio_put(STATUS_NREQ_PORT, 1);  // REQ = 1 (inactive)
+        hostadapterCapture(CAPTURE_EVENT_REQ, 0);
     }
 
     return currentByte - 1;
@@ -285,10 +339,21 @@ void hostadapterWriteResetFlag(bool flagState) { nrstFlag = flagState; }
 // Function to return the state of the host reset flag
 bool hostadapterReadResetFlag(void) { return nrstFlag; }
 
+// Function to read the time of the last host reset
+uint32_t hostadapterReadResetTime(void) { return nrstTime; }
+
+// Function to read the number of host resets (this changes whenever the host
+// resets, so it can be used to detect a reset during a long operation)
+uint32_t hostadapterReadResetCount(void) { return nrstCount; }
+
 // Function to write the data phase flags and control databus direction
 // Note: all SCSI signals are inverted logic
 void hostadapterWriteDataPhaseFlags(bool message, bool commandNotData,
                                     bool inputNotOutput) {
+    // Record the phase change in the bus capture
+    hostadapterCapture(CAPTURE_EVENT_PHASE,
+                       (message << 2) | (commandNotData << 1) | inputNotOutput);
+
     if (message)
         gpio_put(STATUS_NMSG_PORT, 0);  // MSG = active
     else
@@ -311,6 +376,8 @@ void hostadapterWriteDataPhaseFlags(bool message, bool commandNotData,
 // Function to write the host busy flag
 // Note: all SCSI signals are inverted logic
 void hostadapterWriteBusyFlag(bool flagState) {
+    hostadapterCapture(CAPTURE_EVENT_BSY, flagState);
+
     if (flagState)
         gpio_put(STATUS_NBSY_PORT, 0);  // BSY = inactive
     else
@@ -333,4 +400,126 @@ bool hostadapterReadSelectFlag(void) {
     if (gpio_get(NSEL_PORT) != 0) return false;
 
     return true;
-}
\ No newline at end of file
+}
+
+// Bus capture functions
+// ---------------------------------------------------------------
+
+// Arm the bus capture with the specified trigger conditions (capture starts
+// immediately; CAPTURE_TRIGGER_NONE captures until the capture is read)
+void hostadapterCaptureArm(uint8_t triggerMask) {
+    captureRunning = false;
+
+    captureHead = 0;
+    captureTriggered = false;
+    capturePostTriggerRemaining = CAPTURE_POST_TRIGGER;
+    captureTriggerMask = triggerMask;
+    captureTriggerCondition = CAPTURE_TRIGGER_NONE;
+    captureTriggerIndex = 0;
+    captureUploaded = false;
+    captureUploading = false;
+    nrstCapturePending = false;
+
+    captureRunning = true;
+    debugPrintf("Host adapter bus capture armed (trigger mask 0x%02x)\r\n", triggerMask);
+}
+
+// Signal a trigger condition to the bus capture
+void hostadapterCaptureTrigger(uint8_t condition) {
+    if (!captureRunning || captureTriggered) return;
+    if ((captureTriggerMask & condition) == 0) return;
+
+    captureTriggerCondition = condition;
+    captureTriggerIndex = captureHead;
+    hostadapterCapture(CAPTURE_EVENT_TRIGGER, condition);
+    captureTriggered = true;
+}
+
+// Returns true if a triggered capture has completed and its upload hasn't
+// been started
+bool hostadapterCaptureComplete(void) {
+    return captureTriggered && !captureRunning && !captureUploaded &&
+           !captureUploading;
+}
+
+// Start sending the bus capture to the Pi (stops the capture if it is still
+// running).  The capture is sent a frame at a time by
+// hostadapterCaptureProcessUpload(), so selection is never held off for the
+// whole upload (a capture is usually triggered just as the host retries).
+void hostadapterCaptureSendToPi(void) {
+    captureRunning = false;
+    captureUploading = true;
+    captureUploadFrame = 0;
+}
+
+// Send the next frame of a bus capture upload (called whilst the bus is idle).
+// The frame is held back if the host is selecting or resetting.  Returns true
+// if the link was used.
+//
+// Frame format (all values big-endian):
+//   [0] PIC_PUT_CAPTURE, [1] trigger condition (0 = not triggered),
+//   [2-3] frame number, [4-5] frame count, [6-7] records in frame,
+//   [8-11] index of the trigger record (from the start of the capture)
+//   then the records: timestamp (4), event (1), value (1)
+#define CAPTURE_RECORDS_PER_FRAME 80
+
+bool hostadapterCaptureProcessUpload(void) {
+    static uint8_t txData[12 + (CAPTURE_RECORDS_PER_FRAME * 6)];
+    uint8_t rxData[1];
+    uint16_t rxLength;
+
+    if (!captureUploading) return false;
+    if (hostadapterReadSelectFlag() || hostadapterReadResetFlag()) return false;
+
+    // Work out the range of valid records in the ring
+    uint32_t recordCount = captureHead;
+    if (recordCount > CAPTURE_RING_LENGTH) recordCount = CAPTURE_RING_LENGTH;
+    uint32_t firstRecord = captureHead - recordCount;
+    uint32_t triggerIndex = captureTriggered ? captureTriggerIndex - firstRecord : 0xFFFFFFFF;
+
+    uint16_t frameCount = (recordCount + CAPTURE_RECORDS_PER_FRAME - 1) / CAPTURE_RECORDS_PER_FRAME;
+    if (frameCount == 0) frameCount = 1;
+
+    uint16_t frameNumber = captureUploadFrame;
+    uint32_t frameStart = frameNumber * CAPTURE_RECORDS_PER_FRAME;
+    uint16_t frameRecords = CAPTURE_RECORDS_PER_FRAME;
+    if (frameStart + frameRecords > recordCount) frameRecords = recordCount - frameStart;
+
+    uint16_t pointer = 0;
+    txData[pointer++] = PIC_PUT_CAPTURE;
+    txData[pointer++] = captureTriggered ? captureTriggerCondition : 0;
+    txData[pointer++] = (frameNumber >> 8) & 0xFF;
+    txData[pointer++] = frameNumber & 0xFF;
+    txData[pointer++] = (frameCount >> 8) & 0xFF;
+    txData[pointer++] = frameCount & 0xFF;
+    txData[pointer++] = (frameRecords >> 8) & 0xFF;
+    txData[pointer++] = frameRecords & 0xFF;
+    txData[pointer++] = (triggerIndex >> 24) & 0xFF;
+    txData[pointer++] = (triggerIndex >> 16) & 0xFF;
+    txData[pointer++] = (triggerIndex >> 8) & 0xFF;
+    txData[pointer++] = triggerIndex & 0xFF;
+
+    for (uint16_t i = 0; i < frameRecords; i++) {
+        captureRecord_t *record =
+            &captureRing[(firstRecord + frameStart + i) & (CAPTURE_RING_LENGTH - 1)];
+        txData[pointer++] = (record->timestamp >> 24) & 0xFF;
+        txData[pointer++] = (record->timestamp >> 16) & 0xFF;
+        txData[pointer++] = (record->timestamp >> 8) & 0xFF;
+        txData[pointer++] = record->timestamp & 0xFF;
+        txData[pointer++] = record->event;
+        txData[pointer++] = record->value;
+    }
+
+    if (!picomSendToPi(txData, pointer, rxData, sizeof(rxData), &rxLength)) {
+        debugPrintf("hostadapterCaptureProcessUpload() - Pi did not respond, capture upload abandoned\r\n");
+        captureUploading = false;
+        return true;
+    }
+
+    captureUploadFrame++;
+    if (captureUploadFrame == frameCount) {
+        captureUploading = false;
+        captureUploaded = true;
+    }
+    return true;
+}
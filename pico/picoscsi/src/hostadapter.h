@@ -51,6 +51,62 @@
 #define DATABUS_NDB6 17
 #define DATABUS_NDB7 16
 
+// Bus capture (logic analyser) event types
+#define CAPTURE_EVENT_PHASE 0x01    // value = MSG/CD/IO (bits 2-0)
+#define CAPTURE_EVENT_REQ 0x02      // value = 1 asserted, 0 released
+#define CAPTURE_EVENT_ACK 0x03      // ACK asserted by host
+#define CAPTURE_EVENT_DATA 0x04     // value = databus byte
+#define CAPTURE_EVENT_BSY 0x05      // value = 1 asserted, 0 released
+#define CAPTURE_EVENT_SEL 0x06      // value = host ID byte
+#define CAPTURE_EVENT_RESET 0x07    // Host reset (from nrst_isr)
+#define CAPTURE_EVENT_TIMEOUT 0x08  // DMA timeout (TOC_MAX reached)
+#define CAPTURE_EVENT_STATUS 0x09   // value = status byte
+#define CAPTURE_EVENT_TRIGGER 0x0F  // value = trigger condition
+
+// Bus capture trigger conditions (can be combined)
+#define CAPTURE_TRIGGER_NONE 0x00
+#define CAPTURE_TRIGGER_TIMEOUT 0x01  // DMA timeout
+#define CAPTURE_TRIGGER_RESET 0x02    // Host reset
+#define CAPTURE_TRIGGER_CHECK 0x04    // Status other than GOOD
+
+// Bus capture ring (must be a power of 2).  Capture runs continuously once
+// armed; after the trigger a further half ring of events is recorded and the
+// capture then stops, so the ring holds the events either side of the trigger.
+#define CAPTURE_RING_LENGTH 4096
+#define CAPTURE_POST_TRIGGER (CAPTURE_RING_LENGTH / 2)
+
+typedef struct {
+    uint32_t timestamp;  // time_us_32()
+    uint8_t event;
+    uint8_t value;
+} captureRecord_t;
+
+extern captureRecord_t captureRing[CAPTURE_RING_LENGTH];
+extern uint32_t captureHead;
+extern volatile bool captureRunning;
+extern bool captureTriggered;
+extern uint16_t capturePostTriggerRemaining;
+
+// Record a bus event (costs a single test when the capture is not running)
+static inline void hostadapterCaptureAt(uint32_t timestamp, uint8_t event,
+                                        uint8_t value) {
+    if (!captureRunning) return;
+
+    captureRecord_t *record = &captureRing[captureHead & (CAPTURE_RING_LENGTH - 1)];
+    record->timestamp = timestamp;
+    record->event = event;
+    record->value = value;
+    captureHead++;
+
+    if (captureTriggered && --capturePostTriggerRemaining == 0)
+        captureRunning = false;
+}
+
+static inline void hostadapterCapture(uint8_t event, uint8_t value) {
+    if (!captureRunning) return;
+    hostadapterCaptureAt(time_us_32(), event, value);
+}
+
 // Function prototypes
 void nrst_isr(uint gpio, uint32_t events);
 void hostadapterInitialise(void);
@@ -70,6 +126,8 @@ uint16_t hostadapterPerformWriteDMA(uint8_t *dataBuffer);
 
 void hostadapterWriteResetFlag(bool flagState);
 bool hostadapterReadResetFlag(void);
+uint32_t hostadapterReadResetTime(void);
+uint32_t hostadapterReadResetCount(void);
 void hostadapterWriteDataPhaseFlags(bool message, bool commandNotData,
                                     bool inputNotOutput);
 
@@ -77,4 +135,10 @@ void hostadapterWriteBusyFlag(bool flagState);
 void hostadapterWriteRequestFlag(bool flagState);
 bool hostadapterReadSelectFlag(void);
 
+void hostadapterCaptureArm(uint8_t triggerMask);
+void hostadapterCaptureTrigger(uint8_t condition);
+bool hostadapterCaptureComplete(void);
+void hostadapterCaptureSendToPi(void);
+bool hostadapterCaptureProcessUpload(void);
+
 #endif /* HOSTADAPTER_H_ */
\ No newline at end of file
@@ -36,8 +36,14 @@
 #include "scsi.h"
 #include "statusled.h"
 #include "picom.h"
+#include "profile.h"
+
+// Maximum expected time from a host reset to the emulation being ready
+#define RESET_READY_BUDGET_US 1000
 
 int main(void) {
+    uint32_t lastResetCount = 0;
+
     // Initilalise the debug output
     debugInitialise();
 
@@ -53,6 +59,9 @@ int main(void) {
     // Initialise the status LED
     statusledInitialise();
 
+    // Initialise the command profiler
+    profileInitialise();
+
     // Initialise the SCSI emulation
     scsiInitialise();
 
@@ -63,6 +72,14 @@ int main(void) {
 
         // Did the host reset?
         if (hostadapterReadResetFlag()) {
+            // The reset is timed from the reset signal (or from now if the
+            // reset was raised by a host adapter timeout)
+            uint32_t resetCount = hostadapterReadResetCount();
+            uint32_t resetTime = (resetCount != lastResetCount)
+                                     ? hostadapterReadResetTime()
+                                     : time_us_32();
+            lastResetCount = resetCount;
+
             // Reset the host adapter
             hostadapterReset();
 
@@ -77,6 +94,16 @@ int main(void) {
 
             // Clear the reset condition in the host adapter
             hostadapterWriteResetFlag(false);
+
+            // Report the reset to ready time (none of the reset functions
+            // wait on the Pi, so this should be well inside the budget)
+            uint32_t readyTime = time_us_32() - resetTime;
+            profileRecordReset(readyTime);
+            if (readyTime > RESET_READY_BUDGET_US)
+                debugPrintf("main(): WARNING: Reset to ready took %u uS (budget %u uS)\r\n",
+                            readyTime, RESET_READY_BUDGET_US);
+            else if (debugFlag_scsiState)
+                debugPrintf("main(): Reset to ready took %u uS\r\n", readyTime);
         }
     }
 }
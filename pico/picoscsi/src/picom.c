@@ -25,6 +25,7 @@
 ************************************************************************/
 
 // Global includes
+#include <pico/rand.h>
 #include <pico/stdlib.h>
 #include <stdbool.h>
 #include <stdint.h>
@@ -32,86 +33,506 @@
 #include <string.h>
 
 #include "debug.h"
+#include "filesystem.h"
+#include "hostadapter.h"
 #include "picom.h"
+#include "profile.h"
+#include "scsi.h"
+
+// Idle polling of the Pi (the Pico is the link master, so requests from the Pi
+// can only be made in reply to a poll).  If the Pi doesn't respond the poll
+// interval backs off so that the SCSI bus isn't held off by repeated timeouts.
+#define PICOM_POLL_INTERVAL_US 1000000
+#define PICOM_POLL_BACKOFF_US 10000000
+
+// Reply timeout (in 100uS ticks) for a single request.  If the link is silent
+// for PICOM_ATTEMPT_TICKS (before or during the reply) the request (or its
+// reply) is assumed lost and the request is resent with the same sequence
+// number; the Pi answers a resent request from its reply cache rather than
+// repeating it.
+#define PICOM_TIMEOUT_TICKS 10000
+#define PICOM_ATTEMPT_TICKS 1000
+
+// Quiet time required before a request is resent (longer than the Pi's frame
+// timeout, so the Pi has discarded any partial frame)
+#define PICOM_RESYNC_QUIET_US 25000
+
+// First interval between attempts to resume the session after the link has
+// dropped (doubled on each failure, up to PICOM_POLL_BACKOFF_US)
+#define PICOM_RESUME_INTERVAL_US 10000
+
+// Quiet time required to clear the link after a cancelled request
+#define PICOM_DRAIN_QUIET_US 5000
+
+uint32_t picomNextPollTime;
+
+// Sequence number of the last request sent to the Pi (the Pi echoes it in its
+// reply) and a flag showing that a request was cancelled by a host reset
+uint8_t picomSequence = 0;
+bool picomCancelled = false;
+
+// Set when the Pi failed to respond to the last poll
+bool picomPollFailed = false;
+
+// Session ids of the Pico (chosen at boot) and of the Pi.  After the link has
+// dropped the session is resumed before the next poll, so that neither side
+// loses its mount or LUN state.  Whilst the link is down requests are sent
+// once (not resent) so a missing Pi doesn't hold the SCSI bus off.
+uint32_t picomSessionId = 0;
+uint32_t picomPiSessionId = 0;
+bool picomResumePending = true;
+bool picomLinkDown = false;
+uint32_t picomResumeInterval = PICOM_RESUME_INTERVAL_US;
+
+// Timestamps of the previous poll (sent with the next poll so the Pi can
+// estimate the offset between the Pico and Pi clocks)
+uint32_t picomPollSendTime = 0;
+uint32_t picomPollReceiveTime = 0;
+
+static bool picomTransfer(uint8_t *txData, uint16_t txLength,
+                          uint8_t *txPayload, uint16_t txPayloadLength,
+                          uint8_t *rxData, uint16_t rxCapacity,
+                          uint16_t *rxLength);
 
 void picomInitialise(void) {
     // Pi communication is via UART1 to the Raspberry Pi 5
     uart_init(uart1, 115200);
     gpio_set_function(4, GPIO_FUNC_UART);
     gpio_set_function(5, GPIO_FUNC_UART);
+
+    picomNextPollTime = time_us_32() + PICOM_POLL_INTERVAL_US;
+
+    // Start the session (a Pi still holding a session from before the Pico
+    // restarted replaces it).  The sequence numbers start from a random point
+    // so they don't repeat those of the previous session.
+    picomSessionId = get_rand_32();
+    picomSequence = (uint8_t)picomSessionId;
+    picomResumeSession();
 }
 
-// The underlying communication function is simple.  First 2 bytes are sent representing
-// a uint16_t length of the data to be sent.  Then the data is sent.  The Pi will then
-// respond with a uint16_t length of the data to be received.  The data is then received.
-// The function returns true if the data was received successfully and false if there was
-// a timeout.
+// The underlying communication function is simple.  First 2 bytes are sent
+// representing a uint16_t length of the data to be sent, followed by a
+// sequence number.  Then the data is sent.  The Pi will then respond with a
+// uint16_t length of the data to be received and the same sequence number.
+// The data is then received.
+// The function returns true if the data was received successfully and false
+// if there was a timeout or the request was cancelled by a host reset (so a
+// reset is never held up waiting for the Pi).  A request that isn't answered
+// is resent (with the same sequence number) until PICOM_TIMEOUT_TICKS, so a
+// brief drop of the link isn't seen by the host.
 //
-// Note: The maximum length of data that can be sent or received is 512 bytes.
-// Note: The txLength and rxLength do not include the 2 bytes used to represent the length.
+// Note: The maximum length of data that can be sent or received is 512 bytes
+// (plus the command header when sectors are written).  A reply longer than
+// rxCapacity (the size of rxData) is treated as a corrupt frame.
+// Note: The txLength and rxLength do not include the 2 bytes used to represent
+// the length or the sequence number.
 //
-bool picomSendToPi(uint8_t *txData, uint16_t txLength, uint8_t *rxData, uint16_t *rxLength) {
-    // Send the length of the txData
-    uart_putc_raw(uart1, (txLength >> 8) & 0xFF);
-    uart_putc_raw(uart1, txLength & 0xFF);
+// The time spent on the link is recorded by the profiler.
+bool picomSendToPi(uint8_t *txData, uint16_t txLength, uint8_t *rxData,
+                   uint16_t rxCapacity, uint16_t *rxLength) {
+    uint32_t startTime = time_us_32();
+    bool result =
+        picomTransfer(txData, txLength, NULL, 0, rxData, rxCapacity, rxLength);
 
-    // Send the txData
-    for (uint8_t i = 0; i < txLength; i++) {
-        uart_putc_raw(uart1, txData[i]);
-    }
+    profileAddLinkWait(time_us_32() - startTime);
+    return result;
+}
 
-    // Wait for the length of the rxData
-    uint16_t rxLengthTemp = 0;
-    uint16_t timeout = 0;
+// As picomSendToPi() but the txData is followed by a payload sent straight
+// from the caller's buffer (so sectors don't have to be copied behind the
+// command header)
+static bool picomSendPayloadToPi(uint8_t *txData, uint16_t txLength,
+                                 uint8_t *txPayload, uint16_t txPayloadLength,
+                                 uint8_t *rxData, uint16_t rxCapacity,
+                                 uint16_t *rxLength) {
+    uint32_t startTime = time_us_32();
+    bool result = picomTransfer(txData, txLength, txPayload, txPayloadLength,
+                                rxData, rxCapacity, rxLength);
+
+    profileAddLinkWait(time_us_32() - startTime);
+    return result;
+}
+
+// Wait for a byte from the Pi.  The silence count is cleared by each byte, so
+// an attempt only fails if the link goes quiet for silenceTicks (a long reply
+// isn't cut off part way through); timeout counts the whole request.  Returns
+// false on timeout or if the host reset whilst waiting (the request is then
+// cancelled; the Pi's late reply is discarded by its sequence number).
+static bool picomReadByte(uint8_t *byte, uint16_t *timeout, uint16_t *silence,
+                          uint16_t silenceTicks, uint32_t resetCount) {
     while (uart_is_readable(uart1) == false) {
-        sleep_ms(1);
-        timeout++;
-        if (timeout > 1000) {
-            *rxLength = 0;
-            debugPrintf("picomSendToPi() - Timeout waiting for rxLength byte 0\n");
+        if (hostadapterReadResetCount() != resetCount) {
+            picomCancelled = true;
             return false;
         }
+        sleep_us(100);
+        (*timeout)++;
+        (*silence)++;
+        if (*silence > silenceTicks || *timeout > PICOM_TIMEOUT_TICKS)
+            return false;
     }
-    rxLengthTemp = uart_getc(uart1) << 8;
-    while (uart_is_readable(uart1) == false) {
-        sleep_ms(1);
-        timeout++;
-        if (timeout > 1000) {
-            *rxLength = 0;
-            debugPrintf("picomSendToPi() - Timeout waiting for rxLength byte 1\n");
+    *byte = uart_getc(uart1);
+    *silence = 0;
+    return true;
+}
+
+// Discard anything on the link until it has been quiet for
+// PICOM_RESYNC_QUIET_US (so a partial frame from either side is cleared
+// before a request is resent).  Returns false if the host reset or the
+// request timed out whilst waiting.
+static bool picomResync(uint16_t *timeout, uint32_t resetCount) {
+    uint32_t quietStart = time_us_32();
+
+    while ((time_us_32() - quietStart) < PICOM_RESYNC_QUIET_US) {
+        if (hostadapterReadResetCount() != resetCount) {
+            picomCancelled = true;
             return false;
         }
+        if (uart_is_readable(uart1)) {
+            uart_getc(uart1);
+            quietStart = time_us_32();
+        }
+        sleep_us(100);
+        (*timeout)++;
+        if (*timeout > PICOM_TIMEOUT_TICKS) return false;
     }
-    rxLengthTemp |= uart_getc(uart1);
-    *rxLength = rxLengthTemp;
-
-    // Receive the rxData
-    for (uint16_t i = 0; i < rxLengthTemp; i++) {
-        while (uart_is_readable(uart1) == false) {
-            sleep_ms(1);
-            timeout++;
-            if (timeout > 1000) {
-                *rxLength = 0;
-                debugPrintf("picomSendToPi() - Timeout waiting for rxData byte %d of %d\n", i, rxLengthTemp);
+    return true;
+}
+
+// Send a request frame: the length, the sequence number, the txData and the
+// payload
+static void picomSendFrame(uint8_t sequence, uint8_t *txData, uint16_t txLength,
+                           uint8_t *txPayload, uint16_t txPayloadLength) {
+    uint16_t frameLength = txLength + txPayloadLength;
+
+    uart_putc_raw(uart1, (frameLength >> 8) & 0xFF);
+    uart_putc_raw(uart1, frameLength & 0xFF);
+    uart_putc_raw(uart1, sequence);
+    for (uint16_t i = 0; i < txLength; i++) {
+        uart_putc_raw(uart1, txData[i]);
+    }
+    for (uint16_t i = 0; i < txPayloadLength; i++) {
+        uart_putc_raw(uart1, txPayload[i]);
+    }
+}
+
+// Receive replies until the one for this request arrives (a reply with a
+// different sequence number belongs to a cancelled or earlier request).
+// Returns false if the link was silent for silenceTicks or the reply won't
+// fit in rxData (a corrupt length; the caller resyncs and resends).
+static bool picomReceiveReply(uint8_t sequence, uint8_t *rxData,
+                              uint16_t rxCapacity, uint16_t *rxLength,
+                              uint16_t *timeout, uint16_t silenceTicks,
+                              uint32_t resetCount) {
+    uint16_t silence = 0;
+    uint8_t byte;
+
+    while (true) {
+        uint16_t rxLengthTemp;
+        uint8_t rxSequence;
+
+        if (!picomReadByte(&byte, timeout, &silence, silenceTicks, resetCount))
+            return false;
+        rxLengthTemp = byte << 8;
+        if (!picomReadByte(&byte, timeout, &silence, silenceTicks, resetCount))
+            return false;
+        rxLengthTemp |= byte;
+        if (!picomReadByte(&rxSequence, timeout, &silence, silenceTicks,
+                           resetCount))
+            return false;
+
+        if (rxSequence != sequence) {
+            debugPrintf(
+                "picomSendToPi() - Discarding stale reply (sequence %d, "
+                "expected %d)\r\n",
+                rxSequence, sequence);
+            for (uint16_t i = 0; i < rxLengthTemp; i++) {
+                if (!picomReadByte(&byte, timeout, &silence, silenceTicks,
+                                   resetCount))
+                    return false;
+            }
+            continue;
+        }
+
+        if (rxLengthTemp > rxCapacity) {
+            debugPrintf(
+                "picomSendToPi() - Reply length %d exceeds the %d byte "
+                "buffer\r\n",
+                rxLengthTemp, rxCapacity);
+            return false;
+        }
+
+        // Receive the rxData
+        for (uint16_t i = 0; i < rxLengthTemp; i++) {
+            if (!picomReadByte(&rxData[i], timeout, &silence, silenceTicks,
+                               resetCount)) {
+                debugPrintf(
+                    "picomSendToPi() - Failed waiting for rxData byte %d of "
+                    "%d\r\n",
+                    i, rxLengthTemp);
                 return false;
             }
         }
-        rxData[i] = uart_getc(uart1);
+
+        *rxLength = rxLengthTemp;
+        return true;
+    }
+}
+
+static bool picomTransfer(uint8_t *txData, uint16_t txLength,
+                          uint8_t *txPayload, uint16_t txPayloadLength,
+                          uint8_t *rxData, uint16_t rxCapacity,
+                          uint16_t *rxLength) {
+    uint32_t resetCount = hostadapterReadResetCount();
+    uint8_t sequence = ++picomSequence;
+    uint16_t timeout = 0;
+
+    *rxLength = 0;
+    if (debugFlag_filesystem)
+        debugTrace(TRACE_PICOM_REQUEST, txLength + txPayloadLength, txData[0]);
+
+    while (true) {
+        picomSendFrame(sequence, txData, txLength, txPayload, txPayloadLength);
+
+        // Whilst the link is down the request is only sent once
+        uint16_t silenceTicks =
+            picomLinkDown ? PICOM_TIMEOUT_TICKS : PICOM_ATTEMPT_TICKS;
+
+        if (picomReceiveReply(sequence, rxData, rxCapacity, rxLength, &timeout,
+                              silenceTicks, resetCount)) {
+            // Data received successfully.  If the link had dropped the session
+            // is resumed as soon as the bus is idle.
+            if (picomLinkDown || picomResumePending) {
+                picomLinkDown = false;
+                picomResumePending = true;
+                picomNextPollTime = time_us_32();
+            }
+            if (debugFlag_filesystem)
+                debugTrace(TRACE_PICOM_RESPONSE, *rxLength, 0);
+            return true;
+        }
+        if (picomCancelled) break;
+
+        // The request or its reply was lost (or the Pi is slow); resend the
+        // request once the link is quiet
+        picomResumePending = true;
+        if (picomLinkDown || timeout >= PICOM_TIMEOUT_TICKS) break;
+        if (!picomResync(&timeout, resetCount)) break;
+        debugPrintf(
+            "picomSendToPi() - Resending request 0x%02x (sequence %d)\r\n",
+            txData[0], sequence);
+    }
+
+    *rxLength = 0;
+    if (debugFlag_filesystem) debugTrace(TRACE_PICOM_RESPONSE, 0, 1);
+    if (picomCancelled) {
+        debugPrintf(
+            "picomSendToPi() - Request 0x%02x cancelled by host reset\r\n",
+            txData[0]);
+    } else {
+        debugPrintf(
+            "picomSendToPi() - Timeout waiting for reply to request 0x%02x\r\n",
+            txData[0]);
+        picomLinkDown = true;
+        picomNextPollTime = time_us_32() + picomResumeInterval;
+    }
+    return false;
+}
+
+// Discard anything left on the link by a cancelled request.  The link has to
+// be quiet for PICOM_DRAIN_QUIET_US before it is considered clear.
+static void picomDrain(void) {
+    uint32_t quietStart = time_us_32();
+
+    while ((time_us_32() - quietStart) < PICOM_DRAIN_QUIET_US) {
+        if (hostadapterReadSelectFlag() || hostadapterReadResetFlag()) return;
+        if (uart_is_readable(uart1)) {
+            uart_getc(uart1);
+            quietStart = time_us_32();
+        }
     }
+    picomCancelled = false;
+}
 
-    // Data received successfully
-    return true; 
+// Store a uint32_t big-endian in a buffer
+static void picomStore32(uint8_t *buffer, uint32_t value) {
+    buffer[0] = (value >> 24) & 0xFF;
+    buffer[1] = (value >> 16) & 0xFF;
+    buffer[2] = (value >> 8) & 0xFF;
+    buffer[3] = value & 0xFF;
+}
+
+// Process idle time (called whilst waiting for selection)
+void picomProcessIdle(void) {
+    uint8_t rxData[PICOM_POLL_REPLY_LENGTH];
+    uint16_t rxLength;
+
+    // Clear the link of any reply to a cancelled request first
+    if (picomCancelled) {
+        picomDrain();
+        return;
+    }
+
+    // Fill the prefetch buffer and send any bus capture (unless the Pi has
+    // stopped responding); one transfer per call
+    if (!picomPollFailed &&
+        (filesystemProcessPrefetch() || hostadapterCaptureProcessUpload()))
+        return;
+
+    // Is a poll due?
+    if ((int32_t)(time_us_32() - picomNextPollTime) < 0) return;
+
+    // After the link has dropped the session is resumed before anything else
+    // is asked of the Pi.  The interval between attempts grows, so a short
+    // drop is recovered in milliseconds but a missing Pi doesn't keep holding
+    // the bus off.
+    if (picomResumePending) {
+        if (picomResumeSession() != PIR_OK) {
+            picomNextPollTime = time_us_32() + picomResumeInterval;
+            picomResumeInterval *= 2;
+            if (picomResumeInterval > PICOM_POLL_BACKOFF_US)
+                picomResumeInterval = PICOM_POLL_BACKOFF_US;
+            picomPollFailed = true;
+            return;
+        }
+        picomResumeInterval = PICOM_RESUME_INTERVAL_US;
+    }
+
+    // If the poll fails the session is resumed once the Pi responds again
+    if (picomPoll(rxData, &rxLength) != PIR_OK) {
+        picomPollFailed = true;
+        return;
+    }
+    picomPollFailed = false;
+
+    // The reply is the request code followed by any parameters
+    uint8_t request = (rxLength >= 1) ? rxData[0] : PIQ_NONE;
+    uint8_t parameter = (rxLength >= 2) ? rxData[1] : 0;
+
+    // If the Pi had something to say it may have more queued, so poll again
+    // straight away
+    if (request == PIQ_NONE)
+        picomNextPollTime = time_us_32() + PICOM_POLL_INTERVAL_US;
+    else
+        picomNextPollTime = time_us_32();
+
+    // Process the request from the Pi
+    switch (request) {
+        case PIQ_NONE:
+            break;
+
+        case PIQ_GET_PROFILE:
+            profileSendToPi();
+            break;
+
+        case PIQ_CLEAR_PROFILE:
+            profileClear();
+            break;
+
+        case PIQ_ARM_CAPTURE:
+            hostadapterCaptureArm(parameter);
+            break;
+
+        case PIQ_GET_CAPTURE:
+            hostadapterCaptureSendToPi();
+            break;
+
+        case PIQ_DISC_EVENT:
+            // [1] LUN, [2] EFM data present, [3-24] descriptor, [25-29] user
+            // code
+            if (rxLength == 30)
+                filesystemUpdateLun(parameter, rxData[2] != 0, rxData + 3,
+                                    rxData + 25);
+            break;
+
+        case PIQ_EMULATION_MODE:
+            if (rxLength == 2) scsiSetEmulationMode(parameter);
+            break;
+
+        default:
+            debugPrintf(
+                "picomProcessIdle() - Unknown request from Pi: 0x%02x\r\n",
+                request);
+            break;
+    }
+
+    // Complete anything the file system deferred until the Pi was available
+    filesystemProcessIdle();
+
+    // A triggered bus capture is sent to the Pi without waiting to be asked
+    if (hostadapterCaptureComplete()) hostadapterCaptureSendToPi();
 }
 
 // Commands ---------------------------------------------------------------
 
+// Poll the Pi for a pending request (rxData must hold PICOM_POLL_REPLY_LENGTH
+// bytes)
+//
+// The poll also carries the Pico's clock for clock offset estimation: the time
+// the poll was sent, and the send and receive times of the previous poll (the
+// Pi records its own receive and reply times against the send time).
+uint8_t picomPoll(uint8_t *rxData, uint16_t *rxLength) {
+    uint8_t txData[13];
+    uint32_t sendTime = time_us_32();
+
+    txData[0] = PIC_POLL;
+    picomStore32(txData + 1, sendTime);
+    picomStore32(txData + 5, picomPollSendTime);
+    picomStore32(txData + 9, picomPollReceiveTime);
+
+    if (!picomSendToPi(txData, 13, rxData, PICOM_POLL_REPLY_LENGTH, rxLength))
+        return PIR_TIMEOUT;
+
+    picomPollSendTime = sendTime;
+    picomPollReceiveTime = time_us_32();
+
+    return PIR_OK;
+}
+
+// Start or resume the session with the Pi.  The Pico's session id and mount
+// state are sent; a Pi that doesn't hold the session (because it, or the
+// Pico, restarted) takes the mount state and pushes the LUN state again, so
+// the host never sees the drive go unavailable.  A resumed session keeps
+// everything, including requests the Pi has queued for the Pico.
+//
+// Request: [1-4] Pico session id, [5] mount state
+// Response: [0-3] Pi session id, [4] 1 if the session was resumed, 0 if it is
+// new to the Pi
+uint8_t picomResumeSession(void) {
+    uint8_t txData[6];
+    uint8_t rxData[5];
+    uint16_t rxLength;
+
+    txData[0] = PIC_RESUME_SESSION;
+    picomStore32(txData + 1, picomSessionId);
+    txData[5] = filesystemReadMountState() ? 0x01 : 0x00;
+
+    if (!picomSendToPi(txData, 6, rxData, sizeof(rxData), &rxLength))
+        return PIR_TIMEOUT;
+    if (rxLength != 5) return PIR_ERROR;
+
+    uint32_t piSessionId =
+        ((uint32_t)rxData[0] << 24) | ((uint32_t)rxData[1] << 16) |
+        ((uint32_t)rxData[2] << 8) | (uint32_t)rxData[3];
+    if (piSessionId != picomPiSessionId || rxData[4] == 0)
+        debugPrintf(
+            "picomResumeSession() - Session %08x %s with Pi session %08x\r\n",
+            picomSessionId, (rxData[4] != 0) ? "resumed" : "started",
+            piSessionId);
+
+    picomPiSessionId = piSessionId;
+    picomResumePending = false;
+    return PIR_OK;
+}
+
 // Returns PIR_TRUE if the file system is mounted and PIR_FALSE if it is not
 uint8_t picomGetMountState(void) {
     uint8_t txData[1] = {PIC_GET_MOUNT_STATE};
     uint8_t rxData[1];
     uint16_t rxLength;
 
-    if (!picomSendToPi(txData, 1, rxData, &rxLength)) return PIR_TIMEOUT;
+    if (!picomSendToPi(txData, 1, rxData, sizeof(rxData), &rxLength))
+        return PIR_TIMEOUT;
 
     if (rxData[0] == 0) return PIR_FALSE;
     return PIR_TRUE;
@@ -123,7 +544,8 @@ uint8_t picomSetMountState(bool mountState) {
     uint8_t rxData[1];
     uint16_t rxLength;
 
-    if (!picomSendToPi(txData, 2, rxData, &rxLength)) return PIR_TIMEOUT;
+    if (!picomSendToPi(txData, 2, rxData, sizeof(rxData), &rxLength))
+        return PIR_TIMEOUT;
 
     if (rxData[0] == 0) return PIR_FALSE;
     return PIR_TRUE;
@@ -135,7 +557,8 @@ uint8_t picomGetEfmDataPresent(void) {
     uint8_t rxData[1];
     uint16_t rxLength;
 
-    if (!picomSendToPi(txData, 1, rxData, &rxLength)) return PIR_TIMEOUT;
+    if (!picomSendToPi(txData, 1, rxData, sizeof(rxData), &rxLength))
+        return PIR_TIMEOUT;
 
     if (rxData[0] == 0) return PIR_FALSE;
     return PIR_TRUE;
@@ -147,7 +570,7 @@ void picomGetUserCode(uint8_t userCode[5]) {
     uint8_t rxData[5];
     uint16_t rxLength;
 
-    if (!picomSendToPi(txData, 1, rxData, &rxLength)) {
+    if (!picomSendToPi(txData, 1, rxData, sizeof(rxData), &rxLength)) {
         userCode[0] = 0;
         userCode[1] = 0;
         userCode[2] = 0;
@@ -161,4 +584,188 @@ void picomGetUserCode(uint8_t userCode[5]) {
     userCode[2] = rxData[2];
     userCode[3] = rxData[3];
     userCode[4] = rxData[4];
-}
\ No newline at end of file
+}
+
+// Get the disc descriptor (22 byte LUN descriptor) and user code in a single
+// request.  Returns PIR_TRUE if the disc has EFM data (in which case the
+// descriptor and user code are valid) or PIR_FALSE if it does not.
+//
+// Response: [0] EFM data present, [1-22] descriptor, [23-27] user code
+uint8_t picomGetDiscDescriptor(uint8_t lunNumber, uint8_t descriptor[22],
+                               uint8_t userCode[5]) {
+    uint8_t txData[2] = {PIC_GET_DISC_DESCRIPTOR, lunNumber};
+    uint8_t rxData[28];
+    uint16_t rxLength;
+
+    if (!picomSendToPi(txData, 2, rxData, sizeof(rxData), &rxLength))
+        return PIR_TIMEOUT;
+
+    if (rxLength != 28 || rxData[0] == 0) return PIR_FALSE;
+
+    memcpy(descriptor, rxData + 1, 22);
+    memcpy(userCode, rxData + 23, 5);
+    return PIR_TRUE;
+}
+
+// Read sectors (256 bytes each) from the LUN image served by the Pi.  Returns
+// PIR_FALSE (with the first bad sector) if the Pi reports a bad sector.
+//
+// Response: the sectors, or [0] 0x01, [1-4] first bad sector
+uint8_t picomReadSectors(uint8_t lunNumber, uint32_t startSector,
+                         uint8_t numberOfSectors, uint8_t *buffer,
+                         uint32_t *firstBadSector) {
+    uint8_t txData[7];
+    uint16_t rxLength;
+
+    txData[0] = PIC_READ_SECTORS;
+    txData[1] = lunNumber;
+    picomStore32(txData + 2, startSector);
+    txData[6] = numberOfSectors;
+
+    if (!picomSendToPi(txData, 7, buffer, numberOfSectors * 256,
+                       &rxLength)) return PIR_TIMEOUT;
+
+    // Sector data is a multiple of 256 bytes, so it can't be mistaken for a
+    // bad sector report
+    if (rxLength == 5 && buffer[0] == 0x01) {
+        *firstBadSector = ((uint32_t)buffer[1] << 24) |
+                          ((uint32_t)buffer[2] << 16) |
+                          ((uint32_t)buffer[3] << 8) | (uint32_t)buffer[4];
+        return PIR_FALSE;
+    }
+
+    // The Pi responds with no data if the sectors could not be read
+    if (rxLength != numberOfSectors * 256) return PIR_ERROR;
+    return PIR_OK;
+}
+
+// Get the emulation mode (FIXED_EMULATION or LVDOS_EMULATION) the Pi is
+// serving
+uint8_t picomGetEmulationMode(uint8_t *mode) {
+    uint8_t txData[1] = {PIC_GET_EMULATION_MODE};
+    uint8_t rxData[1];
+    uint16_t rxLength;
+
+    if (!picomSendToPi(txData, 1, rxData, sizeof(rxData), &rxLength))
+        return PIR_TIMEOUT;
+    if (rxLength != 1) return PIR_ERROR;
+
+    *mode = rxData[0];
+    return PIR_OK;
+}
+
+// Write sectors (256 bytes each) to the LUN image served by the Pi (fixed
+// emulation only).  The sectors are sent straight from the caller's buffer.
+// The last write of a SCSI command sets commit, so the Pi makes the command's
+// writes durable (in a single journal sync) before replying.
+//
+// Request flags: bit 0 = commit
+// Response: [0] result (0 = written, 1 = failed)
+uint8_t picomWriteSectors(uint8_t lunNumber, uint32_t startSector,
+                          uint8_t numberOfSectors, uint8_t *buffer,
+                          bool commit) {
+    uint8_t txData[8];
+    uint8_t rxData[1];
+    uint16_t rxLength;
+
+    txData[0] = PIC_WRITE_SECTORS;
+    txData[1] = lunNumber;
+    picomStore32(txData + 2, startSector);
+    txData[6] = numberOfSectors;
+    txData[7] = commit ? 0x01 : 0x00;
+
+    if (!picomSendPayloadToPi(txData, 8, buffer, numberOfSectors * 256, rxData,
+                              sizeof(rxData), &rxLength))
+        return PIR_TIMEOUT;
+    if (rxLength != 1 || rxData[0] != 0) return PIR_ERROR;
+    return PIR_OK;
+}
+
+// Format (recreate) a LUN image on the Pi with the given number of sectors
+//
+// Response: [0] result (0 = formatted, 1 = failed)
+uint8_t picomFormatLun(uint8_t lunNumber, uint8_t dataPattern,
+                       uint32_t numberOfSectors) {
+    uint8_t txData[7];
+    uint8_t rxData[1];
+    uint16_t rxLength;
+
+    txData[0] = PIC_FORMAT_LUN;
+    txData[1] = lunNumber;
+    txData[2] = dataPattern;
+    picomStore32(txData + 3, numberOfSectors);
+
+    if (!picomSendToPi(txData, 7, rxData, sizeof(rxData), &rxLength))
+        return PIR_TIMEOUT;
+    if (rxLength != 1 || rxData[0] != 0) return PIR_ERROR;
+    return PIR_OK;
+}
+
+// Write the 22 byte descriptor of a LUN image on the Pi
+//
+// Response: [0] result (0 = written, 1 = failed)
+uint8_t picomWriteDescriptor(uint8_t lunNumber, uint8_t descriptor[22]) {
+    uint8_t txData[24];
+    uint8_t rxData[1];
+    uint16_t rxLength;
+
+    txData[0] = PIC_WRITE_DESCRIPTOR;
+    txData[1] = lunNumber;
+    memcpy(txData + 2, descriptor, 22);
+
+    if (!picomSendToPi(txData, 24, rxData, sizeof(rxData), &rxLength))
+        return PIR_TIMEOUT;
+    if (rxLength != 1 || rxData[0] != 0) return PIR_ERROR;
+    return PIR_OK;
+}
+
+// Hint that sectors are likely to be read soon so the Pi can cache them.  The
+// Pi replies straight away (before caching anything).  The Pico's prefetch
+// counters are included so that the Pi can report how useful the hints are.
+uint8_t picomPrefetchHint(uint8_t lunNumber, uint32_t startSector,
+                          uint8_t numberOfSectors, uint32_t hintCount,
+                          uint32_t prefetchedSectors, uint32_t usedSectors) {
+    uint8_t txData[19];
+    uint8_t rxData[1];
+    uint16_t rxLength;
+
+    txData[0] = PIC_PREFETCH_HINT;
+    txData[1] = lunNumber;
+    picomStore32(txData + 2, startSector);
+    txData[6] = numberOfSectors;
+    picomStore32(txData + 7, hintCount);
+    picomStore32(txData + 11, prefetchedSectors);
+    picomStore32(txData + 15, usedSectors);
+
+    if (!picomSendToPi(txData, 19, rxData, sizeof(rxData), &rxLength))
+        return PIR_TIMEOUT;
+    return PIR_OK;
+}
+
+// Verify sectors on the Pi (the Pi checks the range against a checksum index
+// of the LUN image, so no sector data crosses the link).  Returns PIR_TRUE if
+// the sectors verified, PIR_FALSE (with the first bad sector) if they did not
+// or PIR_ERROR if the Pi could not verify them.
+//
+// Response: [0] result (0 = passed, 1 = failed, 2 = error), [1-4] first bad
+// sector
+uint8_t picomVerifySectors(uint8_t lunNumber, uint32_t startSector,
+                           uint32_t numberOfSectors, uint32_t *firstBadSector) {
+    uint8_t txData[10];
+    uint8_t rxData[5];
+    uint16_t rxLength;
+
+    txData[0] = PIC_VERIFY_SECTORS;
+    txData[1] = lunNumber;
+    picomStore32(txData + 2, startSector);
+    picomStore32(txData + 6, numberOfSectors);
+
+    if (!picomSendToPi(txData, 10, rxData, sizeof(rxData), &rxLength))
+        return PIR_TIMEOUT;
+    if (rxLength != 5 || rxData[0] > 1) return PIR_ERROR;
+
+    *firstBadSector =
+        ((uint32_t)rxData[1] << 24) | ((uint32_t)rxData[2] << 16) |
+        ((uint32_t)rxData[3] << 8) | (uint32_t)rxData[4];
+    return (rxData[0] == 0) ? PIR_TRUE : PIR_FALSE;
+}
@@ -40,15 +40,60 @@
 #define PIC_GET_MOUNT_STATE 0x02
 #define PIC_GET_EFM_DATA_PRESENT 0x03
 #define PIC_GET_USER_CODE 0x04
+#define PIC_POLL 0x05
+#define PIC_PUT_PROFILE 0x06
+#define PIC_PUT_CAPTURE 0x07
+#define PIC_READ_SECTORS 0x08
+#define PIC_GET_DISC_DESCRIPTOR 0x09
+#define PIC_PREFETCH_HINT 0x0A
+#define PIC_VERIFY_SECTORS 0x0B
+#define PIC_GET_EMULATION_MODE 0x0C
+#define PIC_WRITE_SECTORS 0x0D
+#define PIC_FORMAT_LUN 0x0E
+#define PIC_WRITE_DESCRIPTOR 0x0F
+#define PIC_RESUME_SESSION 0x10
+
+// Requests from the Pi (in reply to PIC_POLL)
+#define PIQ_NONE 0x00
+#define PIQ_GET_PROFILE 0x01
+#define PIQ_CLEAR_PROFILE 0x02
+#define PIQ_ARM_CAPTURE 0x03  // Parameter is the trigger mask
+#define PIQ_GET_CAPTURE 0x04
+#define PIQ_DISC_EVENT 0x05  // Mount/eject/disc change (pushes the LUN state)
+#define PIQ_EMULATION_MODE 0x06  // Parameter is the emulation mode
+
+// Maximum length of the Pi's reply to PIC_POLL
+#define PICOM_POLL_REPLY_LENGTH 32
 
 // Function prototypes
 void picomInitialise(void);
-bool picomSendToPi(uint8_t *txData, uint16_t txLength, uint8_t *rxData, uint16_t *rxLength);
+bool picomSendToPi(uint8_t *txData, uint16_t txLength, uint8_t *rxData,
+                   uint16_t rxCapacity, uint16_t *rxLength);
+void picomProcessIdle(void);
 
 // Commands
+uint8_t picomPoll(uint8_t *rxData, uint16_t *rxLength);
+uint8_t picomResumeSession(void);
 uint8_t picomGetMountState(void);
 uint8_t picomSetMountState(bool mountState);
 uint8_t picomGetEfmDataPresent(void);
 void picomGetUserCode(uint8_t userCode[5]);
+uint8_t picomGetDiscDescriptor(uint8_t lunNumber, uint8_t descriptor[22],
+                               uint8_t userCode[5]);
+uint8_t picomReadSectors(uint8_t lunNumber, uint32_t startSector,
+                         uint8_t numberOfSectors, uint8_t *buffer,
+                         uint32_t *firstBadSector);
+uint8_t picomVerifySectors(uint8_t lunNumber, uint32_t startSector,
+                           uint32_t numberOfSectors, uint32_t *firstBadSector);
+uint8_t picomGetEmulationMode(uint8_t *mode);
+uint8_t picomWriteSectors(uint8_t lunNumber, uint32_t startSector,
+                          uint8_t numberOfSectors, uint8_t *buffer,
+                          bool commit);
+uint8_t picomFormatLun(uint8_t lunNumber, uint8_t dataPattern,
+                       uint32_t numberOfSectors);
+uint8_t picomWriteDescriptor(uint8_t lunNumber, uint8_t descriptor[22]);
+uint8_t picomPrefetchHint(uint8_t lunNumber, uint32_t startSector,
+                          uint8_t numberOfSectors, uint32_t hintCount,
+                          uint32_t prefetchedSectors, uint32_t usedSectors);
 
 #endif /* PICOM_H_ */
\ No newline at end of file
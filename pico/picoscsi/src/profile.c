@@ -0,0 +1,230 @@
+/************************************************************************
+
+    profile.c
+
+    PicoSCSI - Raspberry Pico SCSI-1 Drive Emulator
+    Copyright (C) 2025 Simon Inns
+
+    This file is part of PicoSCSI.
+
+    PicoSCSI is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Email: simon.inns@gmail.com
+
+************************************************************************/
+
+// Global includes
+#include <pico/stdlib.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+// Local includes
+#include "debug.h"
+#include "picom.h"
+#include "profile.h"
+#include "scsi.h"
+
+// The profiler is always on; each SCSI state costs two timer reads and a few
+// additions, and the histograms are only updated once per command.  The
+// results survive SCSI resets so they can be read from deployed units.
+
+// Per-opcode profile
+struct profileSlotStruct {
+    uint8_t opCode;
+    uint32_t count;
+
+    uint64_t totalTime[PROFILE_PHASES];  // uS
+    uint32_t maximumTime[PROFILE_PHASES];  // uS
+    uint32_t histogram[PROFILE_PHASES][PROFILE_BUCKETS];
+} profileSlot[PROFILE_SLOTS];
+
+uint8_t profileSlotsUsed;
+uint32_t profileDroppedCount;  // Commands with no free slot
+
+// Host reset to ready times
+uint32_t profileResetCount;
+uint32_t profileResetLastTime;
+uint32_t profileResetMaximumTime;
+
+// Times accumulated for the command currently in progress
+uint32_t profileCurrentTime[PROFILE_PHASES];
+
+// Initialise the profiler
+void profileInitialise(void) { profileClear(); }
+
+// Clear all profile data
+void profileClear(void) {
+    memset(profileSlot, 0, sizeof(profileSlot));
+    memset(profileCurrentTime, 0, sizeof(profileCurrentTime));
+    profileSlotsUsed = 0;
+    profileDroppedCount = 0;
+    profileResetCount = 0;
+    profileResetLastTime = 0;
+    profileResetMaximumTime = 0;
+}
+
+// Get the histogram bucket for an elapsed time
+static inline uint8_t profileBucket(uint32_t elapsedTime) {
+    if (elapsedTime == 0) return 0;
+
+    uint8_t bucket = 32 - __builtin_clz(elapsedTime);
+    if (bucket >= PROFILE_BUCKETS) bucket = PROFILE_BUCKETS - 1;
+    return bucket;
+}
+
+// Add the completed command to the profile for its opcode
+static void profileCommit(uint8_t opCode) {
+    uint8_t slotNumber;
+
+    // Find (or allocate) the slot for the opcode
+    for (slotNumber = 0; slotNumber < profileSlotsUsed; slotNumber++) {
+        if (profileSlot[slotNumber].opCode == opCode) break;
+    }
+
+    if (slotNumber == profileSlotsUsed) {
+        if (profileSlotsUsed == PROFILE_SLOTS) {
+            profileDroppedCount++;
+            return;
+        }
+        profileSlot[slotNumber].opCode = opCode;
+        profileSlotsUsed++;
+    }
+
+    // Time spent on the Pi link is reported separately from the data phase
+    if (profileCurrentTime[PROFILE_PHASE_DATA] >= profileCurrentTime[PROFILE_PHASE_PILINK])
+        profileCurrentTime[PROFILE_PHASE_DATA] -= profileCurrentTime[PROFILE_PHASE_PILINK];
+    else
+        profileCurrentTime[PROFILE_PHASE_DATA] = 0;
+
+    profileSlot[slotNumber].count++;
+    for (uint8_t phase = 0; phase < PROFILE_PHASES; phase++) {
+        uint32_t elapsedTime = profileCurrentTime[phase];
+
+        profileSlot[slotNumber].totalTime[phase] += elapsedTime;
+        if (elapsedTime > profileSlot[slotNumber].maximumTime[phase])
+            profileSlot[slotNumber].maximumTime[phase] = elapsedTime;
+        profileSlot[slotNumber].histogram[phase][profileBucket(elapsedTime)]++;
+    }
+}
+
+// Record the time spent in a SCSI emulation state (called by
+// scsiProcessEmulation() once the state has been processed)
+void profileRecordState(uint8_t state, uint8_t opCode, uint32_t elapsedTime) {
+    switch (state) {
+        case SCSI_BUSFREE:
+            // Waiting for selection (and any idle polling of the Pi) is not
+            // part of a command, so start again from here
+            memset(profileCurrentTime, 0, sizeof(profileCurrentTime));
+            break;
+
+        case SCSI_COMMAND:
+            profileCurrentTime[PROFILE_PHASE_COMMAND] += elapsedTime;
+            break;
+
+        case SCSI_STATUS:
+            profileCurrentTime[PROFILE_PHASE_STATUS] += elapsedTime;
+            break;
+
+        case SCSI_MESSAGE:
+            // The message phase completes the command
+            profileCurrentTime[PROFILE_PHASE_STATUS] += elapsedTime;
+            profileCommit(opCode);
+            memset(profileCurrentTime, 0, sizeof(profileCurrentTime));
+            break;
+
+        default:
+            // Command specific states are the data phase
+            profileCurrentTime[PROFILE_PHASE_DATA] += elapsedTime;
+            break;
+    }
+}
+
+// Record time spent waiting on the Pi link (called by picomSendToPi())
+void profileAddLinkWait(uint32_t elapsedTime) {
+    profileCurrentTime[PROFILE_PHASE_PILINK] += elapsedTime;
+}
+
+// Record the time from a host reset to the emulation being ready again
+void profileRecordReset(uint32_t elapsedTime) {
+    profileResetCount++;
+    profileResetLastTime = elapsedTime;
+    if (elapsedTime > profileResetMaximumTime) profileResetMaximumTime = elapsedTime;
+}
+
+// Store a uint32_t/uint64_t big-endian in a buffer
+static uint16_t profileStore32(uint8_t *buffer, uint16_t pointer, uint32_t value) {
+    buffer[pointer++] = (value >> 24) & 0xFF;
+    buffer[pointer++] = (value >> 16) & 0xFF;
+    buffer[pointer++] = (value >> 8) & 0xFF;
+    buffer[pointer++] = value & 0xFF;
+    return pointer;
+}
+
+static uint16_t profileStore64(uint8_t *buffer, uint16_t pointer, uint64_t value) {
+    pointer = profileStore32(buffer, pointer, (uint32_t)(value >> 32));
+    return profileStore32(buffer, pointer, (uint32_t)value);
+}
+
+// Send the profile to the Pi (one PIC_PUT_PROFILE frame per opcode)
+//
+// Frame format (all values big-endian):
+//   [0] PIC_PUT_PROFILE, [1] slot number, [2] slots used, [3] 0
+//   [4-7] dropped count, [8-11] reset count, [12-15] last reset to ready
+//   time, [16-19] maximum reset to ready time
+//   then (if slots used is not zero) the slot:
+//   opcode, 3 bytes padding, count (4)
+//   for each phase: total (8), maximum (4), histogram (PROFILE_BUCKETS * 4)
+void profileSendToPi(void) {
+    static uint8_t txData[PROFILE_HEADER_LENGTH + PROFILE_SLOT_LENGTH];
+    uint8_t rxData[1];
+    uint16_t rxLength;
+    uint8_t slotNumber = 0;
+
+    do {
+        uint16_t pointer = 0;
+
+        txData[pointer++] = PIC_PUT_PROFILE;
+        txData[pointer++] = slotNumber;
+        txData[pointer++] = profileSlotsUsed;
+        txData[pointer++] = 0;
+        pointer = profileStore32(txData, pointer, profileDroppedCount);
+        pointer = profileStore32(txData, pointer, profileResetCount);
+        pointer = profileStore32(txData, pointer, profileResetLastTime);
+        pointer = profileStore32(txData, pointer, profileResetMaximumTime);
+
+        if (profileSlotsUsed != 0) {
+            txData[pointer++] = profileSlot[slotNumber].opCode;
+            txData[pointer++] = 0;
+            txData[pointer++] = 0;
+            txData[pointer++] = 0;
+            pointer = profileStore32(txData, pointer, profileSlot[slotNumber].count);
+
+            for (uint8_t phase = 0; phase < PROFILE_PHASES; phase++) {
+                pointer = profileStore64(txData, pointer, profileSlot[slotNumber].totalTime[phase]);
+                pointer = profileStore32(txData, pointer, profileSlot[slotNumber].maximumTime[phase]);
+                for (uint8_t bucket = 0; bucket < PROFILE_BUCKETS; bucket++)
+                    pointer = profileStore32(txData, pointer,
+                                             profileSlot[slotNumber].histogram[phase][bucket]);
+            }
+        }
+
+        if (!picomSendToPi(txData, pointer, rxData, sizeof(rxData), &rxLength)) {
+            debugPrintf("profileSendToPi() - Pi did not respond, profile upload abandoned\r\n");
+            return;
+        }
+
+        slotNumber++;
+    } while (slotNumber < profileSlotsUsed);
+}
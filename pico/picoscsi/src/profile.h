@@ -0,0 +1,59 @@
+/************************************************************************
+
+    profile.h
+
+    PicoSCSI - Raspberry Pico SCSI-1 Drive Emulator
+    Copyright (C) 2025 Simon Inns
+
+    This file is part of PicoSCSI.
+
+    PicoSCSI is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Email: simon.inns@gmail.com
+
+************************************************************************/
+
+#ifndef PROFILE_H_
+#define PROFILE_H_
+
+// Profiled phases of a SCSI command
+#define PROFILE_PHASE_COMMAND 0  // Selection to CDB received
+#define PROFILE_PHASE_DATA 1     // Command execution (excluding Pi link)
+#define PROFILE_PHASE_STATUS 2   // Status and message phases
+#define PROFILE_PHASE_PILINK 3   // Time spent waiting on the Pi link
+#define PROFILE_PHASES 4
+
+// Histogram buckets are log2 of the elapsed time in microseconds; bucket 0
+// is 0uS, bucket n is 2^(n-1) to (2^n)-1 uS and the last bucket collects
+// everything from 2^(PROFILE_BUCKETS-2) uS upwards
+#define PROFILE_BUCKETS 20
+
+// Maximum number of distinct opcodes that can be profiled
+#define PROFILE_SLOTS 16
+
+// Length of the header and a single profile slot when sent to the Pi
+#define PROFILE_HEADER_LENGTH 20
+#define PROFILE_SLOT_LENGTH (8 + (PROFILE_PHASES * (12 + (PROFILE_BUCKETS * 4))))
+
+// Function prototypes
+void profileInitialise(void);
+void profileClear(void);
+
+void profileRecordState(uint8_t state, uint8_t opCode, uint32_t elapsedTime);
+void profileAddLinkWait(uint32_t elapsedTime);
+void profileRecordReset(uint32_t elapsedTime);
+
+void profileSendToPi(void);
+
+#endif /* PROFILE_H_ */
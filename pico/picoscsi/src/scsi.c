@@ -34,6 +34,8 @@
 #include "fcode.h"
 #include "filesystem.h"
 #include "hostadapter.h"
+#include "picom.h"
+#include "profile.h"
 #include "scsi.h"
 #include "statusled.h"
 
@@ -56,7 +58,7 @@ struct requestSenseDataStruct {
 
 // Global structure for storing SCSI CDBs
 struct commandDataBlockStruct {
-    uint8_t data[10];
+    uint8_t data[12];  // 10 byte CDB (padded to a multiple of 4 for tracing)
     uint8_t length;
 
     uint8_t opCode;
@@ -84,14 +86,15 @@ void scsiInitialise(void) {
     debugPrintf("Open-source GPLv3 firmware\r\n");
     debugPrintf("\r\n");
 
-    // Determine the emulation mode (fixed or LV-DOS)
-    // if (hostadapterConnectedToExternalBus()) {
-    // 	emulationMode = FIXED_EMULATION;
-    // 	debugPrintf("Emulation mode is Winchester (ADFS SCSI-1
-    // hard-drive)\r\n"); } else {
-    emulationMode = LVDOS_EMULATION;
-    debugPrintf("Emulation mode is Philips VP415 (VFS LaserDisc player)\r\n");
-    //}
+    // Determine the emulation mode (fixed or LV-DOS) from the images the Pi
+    // is serving.  If the Pi isn't available yet it will send the mode when
+    // it is.
+    uint8_t mode;
+    if (picomGetEmulationMode(&mode) == PIR_OK && mode == FIXED_EMULATION)
+        emulationMode = FIXED_EMULATION;
+    else
+        emulationMode = LVDOS_EMULATION;
+    scsiShowEmulationMode();
 
     debugPrintf("\r\n");
 
@@ -111,22 +114,37 @@ void scsiInitialise(void) {
     scsiState = SCSI_BUSFREE;
 }
 
+// Show the emulation mode on the debug output
+void scsiShowEmulationMode(void) {
+    if (emulationMode == FIXED_EMULATION)
+        debugPrintf("Emulation mode is Winchester (ADFS SCSI-1 hard-drive)\r\n");
+    else
+        debugPrintf(
+            "Emulation mode is Philips VP415 (VFS LaserDisc player)\r\n");
+}
+
+// Set the emulation mode (sent by the Pi when it starts serving LaserDisc or
+// hard drive images).  The LUN table is cleared if the mode changes.
+void scsiSetEmulationMode(uint8_t mode) {
+    if (mode != FIXED_EMULATION && mode != LVDOS_EMULATION) return;
+    if (mode == emulationMode) return;
+
+    emulationMode = mode;
+    scsiShowEmulationMode();
+    filesystemResetLunTable();
+}
+
 // Reset the SCSI emulation (called when the host signals reset)
 void scsiReset(void) {
     uint8_t lunNumber;
 
+    if (debugFlag_scsiState) debugTrace(TRACE_SCSI_RESET, 0, 0);
+
     if (debugFlag_scsiState) {
         debugPrintf("\r\n\r\nSCSI State: Resetting SCSI emulation\r\n");
 
-        // Determine the emulation mode (fixed or LV-DOS)
-        // if (hostadapterConnectedToExternalBus()) {
-        // 	emulationMode = FIXED_EMULATION;
-        // 	debugPrintf("Emulation mode is Winchester (ADFS SCSI-1
-        // hard-drive)\r\n"); } else {
-        emulationMode = LVDOS_EMULATION;
-        debugPrintf(
-            "Emulation mode is Philips VP415 (VFS LaserDisc player)\r\n");
-        // }
+        // Show the emulation mode (fixed or LV-DOS)
+        scsiShowEmulationMode();
 
         debugPrintf("\r\n");
     }
@@ -146,6 +164,9 @@ void scsiReset(void) {
 
 // Process the SCSI emulation
 void scsiProcessEmulation(void) {
+    uint8_t previousState = scsiState;
+    uint32_t startTime = time_us_32();
+
     // Process SCSI emulation state
     switch (scsiState) {
         // Handle SCSI bus states:
@@ -228,6 +249,10 @@ void scsiProcessEmulation(void) {
                 debugPrintf("SCSI State: ERROR: Invalid SCSI state!\r\n");
     }
 
+    // Profile the time spent in the state
+    profileRecordState(previousState, commandDataBlock.data[0],
+                       time_us_32() - startTime);
+
     // Show activity using the status LED on whenever we are not in the bus free
     // state
     if (scsiState == SCSI_BUSFREE)
@@ -256,53 +281,37 @@ void scsiInformationTransferPhase(uint8_t transferPhase) {
     switch (transferPhase) {
         case ITPHASE_DATAOUT:
             hostadapterWriteDataPhaseFlags(false, false, false);  // MSG, CD, IO
-            if (debugFlag_scsiState)
-                debugPrintf(
-                    "SCSI State: Information transfer phase: Data out\r\n");
             break;
 
         case ITPHASE_DATAIN:
             hostadapterWriteDataPhaseFlags(false, false, true);  // MSG, CD, IO
-            if (debugFlag_scsiState)
-                debugPrintf(
-                    "SCSI State: Information transfer phase: Data in\r\n");
             break;
 
         case ITPHASE_COMMAND:
             hostadapterWriteDataPhaseFlags(false, true, false);  // MSG, CD, IO
-            if (debugFlag_scsiState)
-                debugPrintf(
-                    "SCSI State: Information transfer phase: Command\r\n");
             break;
 
         case ITPHASE_STATUS:
             hostadapterWriteDataPhaseFlags(false, true, true);  // MSG, CD, IO
-            if (debugFlag_scsiState)
-                debugPrintf(
-                    "SCSI State: Information transfer phase: Status\r\n");
             break;
 
         case ITPHASE_MESSAGEOUT:
             hostadapterWriteDataPhaseFlags(true, true, false);  // MSG, CD, IO
-            if (debugFlag_scsiState)
-                debugPrintf(
-                    "SCSI State: Information transfer phase: Message out\r\n");
             break;
 
         case ITPHASE_MESSAGEIN:
             hostadapterWriteDataPhaseFlags(true, true, true);  // MSG, CD, IO
-            if (debugFlag_scsiState)
-                debugPrintf(
-                    "SCSI State: Information transfer phase: Message in\r\n");
             break;
     }
+
+    if (debugFlag_scsiState) debugTrace(TRACE_SCSI_PHASE, transferPhase, 0);
 }
 
 // SCSI Bus free state
 uint8_t scsiEmulationBusFree(void) {
     uint8_t hostIdentifier = 0;
 
-    if (debugFlag_scsiState) debugPrintf("SCSI State: Bus Free\r\n");
+    if (debugFlag_scsiState) debugTrace(TRACE_SCSI_BUSFREE, 0, 0);
 
     // Clear reset condition
     hostadapterWriteResetFlag(false);
@@ -314,21 +323,24 @@ uint8_t scsiEmulationBusFree(void) {
     hostadapterWriteBusyFlag(false);
     hostadapterWriteRequestFlag(false);
 
-    // Wait for selection (or reset condition)
-    while ((!hostadapterReadSelectFlag()) && (!hostadapterReadResetFlag()));
+    // Wait for selection (or reset condition) and use the idle time to
+    // poll the Pi
+    while ((!hostadapterReadSelectFlag()) && (!hostadapterReadResetFlag()))
+        picomProcessIdle();
 
     // If host signalled reset, go to the bus free state
     if (hostadapterReadResetFlag()) return SCSI_BUSFREE;
 
     // Read the host ID (from the host databus)
     hostIdentifier = hostadapterReadDatabus();
+    hostadapterCapture(CAPTURE_EVENT_SEL, hostIdentifier);
 
     // Set busy flag to active
     hostadapterWriteBusyFlag(true);
 
     // We are now in the selected state
     if (debugFlag_scsiState)
-        debugPrintf("SCSI State: Selected by host ID %d\r\n", hostIdentifier);
+        debugTrace(TRACE_SCSI_SELECTED, hostIdentifier, 0);
 
     // Transition to command state
     return SCSI_COMMAND;
@@ -338,8 +350,6 @@ uint8_t scsiEmulationBusFree(void) {
 uint8_t scsiEmulationCommand(void) {
     uint8_t commandDataBlockPointer = 0;
 
-    if (debugFlag_scsiState) debugPrintf("SCSI State: Command phase\r\n");
-
     // Set signals to indicate command state on the bus
     scsiInformationTransferPhase(ITPHASE_COMMAND);
 
@@ -371,35 +381,31 @@ uint8_t scsiEmulationCommand(void) {
             break;
     }
 
-    // Show CDB byte 0 decode
-    if (debugFlag_scsiCommands) {
-        debugPrintf(
-            "SCSI Commands: CDB byte 0 decode: Command group %d (%d bytes) "
-            "opcode %d\r\n",
-            commandDataBlock.group, commandDataBlock.length,
-            commandDataBlock.opCode);
-    }
-
-    // Show received byte value
-    if (debugFlag_scsiCommands) {
-        debugPrintf("SCSI Commands: Received command operand bytes: %d",
-                    commandDataBlock.data[commandDataBlockPointer]);
-    }
-
     // Next byte...
     commandDataBlockPointer++;
 
     // Get the remainder of the CDB bytes;
     while (commandDataBlockPointer < commandDataBlock.length) {
         commandDataBlock.data[commandDataBlockPointer] = hostadapterReadByte();
-
-        // Show received byte value
-        if (debugFlag_scsiCommands)
-            debugPrintf(" %d", commandDataBlock.data[commandDataBlockPointer]);
-
         commandDataBlockPointer++;
     }
-    if (debugFlag_scsiCommands) debugPrintf("\r\n");
+
+    // Trace the received CDB bytes (4 bytes per trace record)
+    if (debugFlag_scsiCommands) {
+        for (commandDataBlockPointer = 0;
+             commandDataBlockPointer < commandDataBlock.length;
+             commandDataBlockPointer += 4) {
+            debugTrace(
+                TRACE_SCSI_CDB, commandDataBlockPointer,
+                ((uint32_t)commandDataBlock.data[commandDataBlockPointer]
+                 << 24) |
+                    ((uint32_t)commandDataBlock.data[commandDataBlockPointer + 1]
+                     << 16) |
+                    ((uint32_t)commandDataBlock.data[commandDataBlockPointer + 2]
+                     << 8) |
+                    (uint32_t)commandDataBlock.data[commandDataBlockPointer + 3]);
+        }
+    }
 
     // Decode the target LUN
     commandDataBlock.targetLUN = (commandDataBlock.data[1] & 0xE0) >> 5;
@@ -489,12 +495,16 @@ uint8_t scsiEmulationCommand(void) {
 // SCSI status state
 uint8_t scsiEmulationStatus(void) {
     if (debugFlag_scsiState)
-        debugPrintf("SCSI State: Status. Status byte = %d\r\n",
-                    commandDataBlock.status);
+        debugTrace(TRACE_SCSI_STATUS, commandDataBlock.status, 0);
 
     // Set signals to indicate status state on the bus
     scsiInformationTransferPhase(ITPHASE_STATUS);
 
+    // Record the status in the bus capture (and trigger if not GOOD)
+    hostadapterCapture(CAPTURE_EVENT_STATUS, commandDataBlock.status);
+    if (commandDataBlock.status != 0x00)
+        hostadapterCaptureTrigger(CAPTURE_TRIGGER_CHECK);
+
     // Write the status byte to the host
     hostadapterWriteByte(commandDataBlock.status);
 
@@ -505,8 +515,7 @@ uint8_t scsiEmulationStatus(void) {
 // SCSI message in state
 uint8_t scsiEmulationMessage(void) {
     if (debugFlag_scsiState)
-        debugPrintf("SCSI State: Message In. Message byte = %d\r\n",
-                    commandDataBlock.message);
+        debugTrace(TRACE_SCSI_MESSAGE, commandDataBlock.message, 0);
 
     // Set signals to indicate message in state on the bus
     scsiInformationTransferPhase(ITPHASE_MESSAGEIN);
@@ -910,6 +919,7 @@ uint8_t scsiCommandRead6(void) {
     uint32_t logicalBlockAddress = 0;
     uint32_t numberOfBlocks = 0;
     uint32_t currentBlock = 0;
+    uint32_t badBlock = 0;
 
     uint16_t bytesTransferred = 0;
 
@@ -999,6 +1009,21 @@ uint8_t scsiCommandRead6(void) {
 
         // Set request sense error globals
         requestSenseData[commandDataBlock.targetLUN].errorFlag = true;
+
+        // A bad sector is a media error; the LUN itself is still usable
+        if (filesystemGetReadBadSector(&badBlock)) {
+            requestSenseData[commandDataBlock.targetLUN].validAddressFlag =
+                true;
+            requestSenseData[commandDataBlock.targetLUN].errorClass =
+                0x01;  // Class 01 error code
+            requestSenseData[commandDataBlock.targetLUN].errorCode =
+                0x11;  // Uncorrectable data error
+            requestSenseData[commandDataBlock.targetLUN].logicalBlockAddress =
+                badBlock;
+            filesystemCloseLunForRead();
+            return SCSI_STATUS;
+        }
+
         requestSenseData[commandDataBlock.targetLUN].validAddressFlag = false;
         requestSenseData[commandDataBlock.targetLUN].errorClass =
             0x00;  // Class 00 error code
@@ -1018,8 +1043,10 @@ uint8_t scsiCommandRead6(void) {
         debugPrintf(
             "SCSI Commands: Transferring requested blocks to the host...\r\n");
     for (currentBlock = 0; currentBlock < numberOfBlocks; currentBlock++) {
-        // Read the requested block from the LUN image
-        if (!filesystemReadNextSector(scsiSectorBuffer)) {
+        // Borrow the requested block from the LUN image (the data bus is
+        // driven straight from the file system's buffer)
+        uint8_t *sectorData = filesystemAcquireReadSector();
+        if (sectorData == NULL) {
             // Reading from the LUN image failed... try to recover with a little
             // grace...
             if (debugFlag_scsiCommands)
@@ -1032,6 +1059,21 @@ uint8_t scsiCommandRead6(void) {
 
             // Set request sense error globals
             requestSenseData[commandDataBlock.targetLUN].errorFlag = true;
+
+            // A bad sector is a media error; the LUN itself is still usable
+            if (filesystemGetReadBadSector(&badBlock)) {
+                requestSenseData[commandDataBlock.targetLUN].validAddressFlag =
+                    true;
+                requestSenseData[commandDataBlock.targetLUN].errorClass =
+                    0x01;  // Class 01 error code
+                requestSenseData[commandDataBlock.targetLUN].errorCode =
+                    0x11;  // Uncorrectable data error
+                requestSenseData[commandDataBlock.targetLUN]
+                    .logicalBlockAddress = badBlock;
+                filesystemCloseLunForRead();
+                return SCSI_STATUS;
+            }
+
             requestSenseData[commandDataBlock.targetLUN].validAddressFlag =
                 false;
             requestSenseData[commandDataBlock.targetLUN].errorClass =
@@ -1049,7 +1091,7 @@ uint8_t scsiCommandRead6(void) {
         }
 
         // Send the data to the host
-        bytesTransferred = hostadapterPerformReadDMA(scsiSectorBuffer);
+        bytesTransferred = hostadapterPerformReadDMA(sectorData);
 
         // Check for a host reset condition
         if (hostadapterReadResetFlag()) {
@@ -1067,19 +1109,26 @@ uint8_t scsiCommandRead6(void) {
 
         // Show debug
         if (!debugFlag_scsiBlocks) {
-            if (debugFlag_scsiCommands) debugPrintf("%ld ", currentBlock);
+            if (debugFlag_scsiCommands)
+                debugTrace(TRACE_SCSI_BLOCK, bytesTransferred, currentBlock);
         } else {
             if (debugFlag_scsiBlocks) {
                 debugPrintf("Hex dump for block #%ld\r\n", currentBlock);
-                debugSectorBufferHex(scsiSectorBuffer, 256);
+                debugSectorBufferHex(sectorData, 256);
             }
         }
+
+        // Return the block to the file system
+        filesystemReleaseReadSector();
     }
-    if (debugFlag_scsiCommands || debugFlag_scsiBlocks) debugPrintf("\r\n");
 
     // Close the currently open LUN image
     filesystemCloseLunForRead();
 
+    // Sequential reads are common, so prefetch the following blocks
+    filesystemPrefetchHint(commandDataBlock.targetLUN,
+                           logicalBlockAddress + numberOfBlocks);
+
     // Indicate successful transfer in status and message
     commandDataBlock.status = 0x00;  // 0x00 = Good
     commandDataBlock.message = 0x00;
@@ -1214,8 +1263,11 @@ uint8_t scsiCommandWrite6(void) {
             "SCSI Commands: Transferring requested blocks from the "
             "host...\r\n");
     for (currentBlock = 0; currentBlock < numberOfBlocks; currentBlock++) {
-        // Get the data from the host
-        bytesTransferred = hostadapterPerformWriteDMA(scsiSectorBuffer);
+        // Get the data from the host (straight into the file system's buffer)
+        uint8_t *sectorData = filesystemAcquireWriteSector();
+        bytesTransferred = 0;
+        if (sectorData != NULL)
+            bytesTransferred = hostadapterPerformWriteDMA(sectorData);
 
         // Check for a host reset condition
         if (hostadapterReadResetFlag()) {
@@ -1232,7 +1284,7 @@ uint8_t scsiCommandWrite6(void) {
         }
 
         // Write the requested block to the LUN image
-        if (!filesystemWriteNextSector(scsiSectorBuffer)) {
+        if (sectorData == NULL || !filesystemCommitWriteSector()) {
             // Writing to the LUN image failed... try to recover with a little
             // grace...
             if (debugFlag_scsiCommands)
@@ -1262,15 +1314,15 @@ uint8_t scsiCommandWrite6(void) {
 
         // Show debug
         if (!debugFlag_scsiBlocks) {
-            if (debugFlag_scsiCommands) debugPrintf("%ld ", currentBlock);
+            if (debugFlag_scsiCommands)
+                debugTrace(TRACE_SCSI_BLOCK, bytesTransferred, currentBlock);
         } else {
             if (debugFlag_scsiBlocks) {
                 debugPrintf("Hex dump for block #%ld\r\n", currentBlock);
-                debugSectorBufferHex(scsiSectorBuffer, 256);
+                debugSectorBufferHex(sectorData, 256);
             }
         }
     }
-    if (debugFlag_scsiCommands || debugFlag_scsiBlocks) debugPrintf("\r\n");
 
     // Close the currently open LUN image
     filesystemCloseLunForWrite();
@@ -1288,9 +1340,8 @@ uint8_t scsiCommandWrite6(void) {
 // SCSI Command (0x0B) Seek
 //
 // This command is reported to be used in some (unknown) ADFS utilities.  It
-// doesn't serve a purpose for the file system implementation, but is included
-// for completeness.  It simply returns successfully if the specified LUN is
-// available.
+// doesn't need to move anything, but the target block is passed on as a
+// prefetch hint.  It returns successfully if the specified LUN is available.
 uint8_t scsiCommandSeek(void) {
     if (debugFlag_scsiCommands) {
         debugPrintf("SCSI Commands: SEEK command (0x0B) received\r\n");
@@ -1300,6 +1351,13 @@ uint8_t scsiCommandSeek(void) {
 
     // Check to see if the requested LUN is started
     if (filesystemReadLunStatus(commandDataBlock.targetLUN)) {
+        // The host seeks before reading, so use the seek as a prefetch hint
+        uint32_t logicalBlockAddress =
+            (((uint32_t)commandDataBlock.data[1] & 0x1F) << 16) |
+            ((uint32_t)commandDataBlock.data[2] << 8) |
+            ((uint32_t)commandDataBlock.data[3]);
+        filesystemPrefetchHint(commandDataBlock.targetLUN, logicalBlockAddress);
+
         // Indicate successful command in status and message
         commandDataBlock.status = 0x00;  // 0x00 = Good
         commandDataBlock.message = 0x00;
@@ -1875,12 +1933,48 @@ uint8_t scsiCommandVerify(void) {
             logicalBlockAddress;
 
         return SCSI_STATUS;
-    } else {
-        // In range
+    }
+
+    // In range; the blocks are verified by the Pi against its checksum index
+    // of the LUN image (so the data doesn't need to cross the link)
+    uint32_t firstBadBlock = logicalBlockAddress;
+    uint8_t pirResponse =
+        picomVerifySectors(commandDataBlock.targetLUN, logicalBlockAddress,
+                           numberOfBlocks, &firstBadBlock);
 
+    if (pirResponse == PIR_TRUE) {
         // Indicate successful command in status and message
         commandDataBlock.status = 0x00;  // 0x00 = Good
         commandDataBlock.message = 0x00;
+        return SCSI_STATUS;
+    }
+
+    if (debugFlag_scsiCommands)
+        debugPrintf("SCSI Commands: ERROR: Verify failed (response %d) at LBA %ld\r\n",
+                    pirResponse, firstBadBlock);
+
+    // Set error status
+    commandDataBlock.status =
+        (commandDataBlock.targetLUN << 5) | 0x02;  // 0x02 = Bad
+    commandDataBlock.message = 0x00;
+
+    // Set request sense error globals
+    requestSenseData[commandDataBlock.targetLUN].errorFlag = true;
+    if (pirResponse == PIR_FALSE) {
+        requestSenseData[commandDataBlock.targetLUN].validAddressFlag = true;
+        requestSenseData[commandDataBlock.targetLUN].errorClass =
+            0x01;  // Class 01 error code
+        requestSenseData[commandDataBlock.targetLUN].errorCode =
+            0x11;  // Uncorrectable data error
+        requestSenseData[commandDataBlock.targetLUN].logicalBlockAddress =
+            firstBadBlock;
+    } else {
+        requestSenseData[commandDataBlock.targetLUN].validAddressFlag = false;
+        requestSenseData[commandDataBlock.targetLUN].errorClass =
+            0x00;  // Class 00 error code
+        requestSenseData[commandDataBlock.targetLUN].errorCode =
+            0x04;  // Drive not ready
+        requestSenseData[commandDataBlock.targetLUN].logicalBlockAddress = 0x00;
     }
 
     return SCSI_STATUS;
@@ -71,6 +71,8 @@ extern uint8_t emulationMode;
 // Function prototypes
 void scsiInitialise(void);
 void scsiReset(void);
+void scsiShowEmulationMode(void);
+void scsiSetEmulationMode(uint8_t mode);
 
 void scsiProcessEmulation(void);
 void scsiInformationTransferPhase(uint8_t transferPhase);
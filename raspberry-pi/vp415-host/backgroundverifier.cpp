@@ -0,0 +1,199 @@
+/************************************************************************
+
+    backgroundverifier.cpp
+
+    VP415-host - A host application for the VP415 Emulator
+    VP415-Emulator
+    Copyright (C) 2025 Simon Inns
+
+    This file is part of VP415-Emulator.
+
+    This is free software: you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Email: simon.inns@gmail.com
+
+************************************************************************/
+
+#include "backgroundverifier.h"
+
+#include <QDebug>
+#include <QMutexLocker>
+
+#include "realtime.h"
+
+#ifdef Q_OS_LINUX
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+// Put the calling thread in the idle I/O class, so its reads only get the SD
+// card when nothing else wants it (the CPU priority is set by QThread)
+void setIdleIoPriority() {
+#ifdef Q_OS_LINUX
+    const int IOPRIO_WHO_PROCESS = 1;  // With an id of 0, the calling thread
+    const int IOPRIO_CLASS_IDLE = 3;
+    const int IOPRIO_CLASS_SHIFT = 13;
+    if (syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT) != 0)
+        qDebug() << "BackgroundVerifier::setIdleIoPriority() - Failed to set idle I/O priority";
+#endif
+}
+
+}
+
+BackgroundVerifier::BackgroundVerifier(QObject *parent) : QObject(parent) {
+    m_metrics = nullptr;
+    m_clock.start();
+    m_lastActivity = -BUSY_HOLDOFF_MS;
+}
+
+BackgroundVerifier::~BackgroundVerifier() {
+    stop();
+}
+
+// Start verifying the captured sectors of a disc (the parts it was opened
+// from and its extent map).  threads 0 means one per core.
+void BackgroundVerifier::start(const QVector<EfmData::Part> &parts, const ExtentMap &extentMap, int threads) {
+    stop();
+
+    m_parts = parts;
+    for (int index = 0; index < extentMap.count(); index++) {
+        const ExtentMap::Extent &extent = extentMap.at(index);
+        for (uint32_t offset = 0; offset < extent.sectors; offset += UNIT_SECTORS) {
+            uint32_t sectors = extent.sectors - offset;
+            if (sectors > UNIT_SECTORS) sectors = UNIT_SECTORS;
+            m_units.append(Unit{extent.startSector + offset, sectors});
+        }
+    }
+
+    if (threads <= 0) threads = QThread::idealThreadCount();
+    m_nextUnit = 0;
+    m_activeWorkers = threads;
+    m_sectorsVerified = 0;
+    m_stopping = false;
+
+    qDebug() << "BackgroundVerifier::start() - Verifying" << m_units.size() << "units of EFM data with"
+             << threads << "threads";
+    for (int index = 0; index < threads; index++) {
+        QThread *thread = QThread::create([this] { worker(); });
+        m_workers.append(thread);
+        thread->start(QThread::IdlePriority);
+    }
+}
+
+// Stop the workers and forget the disc (and its bad extents)
+void BackgroundVerifier::stop() {
+    m_stopping = true;
+    for (QThread *thread : m_workers) {
+        thread->wait();
+        delete thread;
+    }
+    m_workers.clear();
+    m_units.clear();
+    m_parts.clear();
+
+    QMutexLocker locker(&m_badMutex);
+    m_badExtents.clear();
+    m_badExtentCount = 0;
+}
+
+// Called for each request on the serving path; the workers hold off until it
+// has been idle for BUSY_HOLDOFF_MS
+void BackgroundVerifier::noteActivity() {
+    m_lastActivity = m_clock.elapsed();
+}
+
+bool BackgroundVerifier::isBusy() const {
+    return m_clock.elapsed() - m_lastActivity < BUSY_HOLDOFF_MS;
+}
+
+// Does a range of sectors include any that failed verification?  If so, the
+// first bad sector in the range is returned in firstBadSector (if given)
+bool BackgroundVerifier::isBad(uint32_t startSector, uint32_t numberOfSectors, uint32_t *firstBadSector) {
+    if (m_badExtentCount == 0 || numberOfSectors == 0) return false;
+
+    QMutexLocker locker(&m_badMutex);
+    int index = m_badExtents.findFrom(startSector);
+    if (index < 0 || m_badExtents.at(index).startSector >= static_cast<uint64_t>(startSector) + numberOfSectors)
+        return false;
+
+    if (firstBadSector) *firstBadSector = qMax(startSector, m_badExtents.at(index).startSector);
+    return true;
+}
+
+// Each worker opens the EFM data itself, so it has its own file handles and
+// caches and shares nothing with the serving path.  Opening only loads the
+// stored extent indexes (it never builds or writes one), and a worker without
+// them stops: checksums made from the data being checked would prove nothing.
+void BackgroundVerifier::worker() {
+    setIdleIoPriority();
+    RealTime::leaveServingCore();
+
+    EfmData efmData;
+    if (!efmData.openEfmData(m_parts)) {
+        qDebug() << "BackgroundVerifier::worker() - Failed to open the EFM data";
+    } else if (!efmData.hasExtentIndex()) {
+        qDebug() << "BackgroundVerifier::worker() - EFM data has no stored extent index; not verifying";
+    } else {
+        while (!m_stopping) {
+            if (isBusy()) {
+                QThread::msleep(BUSY_HOLDOFF_MS);
+                continue;
+            }
+
+            int unit = m_nextUnit++;
+            if (unit >= m_units.size()) break;
+            verifyUnit(efmData, m_units.at(unit));
+        }
+    }
+
+    if (--m_activeWorkers == 0 && !m_stopping) {
+        qDebug() << "BackgroundVerifier::worker() - Verified" << m_sectorsVerified.load() << "sectors;"
+                 << m_badExtentCount.load() << "bad extents found";
+    }
+}
+
+// Verify a unit.  When it fails, the bad sectors are found by checking them
+// one at a time (each check re-reads the extent or chunk holding the sector,
+// but only for sectors next to a failure).
+void BackgroundVerifier::verifyUnit(EfmData &efmData, const Unit &unit) {
+    uint32_t endSector = unit.startSector + unit.sectors;  // Exclusive
+    uint32_t sector = unit.startSector;
+    uint32_t badSector;
+
+    while (sector < endSector && !m_stopping) {
+        if (efmData.verifySectors(sector, endSector - sector, &badSector)) break;
+
+        uint32_t badEnd = badSector + 1;
+        uint32_t unused;
+        while (badEnd < endSector && !m_stopping && !efmData.verifySectors(badEnd, 1, &unused)) badEnd++;
+
+        addBadExtent(badSector, badEnd - badSector);
+        sector = badEnd;
+    }
+
+    m_sectorsVerified += unit.sectors;
+    if (m_metrics) m_metrics->backgroundVerifiedSectors.add(unit.sectors);
+}
+
+void BackgroundVerifier::addBadExtent(uint32_t startSector, uint32_t sectors) {
+    qDebug() << "BackgroundVerifier::addBadExtent() - Sectors" << startSector << "to"
+             << startSector + sectors - 1 << "failed verification; they will be reported as media errors";
+
+    QMutexLocker locker(&m_badMutex);
+    m_badExtents.add(ExtentMap::Extent{startSector, sectors, -1, 0});
+    m_badExtentCount++;
+    if (m_metrics) m_metrics->backgroundBadSectors.add(sectors);
+}
@@ -0,0 +1,102 @@
+/************************************************************************
+
+    backgroundverifier.h
+
+    VP415-host - A host application for the VP415 Emulator
+    VP415-Emulator
+    Copyright (C) 2025 Simon Inns
+
+    This file is part of VP415-Emulator.
+
+    This is free software: you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Email: simon.inns@gmail.com
+
+************************************************************************/
+
+#ifndef BACKGROUNDVERIFIER_H
+#define BACKGROUNDVERIFIER_H
+
+#include <QObject>
+#include <QVector>
+#include <QThread>
+#include <QMutex>
+#include <QElapsedTimer>
+
+#include <atomic>
+
+#include "efmdata.h"
+#include "extentmap.h"
+#include "metrics.h"
+
+// Verifies the whole of a disc's EFM data in the background, so a corrupt
+// image is found before the sectors are served rather than when a session
+// hangs.  The captured sectors are split into units that worker threads check
+// in parallel against the image's own checksums (the extent index, the
+// compressed image's chunk checksums or the chunk store hashes).  Workers run
+// at idle CPU and I/O priority and back off while the Pico is being served.
+//
+// Sectors that fail are kept as bad extents; reads of them are refused so the
+// Pico reports a media error instead of passing on bad data.
+class BackgroundVerifier : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit BackgroundVerifier(QObject *parent = nullptr);
+    ~BackgroundVerifier();
+
+    // Sectors verified by a worker between checks for a busy serving path
+    static const uint32_t UNIT_SECTORS = 1024;
+    // Workers pause until the serving path has been idle this long
+    static const int BUSY_HOLDOFF_MS = 250;
+
+    void start(const QVector<EfmData::Part> &parts, const ExtentMap &extentMap, int threads);
+    void stop();
+    bool isRunning() const { return !m_workers.isEmpty(); }
+
+    void noteActivity();
+    bool isBad(uint32_t startSector, uint32_t numberOfSectors, uint32_t *firstBadSector = nullptr);
+    void setMetrics(Metrics *metrics) { m_metrics = metrics; }
+
+private:
+    struct Unit {
+        uint32_t startSector;
+        uint32_t sectors;
+    };
+
+    QVector<EfmData::Part> m_parts;
+    QVector<Unit> m_units;
+    QVector<QThread *> m_workers;
+    Metrics *m_metrics;
+
+    std::atomic<int> m_nextUnit{0};
+    std::atomic<int> m_activeWorkers{0};
+    std::atomic<bool> m_stopping{false};
+    QElapsedTimer m_clock;
+    std::atomic<qint64> m_lastActivity{0};
+    std::atomic<uint64_t> m_sectorsVerified{0};
+
+    // Bad sectors (the extent map's backing file is unused)
+    QMutex m_badMutex;
+    ExtentMap m_badExtents;
+    std::atomic<int> m_badExtentCount{0};
+
+    void worker();
+    bool isBusy() const;
+    void verifyUnit(EfmData &efmData, const Unit &unit);
+    void addBadExtent(uint32_t startSector, uint32_t sectors);
+};
+
+#endif // BACKGROUNDVERIFIER_H
@@ -0,0 +1,239 @@
+/************************************************************************
+
+    buscapture.cpp
+
+    VP415-host - A host application for the VP415 Emulator
+    VP415-Emulator
+    Copyright (C) 2025 Simon Inns
+
+    This file is part of VP415-Emulator.
+
+    This is free software: you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Email: simon.inns@gmail.com
+
+************************************************************************/
+
+#include "buscapture.h"
+#include <QDebug>
+#include <QFile>
+#include <QTextStream>
+#include <algorithm>
+
+// Capture event types (must match hostadapter.h on the Pico)
+static const uint8_t CAPTURE_EVENT_PHASE = 0x01;
+static const uint8_t CAPTURE_EVENT_REQ = 0x02;
+static const uint8_t CAPTURE_EVENT_ACK = 0x03;
+static const uint8_t CAPTURE_EVENT_DATA = 0x04;
+static const uint8_t CAPTURE_EVENT_BSY = 0x05;
+static const uint8_t CAPTURE_EVENT_SEL = 0x06;
+static const uint8_t CAPTURE_EVENT_RESET = 0x07;
+static const uint8_t CAPTURE_EVENT_TIMEOUT = 0x08;
+static const uint8_t CAPTURE_EVENT_STATUS = 0x09;
+static const uint8_t CAPTURE_EVENT_TRIGGER = 0x0F;
+
+static uint16_t readUint16(const QByteArray &data, int position) {
+    return (static_cast<uint16_t>(static_cast<uint8_t>(data[position])) << 8) |
+           static_cast<uint16_t>(static_cast<uint8_t>(data[position + 1]));
+}
+
+static uint32_t readUint32(const QByteArray &data, int position) {
+    return (static_cast<uint32_t>(readUint16(data, position)) << 16) | readUint16(data, position + 2);
+}
+
+BusCapture::BusCapture(QObject *parent) : QObject(parent) {
+    m_triggerCondition = 0;
+    m_triggerIndex = 0xFFFFFFFF;
+    m_expectedFrame = 0;
+    m_isComplete = false;
+}
+
+BusCapture::~BusCapture() {}
+
+// Add a PIC_PUT_CAPTURE frame to the capture; returns true once the last
+// frame has been received
+bool BusCapture::addFrame(const QByteArray &data) {
+    if (data.size() < 12) {
+        qDebug() << "BusCapture::addFrame() - Frame too short: " << data.size();
+        return false;
+    }
+
+    uint16_t frameNumber = readUint16(data, 2);
+    uint16_t frameCount = readUint16(data, 4);
+    uint16_t frameRecords = readUint16(data, 6);
+
+    // The first frame starts a new capture
+    if (frameNumber == 0) {
+        m_records.clear();
+        m_expectedFrame = 0;
+        m_isComplete = false;
+    }
+
+    if (frameNumber != m_expectedFrame || data.size() < 12 + (frameRecords * 6)) {
+        qDebug() << "BusCapture::addFrame() - Invalid frame " << frameNumber << " (expected "
+                 << m_expectedFrame << ")";
+        return false;
+    }
+
+    m_triggerCondition = static_cast<uint8_t>(data[1]);
+    m_triggerIndex = readUint32(data, 8);
+
+    for (int i = 0; i < frameRecords; i++) {
+        int position = 12 + (i * 6);
+        Record record;
+        record.timestamp = readUint32(data, position);
+        record.event = static_cast<uint8_t>(data[position + 4]);
+        record.value = static_cast<uint8_t>(data[position + 5]);
+        m_records.append(record);
+    }
+
+    m_expectedFrame++;
+    m_isComplete = (m_expectedFrame >= frameCount);
+    return m_isComplete;
+}
+
+// Show a summary of the capture in the debug output
+void BusCapture::showCapture() {
+    qDebug() << "BusCapture::showCapture() - Bus capture:";
+    qDebug() << "  Records: " << m_records.size();
+    if (m_triggerCondition != 0) {
+        qDebug() << "  Triggered by condition: " << m_triggerCondition << " at record " << m_triggerIndex;
+    } else {
+        qDebug() << "  Not triggered";
+    }
+    if (!m_records.isEmpty()) {
+        qDebug() << "  Duration: " << (m_records.last().timestamp - m_records.first().timestamp) << "us";
+    }
+}
+
+// Write the capture as a VCD file.  All signals are shown active high (i.e.
+// 1 = asserted) regardless of the inverted logic on the bus.
+//
+// The Pico only records the edges it drives or waits for, so ACK is shown
+// released when REQ is released, SEL is shown released when BSY is asserted
+// and RST, TIMEOUT and TRIGGER are shown as 1uS pulses.
+bool BusCapture::writeVcd(QString filename) {
+    if (m_records.isEmpty()) {
+        qDebug() << "BusCapture::writeVcd() - Capture is empty";
+        return false;
+    }
+
+    QFile file(filename);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Text)) {
+        qDebug() << "BusCapture::writeVcd() - Failed to open file: " << filename;
+        return false;
+    }
+
+    // Value changes (time, identifier, value)
+    struct Change {
+        uint64_t time;
+        QString value;
+    };
+    QVector<Change> changes;
+
+    auto addChange = [&changes](uint64_t time, QString id, QString value) {
+        changes.append({time, value.length() > 1 ? value + " " + id : value + id});
+    };
+    auto bits = [](uint8_t value) { return "b" + QString::number(value, 2); };
+
+    // Convert the timestamps to a time relative to the first record (the
+    // Pico's microsecond timer may wrap during the capture)
+    uint64_t time = 0;
+    uint32_t lastTimestamp = m_records.first().timestamp;
+
+    for (int i = 0; i < m_records.size(); i++) {
+        const Record &record = m_records[i];
+        time += static_cast<uint32_t>(record.timestamp - lastTimestamp);
+        lastTimestamp = record.timestamp;
+
+        switch (record.event) {
+            case CAPTURE_EVENT_PHASE:
+                addChange(time, "&", (record.value & 0x04) ? "1" : "0");
+                addChange(time, "'", (record.value & 0x02) ? "1" : "0");
+                addChange(time, "(", (record.value & 0x01) ? "1" : "0");
+                break;
+            case CAPTURE_EVENT_REQ:
+                addChange(time, "!", record.value ? "1" : "0");
+                if (!record.value) addChange(time, "\"", "0");
+                break;
+            case CAPTURE_EVENT_ACK:
+                addChange(time, "\"", "1");
+                break;
+            case CAPTURE_EVENT_DATA:
+            case CAPTURE_EVENT_STATUS:
+                addChange(time, ")", bits(record.value));
+                break;
+            case CAPTURE_EVENT_BSY:
+                addChange(time, "#", record.value ? "1" : "0");
+                if (record.value) addChange(time, "$", "0");
+                break;
+            case CAPTURE_EVENT_SEL:
+                addChange(time, "$", "1");
+                addChange(time, ")", bits(record.value));
+                break;
+            case CAPTURE_EVENT_RESET:
+                addChange(time, "%", "1");
+                addChange(time + 1, "%", "0");
+                break;
+            case CAPTURE_EVENT_TIMEOUT:
+                addChange(time, "+", "1");
+                addChange(time + 1, "+", "0");
+                break;
+            case CAPTURE_EVENT_TRIGGER:
+                addChange(time, "*", "1");
+                addChange(time + 1, "*", "0");
+                break;
+            default:
+                qDebug() << "BusCapture::writeVcd() - Unknown event type: " << record.event;
+                break;
+        }
+    }
+
+    // Pulse ends can fall after later events, so the changes must be sorted
+    std::stable_sort(changes.begin(), changes.end(),
+                     [](const Change &a, const Change &b) { return a.time < b.time; });
+
+    QTextStream stream(&file);
+    stream << "$comment VP415 Emulator SCSI bus capture $end\n";
+    stream << "$timescale 1us $end\n";
+    stream << "$scope module scsi $end\n";
+    stream << "$var wire 1 ! REQ $end\n";
+    stream << "$var wire 1 \" ACK $end\n";
+    stream << "$var wire 1 # BSY $end\n";
+    stream << "$var wire 1 $ SEL $end\n";
+    stream << "$var wire 1 % RST $end\n";
+    stream << "$var wire 1 & MSG $end\n";
+    stream << "$var wire 1 ' CD $end\n";
+    stream << "$var wire 1 ( IO $end\n";
+    stream << "$var wire 8 ) DB $end\n";
+    stream << "$var wire 1 * TRIGGER $end\n";
+    stream << "$var wire 1 + TIMEOUT $end\n";
+    stream << "$upscope $end\n";
+    stream << "$enddefinitions $end\n";
+
+    stream << "#0\n$dumpvars\n0!\n0\"\n0#\n0$\n0%\n0&\n0'\n0(\nb0 )\n0*\n0+\n$end\n";
+
+    uint64_t currentTime = 0;
+    for (const Change &change : changes) {
+        if (change.time != currentTime) {
+            currentTime = change.time;
+            stream << "#" << currentTime << "\n";
+        }
+        stream << change.value << "\n";
+    }
+
+    file.close();
+    qDebug() << "BusCapture::writeVcd() - Capture written to: " << filename;
+    return true;
+}
@@ -0,0 +1,66 @@
+/************************************************************************
+
+    buscapture.h
+
+    VP415-host - A host application for the VP415 Emulator
+    VP415-Emulator
+    Copyright (C) 2025 Simon Inns
+
+    This file is part of VP415-Emulator.
+
+    This is free software: you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Email: simon.inns@gmail.com
+
+************************************************************************/
+
+#ifndef BUSCAPTURE_H
+#define BUSCAPTURE_H
+
+#include <QObject>
+#include <QString>
+#include <QByteArray>
+#include <QVector>
+
+// SCSI bus capture uploaded by the Pico (see hostadapter.c) with conversion
+// to VCD for viewing in GTKWave
+class BusCapture : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit BusCapture(QObject *parent = nullptr);
+    ~BusCapture();
+
+    struct Record {
+        uint32_t timestamp;
+        uint8_t event;
+        uint8_t value;
+    };
+
+    bool addFrame(const QByteArray &data);
+    bool isComplete() const { return m_isComplete; }
+
+    void showCapture();
+    bool writeVcd(QString filename);
+
+private:
+    QVector<Record> m_records;
+    uint8_t m_triggerCondition;
+    uint32_t m_triggerIndex;
+    uint16_t m_expectedFrame;
+    bool m_isComplete;
+};
+
+#endif // BUSCAPTURE_H
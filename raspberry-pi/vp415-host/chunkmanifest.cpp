@@ -0,0 +1,287 @@
+/************************************************************************
+
+    chunkmanifest.cpp
+
+    VP415-host - A host application for the VP415 Emulator
+    VP415-Emulator
+    Copyright (C) 2025 Simon Inns
+
+    This file is part of VP415-Emulator.
+
+    This is free software: you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Email: simon.inns@gmail.com
+
+************************************************************************/
+
+
+#include "chunkmanifest.h"
+#include "compressedimage.h"
+
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QtEndian>
+
+#include <algorithm>
+
+// Header magic and version
+static const quint32 MANIFEST_MAGIC = 0x5650434D;  // "VPCM"
+static const quint32 MANIFEST_VERSION = 1;
+
+// FNV-1a hash of a sector (used only to place chunk boundaries)
+static uint32_t sectorHash(const char *sectorData) {
+    uint32_t hash = 2166136261u;
+    for (int index = 0; index < 256; index++) {
+        hash ^= static_cast<uint8_t>(sectorData[index]);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+ChunkManifest::ChunkManifest(QObject *parent) : QObject(parent) {
+    m_store = nullptr;
+    m_sectorCount = 0;
+    m_metrics = nullptr;
+}
+
+ChunkManifest::~ChunkManifest() {
+    close();
+}
+
+bool ChunkManifest::isManifest(QString filename) {
+    QFile file(filename);
+    if (!file.open(QIODevice::ReadOnly)) return false;
+
+    QByteArray magic = file.read(4);
+    return magic.size() == 4 &&
+           qFromBigEndian<quint32>(reinterpret_cast<const uchar *>(magic.constData())) == MANIFEST_MAGIC;
+}
+
+// Split an image (flat or compressed) into chunks, add the chunks the store
+// doesn't already have and write the image's manifest
+bool ChunkManifest::import(QString imageFilename, QString manifestFilename, QString storeDirectory, int level,
+                           ImportStatistics *statistics) {
+    *statistics = ImportStatistics{0, 0, 0, 0};
+
+    CompressedImage compressedImage;
+    QFile imageFile(imageFilename);
+    uint32_t sectorCount = 0;
+    if (CompressedImage::isCompressedImage(imageFilename)) {
+        if (!compressedImage.open(imageFilename)) return false;
+        sectorCount = compressedImage.sectorCount();
+    } else {
+        if (!imageFile.open(QIODevice::ReadOnly)) {
+            qDebug() << "ChunkManifest::import() - Failed to open image: " << imageFilename;
+            return false;
+        }
+        sectorCount = static_cast<uint32_t>(imageFile.size() / 256);
+    }
+
+    ChunkStore *store = ChunkStore::shared(storeDirectory);
+    QByteArray entries;
+    uint32_t chunkCount = 0;
+
+    // Keep up to a maximum length chunk of the image read ahead and cut
+    // chunks from the front of it
+    QByteArray pending;
+    uint32_t sector = 0;
+    while (sector < sectorCount || !pending.isEmpty()) {
+        uint32_t sectors = qMin<uint32_t>(MAXIMUM_CHUNK_SECTORS - static_cast<uint32_t>(pending.size() / 256),
+                                          sectorCount - sector);
+        if (sectors > 0) {
+            QByteArray data = compressedImage.isOpen()
+                ? compressedImage.readSectors(sector, sectors)
+                : imageFile.read(static_cast<qint64>(sectors) * 256);
+            if (data.size() != static_cast<qsizetype>(sectors) * 256) {
+                qDebug() << "ChunkManifest::import() - Failed to read image at sector" << sector;
+                return false;
+            }
+            pending.append(data);
+            sector += sectors;
+        }
+
+        uint32_t pendingSectors = static_cast<uint32_t>(pending.size() / 256);
+        uint32_t chunkSectors = qMin(pendingSectors, MAXIMUM_CHUNK_SECTORS);
+        for (uint32_t length = MINIMUM_CHUNK_SECTORS; length < chunkSectors; length++) {
+            if ((sectorHash(pending.constData() + static_cast<qsizetype>(length - 1) * 256) &
+                 (AVERAGE_CHUNK_SECTORS - 1)) == 0) {
+                chunkSectors = length;
+                break;
+            }
+        }
+
+        QByteArray chunkData = pending.left(static_cast<qsizetype>(chunkSectors) * 256);
+        pending.remove(0, chunkData.size());
+
+        QByteArray chunkId = ChunkStore::chunkId(chunkData);
+        qint64 storedBytes = 0;
+        if (!store->put(chunkId, chunkData, level, &storedBytes)) return false;
+        if (storedBytes > 0) statistics->newChunks++;
+        statistics->storedBytes += storedBytes;
+
+        QByteArray entry(ENTRY_LENGTH - chunkId.size(), 0x00);
+        qToBigEndian<quint32>(chunkSectors, reinterpret_cast<uchar *>(entry.data()));
+        entries.append(entry);
+        entries.append(chunkId);
+        chunkCount++;
+    }
+
+    QString storePath = QFileInfo(manifestFilename).absoluteDir().relativeFilePath(store->directory());
+    QByteArray storePathData = storePath.toUtf8();
+
+    QByteArray header(HEADER_LENGTH, 0x00);
+    uchar *headerData = reinterpret_cast<uchar *>(header.data());
+    qToBigEndian<quint32>(MANIFEST_MAGIC, headerData);
+    qToBigEndian<quint32>(MANIFEST_VERSION, headerData + 4);
+    qToBigEndian<quint32>(sectorCount, headerData + 8);
+    qToBigEndian<quint32>(chunkCount, headerData + 12);
+    qToBigEndian<quint32>(static_cast<quint32>(storePathData.size()), headerData + 16);
+
+    QSaveFile manifestFile(manifestFilename);
+    if (!manifestFile.open(QIODevice::WriteOnly)) {
+        qDebug() << "ChunkManifest::import() - Failed to create: " << manifestFilename;
+        return false;
+    }
+    manifestFile.write(header);
+    manifestFile.write(storePathData);
+    manifestFile.write(entries);
+    if (!manifestFile.commit()) {
+        qDebug() << "ChunkManifest::import() - Failed to write: " << manifestFilename;
+        return false;
+    }
+
+    statistics->sectors = sectorCount;
+    statistics->chunks = chunkCount;
+    qDebug() << "ChunkManifest::import() - Imported" << sectorCount << "sectors as" << chunkCount << "chunks ("
+             << statistics->newChunks << "new," << statistics->storedBytes << "bytes stored)";
+    return true;
+}
+
+bool ChunkManifest::open(QString filename) {
+    close();
+
+    QFile file(filename);
+    if (!file.open(QIODevice::ReadOnly)) {
+        qDebug() << "ChunkManifest::open() - Failed to open: " << filename;
+        return false;
+    }
+
+    QByteArray header = file.read(HEADER_LENGTH);
+    const uchar *headerData = reinterpret_cast<const uchar *>(header.constData());
+    if (header.size() != HEADER_LENGTH || qFromBigEndian<quint32>(headerData) != MANIFEST_MAGIC ||
+        qFromBigEndian<quint32>(headerData + 4) != MANIFEST_VERSION) {
+        qDebug() << "ChunkManifest::open() - Not a chunk manifest: " << filename;
+        return false;
+    }
+    uint32_t sectorCount = qFromBigEndian<quint32>(headerData + 8);
+    uint32_t chunkCount = qFromBigEndian<quint32>(headerData + 12);
+    uint32_t storePathLength = qFromBigEndian<quint32>(headerData + 16);
+
+    QByteArray storePath = file.read(storePathLength);
+    QByteArray entries = file.read(static_cast<qint64>(chunkCount) * ENTRY_LENGTH);
+    if (storePath.size() != static_cast<qsizetype>(storePathLength) ||
+        entries.size() != static_cast<qsizetype>(chunkCount) * ENTRY_LENGTH) {
+        qDebug() << "ChunkManifest::open() - Manifest is truncated: " << filename;
+        return false;
+    }
+
+    uint64_t sector = 0;
+    m_chunks.reserve(chunkCount);
+    for (uint32_t chunk = 0; chunk < chunkCount; chunk++) {
+        const char *entry = entries.constData() + static_cast<qsizetype>(chunk) * ENTRY_LENGTH;
+        uint32_t sectors = qFromBigEndian<quint32>(reinterpret_cast<const uchar *>(entry));
+        m_chunks.append(Chunk{static_cast<uint32_t>(sector), sectors, QByteArray(entry + 4, ENTRY_LENGTH - 4)});
+        sector += sectors;
+    }
+    if (sector != sectorCount) {
+        qDebug() << "ChunkManifest::open() - Chunks don't add up to the image size: " << filename;
+        m_chunks.clear();
+        return false;
+    }
+
+    m_store = ChunkStore::shared(QFileInfo(filename).absoluteDir().absoluteFilePath(QString::fromUtf8(storePath)));
+    m_sectorCount = sectorCount;
+    qDebug() << "ChunkManifest::open() - Opened" << filename << "containing" << m_sectorCount << "sectors in"
+             << chunkCount << "chunks from" << m_store->directory();
+    return true;
+}
+
+void ChunkManifest::close() {
+    m_store = nullptr;
+    m_chunks.clear();
+    m_sectorCount = 0;
+}
+
+// Index of the chunk holding a sector
+int ChunkManifest::findChunk(uint32_t sector) const {
+    auto next = std::upper_bound(m_chunks.begin(), m_chunks.end(), sector,
+                                 [](uint32_t value, const Chunk &chunk) { return value < chunk.startSector; });
+    return static_cast<int>(next - m_chunks.begin()) - 1;
+}
+
+// Read sectors (the result is short if the range runs off the end of the
+// image or a chunk is missing or corrupt)
+QByteArray ChunkManifest::readSectors(uint32_t startSector, uint32_t numberOfSectors) {
+    QByteArray sectorData;
+    if (!isOpen() || startSector >= m_sectorCount) return sectorData;
+
+    uint32_t endSector = (static_cast<uint64_t>(startSector) + numberOfSectors > m_sectorCount)
+        ? m_sectorCount : startSector + numberOfSectors;
+    sectorData.reserve(static_cast<qsizetype>(endSector - startSector) * 256);
+
+    for (int index = findChunk(startSector); index < m_chunks.size() && sectorData.size() <
+         static_cast<qsizetype>(endSector - startSector) * 256; index++) {
+        const Chunk &chunk = m_chunks.at(index);
+        bool cacheHit = false;
+        QByteArray chunkData = m_store->get(chunk.chunkId, chunk.sectors, true, &cacheHit);
+        if (m_metrics) (cacheHit ? m_metrics->chunkCacheHits : m_metrics->chunkCacheMisses).add();
+        if (chunkData.isEmpty()) break;
+
+        uint32_t first = qMax(startSector, chunk.startSector);
+        uint32_t last = qMin(endSector, chunk.startSector + chunk.sectors);
+        sectorData.append(chunkData.constData() + static_cast<qsizetype>(first - chunk.startSector) * 256,
+                          static_cast<qsizetype>(last - first) * 256);
+    }
+
+    return sectorData;
+}
+
+// Verify a range of sectors by reloading (and rehashing) the chunks that
+// hold them.  On failure firstBadSector is the first sector of the range in
+// the bad chunk (or the first sector beyond the end of the image).
+bool ChunkManifest::verify(uint32_t startSector, uint32_t numberOfSectors, uint32_t *firstBadSector) {
+    *firstBadSector = startSector;
+    if (!isOpen()) return false;
+    if (numberOfSectors == 0) return true;
+
+    uint64_t endSector = static_cast<uint64_t>(startSector) + numberOfSectors;  // Exclusive
+    for (int index = findChunk(startSector); index < m_chunks.size() && m_chunks.at(index).startSector < endSector;
+         index++) {
+        const Chunk &chunk = m_chunks.at(index);
+        bool cacheHit = false;
+        if (m_store->get(chunk.chunkId, chunk.sectors, false, &cacheHit).isEmpty()) {
+            *firstBadSector = qMax(startSector, chunk.startSector);
+            return false;
+        }
+    }
+
+    if (endSector > m_sectorCount) {
+        *firstBadSector = qMax(startSector, m_sectorCount);
+        return false;
+    }
+    return true;
+}
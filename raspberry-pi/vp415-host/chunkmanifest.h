@@ -0,0 +1,103 @@
+/************************************************************************
+
+    chunkmanifest.h
+
+    VP415-host - A host application for the VP415 Emulator
+    VP415-Emulator
+    Copyright (C) 2025 Simon Inns
+
+    This file is part of VP415-Emulator.
+
+    This is free software: you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Email: simon.inns@gmail.com
+
+************************************************************************/
+
+
+#ifndef CHUNKMANIFEST_H
+#define CHUNKMANIFEST_H
+
+#include <QObject>
+#include <QString>
+#include <QByteArray>
+#include <QVector>
+
+#include "metrics.h"
+#include "chunkstore.h"
+
+// Per-disc manifest of EFM data held in a chunk store.  The image is listed
+// as a sequence of chunks (each a run of sectors and the id of its data in
+// the store).
+//
+// Chunk boundaries are content-defined at sector granularity: a chunk ends
+// after a sector whose hash has its low bits clear (within minimum and
+// maximum lengths), so regions shared by two discs chunk the same way even
+// if they start at different sectors.
+//
+// The file is a 32 byte header ("VPCM", version, image size in sectors,
+// chunk count and the length of the store path), the path of the chunk store
+// relative to the manifest, then 36 bytes per chunk (sectors and SHA-256).
+class ChunkManifest : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit ChunkManifest(QObject *parent = nullptr);
+    ~ChunkManifest();
+
+    // Chunk lengths in sectors (the average is a power of two)
+    static const uint32_t MINIMUM_CHUNK_SECTORS = 16;
+    static const uint32_t AVERAGE_CHUNK_SECTORS = 64;
+    static const uint32_t MAXIMUM_CHUNK_SECTORS = 256;
+
+    struct ImportStatistics {
+        uint32_t sectors;
+        uint32_t chunks;
+        uint32_t newChunks;
+        qint64 storedBytes;
+    };
+
+    static bool isManifest(QString filename);
+    static bool import(QString imageFilename, QString manifestFilename, QString storeDirectory, int level,
+                       ImportStatistics *statistics);
+
+    bool open(QString filename);
+    void close();
+    bool isOpen() const { return m_store != nullptr; }
+
+    uint32_t sectorCount() const { return m_sectorCount; }
+    QByteArray readSectors(uint32_t startSector, uint32_t numberOfSectors);
+    bool verify(uint32_t startSector, uint32_t numberOfSectors, uint32_t *firstBadSector);
+
+    void setMetrics(Metrics *metrics) { m_metrics = metrics; }
+
+private:
+    struct Chunk {
+        uint32_t startSector;
+        uint32_t sectors;
+        QByteArray chunkId;
+    };
+
+    ChunkStore *m_store;
+    uint32_t m_sectorCount;
+    QVector<Chunk> m_chunks;
+    Metrics *m_metrics;
+
+    static const int HEADER_LENGTH = 32;
+    static const int ENTRY_LENGTH = 36;
+    int findChunk(uint32_t sector) const;
+};
+
+#endif // CHUNKMANIFEST_H
@@ -0,0 +1,127 @@
+/************************************************************************
+
+    chunkstore.cpp
+
+    VP415-host - A host application for the VP415 Emulator
+    VP415-Emulator
+    Copyright (C) 2025 Simon Inns
+
+    This file is part of VP415-Emulator.
+
+    This is free software: you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Email: simon.inns@gmail.com
+
+************************************************************************/
+
+
+#include "chunkstore.h"
+
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QCryptographicHash>
+#include <QMutexLocker>
+
+ChunkStore::ChunkStore(QString directory, QObject *parent) : QObject(parent), m_chunkCache(CACHE_KBYTES) {
+    m_directory = directory;
+}
+
+// The store for a directory (created on first use and kept until exit)
+ChunkStore *ChunkStore::shared(QString directory) {
+    static QMutex storesMutex;
+    static QHash<QString, ChunkStore *> stores;
+
+    QString path = QFileInfo(directory).absoluteFilePath();
+    QMutexLocker locker(&storesMutex);
+    ChunkStore *store = stores.value(path, nullptr);
+    if (store == nullptr) {
+        store = new ChunkStore(path);
+        stores.insert(path, store);
+    }
+    return store;
+}
+
+QByteArray ChunkStore::chunkId(const QByteArray &chunkData) {
+    return QCryptographicHash::hash(chunkData, QCryptographicHash::Sha256);
+}
+
+// Chunks are spread over 256 subdirectories by the first byte of their id
+QString ChunkStore::chunkFilename(const QByteArray &chunkId) const {
+    QString hex = QString::fromLatin1(chunkId.toHex());
+    return m_directory + "/" + hex.left(2) + "/" + hex;
+}
+
+bool ChunkStore::contains(const QByteArray &chunkId) const {
+    return QFile::exists(chunkFilename(chunkId));
+}
+
+// Add a chunk (unless the store already has it).  storedBytes is set to the
+// bytes written, so 0 for a chunk that was already stored.
+bool ChunkStore::put(const QByteArray &chunkId, const QByteArray &chunkData, int level, qint64 *storedBytes) {
+    *storedBytes = 0;
+    if (contains(chunkId)) return true;
+
+    QString filename = chunkFilename(chunkId);
+    if (!QDir().mkpath(QFileInfo(filename).path())) {
+        qDebug() << "ChunkStore::put() - Failed to create directory for: " << filename;
+        return false;
+    }
+
+    QSaveFile chunkFile(filename);
+    QByteArray compressedChunk = qCompress(chunkData, level);
+    if (!chunkFile.open(QIODevice::WriteOnly) || chunkFile.write(compressedChunk) != compressedChunk.size() ||
+        !chunkFile.commit()) {
+        qDebug() << "ChunkStore::put() - Failed to write: " << filename;
+        return false;
+    }
+
+    *storedBytes = compressedChunk.size();
+    return true;
+}
+
+// Get a chunk's data, from the cache if useCache is set.  Returns an empty
+// array if the chunk is missing, the wrong size or doesn't match its id.
+QByteArray ChunkStore::get(const QByteArray &chunkId, uint32_t sectors, bool useCache, bool *cacheHit) {
+    *cacheHit = false;
+    if (useCache) {
+        QMutexLocker locker(&m_cacheMutex);
+        QByteArray *chunkData = m_chunkCache.object(chunkId);
+        if (chunkData != nullptr) {
+            *cacheHit = true;
+            return *chunkData;
+        }
+    }
+
+    QFile chunkFile(chunkFilename(chunkId));
+    if (!chunkFile.open(QIODevice::ReadOnly)) {
+        qDebug() << "ChunkStore::get() - Chunk is missing: " << chunkFile.fileName();
+        return QByteArray();
+    }
+
+    QByteArray chunkData = qUncompress(chunkFile.readAll());
+    if (chunkData.size() != static_cast<qsizetype>(sectors) * 256 || ChunkStore::chunkId(chunkData) != chunkId) {
+        qDebug() << "ChunkStore::get() - Chunk is corrupt: " << chunkFile.fileName();
+        return QByteArray();
+    }
+
+    // Verification reads (useCache clear) don't displace the chunks being served
+    if (useCache) {
+        QMutexLocker locker(&m_cacheMutex);
+        m_chunkCache.insert(chunkId, new QByteArray(chunkData), static_cast<qsizetype>(sectors) / 4 + 1);
+    }
+    return chunkData;
+}
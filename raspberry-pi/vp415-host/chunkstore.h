@@ -0,0 +1,74 @@
+/************************************************************************
+
+    chunkstore.h
+
+    VP415-host - A host application for the VP415 Emulator
+    VP415-Emulator
+    Copyright (C) 2025 Simon Inns
+
+    This file is part of VP415-Emulator.
+
+    This is free software: you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Email: simon.inns@gmail.com
+
+************************************************************************/
+
+
+#ifndef CHUNKSTORE_H
+#define CHUNKSTORE_H
+
+#include <QObject>
+#include <QString>
+#include <QByteArray>
+#include <QCache>
+#include <QHash>
+#include <QMutex>
+
+// Content-addressed store of EFM data chunks shared by the discs in a
+// library.  Each chunk is a run of sectors kept (zlib compressed) in a file
+// named by the SHA-256 of its data, so identical regions of different discs
+// are only stored once.  Chunks are checked against their hash whenever they
+// are loaded.
+//
+// There is one store (and so one decompressed chunk cache) per directory for
+// the life of the process, so changing disc keeps the chunks that are
+// already cached.
+class ChunkStore : public QObject
+{
+    Q_OBJECT
+
+public:
+    // Decompressed chunk cache size
+    static const int CACHE_KBYTES = 64 * 1024;
+
+    static ChunkStore *shared(QString directory);
+    static QByteArray chunkId(const QByteArray &chunkData);
+
+    QString directory() const { return m_directory; }
+    bool contains(const QByteArray &chunkId) const;
+    bool put(const QByteArray &chunkId, const QByteArray &chunkData, int level, qint64 *storedBytes);
+    QByteArray get(const QByteArray &chunkId, uint32_t sectors, bool useCache, bool *cacheHit);
+
+private:
+    explicit ChunkStore(QString directory, QObject *parent = nullptr);
+
+    QString m_directory;
+    QMutex m_cacheMutex;
+    QCache<QByteArray, QByteArray> m_chunkCache;
+
+    QString chunkFilename(const QByteArray &chunkId) const;
+};
+
+#endif // CHUNKSTORE_H
@@ -0,0 +1,268 @@
+/************************************************************************
+
+    circ.cpp
+
+    VP415-host - A host application for the VP415 Emulator
+    VP415-Emulator
+    Copyright (C) 2025 Simon Inns
+
+    This file is part of VP415-Emulator.
+
+    This is free software: you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Email: simon.inns@gmail.com
+
+************************************************************************/
+
+
+#include "circ.h"
+#include "syndromebatch.h"
+
+#include <cstring>
+
+namespace {
+
+// Positions of the parity symbols (C2's Q parity is in the middle of the
+// codeword)
+const int c1Parity[ReedSolomon::PARITY_SYMBOLS] = {28, 29, 30, 31};
+const int c2Parity[ReedSolomon::PARITY_SYMBOLS] = {12, 13, 14, 15};
+
+// Symbols stored inverted on the disc
+bool invertedSymbol(int index) {
+    return (index >= 12 && index < 16) || index >= 28;
+}
+
+// The 12 sixteen bit words of a frame are split into two groups (the second
+// delayed by two frames) before C2 encoding
+const int groupAWords[6] = {0, 1, 4, 5, 8, 9};
+const int groupBWords[6] = {2, 3, 6, 7, 10, 11};
+
+// Decode a codeword, using the erasure flags if there are few enough of them
+int decodeCodeword(const ReedSolomon &code, uint8_t *codeword, uint32_t erasureMask,
+                   const uint8_t *knownSyndromes = nullptr) {
+    int erasures[ReedSolomon::PARITY_SYMBOLS];
+    int erasureCount = 0;
+    for (int index = 0; index < code.length(); index++) {
+        if (!(erasureMask & (1u << index))) continue;
+        if (erasureCount == ReedSolomon::PARITY_SYMBOLS) return -1;
+        erasures[erasureCount++] = index;
+    }
+    return code.decode(codeword, erasures, erasureCount, knownSyndromes);
+}
+
+}
+
+CircDecoder::CircDecoder()
+    : m_c1(32), m_c2(28) {
+    reset();
+}
+
+// Start with every delayed symbol flagged as an erasure
+void CircDecoder::reset() {
+    memset(m_previousSymbols, 0, sizeof(m_previousSymbols));
+    m_previousErasures = 0xFFFFFFFF;
+    memset(m_c1Symbols, 0, sizeof(m_c1Symbols));
+    for (int frame = 0; frame < C1_HISTORY; frame++) m_c1Erasures[frame] = 0x0FFFFFFF;
+    memset(m_c2Symbols, 0, sizeof(m_c2Symbols));
+    m_c2Erasures[0] = m_c2Erasures[1] = 0xFFF;
+    m_frame = 0;
+}
+
+void CircDecoder::push(const EfmFrame &input, CircFrame *output, Statistics *statistics) {
+    // Undo the one frame delay of the odd symbols and the parity inversion
+    uint8_t c1Word[32];
+    uint32_t c1Erasures = 0;
+    for (int index = 0; index < 32; index++) {
+        bool odd = index & 1;
+        c1Word[index] = odd ? m_previousSymbols[index] : input.symbols[index];
+        if (invertedSymbol(index)) c1Word[index] ^= 0xFF;
+        if ((odd ? m_previousErasures : input.erasures) & (1u << index)) c1Erasures |= 1u << index;
+    }
+    memcpy(m_previousSymbols, input.symbols, sizeof(m_previousSymbols));
+    m_previousErasures = input.erasures;
+
+    storeC1(m_frame, c1Word, decodeCodeword(m_c1, c1Word, c1Erasures), statistics);
+
+    // Undo the C2 interleave (symbol i was delayed by 4 * i frames)
+    uint8_t c2Word[28];
+    uint32_t c2Erasures = 0;
+    for (int index = 0; index < 28; index++) {
+        int delayedSlot = static_cast<int>((m_frame + C1_HISTORY - (27 - index) * 4) % C1_HISTORY);
+        c2Word[index] = m_c1Symbols[delayedSlot][index];
+        if (m_c1Erasures[delayedSlot] & (1u << index)) c2Erasures |= 1u << index;
+    }
+
+    outputFrame(m_frame, c2Word, decodeCodeword(m_c2, c2Word, c2Erasures), output, statistics);
+    m_frame++;
+}
+
+// The same as calling push() for each frame
+void CircDecoder::pushFrames(const EfmFrame *input, int count, CircFrame *output, Statistics *statistics) {
+    // Symbol-major codewords and syndromes for a batch
+    uint8_t symbols[32 * BATCH_FRAMES];
+    uint8_t syndromes[ReedSolomon::PARITY_SYMBOLS * BATCH_FRAMES];
+    uint32_t erasures[BATCH_FRAMES];
+
+    for (int first = 0; first < count; first += BATCH_FRAMES) {
+        int frames = count - first < BATCH_FRAMES ? count - first : BATCH_FRAMES;
+
+        // C1 codewords
+        for (int frame = 0; frame < frames; frame++) {
+            const EfmFrame &current = input[first + frame];
+            const uint8_t *previousSymbols = frame ? input[first + frame - 1].symbols : m_previousSymbols;
+            uint32_t previousErasures = frame ? input[first + frame - 1].erasures : m_previousErasures;
+
+            erasures[frame] = 0;
+            for (int index = 0; index < 32; index++) {
+                bool odd = index & 1;
+                uint8_t symbol = odd ? previousSymbols[index] : current.symbols[index];
+                if (invertedSymbol(index)) symbol ^= 0xFF;
+                symbols[index * frames + frame] = symbol;
+                if ((odd ? previousErasures : current.erasures) & (1u << index)) erasures[frame] |= 1u << index;
+            }
+        }
+        memcpy(m_previousSymbols, input[first + frames - 1].symbols, sizeof(m_previousSymbols));
+        m_previousErasures = input[first + frames - 1].erasures;
+
+        SyndromeBatch::syndromes(symbols, 32, frames, syndromes);
+        for (int frame = 0; frame < frames; frame++) {
+            uint8_t c1Word[32];
+            for (int index = 0; index < 32; index++) c1Word[index] = symbols[index * frames + frame];
+
+            uint8_t syndrome[ReedSolomon::PARITY_SYMBOLS];
+            bool valid = true;
+            for (int root = 0; root < ReedSolomon::PARITY_SYMBOLS; root++) {
+                syndrome[root] = syndromes[root * frames + frame];
+                if (syndrome[root] != 0) valid = false;
+            }
+            int corrected = (valid && __builtin_popcount(erasures[frame]) <= ReedSolomon::PARITY_SYMBOLS)
+                    ? 0 : decodeCodeword(m_c1, c1Word, erasures[frame], syndrome);
+            storeC1(m_frame + static_cast<uint32_t>(frame), c1Word, corrected, statistics);
+        }
+
+        // C2 codewords (the C1 history now includes the whole batch)
+        for (int frame = 0; frame < frames; frame++) {
+            uint32_t frameNumber = m_frame + static_cast<uint32_t>(frame);
+            erasures[frame] = 0;
+            for (int index = 0; index < 28; index++) {
+                int delayedSlot = static_cast<int>((frameNumber + C1_HISTORY - (27 - index) * 4) % C1_HISTORY);
+                symbols[index * frames + frame] = m_c1Symbols[delayedSlot][index];
+                if (m_c1Erasures[delayedSlot] & (1u << index)) erasures[frame] |= 1u << index;
+            }
+        }
+
+        SyndromeBatch::syndromes(symbols, 28, frames, syndromes);
+        for (int frame = 0; frame < frames; frame++) {
+            uint8_t c2Word[28];
+            for (int index = 0; index < 28; index++) c2Word[index] = symbols[index * frames + frame];
+
+            uint8_t syndrome[ReedSolomon::PARITY_SYMBOLS];
+            bool valid = true;
+            for (int root = 0; root < ReedSolomon::PARITY_SYMBOLS; root++) {
+                syndrome[root] = syndromes[root * frames + frame];
+                if (syndrome[root] != 0) valid = false;
+            }
+            int corrected = (valid && __builtin_popcount(erasures[frame]) <= ReedSolomon::PARITY_SYMBOLS)
+                    ? 0 : decodeCodeword(m_c2, c2Word, erasures[frame], syndrome);
+            outputFrame(m_frame + static_cast<uint32_t>(frame), c2Word, corrected, &output[first + frame], statistics);
+        }
+
+        m_frame += static_cast<uint32_t>(frames);
+    }
+}
+
+// Keep a C1 codeword for C2 (a failed codeword flags all of its symbols)
+void CircDecoder::storeC1(uint32_t frame, const uint8_t *c1Word, int corrected, Statistics *statistics) {
+    int slot = static_cast<int>(frame % C1_HISTORY);
+    memcpy(m_c1Symbols[slot], c1Word, 28);
+    if (corrected < 0) {
+        m_c1Erasures[slot] = 0x0FFFFFFF;
+        statistics->c1Failed++;
+    } else {
+        m_c1Erasures[slot] = 0;
+        statistics->c1Corrected += static_cast<uint64_t>(corrected);
+    }
+}
+
+// Output a frame from a C2 codeword: group A is from this frame, group B from
+// two frames ago
+void CircDecoder::outputFrame(uint32_t frame, const uint8_t *c2Word, int corrected, CircFrame *output,
+                              Statistics *statistics) {
+    uint32_t c2Erasures = 0;
+    if (corrected < 0) {
+        c2Erasures = 0x0FFFFFFF;
+        statistics->c2Failed++;
+    } else {
+        statistics->c2Corrected += static_cast<uint64_t>(corrected);
+    }
+
+    const uint8_t *groupB = m_c2Symbols[frame & 1];
+    uint32_t groupBErasures = m_c2Erasures[frame & 1];
+    output->erasures = 0;
+    for (int word = 0; word < 6; word++) {
+        for (int byte = 0; byte < 2; byte++) {
+            int a = groupAWords[word] * 2 + byte;
+            int b = groupBWords[word] * 2 + byte;
+            output->data[a] = c2Word[word * 2 + byte];
+            output->data[b] = groupB[word * 2 + byte];
+            if (c2Erasures & (1u << (word * 2 + byte))) output->erasures |= 1u << a;
+            if (groupBErasures & (1u << (word * 2 + byte))) output->erasures |= 1u << b;
+        }
+    }
+    memcpy(m_c2Symbols[frame & 1], c2Word + 16, 12);
+    m_c2Erasures[frame & 1] = (c2Erasures >> 16) & 0xFFF;
+}
+
+CircEncoder::CircEncoder()
+    : m_c1(32), m_c2(28) {
+    reset();
+}
+
+void CircEncoder::reset() {
+    memset(m_groupA, 0, sizeof(m_groupA));
+    memset(m_c2Symbols, 0, sizeof(m_c2Symbols));
+    memset(m_previousSymbols, 0, sizeof(m_previousSymbols));
+    m_frame = 0;
+}
+
+void CircEncoder::push(const uint8_t *data, EfmFrame *output) {
+    // Group A is delayed by two frames
+    uint8_t c2Word[28];
+    memcpy(c2Word, m_groupA[m_frame & 1], 12);
+    for (int word = 0; word < 6; word++) {
+        for (int byte = 0; byte < 2; byte++) {
+            m_groupA[m_frame & 1][word * 2 + byte] = data[groupAWords[word] * 2 + byte];
+            c2Word[16 + word * 2 + byte] = data[groupBWords[word] * 2 + byte];
+        }
+    }
+    m_c2.encode(c2Word, c2Parity);
+
+    // C2 interleave: symbol i is delayed by 4 * i frames
+    int slot = static_cast<int>(m_frame % C2_HISTORY);
+    memcpy(m_c2Symbols[slot], c2Word, 28);
+    uint8_t c1Word[32];
+    for (int index = 0; index < 28; index++)
+        c1Word[index] = m_c2Symbols[(m_frame + C2_HISTORY - index * 4) % C2_HISTORY][index];
+    m_c1.encode(c1Word, c1Parity);
+
+    // Invert the parity and delay the even symbols by one frame
+    for (int index = 0; index < 32; index++) {
+        if (invertedSymbol(index)) c1Word[index] ^= 0xFF;
+        output->symbols[index] = (index & 1) ? c1Word[index] : m_previousSymbols[index];
+    }
+    memcpy(m_previousSymbols, c1Word, sizeof(m_previousSymbols));
+    output->erasures = 0;
+
+    m_frame++;
+}
@@ -0,0 +1,126 @@
+/************************************************************************
+
+    circ.h
+
+    VP415-host - A host application for the VP415 Emulator
+    VP415-Emulator
+    Copyright (C) 2025 Simon Inns
+
+    This file is part of VP415-Emulator.
+
+    This is free software: you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Email: simon.inns@gmail.com
+
+************************************************************************/
+
+
+#ifndef CIRC_H
+#define CIRC_H
+
+#include <cstdint>
+
+#include "reedsolomon.h"
+
+// An EFM frame's 32 data symbols (after demodulation) with a bit set in
+// erasures for each symbol that didn't demodulate
+struct EfmFrame {
+    uint8_t symbols[32];
+    uint32_t erasures;
+};
+
+// 24 bytes of user data from a frame with a bit set in erasures for each
+// byte that couldn't be corrected
+struct CircFrame {
+    uint8_t data[24];
+    uint32_t erasures;
+};
+
+// Cross-interleaved Reed-Solomon decoder (ECMA-130 section 16).  Each frame
+// pushed returns the data of the frame LATENCY frames earlier; the decoder's
+// state depends only on the last WARM_UP frames, so a stream can be decoded
+// in independent pieces if each starts WARM_UP frames early.
+//
+// push() decodes one frame at a time and is the reference.  pushFrames()
+// gives bit for bit the same results, but works on BATCH_FRAMES frames at a
+// time so the syndromes of their C1 and then C2 codewords can be computed
+// together with vector instructions (only codewords with errors then go
+// through the scalar decoder).
+class CircDecoder
+{
+public:
+    static const int LATENCY = 111;
+    static const int WARM_UP = 112;
+    static const int BATCH_FRAMES = 32;
+
+    struct Statistics {
+        uint64_t c1Corrected;
+        uint64_t c1Failed;
+        uint64_t c2Corrected;
+        uint64_t c2Failed;
+    };
+
+    CircDecoder();
+
+    void reset();
+    void push(const EfmFrame &input, CircFrame *output, Statistics *statistics);
+    void pushFrames(const EfmFrame *input, int count, CircFrame *output, Statistics *statistics);
+
+private:
+    // At least the C2 interleave (108 frames) plus a batch
+    static const int C1_HISTORY = 256;
+
+    ReedSolomon m_c1;
+    ReedSolomon m_c2;
+
+    // Odd symbols of the previous frame
+    uint8_t m_previousSymbols[32];
+    uint32_t m_previousErasures;
+
+    // C1 output for the last C1_HISTORY frames
+    uint8_t m_c1Symbols[C1_HISTORY][28];
+    uint32_t m_c1Erasures[C1_HISTORY];
+    uint32_t m_frame;
+
+    // Second half of the C2 output for the last two frames
+    uint8_t m_c2Symbols[2][12];
+    uint32_t m_c2Erasures[2];
+
+    void storeC1(uint32_t frame, const uint8_t *c1Word, int corrected, Statistics *statistics);
+    void outputFrame(uint32_t frame, const uint8_t *c2Word, int corrected, CircFrame *output,
+                     Statistics *statistics);
+};
+
+// The matching encoder (used to generate test data)
+class CircEncoder
+{
+public:
+    CircEncoder();
+
+    void reset();
+    void push(const uint8_t *data, EfmFrame *output);
+
+private:
+    static const int C2_HISTORY = 128;
+
+    ReedSolomon m_c1;
+    ReedSolomon m_c2;
+
+    uint8_t m_groupA[2][12];
+    uint8_t m_c2Symbols[C2_HISTORY][28];
+    uint8_t m_previousSymbols[32];
+    uint32_t m_frame;
+};
+
+#endif // CIRC_H
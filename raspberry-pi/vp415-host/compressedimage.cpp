@@ -0,0 +1,269 @@
+/************************************************************************
+
+    compressedimage.cpp
+
+    VP415-host - A host application for the VP415 Emulator
+    VP415-Emulator
+    Copyright (C) 2025 Simon Inns
+
+    This file is part of VP415-Emulator.
+
+    This is free software: you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Email: simon.inns@gmail.com
+
+************************************************************************/
+
+#include "compressedimage.h"
+
+#include <QDebug>
+#include <QSaveFile>
+#include <QtEndian>
+
+// Header magic and version
+static const quint32 COMPRESSED_MAGIC = 0x5650455A;  // "VPEZ"
+static const quint32 COMPRESSED_VERSION = 1;
+
+CompressedImage::CompressedImage(QObject *parent) : QObject(parent), m_chunkCache(CACHE_CHUNKS) {
+    m_chunkSectors = 0;
+    m_sectorCount = 0;
+    m_metrics = nullptr;
+}
+
+CompressedImage::~CompressedImage() {
+    close();
+}
+
+// True if the file starts with the compressed image magic (otherwise it is
+// treated as a flat image)
+bool CompressedImage::isCompressedImage(QString filename) {
+    QFile file(filename);
+    if (!file.open(QIODevice::ReadOnly)) return false;
+
+    QByteArray magic = file.read(4);
+    return magic.size() == 4 &&
+           qFromBigEndian<quint32>(reinterpret_cast<const uchar *>(magic.constData())) == COMPRESSED_MAGIC;
+}
+
+// Convert a flat image into a compressed image (level is the zlib level, -1
+// for the default).  A trailing part sector in the flat image is dropped.
+bool CompressedImage::compress(QString imageFilename, QString compressedFilename, uint32_t chunkSectors,
+                               int level) {
+    QFile imageFile(imageFilename);
+    if (chunkSectors == 0 || !imageFile.open(QIODevice::ReadOnly)) {
+        qDebug() << "CompressedImage::compress() - Failed to open image: " << imageFilename;
+        return false;
+    }
+
+    uint32_t sectorCount = static_cast<uint32_t>(imageFile.size() / 256);
+    uint32_t chunkCount = (sectorCount + chunkSectors - 1) / chunkSectors;
+
+    QSaveFile compressedFile(compressedFilename);
+    if (!compressedFile.open(QIODevice::WriteOnly)) {
+        qDebug() << "CompressedImage::compress() - Failed to create: " << compressedFilename;
+        return false;
+    }
+
+    QByteArray header(HEADER_LENGTH, 0x00);
+    uchar *headerData = reinterpret_cast<uchar *>(header.data());
+    qToBigEndian<quint32>(COMPRESSED_MAGIC, headerData);
+    qToBigEndian<quint32>(COMPRESSED_VERSION, headerData + 4);
+    qToBigEndian<quint32>(chunkSectors, headerData + 8);
+    qToBigEndian<quint32>(sectorCount, headerData + 12);
+    compressedFile.write(header);
+
+    QByteArray offsetTable((static_cast<qsizetype>(chunkCount) + 1) * 8, 0x00);
+    uchar *tableData = reinterpret_cast<uchar *>(offsetTable.data());
+    quint64 offset = HEADER_LENGTH;
+
+    for (uint32_t chunkNumber = 0; chunkNumber < chunkCount; chunkNumber++) {
+        uint32_t sectors = qMin(chunkSectors, sectorCount - chunkNumber * chunkSectors);
+        QByteArray chunkData = imageFile.read(static_cast<qint64>(sectors) * 256);
+        if (chunkData.size() != static_cast<qsizetype>(sectors) * 256) {
+            qDebug() << "CompressedImage::compress() - Failed to read image at sector" << chunkNumber * chunkSectors;
+            compressedFile.cancelWriting();
+            return false;
+        }
+
+        QByteArray compressedChunk = qCompress(chunkData, level);
+        qToBigEndian<quint64>(offset, tableData + static_cast<qsizetype>(chunkNumber) * 8);
+        compressedFile.write(compressedChunk);
+        offset += static_cast<quint64>(compressedChunk.size());
+    }
+    qToBigEndian<quint64>(offset, tableData + static_cast<qsizetype>(chunkCount) * 8);
+    compressedFile.write(offsetTable);
+
+    QByteArray trailer(8, 0x00);
+    qToBigEndian<quint64>(offset, reinterpret_cast<uchar *>(trailer.data()));
+    compressedFile.write(trailer);
+
+    if (!compressedFile.commit()) {
+        qDebug() << "CompressedImage::compress() - Failed to write: " << compressedFilename;
+        return false;
+    }
+
+    qDebug() << "CompressedImage::compress() - Compressed" << sectorCount << "sectors into" << chunkCount
+             << "chunks (" << imageFile.size() << "->" << offset + offsetTable.size() + 8 << "bytes)";
+    return true;
+}
+
+bool CompressedImage::open(QString filename) {
+    close();
+
+    m_file.setFileName(filename);
+    if (!m_file.open(QIODevice::ReadOnly)) {
+        qDebug() << "CompressedImage::open() - Failed to open: " << filename;
+        return false;
+    }
+
+    QByteArray header = m_file.read(HEADER_LENGTH);
+    const uchar *headerData = reinterpret_cast<const uchar *>(header.constData());
+    if (header.size() != HEADER_LENGTH || qFromBigEndian<quint32>(headerData) != COMPRESSED_MAGIC ||
+        qFromBigEndian<quint32>(headerData + 4) != COMPRESSED_VERSION || qFromBigEndian<quint32>(headerData + 8) == 0) {
+        qDebug() << "CompressedImage::open() - Not a compressed image: " << filename;
+        close();
+        return false;
+    }
+    m_chunkSectors = qFromBigEndian<quint32>(headerData + 8);
+    m_sectorCount = qFromBigEndian<quint32>(headerData + 12);
+
+    // Find and load the offset table
+    uint32_t chunkCount = (m_sectorCount + m_chunkSectors - 1) / m_chunkSectors;
+    qint64 tableLength = (static_cast<qint64>(chunkCount) + 1) * 8;
+    QByteArray trailer;
+    if (m_file.seek(m_file.size() - 8)) trailer = m_file.read(8);
+    quint64 tableOffset = (trailer.size() == 8)
+        ? qFromBigEndian<quint64>(reinterpret_cast<const uchar *>(trailer.constData())) : 0;
+
+    if (tableOffset < HEADER_LENGTH || static_cast<qint64>(tableOffset) + tableLength + 8 != m_file.size() ||
+        !m_file.seek(static_cast<qint64>(tableOffset))) {
+        qDebug() << "CompressedImage::open() - Offset table is missing or truncated: " << filename;
+        close();
+        return false;
+    }
+
+    QByteArray table = m_file.read(tableLength);
+    const uchar *tableData = reinterpret_cast<const uchar *>(table.constData());
+    m_chunkOffsets.resize(chunkCount + 1);
+    for (uint32_t entry = 0; entry <= chunkCount; entry++) {
+        m_chunkOffsets[entry] = qFromBigEndian<quint64>(tableData + static_cast<qsizetype>(entry) * 8);
+        if (entry > 0 && m_chunkOffsets[entry] < m_chunkOffsets[entry - 1]) {
+            qDebug() << "CompressedImage::open() - Offset table is corrupt: " << filename;
+            close();
+            return false;
+        }
+    }
+
+    qDebug() << "CompressedImage::open() - Opened" << filename << "containing" << m_sectorCount
+             << "sectors in" << chunkCount << "chunks of" << m_chunkSectors << "sectors";
+    return true;
+}
+
+void CompressedImage::close() {
+    if (m_file.isOpen()) m_file.close();
+    m_chunkOffsets.clear();
+    m_chunkCache.clear();
+    m_chunkSectors = 0;
+    m_sectorCount = 0;
+}
+
+// Sectors in a chunk (the last chunk may be short)
+uint32_t CompressedImage::chunkLength(uint32_t chunkNumber) const {
+    return qMin(m_chunkSectors, m_sectorCount - chunkNumber * m_chunkSectors);
+}
+
+// Get a decompressed chunk, from the cache if possible.  Returns nullptr if
+// the chunk can't be read or fails to decompress.  The pointer is only valid
+// until the next call.
+const QByteArray *CompressedImage::chunk(uint32_t chunkNumber) {
+    if (chunkNumber + 1 >= static_cast<uint32_t>(m_chunkOffsets.size())) return nullptr;
+
+    QByteArray *chunkData = m_chunkCache.object(chunkNumber);
+    if (chunkData != nullptr) return chunkData;
+
+    quint64 offset = m_chunkOffsets[chunkNumber];
+    qint64 length = static_cast<qint64>(m_chunkOffsets[chunkNumber + 1] - offset);
+    if (!m_file.seek(static_cast<qint64>(offset))) return nullptr;
+
+    QByteArray compressedChunk = m_file.read(length);
+    if (compressedChunk.size() != length) return nullptr;
+
+    // zlib's checksum catches a corrupt chunk
+    chunkData = new QByteArray(qUncompress(compressedChunk));
+    if (chunkData->size() != static_cast<qsizetype>(chunkLength(chunkNumber)) * 256) {
+        qDebug() << "CompressedImage::chunk() - Chunk" << chunkNumber << "is corrupt";
+        delete chunkData;
+        return nullptr;
+    }
+
+    if (m_metrics) m_metrics->efmChunksDecompressed.add();
+    m_chunkCache.insert(chunkNumber, chunkData);
+    return chunkData;
+}
+
+// Read sectors (the result is short if the range runs off the end of the
+// image or a chunk is corrupt)
+QByteArray CompressedImage::readSectors(uint32_t startSector, uint32_t numberOfSectors) {
+    QByteArray sectorData;
+    if (!isOpen() || startSector >= m_sectorCount) return sectorData;
+
+    uint32_t endSector = (static_cast<uint64_t>(startSector) + numberOfSectors > m_sectorCount)
+        ? m_sectorCount : startSector + numberOfSectors;
+    sectorData.reserve(static_cast<qsizetype>(endSector - startSector) * 256);
+
+    uint32_t sector = startSector;
+    while (sector < endSector) {
+        uint32_t chunkNumber = sector / m_chunkSectors;
+        const QByteArray *chunkData = chunk(chunkNumber);
+        if (chunkData == nullptr) break;
+
+        uint32_t chunkStart = chunkNumber * m_chunkSectors;
+        uint32_t sectors = qMin(endSector, chunkStart + chunkLength(chunkNumber)) - sector;
+        sectorData.append(chunkData->constData() + static_cast<qsizetype>(sector - chunkStart) * 256,
+                          static_cast<qsizetype>(sectors) * 256);
+        sector += sectors;
+    }
+
+    return sectorData;
+}
+
+// Verify a range of sectors by decompressing the chunks that hold them.  On
+// failure firstBadSector is the first sector of the range in the bad chunk
+// (or the first sector beyond the end of the image).
+bool CompressedImage::verify(uint32_t startSector, uint32_t numberOfSectors, uint32_t *firstBadSector) {
+    *firstBadSector = startSector;
+    if (!isOpen()) return false;
+    if (numberOfSectors == 0) return true;
+
+    uint64_t endSector = static_cast<uint64_t>(startSector) + numberOfSectors;  // Exclusive
+    uint32_t lastSector = static_cast<uint32_t>(qMin<uint64_t>(endSector, m_sectorCount));
+
+    for (uint32_t sector = startSector; sector < lastSector;) {
+        uint32_t chunkNumber = sector / m_chunkSectors;
+
+        // Verification must read the file, not the cache
+        m_chunkCache.remove(chunkNumber);
+        if (chunk(chunkNumber) == nullptr) {
+            *firstBadSector = sector;
+            return false;
+        }
+        sector = (chunkNumber + 1) * m_chunkSectors;
+    }
+
+    if (endSector > m_sectorCount) {
+        *firstBadSector = (startSector > m_sectorCount) ? startSector : m_sectorCount;
+        return false;
+    }
+    return true;
+}
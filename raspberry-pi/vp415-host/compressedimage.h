@@ -0,0 +1,90 @@
+/************************************************************************
+
+    compressedimage.h
+
+    VP415-host - A host application for the VP415 Emulator
+    VP415-Emulator
+    Copyright (C) 2025 Simon Inns
+
+    This file is part of VP415-Emulator.
+
+    This is free software: you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Email: simon.inns@gmail.com
+
+************************************************************************/
+
+#ifndef COMPRESSEDIMAGE_H
+#define COMPRESSEDIMAGE_H
+
+#include <QObject>
+#include <QString>
+#include <QByteArray>
+#include <QVector>
+#include <QFile>
+#include <QCache>
+
+#include "metrics.h"
+
+// Seekable compressed EFM data (.dat) image.  The sectors are split into
+// fixed size chunks which are compressed independently (zlib), so any sector
+// can be read by decompressing a single chunk.  Recently used chunks are kept
+// decompressed in a small cache.
+//
+// The file is a 32 byte header ("VPEZ", version, sectors per chunk and the
+// image size in sectors), the compressed chunks, a table of chunk offsets
+// (one per chunk plus the end of the last chunk) and finally the offset of
+// that table (8 bytes).  The table is at the end so that an image can be
+// compressed in a single pass.
+class CompressedImage : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit CompressedImage(QObject *parent = nullptr);
+    ~CompressedImage();
+
+    // Sectors per chunk written by the converter (matches the EfmData
+    // prefetch extent) and the number of decompressed chunks cached
+    static const uint32_t DEFAULT_CHUNK_SECTORS = 64;
+    static const int CACHE_CHUNKS = 16;
+
+    static bool isCompressedImage(QString filename);
+    static bool compress(QString imageFilename, QString compressedFilename,
+                         uint32_t chunkSectors = DEFAULT_CHUNK_SECTORS, int level = -1);
+
+    bool open(QString filename);
+    void close();
+    bool isOpen() const { return m_file.isOpen(); }
+
+    uint32_t sectorCount() const { return m_sectorCount; }
+    QByteArray readSectors(uint32_t startSector, uint32_t numberOfSectors);
+    bool verify(uint32_t startSector, uint32_t numberOfSectors, uint32_t *firstBadSector);
+
+    void setMetrics(Metrics *metrics) { m_metrics = metrics; }
+
+private:
+    QFile m_file;
+    uint32_t m_chunkSectors;
+    uint32_t m_sectorCount;
+    QVector<quint64> m_chunkOffsets;
+    QCache<uint32_t, QByteArray> m_chunkCache;
+    Metrics *m_metrics;
+
+    static const int HEADER_LENGTH = 32;
+    const QByteArray *chunk(uint32_t chunkNumber);
+    uint32_t chunkLength(uint32_t chunkNumber) const;
+};
+
+#endif // COMPRESSEDIMAGE_H
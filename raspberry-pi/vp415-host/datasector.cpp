@@ -0,0 +1,132 @@
+/************************************************************************
+
+    datasector.cpp
+
+    VP415-host - A host application for the VP415 Emulator
+    VP415-Emulator
+    Copyright (C) 2025 Simon Inns
+
+    This file is part of VP415-Emulator.
+
+    This is free software: you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Email: simon.inns@gmail.com
+
+************************************************************************/
+
+
+#include "datasector.h"
+
+#include <cstring>
+
+namespace {
+
+const uint8_t syncPattern[DataSector::SYNC_BYTES] = {
+    0x00, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x00
+};
+
+// Scrambler sequence (x^15 + x + 1, preset to 1, least significant bit
+// first) and the EDC CRC table (x^32 + x^31 + x^16 + x^15 + x^4 + x^3 + x + 1,
+// reflected)
+struct SectorTables {
+    uint8_t scrambler[DataSector::SECTOR_BYTES - DataSector::SYNC_BYTES];
+    uint32_t edc[256];
+
+    SectorTables() {
+        uint32_t shiftRegister = 1;
+        for (int index = 0; index < DataSector::SECTOR_BYTES - DataSector::SYNC_BYTES; index++) {
+            uint8_t value = 0;
+            for (int bit = 0; bit < 8; bit++) {
+                value = static_cast<uint8_t>(value | ((shiftRegister & 1) << bit));
+                uint32_t feedback = (shiftRegister ^ (shiftRegister >> 1)) & 1;
+                shiftRegister = (shiftRegister >> 1) | (feedback << 14);
+            }
+            scrambler[index] = value;
+        }
+
+        for (uint32_t index = 0; index < 256; index++) {
+            uint32_t crc = index;
+            for (int bit = 0; bit < 8; bit++) crc = (crc & 1) ? (crc >> 1) ^ 0xD8018001 : crc >> 1;
+            edc[index] = crc;
+        }
+    }
+};
+
+const SectorTables &tables() {
+    static const SectorTables sectorTables;
+    return sectorTables;
+}
+
+uint8_t toBcd(int value) {
+    return static_cast<uint8_t>(((value / 10) << 4) | (value % 10));
+}
+
+int fromBcd(uint8_t value) {
+    if ((value >> 4) > 9 || (value & 0x0F) > 9) return -1;
+    return (value >> 4) * 10 + (value & 0x0F);
+}
+
+}
+
+bool DataSector::isSync(const uint8_t *bytes) {
+    return memcmp(bytes, syncPattern, SYNC_BYTES) == 0;
+}
+
+uint32_t DataSector::edc(const uint8_t *bytes, int length) {
+    const uint32_t *table = tables().edc;
+    uint32_t crc = 0;
+    for (int index = 0; index < length; index++) crc = (crc >> 8) ^ table[(crc ^ bytes[index]) & 0xFF];
+    return crc;
+}
+
+// Scrambling is its own inverse
+void DataSector::scramble(uint8_t *sector) {
+    const uint8_t *scrambler = tables().scrambler;
+    for (int index = SYNC_BYTES; index < SECTOR_BYTES; index++) sector[index] ^= scrambler[index - SYNC_BYTES];
+}
+
+// Build a scrambled mode 1 sector
+void DataSector::encode(int32_t lba, const uint8_t *userData, uint8_t *sector) {
+    memset(sector, 0, SECTOR_BYTES);
+    memcpy(sector, syncPattern, SYNC_BYTES);
+
+    int32_t address = lba + LBA_OFFSET;
+    sector[12] = toBcd(address / (60 * 75));
+    sector[13] = toBcd((address / 75) % 60);
+    sector[14] = toBcd(address % 75);
+    sector[15] = 1;
+    memcpy(sector + USER_OFFSET, userData, USER_BYTES);
+
+    uint32_t crc = edc(sector, EDC_OFFSET);
+    for (int index = 0; index < 4; index++) sector[EDC_OFFSET + index] = static_cast<uint8_t>(crc >> (index * 8));
+
+    scramble(sector);
+}
+
+// Descramble a sector in place and check it.  Returns true if it is a mode 1
+// sector with a good EDC; lba is set from the header if that is readable.
+bool DataSector::decode(uint8_t *sector, int32_t *lba) {
+    scramble(sector);
+
+    int minutes = fromBcd(sector[12]);
+    int seconds = fromBcd(sector[13]);
+    int frames = fromBcd(sector[14]);
+    bool headerValid = minutes >= 0 && seconds >= 0 && seconds < 60 && frames >= 0 && frames < 75;
+    if (headerValid) *lba = (minutes * 60 + seconds) * 75 + frames - LBA_OFFSET;
+
+    uint32_t crc = 0;
+    for (int index = 0; index < 4; index++) crc |= static_cast<uint32_t>(sector[EDC_OFFSET + index]) << (index * 8);
+
+    return headerValid && sector[15] == 1 && edc(sector, EDC_OFFSET) == crc;
+}
@@ -0,0 +1,60 @@
+/************************************************************************
+
+    datasector.h
+
+    VP415-host - A host application for the VP415 Emulator
+    VP415-Emulator
+    Copyright (C) 2025 Simon Inns
+
+    This file is part of VP415-Emulator.
+
+    This is free software: you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Email: simon.inns@gmail.com
+
+************************************************************************/
+
+
+#ifndef DATASECTOR_H
+#define DATASECTOR_H
+
+#include <cstdint>
+
+// ECMA-130 mode 1 data sectors: a 12 byte sync, a 4 byte header (address and
+// mode), 2048 bytes of user data, a 4 byte EDC, 8 zero bytes and 276 bytes of
+// P and Q parity.  Everything after the sync is scrambled.
+//
+// The P/Q (ECC) parity is neither generated nor checked; a sector is valid if
+// its EDC matches.
+class DataSector
+{
+public:
+    static const int SECTOR_BYTES = 2352;
+    static const int SYNC_BYTES = 12;
+    static const int USER_OFFSET = 16;
+    static const int USER_BYTES = 2048;
+    static const int EDC_OFFSET = 2064;
+
+    // Logical block address of 00:02:00
+    static const int32_t LBA_OFFSET = 150;
+
+    static bool isSync(const uint8_t *bytes);
+    static void encode(int32_t lba, const uint8_t *userData, uint8_t *sector);
+    static bool decode(uint8_t *sector, int32_t *lba);
+
+    static uint32_t edc(const uint8_t *bytes, int length);
+    static void scramble(uint8_t *sector);
+};
+
+#endif // DATASECTOR_H
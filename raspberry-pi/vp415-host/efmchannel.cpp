@@ -0,0 +1,156 @@
+/************************************************************************
+
+    efmchannel.cpp
+
+    VP415-host - A host application for the VP415 Emulator
+    VP415-Emulator
+    Copyright (C) 2025 Simon Inns
+
+    This file is part of VP415-Emulator.
+
+    This is free software: you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Email: simon.inns@gmail.com
+
+************************************************************************/
+
+
+#include "efmchannel.h"
+
+#include <cstring>
+
+namespace {
+
+// The sync pattern (without its merging bits)
+const uint32_t SYNC_PATTERN = 0x801002;
+const int SYNC_BITS = 24;
+const int MERGING_BITS = 3;
+
+// Channel bit of data symbol 0
+const int FIRST_SYMBOL_BIT = SYNC_BITS + MERGING_BITS + EfmCodeTable::CODE_BITS + MERGING_BITS;
+const int SYMBOL_BITS = EfmCodeTable::CODE_BITS + MERGING_BITS;
+
+int leadingZeros(uint16_t word, int bits) {
+    int zeros = 0;
+    while (zeros < bits && !(word & (1 << (bits - 1 - zeros)))) zeros++;
+    return zeros;
+}
+
+}
+
+void EfmDemodulator::findFrames(const EfmCodeTable &table, const uint8_t *tValues, size_t count,
+                                size_t begin, size_t end, uint64_t bitPosition, std::vector<ChannelFrame> *frames) {
+    for (size_t index = begin; index < end; bitPosition += tValues[index], index++) {
+        if (tValues[index] != SYNC_T || index + 1 >= count || tValues[index + 1] != SYNC_T) continue;
+
+        // Rebuild the frame's channel bits (most significant first)
+        uint64_t bits[(FRAME_BITS + 63) / 64 + 1] = {0};
+        int position = 0;
+        size_t next = index;
+        while (position < FRAME_BITS && next < count) {
+            bits[position >> 6] |= 1ULL << (63 - (position & 63));
+            position += tValues[next++];
+        }
+        int validBits = position < FRAME_BITS ? position : FRAME_BITS;
+
+        ChannelFrame channelFrame;
+        channelFrame.bitPosition = bitPosition;
+        channelFrame.frame.erasures = 0;
+        for (int symbol = 0; symbol < 32; symbol++) {
+            int start = FIRST_SYMBOL_BIT + symbol * SYMBOL_BITS;
+            int offset = start & 63;
+            uint64_t word = bits[start >> 6] << offset;
+            if (offset) word |= bits[(start >> 6) + 1] >> (64 - offset);
+
+            int value = table.decode(static_cast<uint16_t>(word >> (64 - EfmCodeTable::CODE_BITS)));
+            if (value < 0 || start + EfmCodeTable::CODE_BITS > validBits) {
+                channelFrame.frame.symbols[symbol] = 0;
+                channelFrame.frame.erasures |= 1u << symbol;
+            } else {
+                channelFrame.frame.symbols[symbol] = static_cast<uint8_t>(value);
+            }
+        }
+        frames->push_back(channelFrame);
+    }
+}
+
+EfmModulator::EfmModulator(const EfmCodeTable &table)
+    : m_table(table) {
+    m_zeros = 0;
+    m_started = false;
+}
+
+// Append a frame (with a zero subcode symbol)
+void EfmModulator::push(const EfmFrame &frame, std::vector<uint8_t> *tValues) {
+    appendMerging(static_cast<uint16_t>(SYNC_PATTERN >> (SYNC_BITS - EfmCodeTable::CODE_BITS)), tValues);
+    appendBits(SYNC_PATTERN, SYNC_BITS, tValues);
+
+    appendMerging(m_table.encode(0), tValues);
+    appendBits(m_table.encode(0), EfmCodeTable::CODE_BITS, tValues);
+    for (int symbol = 0; symbol < 32; symbol++) {
+        uint16_t word = m_table.encode(frame.symbols[symbol]);
+        appendMerging(word, tValues);
+        appendBits(word, EfmCodeTable::CODE_BITS, tValues);
+    }
+}
+
+// Terminate the last run length
+void EfmModulator::flush(std::vector<uint8_t> *tValues) {
+    appendBits(1, 1, tValues);
+}
+
+// The merging bits come before each word (rather than after the previous
+// one) so they can be chosen knowing both neighbours.  Prefer merging bits
+// that don't make an 11T run, so data can't look like a sync.
+void EfmModulator::appendMerging(uint16_t nextWord, std::vector<uint8_t> *tValues) {
+    if (!m_started) {
+        appendBits(0, MERGING_BITS, tValues);
+        return;
+    }
+
+    static const uint32_t candidates[4] = {0x0, 0x4, 0x2, 0x1};
+    int leading = leadingZeros(nextWord, EfmCodeTable::CODE_BITS);
+    int chosen = -1;
+    for (int pass = 0; pass < 2 && chosen < 0; pass++) {
+        for (int candidate = 0; candidate < 4; candidate++) {
+            int first;
+            int second;
+            if (candidates[candidate] == 0) {
+                first = m_zeros + MERGING_BITS + leading;
+                second = first;
+            } else {
+                int one = leadingZeros(static_cast<uint16_t>(candidates[candidate]), MERGING_BITS);
+                first = m_zeros + one;
+                second = MERGING_BITS - 1 - one + leading;
+            }
+            if (first < 2 || first > 10 || second < 2 || second > 10) continue;
+            if (pass == 0 && (first == 10 || second == 10)) continue;
+            chosen = candidate;
+            break;
+        }
+    }
+    appendBits(candidates[chosen < 0 ? 0 : chosen], MERGING_BITS, tValues);
+}
+
+void EfmModulator::appendBits(uint32_t bits, int count, std::vector<uint8_t> *tValues) {
+    for (int bit = count - 1; bit >= 0; bit--) {
+        if (!(bits & (1u << bit))) {
+            m_zeros++;
+            continue;
+        }
+        if (m_started) tValues->push_back(static_cast<uint8_t>(m_zeros < 254 ? m_zeros + 1 : 255));
+        m_started = true;
+        m_zeros = 0;
+    }
+}
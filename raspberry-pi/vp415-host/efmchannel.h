@@ -0,0 +1,85 @@
+/************************************************************************
+
+    efmchannel.h
+
+    VP415-host - A host application for the VP415 Emulator
+    VP415-Emulator
+    Copyright (C) 2025 Simon Inns
+
+    This file is part of VP415-Emulator.
+
+    This is free software: you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Email: simon.inns@gmail.com
+
+************************************************************************/
+
+
+#ifndef EFMCHANNEL_H
+#define EFMCHANNEL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "efmcodetable.h"
+#include "circ.h"
+
+// EFM channel frames.  A frame is 588 channel bits: a 24 bit sync pattern
+// (two 11T run lengths), then the subcode symbol and 32 data symbols, each
+// a 14 bit word, with three merging bits after the sync and every word.
+//
+// Raw captures are a byte per run length (T-value), as written by ld-decode's
+// EFM output: a value of t is a one followed by t - 1 zeros.
+
+// A frame found in the capture, with the position of its sync in channel bits
+// from the start of the capture
+struct ChannelFrame {
+    uint64_t bitPosition;
+    EfmFrame frame;
+};
+
+class EfmDemodulator
+{
+public:
+    static const int FRAME_BITS = 588;
+    static const int SYNC_T = 11;
+
+    // Find the frames whose sync starts at a T-value in [begin, end).  Frames
+    // may run on past end (up to count).  bitPosition is the channel bit
+    // position of tValues[begin].
+    static void findFrames(const EfmCodeTable &table, const uint8_t *tValues, size_t count,
+                           size_t begin, size_t end, uint64_t bitPosition, std::vector<ChannelFrame> *frames);
+};
+
+// Generate a capture (used to test and benchmark the decoder).  Merging bits
+// are chosen to meet the run length limits; DC balance isn't considered.
+class EfmModulator
+{
+public:
+    explicit EfmModulator(const EfmCodeTable &table);
+
+    void push(const EfmFrame &frame, std::vector<uint8_t> *tValues);
+    void flush(std::vector<uint8_t> *tValues);
+
+private:
+    const EfmCodeTable &m_table;
+    int m_zeros;       // Zeros since the last one
+    bool m_started;
+
+    void appendMerging(uint16_t nextWord, std::vector<uint8_t> *tValues);
+    void appendBits(uint32_t bits, int count, std::vector<uint8_t> *tValues);
+};
+
+#endif // EFMCHANNEL_H
@@ -0,0 +1,64 @@
+/************************************************************************
+
+    efmcodetable.h
+
+    VP415-host - A host application for the VP415 Emulator
+    VP415-Emulator
+    Copyright (C) 2025 Simon Inns
+
+    This file is part of VP415-Emulator.
+
+    This is free software: you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Email: simon.inns@gmail.com
+
+************************************************************************/
+
+
+#ifndef EFMCODETABLE_H
+#define EFMCODETABLE_H
+
+#include <cstdint>
+
+// Eight to fourteen modulation code table.  Each data byte is recorded as a
+// 14 channel bit word with at least two and at most ten zeros between ones.
+// The standard table (ECMA-130 Annex D) is built in; a synthetic table
+// satisfying the same run length limits is available for benchmarking.
+class EfmCodeTable
+{
+public:
+    static const int CODE_BITS = 14;
+    static const int CODES = 1 << CODE_BITS;
+
+    EfmCodeTable();
+
+    bool setCodes(const uint16_t *codes, int *badIndex = nullptr);
+    bool isValid() const { return m_valid; }
+
+    uint16_t encode(uint8_t value) const { return m_codes[value]; }
+
+    // Data byte for a channel word, or -1 if it isn't in the table
+    int decode(uint16_t code) const { return m_decode[code & (CODES - 1)]; }
+
+    static bool isValidCode(uint16_t code);
+    static void annexDCodes(uint16_t *codes);
+    static void syntheticCodes(uint16_t *codes);
+
+private:
+    bool m_valid;
+    uint16_t m_codes[256];
+    int16_t m_decode[CODES];
+};
+
+#endif // EFMCODETABLE_H
@@ -29,41 +29,301 @@
 
 EfmData::EfmData(QObject *parent) : QObject(parent) {
     m_hasEfmData = false;
+    m_canVerify = false;
+    m_mapBackingFiles = false;
+    m_metrics = nullptr;
+    m_cacheExtents = 1;
+    m_cacheClock = 0;
 }
 
 EfmData::~EfmData() {
     closeEfmData();
 }
 
-bool EfmData::openEfmData(QString efmDataFilename) {
-    m_efmFile = new QFile(efmDataFilename);
-    if (!m_efmFile->open(QIODevice::ReadOnly)) {
-        qDebug() << "EfmData::loadEfmData() - Failed to open EFM data file: " << efmDataFilename;
+void EfmData::setMetrics(Metrics *metrics) {
+    m_metrics = metrics;
+    for (const BackingFile &backingFile : m_backingFiles) {
+        if (backingFile.compressedImage) backingFile.compressedImage->setMetrics(metrics);
+        if (backingFile.manifest) backingFile.manifest->setMetrics(metrics);
+    }
+}
+
+// Open a single EFM data file.  dataOffset is the disc sector held by the
+// first sector of the file (the sectors before it are a hole).
+bool EfmData::openEfmData(QString efmDataFilename, uint32_t dataOffset) {
+    return openEfmData(QVector<Part>{Part{efmDataFilename, dataOffset, 0, 0}});
+}
+
+// Open EFM data made up of parts (each a run of disc sectors held in a backing
+// file).  Disc sectors not covered by any part read as zeros.
+bool EfmData::openEfmData(const QVector<Part> &parts) {
+    closeEfmData();
+
+    QHash<QString, int> backingFileIndex;
+    for (const Part &part : parts) {
+        // Parts can share a backing file
+        int backingFile = backingFileIndex.value(part.filename, -1);
+        if (backingFile < 0) {
+            backingFile = openBackingFile(part.filename);
+            if (backingFile < 0) {
+                closeEfmData();
+                return false;
+            }
+            backingFileIndex.insert(part.filename, backingFile);
+        }
+
+        // A part may run past the end of a partially captured file; the rest
+        // of it is left as a hole
+        uint32_t fileSectors = m_backingFiles.at(backingFile).sectors;
+        uint32_t sectors = (part.fileSector < fileSectors) ? fileSectors - part.fileSector : 0;
+        if (part.sectors != 0 && part.sectors < sectors) sectors = part.sectors;
+        if (part.sectors != 0 && part.sectors > sectors) {
+            qDebug() << "EfmData::openEfmData() - Part at sector" << part.startSector << "is short by"
+                     << part.sectors - sectors << "sectors in" << part.filename;
+        }
+        if (sectors == 0) continue;
+
+        if (!m_extentMap.add(ExtentMap::Extent{part.startSector, sectors, backingFile, part.fileSector})) {
+            qDebug() << "EfmData::openEfmData() - Part at sector" << part.startSector << "overlaps another part";
+            closeEfmData();
+            return false;
+        }
+    }
+
+    if (m_extentMap.isEmpty()) {
+        qDebug() << "EfmData::openEfmData() - EFM data contains no sectors";
+        closeEfmData();
         return false;
     }
 
-    // Show the file size in debug (in sectors)
-    qDebug() << "EfmData::loadEfmData() - Opened EFM data file" << efmDataFilename << "containing" << m_efmFile->size() / 256 << "sectors";
+    m_canVerify = true;
+    for (const BackingFile &backingFile : m_backingFiles) {
+        if (backingFile.extentIndex && !backingFile.extentIndex->isValid()) m_canVerify = false;
+    }
 
+    qDebug() << "EfmData::openEfmData() - EFM data contains" << m_extentMap.endSector() << "sectors in"
+             << m_extentMap.count() << "extents from" << m_backingFiles.size() << "files";
     m_hasEfmData = true;
     return true;
 }
 
+// Open a backing file (flat or compressed) and return its index (or -1)
+int EfmData::openBackingFile(QString filename) {
+    BackingFile backingFile{nullptr, nullptr, nullptr, nullptr, nullptr, 0};
+
+    // A compressed image carries its own chunk offsets and zlib checksums,
+    // and chunk store chunks are checked against their hashes, so neither
+    // needs an extent index
+    if (ChunkManifest::isManifest(filename)) {
+        backingFile.manifest = new ChunkManifest();
+        backingFile.manifest->setMetrics(m_metrics);
+        if (!backingFile.manifest->open(filename)) {
+            qDebug() << "EfmData::openBackingFile() - Failed to open EFM data chunk manifest: " << filename;
+            delete backingFile.manifest;
+            return -1;
+        }
+        backingFile.sectors = backingFile.manifest->sectorCount();
+    } else if (CompressedImage::isCompressedImage(filename)) {
+        backingFile.compressedImage = new CompressedImage();
+        backingFile.compressedImage->setMetrics(m_metrics);
+        if (!backingFile.compressedImage->open(filename)) {
+            qDebug() << "EfmData::openBackingFile() - Failed to open compressed EFM data file: " << filename;
+            delete backingFile.compressedImage;
+            return -1;
+        }
+        backingFile.sectors = backingFile.compressedImage->sectorCount();
+    } else {
+        backingFile.file = new QFile(filename);
+        if (!backingFile.file->open(QIODevice::ReadOnly)) {
+            qDebug() << "EfmData::openBackingFile() - Failed to open EFM data file: " << filename;
+            delete backingFile.file;
+            return -1;
+        }
+        backingFile.sectors = static_cast<uint32_t>(backingFile.file->size() / 256);
+
+        // Open the checksum index used to verify the data
+        backingFile.extentIndex = new ExtentIndex();
+        if (!backingFile.extentIndex->open(backingFile.file, filename))
+            qDebug() << "EfmData::openBackingFile() - No extent index available; VERIFY will fail";
+
+        if (m_mapBackingFiles && backingFile.sectors != 0) {
+            backingFile.map = backingFile.file->map(0, static_cast<qint64>(backingFile.sectors) * 256);
+            if (backingFile.map == nullptr)
+                qDebug() << "EfmData::openBackingFile() - Failed to map EFM data file (it will be read instead): "
+                         << filename;
+        }
+    }
+
+    qDebug() << "EfmData::openBackingFile() - Opened EFM data file" << filename << "containing"
+             << backingFile.sectors << "sectors";
+    m_backingFiles.append(backingFile);
+    return static_cast<int>(m_backingFiles.size() - 1);
+}
+
 void EfmData::closeEfmData() {
+    for (BackingFile &backingFile : m_backingFiles) {
+        delete backingFile.extentIndex;
+        delete backingFile.compressedImage;
+        delete backingFile.manifest;
+        delete backingFile.file;
+    }
+    m_backingFiles.clear();
+    m_extentMap.clear();
+    m_cache.clear();
+    m_canVerify = false;
+
     if (m_hasEfmData) {
         m_hasEfmData = false;
-        m_efmFile->close();
         qDebug() << "EfmData::closeEfmData() - Closed EFM data file";
     }
 }
 
-QByteArray EfmData::getEfmSectorData(uint16_t sectorNumber) const {
+uint32_t EfmData::sectorCount() const {
+    return m_extentMap.endSector();
+}
+
+// Number of prefetched extents kept (at least one)
+void EfmData::setCacheExtents(int cacheExtents) {
+    m_cacheExtents = qMax(cacheExtents, 1);
+    if (m_cache.size() > m_cacheExtents) m_cache.resize(m_cacheExtents);
+}
+
+QByteArray EfmData::getEfmSectorData(uint32_t sectorNumber) {
     QByteArray efmSectorData;
 
     if (m_hasEfmData) {
-        m_efmFile->seek(sectorNumber * 256);
-        efmSectorData = m_efmFile->read(256);
+        // Is the sector in a prefetched extent?
+        for (CachedExtent &extent : m_cache) {
+            if (sectorNumber >= extent.startSector &&
+                sectorNumber < extent.startSector + static_cast<uint32_t>(extent.data.size() / 256)) {
+                if (m_metrics) m_metrics->efmCacheHits.add();
+                extent.lastUsed = ++m_cacheClock;
+                return extent.data.mid(static_cast<qsizetype>(sectorNumber - extent.startSector) * 256, 256);
+            }
+        }
+
+        if (m_metrics) m_metrics->efmCacheMisses.add();
+        efmSectorData = readSectors(sectorNumber, 1);
     }
 
     return efmSectorData;
-}
\ No newline at end of file
+}
+
+// Read an extent of the EFM data into memory (in response to a prefetch hint
+// from the Pico) so that the following sector reads don't wait on the file
+void EfmData::prefetch(uint32_t sectorNumber, uint32_t numberOfSectors) {
+    if (!m_hasEfmData) return;
+    if (numberOfSectors < PREFETCH_SECTORS) numberOfSectors = PREFETCH_SECTORS;
+
+    // Already cached?
+    for (CachedExtent &extent : m_cache) {
+        uint32_t cachedSectors = static_cast<uint32_t>(extent.data.size() / 256);
+        if (sectorNumber >= extent.startSector && static_cast<uint64_t>(sectorNumber) + numberOfSectors <=
+                                                      static_cast<uint64_t>(extent.startSector) + cachedSectors) {
+            extent.lastUsed = ++m_cacheClock;
+            return;
+        }
+    }
+
+    CachedExtent extent{sectorNumber, readSectors(sectorNumber, numberOfSectors), ++m_cacheClock};
+    if (m_cache.size() < m_cacheExtents) {
+        m_cache.append(extent);
+        return;
+    }
+
+    int leastRecentlyUsed = 0;
+    for (int index = 1; index < m_cache.size(); index++) {
+        if (m_cache.at(index).lastUsed < m_cache.at(leastRecentlyUsed).lastUsed) leastRecentlyUsed = index;
+    }
+    m_cache[leastRecentlyUsed] = extent;
+}
+
+// Read disc sectors through the extent map.  Holes are zero filled without
+// reading anything; the result is short if the range runs off the end of the
+// disc (or a backing file can't be read).
+QByteArray EfmData::readSectors(uint32_t sectorNumber, uint32_t numberOfSectors) const {
+    QByteArray sectorData;
+    uint32_t endSector = m_extentMap.endSector();
+    if (static_cast<uint64_t>(sectorNumber) + numberOfSectors < endSector) endSector = sectorNumber + numberOfSectors;
+    if (sectorNumber >= endSector) return sectorData;
+    sectorData.reserve(static_cast<qsizetype>(endSector - sectorNumber) * 256);
+
+    uint32_t sector = sectorNumber;
+    while (sector < endSector) {
+        const ExtentMap::Extent &extent = m_extentMap.at(m_extentMap.findFrom(sector));
+
+        if (extent.startSector > sector) {
+            uint32_t holeEnd = qMin(extent.startSector, endSector);
+            sectorData.append(static_cast<qsizetype>(holeEnd - sector) * 256, '\0');
+            sector = holeEnd;
+            continue;
+        }
+
+        uint32_t extentEnd = qMin(extent.startSector + extent.sectors, endSector);
+        QByteArray extentData = readBackingFile(extent.backingFile,
+                                                extent.backingSector + (sector - extent.startSector),
+                                                extentEnd - sector);
+        sectorData.append(extentData);
+        if (extentData.size() != static_cast<qsizetype>(extentEnd - sector) * 256) break;
+        sector = extentEnd;
+    }
+
+    return sectorData;
+}
+
+QByteArray EfmData::readBackingFile(int backingFileIndex, uint32_t sectorNumber, uint32_t numberOfSectors) const {
+    const BackingFile &backingFile = m_backingFiles.at(backingFileIndex);
+    if (backingFile.compressedImage) return backingFile.compressedImage->readSectors(sectorNumber, numberOfSectors);
+    if (backingFile.manifest) return backingFile.manifest->readSectors(sectorNumber, numberOfSectors);
+
+    if (backingFile.map) {
+        if (sectorNumber >= backingFile.sectors) return QByteArray();
+        uint32_t sectors = qMin(numberOfSectors, backingFile.sectors - sectorNumber);
+        return QByteArray(reinterpret_cast<const char *>(backingFile.map) + static_cast<qint64>(sectorNumber) * 256,
+                          static_cast<qsizetype>(sectors) * 256);
+    }
+
+    if (!backingFile.file->seek(static_cast<qint64>(sectorNumber) * 256)) return QByteArray();
+    return backingFile.file->read(static_cast<qint64>(numberOfSectors) * 256);
+}
+
+// Verify a range of sectors against the extent index (the data is checked on
+// the Pi, so nothing needs to be sent to the Pico).  Holes weren't captured,
+// so they fail verification.
+bool EfmData::verifySectors(uint32_t sectorNumber, uint32_t numberOfSectors, uint32_t *firstBadSector) {
+    *firstBadSector = sectorNumber;
+    if (!m_hasEfmData) return false;
+
+    uint64_t endSector = static_cast<uint64_t>(sectorNumber) + numberOfSectors;  // Exclusive
+    uint32_t sector = sectorNumber;
+    while (sector < endSector) {
+        int index = m_extentMap.findFrom(sector);
+        if (index < 0 || m_extentMap.at(index).startSector > sector) {
+            *firstBadSector = sector;
+            return false;
+        }
+
+        const ExtentMap::Extent &extent = m_extentMap.at(index);
+        uint32_t extentEnd = static_cast<uint32_t>(
+            qMin<uint64_t>(static_cast<uint64_t>(extent.startSector) + extent.sectors, endSector));
+        uint32_t backingSector = extent.backingSector + (sector - extent.startSector);
+        const BackingFile &backingFile = m_backingFiles.at(extent.backingFile);
+
+        uint32_t badSector = backingSector;
+        bool verified;
+        if (backingFile.compressedImage)
+            verified = backingFile.compressedImage->verify(backingSector, extentEnd - sector, &badSector);
+        else if (backingFile.manifest)
+            verified = backingFile.manifest->verify(backingSector, extentEnd - sector, &badSector);
+        else
+            verified = backingFile.extentIndex->verify(backingSector, extentEnd - sector, &badSector);
+        if (!verified) {
+            *firstBadSector = sector + (badSector - backingSector);
+            return false;
+        }
+
+        sector = extentEnd;
+    }
+
+    return true;
+}
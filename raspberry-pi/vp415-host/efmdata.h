@@ -31,8 +31,20 @@
 #include <QObject>
 #include <QFile>
 #include <QByteArray>
+#include <QVector>
+#include <QHash>
 #include <QDebug>
 
+#include "metrics.h"
+#include "extentindex.h"
+#include "compressedimage.h"
+#include "chunkmanifest.h"
+#include "extentmap.h"
+
+// EFM data for the disc.  Disc sectors (SCSI LBAs) are mapped to the backing
+// files holding them by an extent map, so a disc can be served from several
+// files (flat, compressed or chunk store manifests) and sectors that weren't
+// captured read as zeros.
 class EfmData : public QObject
 {
     Q_OBJECT
@@ -41,16 +53,71 @@ public:
     explicit EfmData(QObject *parent = nullptr);
     ~EfmData();
 
-    bool openEfmData(QString efmDataFilename);
+    // A run of disc sectors held in a backing file (sectors 0 means to the
+    // end of the file)
+    struct Part {
+        QString filename;
+        uint32_t startSector;
+        uint32_t sectors;
+        uint32_t fileSector;
+    };
+
+    bool openEfmData(QString efmDataFilename, uint32_t dataOffset = 0);
+    bool openEfmData(const QVector<Part> &parts);
     void closeEfmData();
 
     bool hasEfmData() const { return m_hasEfmData; }
-    QByteArray getEfmSectorData(uint16_t sectorNumber) const;
+    uint32_t sectorCount() const;
+    const ExtentMap &extentMap() const { return m_extentMap; }
+    QByteArray getEfmSectorData(uint32_t sectorNumber);
+    void prefetch(uint32_t sectorNumber, uint32_t numberOfSectors);
+    void setCacheExtents(int cacheExtents);
+    bool hasExtentIndex() const { return m_canVerify; }
+    bool verifySectors(uint32_t sectorNumber, uint32_t numberOfSectors, uint32_t *firstBadSector);
+    void setMetrics(Metrics *metrics);
+
+    // Map flat backing files into memory rather than reading them (in
+    // real-time mode, so they are locked along with the rest of the process)
+    void setMapBackingFiles(bool mapBackingFiles) { m_mapBackingFiles = mapBackingFiles; }
+
+    // Minimum number of sectors cached by a prefetch
+    static const uint32_t PREFETCH_SECTORS = 64;
 
 private:
     bool m_hasEfmData;
     QByteArray m_efmData[256];
-    QFile *m_efmFile;
+    bool m_canVerify;  // Every backing file is compressed or has an extent index
+    bool m_mapBackingFiles;
+    Metrics *m_metrics;
+
+    // Backing files are flat (with an extent index, and possibly mapped),
+    // compressed or a manifest of chunks in a chunk store
+    struct BackingFile {
+        QFile *file;
+        const uchar *map;
+        CompressedImage *compressedImage;
+        ChunkManifest *manifest;
+        ExtentIndex *extentIndex;
+        uint32_t sectors;
+    };
+    QVector<BackingFile> m_backingFiles;
+    ExtentMap m_extentMap;
+
+    // Extents cached by prefetches (the least recently used is replaced).
+    // When several units are served they share the cache, so one unit can
+    // read sectors another has prefetched.
+    struct CachedExtent {
+        uint32_t startSector;
+        QByteArray data;
+        uint64_t lastUsed;
+    };
+    QVector<CachedExtent> m_cache;
+    int m_cacheExtents;
+    uint64_t m_cacheClock;
+
+    int openBackingFile(QString filename);
+    QByteArray readSectors(uint32_t sectorNumber, uint32_t numberOfSectors) const;
+    QByteArray readBackingFile(int backingFileIndex, uint32_t sectorNumber, uint32_t numberOfSectors) const;
 };
 
 #endif // EFM_DATA_H
\ No newline at end of file
@@ -0,0 +1,298 @@
+/************************************************************************
+
+    efmpipeline.cpp
+
+    VP415-host - A host application for the VP415 Emulator
+    VP415-Emulator
+    Copyright (C) 2025 Simon Inns
+
+    This file is part of VP415-Emulator.
+
+    This is free software: you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Email: simon.inns@gmail.com
+
+************************************************************************/
+
+
+#include "efmpipeline.h"
+#include "datasector.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <thread>
+
+namespace {
+
+// T-values kept back from each batch so every frame found in it is complete
+// (a frame can't be longer than 588 T-values)
+const size_t BATCH_MARGIN = 1024;
+
+// Smallest piece of work handed to a thread
+const size_t MINIMUM_CHUNK_BYTES = 64 * 1024;
+const size_t MINIMUM_CHUNK_FRAMES = 512;
+
+// Frame sync flywheel: syncs are accepted within SYNC_TOLERANCE bits of a
+// whole number of frames from the last one; otherwise they're ignored unless
+// no sync has been accepted for RESYNC_FRAMES frames.  At most WARM_UP lost
+// frames are inserted (enough to flush the CIRC decoder).
+const uint64_t SYNC_TOLERANCE = 3;
+const uint64_t RESYNC_FRAMES = 3;
+
+const int SECTOR_MISSES = 3;
+
+EfmFrame erasedFrame() {
+    EfmFrame frame;
+    memset(frame.symbols, 0, sizeof(frame.symbols));
+    frame.erasures = 0xFFFFFFFF;
+    return frame;
+}
+
+double secondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+}
+
+EfmPipeline::EfmPipeline(const EfmCodeTable &table, int threads)
+    : m_table(table) {
+    m_threads = threads > 0 ? threads : static_cast<int>(std::thread::hardware_concurrency());
+    if (m_threads < 1) m_threads = 1;
+    memset(&m_statistics, 0, sizeof(m_statistics));
+}
+
+void EfmPipeline::run(const ReadFunction &read, const SectorFunction &sector) {
+    memset(&m_statistics, 0, sizeof(m_statistics));
+    m_locked = false;
+    m_lastSyncBit = 0;
+    m_framesDecoded = 0;
+    m_bytes.clear();
+    m_sectorLocked = false;
+    m_sectorMisses = 0;
+    m_haveLba = false;
+    m_nextLba = 0;
+
+    std::vector<uint8_t> tValues;
+    size_t carry = 0;
+    uint64_t bitPosition = 0;
+    std::vector<EfmFrame> frames;
+    size_t history = 0;
+    std::vector<CircFrame> circFrames;
+
+    bool finished = false;
+    while (!finished) {
+        tValues.resize(carry + BATCH_BYTES);
+        size_t bytesRead = read(tValues.data() + carry, BATCH_BYTES);
+        tValues.resize(carry + bytesRead);
+        m_statistics.channelBytes += bytesRead;
+        finished = (bytesRead == 0);
+
+        size_t end = tValues.size();
+        if (!finished) end = end > BATCH_MARGIN ? end - BATCH_MARGIN : 0;
+
+        auto start = std::chrono::steady_clock::now();
+        uint64_t endBitPosition = demodulate(tValues, end, bitPosition, &frames);
+
+        // Flush the frames still in the CIRC decoder
+        if (finished) frames.insert(frames.end(), CircDecoder::LATENCY, erasedFrame());
+        m_statistics.demodulateSeconds += secondsSince(start);
+
+        start = std::chrono::steady_clock::now();
+        decodeCirc(frames, history, &circFrames);
+        m_statistics.circSeconds += secondsSince(start);
+
+        start = std::chrono::steady_clock::now();
+        assembleSectors(circFrames, sector);
+        m_statistics.sectorSeconds += secondsSince(start);
+
+        // Keep the frames the next batch's decoders warm up on, and the
+        // T-values held back
+        size_t keep = std::min(frames.size(), static_cast<size_t>(CircDecoder::WARM_UP));
+        frames.erase(frames.begin(), frames.end() - static_cast<std::ptrdiff_t>(keep));
+        history = keep;
+
+        tValues.erase(tValues.begin(), tValues.begin() + static_cast<std::ptrdiff_t>(end));
+        carry = tValues.size();
+        bitPosition = endBitPosition;
+    }
+}
+
+// Stage 1: find and demodulate the frames in tValues[0, end), append them to
+// frames and return the bit position of tValues[end]
+uint64_t EfmPipeline::demodulate(const std::vector<uint8_t> &tValues, size_t end, uint64_t bitPosition,
+                                 std::vector<EfmFrame> *frames) {
+    size_t chunkBytes = std::max(MINIMUM_CHUNK_BYTES, end / (static_cast<size_t>(m_threads) * 4) + 1);
+    int chunks = static_cast<int>((end + chunkBytes - 1) / chunkBytes);
+
+    // Bit position of each piece
+    std::vector<uint64_t> chunkBits(static_cast<size_t>(chunks) + 1, 0);
+    parallelFor(chunks, [&](int chunk) {
+        size_t last = std::min(end, (static_cast<size_t>(chunk) + 1) * chunkBytes);
+        uint64_t bits = 0;
+        for (size_t index = static_cast<size_t>(chunk) * chunkBytes; index < last; index++) bits += tValues[index];
+        chunkBits[static_cast<size_t>(chunk) + 1] = bits;
+    });
+    chunkBits[0] = bitPosition;
+    for (int chunk = 0; chunk < chunks; chunk++) chunkBits[chunk + 1] += chunkBits[chunk];
+
+    std::vector<std::vector<ChannelFrame>> chunkFrames(static_cast<size_t>(chunks));
+    parallelFor(chunks, [&](int chunk) {
+        size_t first = static_cast<size_t>(chunk) * chunkBytes;
+        size_t last = std::min(end, first + chunkBytes);
+        EfmDemodulator::findFrames(m_table, tValues.data(), tValues.size(), first, last, chunkBits[chunk],
+                                   &chunkFrames[static_cast<size_t>(chunk)]);
+    });
+
+    // Merge the frames through the sync flywheel
+    for (const std::vector<ChannelFrame> &found : chunkFrames) {
+        for (const ChannelFrame &channelFrame : found) {
+            if (m_locked) {
+                uint64_t distance = channelFrame.bitPosition - m_lastSyncBit;
+                uint64_t advance = (distance + EfmDemodulator::FRAME_BITS / 2) / EfmDemodulator::FRAME_BITS;
+                uint64_t nearest = advance * EfmDemodulator::FRAME_BITS;
+                uint64_t offset = distance > nearest ? distance - nearest : nearest - distance;
+
+                if (advance == 0 || (offset > SYNC_TOLERANCE && advance <= RESYNC_FRAMES)) {
+                    m_statistics.falseSyncs++;
+                    continue;
+                }
+
+                uint64_t lost = std::min(advance - 1, static_cast<uint64_t>(CircDecoder::WARM_UP));
+                frames->insert(frames->end(), lost, erasedFrame());
+                m_statistics.framesLost += lost;
+            }
+
+            frames->push_back(channelFrame.frame);
+            m_statistics.frames++;
+            m_lastSyncBit = channelFrame.bitPosition;
+            m_locked = true;
+        }
+    }
+
+    return chunkBits[static_cast<size_t>(chunks)];
+}
+
+// Stage 2: CIRC decode frames[history, end).  The first history frames were
+// decoded in the last batch and are only used to warm up the decoders.
+void EfmPipeline::decodeCirc(const std::vector<EfmFrame> &frames, size_t history,
+                             std::vector<CircFrame> *circFrames) {
+    size_t count = frames.size() - history;
+    circFrames->resize(count);
+
+    size_t chunkFrames = std::max(MINIMUM_CHUNK_FRAMES, count / (static_cast<size_t>(m_threads) * 4) + 1);
+    int chunks = static_cast<int>((count + chunkFrames - 1) / chunkFrames);
+    std::vector<CircDecoder::Statistics> chunkStatistics(static_cast<size_t>(chunks));
+
+    parallelFor(chunks, [&](int chunk) {
+        size_t first = history + static_cast<size_t>(chunk) * chunkFrames;
+        size_t last = std::min(frames.size(), first + chunkFrames);
+        size_t warmUp = first >= CircDecoder::WARM_UP ? first - CircDecoder::WARM_UP : 0;
+
+        CircDecoder decoder;
+        CircDecoder::Statistics warmUpStatistics;
+        CircDecoder::Statistics &statistics = chunkStatistics[static_cast<size_t>(chunk)];
+        memset(&statistics, 0, sizeof(statistics));
+        std::vector<CircFrame> discarded(first - warmUp);
+        decoder.pushFrames(frames.data() + warmUp, static_cast<int>(first - warmUp), discarded.data(),
+                           &warmUpStatistics);
+        decoder.pushFrames(frames.data() + first, static_cast<int>(last - first),
+                           circFrames->data() + (first - history), &statistics);
+    });
+
+    for (const CircDecoder::Statistics &statistics : chunkStatistics) {
+        m_statistics.circ.c1Corrected += statistics.c1Corrected;
+        m_statistics.circ.c1Failed += statistics.c1Failed;
+        m_statistics.circ.c2Corrected += statistics.c2Corrected;
+        m_statistics.circ.c2Failed += statistics.c2Failed;
+    }
+
+    // The decoder's first LATENCY outputs are from its initial state
+    if (m_framesDecoded < CircDecoder::LATENCY) {
+        size_t skip = std::min(count, static_cast<size_t>(CircDecoder::LATENCY - m_framesDecoded));
+        circFrames->erase(circFrames->begin(), circFrames->begin() + static_cast<std::ptrdiff_t>(skip));
+    }
+    m_framesDecoded += count;
+}
+
+// Stage 3: find the sectors in the data and check them
+void EfmPipeline::assembleSectors(const std::vector<CircFrame> &circFrames, const SectorFunction &sector) {
+    for (const CircFrame &circFrame : circFrames) m_bytes.insert(m_bytes.end(), circFrame.data, circFrame.data + 24);
+
+    // Split the data into sectors (the sync is expected every sector once
+    // found; the search restarts after SECTOR_MISSES sectors without it)
+    std::vector<SectorJob> jobs;
+    size_t position = 0;
+    while (m_bytes.size() - position >= static_cast<size_t>(DataSector::SECTOR_BYTES)) {
+        if (!m_sectorLocked) {
+            size_t last = m_bytes.size() - DataSector::SECTOR_BYTES;
+            while (position <= last && !DataSector::isSync(m_bytes.data() + position)) position++;
+            if (position > last) break;
+            m_sectorLocked = true;
+            m_sectorMisses = 0;
+        } else if (DataSector::isSync(m_bytes.data() + position)) {
+            m_sectorMisses = 0;
+        } else if (++m_sectorMisses > SECTOR_MISSES) {
+            m_sectorLocked = false;
+            continue;
+        }
+
+        jobs.emplace_back();
+        memcpy(jobs.back().data, m_bytes.data() + position, DataSector::SECTOR_BYTES);
+        position += DataSector::SECTOR_BYTES;
+    }
+    m_bytes.erase(m_bytes.begin(), m_bytes.begin() + static_cast<std::ptrdiff_t>(position));
+
+    parallelFor(static_cast<int>(jobs.size()), [&](int index) {
+        SectorJob &job = jobs[static_cast<size_t>(index)];
+        job.lba = INT32_MIN;
+        job.valid = DataSector::decode(job.data, &job.lba);
+        job.headerLba = job.lba != INT32_MIN;
+    });
+
+    for (const SectorJob &job : jobs) {
+        int32_t lba = job.lba;
+        if (!job.valid && m_haveLba) lba = m_nextLba;
+        if (!job.valid && !m_haveLba && !job.headerLba) {
+            m_statistics.sectorsInvalid++;
+            continue;
+        }
+
+        m_statistics.sectors++;
+        if (!job.valid) m_statistics.sectorsInvalid++;
+        sector(lba, job.data + DataSector::USER_OFFSET, job.valid);
+        m_nextLba = lba + 1;
+        m_haveLba = true;
+    }
+}
+
+// Call function(0) to function(count - 1) across the threads
+void EfmPipeline::parallelFor(int count, const std::function<void(int)> &function) const {
+    int threads = std::min(m_threads, count);
+    if (threads <= 1) {
+        for (int index = 0; index < count; index++) function(index);
+        return;
+    }
+
+    std::atomic<int> next(0);
+    auto worker = [&]() {
+        for (int index = next++; index < count; index = next++) function(index);
+    };
+
+    std::vector<std::thread> workers;
+    for (int thread = 1; thread < threads; thread++) workers.emplace_back(worker);
+    worker();
+    for (std::thread &thread : workers) thread.join();
+}
@@ -0,0 +1,116 @@
+/************************************************************************
+
+    efmpipeline.h
+
+    VP415-host - A host application for the VP415 Emulator
+    VP415-Emulator
+    Copyright (C) 2025 Simon Inns
+
+    This file is part of VP415-Emulator.
+
+    This is free software: you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Email: simon.inns@gmail.com
+
+************************************************************************/
+
+
+#ifndef EFMPIPELINE_H
+#define EFMPIPELINE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include "efmcodetable.h"
+#include "efmchannel.h"
+#include "circ.h"
+
+// Raw EFM capture to data sector decoder.  The capture is read in batches and
+// each batch goes through three stages:
+//
+//   1. Demodulation: the batch is split into pieces which are searched for
+//      frame syncs and demodulated in parallel, then the frames are merged in
+//      order (inserting erased frames where syncs were lost).
+//   2. CIRC: the frames are split into pieces decoded in parallel, each
+//      decoder starting CircDecoder::WARM_UP frames early so the result is
+//      the same as decoding the whole stream in order.
+//   3. Sectors: sector syncs are found in order, then the sectors are
+//      descrambled and checked in parallel and passed on in order.
+class EfmPipeline
+{
+public:
+    struct Statistics {
+        uint64_t channelBytes;
+        uint64_t frames;
+        uint64_t framesLost;      // Erased frames inserted for missing syncs
+        uint64_t falseSyncs;
+        CircDecoder::Statistics circ;
+        uint64_t sectors;
+        uint64_t sectorsInvalid;
+        double demodulateSeconds;
+        double circSeconds;
+        double sectorSeconds;
+    };
+
+    // Read up to maximum bytes of capture, returning 0 at the end
+    typedef std::function<size_t(uint8_t *buffer, size_t maximum)> ReadFunction;
+
+    // Called in order for each sector (valid is false if the EDC failed, in
+    // which case the LBA is the one expected after the previous sector)
+    typedef std::function<void(int32_t lba, const uint8_t *userData, bool valid)> SectorFunction;
+
+    static const size_t BATCH_BYTES = 16 * 1024 * 1024;
+
+    EfmPipeline(const EfmCodeTable &table, int threads = 0);
+
+    int threads() const { return m_threads; }
+    void run(const ReadFunction &read, const SectorFunction &sector);
+    const Statistics &statistics() const { return m_statistics; }
+
+private:
+    struct SectorJob {
+        uint8_t data[2352];
+        int32_t lba;
+        bool headerLba;
+        bool valid;
+    };
+
+    const EfmCodeTable &m_table;
+    int m_threads;
+    Statistics m_statistics;
+
+    // Frame sync flywheel
+    bool m_locked;
+    uint64_t m_lastSyncBit;
+
+    // Frames pushed through CIRC decoding so far
+    uint64_t m_framesDecoded;
+
+    // Sector sync flywheel
+    std::vector<uint8_t> m_bytes;
+    bool m_sectorLocked;
+    int m_sectorMisses;
+    bool m_haveLba;
+    int32_t m_nextLba;
+
+    uint64_t demodulate(const std::vector<uint8_t> &tValues, size_t end, uint64_t bitPosition,
+                        std::vector<EfmFrame> *frames);
+    void decodeCirc(const std::vector<EfmFrame> &frames, size_t history, std::vector<CircFrame> *circFrames);
+    void assembleSectors(const std::vector<CircFrame> &circFrames, const SectorFunction &sector);
+    void parallelFor(int count, const std::function<void(int)> &function) const;
+};
+
+#endif // EFMPIPELINE_H
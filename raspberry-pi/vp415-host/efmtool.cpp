@@ -0,0 +1,1100 @@
+/************************************************************************
+
+    efmtool.cpp
+
+    VP415-host - A host application for the VP415 Emulator
+    VP415-Emulator
+    Copyright (C) 2025 Simon Inns
+
+    This file is part of VP415-Emulator.
+
+    This is free software: you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Email: simon.inns@gmail.com
+
+************************************************************************/
+
+#include <QCoreApplication>
+#include <QDebug>
+#include <QtGlobal>
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QRandomGenerator>
+#include <QTextStream>
+#include <QFile>
+#include <QFileInfo>
+#include <QTemporaryFile>
+#include <QTimer>
+#include <QEventLoop>
+#include <QVector>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#ifdef Q_OS_UNIX
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <termios.h>
+#include <unistd.h>
+#endif
+
+#include "efmdata.h"
+#include "extentindex.h"
+#include "metrics.h"
+#include "compressedimage.h"
+#include "chunkmanifest.h"
+#include "efmcodetable.h"
+#include "efmpipeline.h"
+#include "datasector.h"
+#include "syndromebatch.h"
+#include "realtime.h"
+#include "picolink.h"
+
+// Capture bytes read by circ-test
+static const qint64 CIRC_TEST_BYTES = 64 * 1024 * 1024;
+
+// jitter-test requests (one every period, each reading a few sectors as the
+// Pico does) and the size of the scratch file its storage stress writes
+static const int JITTER_PERIOD_US = 1000;
+static const uint32_t JITTER_READ_SECTORS = 4;
+static const qint64 JITTER_SCRATCH_BYTES = 64 * 1024 * 1024;
+
+// serve-bench units read runs of sectors from random places on the disc (as
+// Domesday does), keeping this many prefetched extents each in the shared
+// cache (as vp415-host does)
+static const uint32_t SERVE_RUN_SECTORS = 256;
+static const int SERVE_CACHE_EXTENTS_PER_UNIT = 2;
+
+// serve-bench Picos resend a request after the link has been silent for
+// SERVE_ATTEMPT_MS (and quiet for SERVE_RESYNC_QUIET_MS), giving up after
+// SERVE_TIMEOUT_MS, as picom.c does
+static const int SERVE_ATTEMPT_MS = 100;
+static const int SERVE_RESYNC_QUIET_MS = 25;
+static const int SERVE_TIMEOUT_MS = 1000;
+
+// Convert a flat EFM data image into a compressed image
+static int commandCompress(const QStringList &arguments, uint32_t chunkSectors, int level) {
+    if (arguments.count() != 3) {
+        qWarning() << "compress needs an input image and an output filename";
+        return 1;
+    }
+
+    return CompressedImage::compress(arguments.at(1), arguments.at(2), chunkSectors, level) ? 0 : 1;
+}
+
+// Build the extent (checksum) index of each flat image, so vp415-host can
+// verify it
+static int commandIndex(const QStringList &arguments) {
+    QTextStream out(stdout);
+
+    if (arguments.count() < 2) {
+        qWarning() << "index needs one or more images";
+        return 1;
+    }
+
+    for (int argument = 1; argument < arguments.count(); argument++) {
+        QElapsedTimer timer;
+        timer.start();
+        if (!ExtentIndex::create(arguments.at(argument))) {
+            qWarning() << "Failed to index image:" << arguments.at(argument);
+            return 1;
+        }
+        out << arguments.at(argument) << ": indexed in " << timer.elapsed() << " ms\n";
+    }
+    return 0;
+}
+
+// Add an image (flat or compressed) to a chunk store and write its manifest
+static int commandImport(const QStringList &arguments, QString storeDirectory, int level) {
+    QTextStream out(stdout);
+
+    if (arguments.count() != 3 || storeDirectory.isEmpty()) {
+        qWarning() << "import needs an input image, a manifest filename and a chunk store (--store)";
+        return 1;
+    }
+
+    ChunkManifest::ImportStatistics statistics;
+    if (!ChunkManifest::import(arguments.at(1), arguments.at(2), storeDirectory, level, &statistics)) {
+        qWarning() << "Failed to import image:" << arguments.at(1);
+        return 1;
+    }
+
+    out << arguments.at(1) << ": " << statistics.sectors << " sectors in " << statistics.chunks << " chunks, "
+        << statistics.newChunks << " new (" << statistics.chunks - statistics.newChunks << " already stored), "
+        << statistics.storedBytes << " bytes added to the store\n";
+    return 0;
+}
+
+// Time random single sector reads and sequential prefetched reads of each
+// image (flat or compressed) through EfmData, as vp415-host reads them
+static int commandBench(const QStringList &arguments, uint32_t reads) {
+    QTextStream out(stdout);
+
+    if (arguments.count() < 2) {
+        qWarning() << "bench needs at least one image";
+        return 1;
+    }
+
+    for (int index = 1; index < arguments.count(); index++) {
+        EfmData efmData;
+        if (!efmData.openEfmData(arguments.at(index)) || efmData.sectorCount() == 0) {
+            qWarning() << "Failed to open image:" << arguments.at(index);
+            return 1;
+        }
+        uint32_t sectorCount = efmData.sectorCount();
+
+        // Random reads (the same sequence for every image)
+        QRandomGenerator random(415);
+        QElapsedTimer timer;
+        timer.start();
+        for (uint32_t read = 0; read < reads; read++) {
+            if (efmData.getEfmSectorData(random.bounded(sectorCount)).size() != 256) {
+                qWarning() << "Read failed:" << arguments.at(index);
+                return 1;
+            }
+        }
+        double randomUs = static_cast<double>(timer.nsecsElapsed()) / 1000.0 / reads;
+
+        // Sequential reads, prefetching an extent at a time as the Pico does
+        uint32_t sequentialSectors = qMin(sectorCount, reads);
+        timer.restart();
+        for (uint32_t sector = 0; sector < sequentialSectors; sector++) {
+            if (sector % EfmData::PREFETCH_SECTORS == 0) efmData.prefetch(sector, EfmData::PREFETCH_SECTORS);
+            efmData.getEfmSectorData(sector);
+        }
+        double sequentialUs = static_cast<double>(timer.nsecsElapsed()) / 1000.0 / sequentialSectors;
+
+        out << arguments.at(index) << ": " << sectorCount << " sectors, random read "
+            << QString::number(randomUs, 'f', 2) << " uS/sector, sequential read "
+            << QString::number(sequentialUs, 'f', 2) << " uS/sector\n";
+        efmData.closeEfmData();
+    }
+
+    return 0;
+}
+
+// Load an EFM code table: 256 lines (for data bytes 0 to 255 in order) whose
+// last field is the 14 channel bits, as listed in ECMA-130 Annex D.  Blank
+// lines and lines starting with # are ignored.
+static bool loadCodeTable(const QString &filename, EfmCodeTable *table) {
+    QFile file(filename);
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        qWarning() << "Could not open EFM code table:" << filename;
+        return false;
+    }
+
+    uint16_t codes[256];
+    int count = 0;
+    while (!file.atEnd()) {
+        QString line = QString::fromLatin1(file.readLine()).trimmed();
+        if (line.isEmpty() || line.startsWith('#')) continue;
+
+        QString bits = line.simplified().split(' ').last();
+        bool ok = false;
+        uint code = bits.toUInt(&ok, 2);
+        if (!ok || bits.length() != EfmCodeTable::CODE_BITS || count == 256) {
+            qWarning() << "Bad EFM code table line:" << line;
+            return false;
+        }
+        codes[count++] = static_cast<uint16_t>(code);
+    }
+
+    int badIndex = -1;
+    if (count != 256 || !table->setCodes(codes, &badIndex)) {
+        qWarning() << "EFM code table must have 256 distinct valid codes - bad entry:" << (count != 256 ? count : badIndex);
+        return false;
+    }
+    return true;
+}
+
+static void printStatistics(QTextStream &out, const EfmPipeline::Statistics &statistics) {
+    out << "Frames: " << statistics.frames << " (" << statistics.framesLost << " lost, "
+        << statistics.falseSyncs << " false syncs)\n";
+    out << "C1: " << statistics.circ.c1Corrected << " symbols corrected, " << statistics.circ.c1Failed << " failed\n";
+    out << "C2: " << statistics.circ.c2Corrected << " symbols corrected, " << statistics.circ.c2Failed << " failed\n";
+    out << "Sectors: " << statistics.sectors << " (" << statistics.sectorsInvalid << " invalid)\n";
+    out << "Stage time: demodulate " << QString::number(statistics.demodulateSeconds, 'f', 2) << "s, CIRC "
+        << QString::number(statistics.circSeconds, 'f', 2) << "s, sectors "
+        << QString::number(statistics.sectorSeconds, 'f', 2) << "s\n";
+}
+
+// Decode a raw EFM capture (one byte per T-value) into a flat EFM data
+// image.  Each mode 1 sector's 2048 bytes of user data is written at
+// (LBA - first LBA) * 2048; sectors that fail their EDC are left as zeros.
+static int commandDecode(const QStringList &arguments, const EfmCodeTable &table, int threads, QString firstLba) {
+    QTextStream out(stdout);
+
+    if (arguments.count() != 3) {
+        qWarning() << "decode needs a capture and an output filename";
+        return 1;
+    }
+
+    QFile capture(arguments.at(1));
+    if (!capture.open(QIODevice::ReadOnly)) {
+        qWarning() << "Could not open capture:" << arguments.at(1);
+        return 1;
+    }
+    QFile image(arguments.at(2));
+    if (!image.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        qWarning() << "Could not create image:" << arguments.at(2);
+        return 1;
+    }
+
+    bool haveBase = !firstLba.isEmpty();
+    int32_t baseLba = firstLba.toInt();
+    uint64_t written = 0;
+    uint64_t skipped = 0;
+    bool writeFailed = false;
+
+    EfmPipeline pipeline(table, threads);
+    QElapsedTimer timer;
+    timer.start();
+    pipeline.run(
+        [&](uint8_t *buffer, size_t maximum) {
+            qint64 bytesRead = capture.read(reinterpret_cast<char *>(buffer), static_cast<qint64>(maximum));
+            return bytesRead > 0 ? static_cast<size_t>(bytesRead) : 0;
+        },
+        [&](int32_t lba, const uint8_t *userData, bool valid) {
+            if (!valid) return;
+            if (!haveBase) {
+                baseLba = lba;
+                haveBase = true;
+            }
+            if (lba < baseLba) {
+                skipped++;
+                return;
+            }
+            if (!image.seek(static_cast<qint64>(lba - baseLba) * DataSector::USER_BYTES) ||
+                image.write(reinterpret_cast<const char *>(userData), DataSector::USER_BYTES) != DataSector::USER_BYTES)
+                writeFailed = true;
+            written++;
+        });
+    double seconds = static_cast<double>(timer.nsecsElapsed()) / 1e9;
+    image.close();
+
+    if (writeFailed) {
+        qWarning() << "Failed writing image:" << arguments.at(2);
+        return 1;
+    }
+
+    printStatistics(out, pipeline.statistics());
+    out << "Wrote " << written << " sectors from LBA " << baseLba << " (" << skipped << " before it skipped) in "
+        << QString::number(seconds, 'f', 2) << "s using " << pipeline.threads() << " threads\n";
+    return 0;
+}
+
+// Generate a capture of sectors of random data (through the CIRC encoder and
+// EFM modulator), shortening or lengthening a fraction of the T-values
+static std::vector<uint8_t> synthesizeCapture(const EfmCodeTable &table, const QByteArray &userData,
+                                              int32_t firstLba, double errorRate) {
+    std::vector<uint8_t> sectorBytes;
+    uint8_t sector[DataSector::SECTOR_BYTES];
+    int sectors = static_cast<int>(userData.size() / DataSector::USER_BYTES);
+    for (int index = 0; index < sectors; index++) {
+        DataSector::encode(firstLba + index,
+                           reinterpret_cast<const uint8_t *>(userData.constData()) + index * DataSector::USER_BYTES,
+                           sector);
+        sectorBytes.insert(sectorBytes.end(), sector, sector + DataSector::SECTOR_BYTES);
+    }
+    while (sectorBytes.size() % 24) sectorBytes.push_back(0);
+
+    std::vector<uint8_t> tValues;
+    CircEncoder encoder;
+    EfmModulator modulator(table);
+    const uint8_t silence[24] = {0};
+    size_t frames = sectorBytes.size() / 24;
+    for (size_t frame = 0; frame < frames + CircDecoder::LATENCY; frame++) {
+        EfmFrame efmFrame;
+        encoder.push(frame < frames ? sectorBytes.data() + frame * 24 : silence, &efmFrame);
+        modulator.push(efmFrame, &tValues);
+    }
+    modulator.flush(&tValues);
+
+    if (errorRate > 0) {
+        QRandomGenerator random(415);
+        for (uint8_t &tValue : tValues) {
+            if (random.generateDouble() < errorRate) tValue = static_cast<uint8_t>(tValue > 3 ? tValue - 1 : tValue + 1);
+        }
+    }
+    return tValues;
+}
+
+// Decode a synthesized capture with 1, 2, 4... threads (up to the number of
+// cores) and report the throughput and scaling
+static int commandDecodeBench(const EfmCodeTable &table, int sectors, double errorRate) {
+    QTextStream out(stdout);
+    const int32_t firstLba = 1000;
+
+    QByteArray userData(static_cast<qsizetype>(sectors) * DataSector::USER_BYTES, 0);
+    QRandomGenerator random(415);
+    random.fillRange(reinterpret_cast<quint32 *>(userData.data()), userData.size() / 4);
+    std::vector<uint8_t> capture = synthesizeCapture(table, userData, firstLba, errorRate);
+
+    out << "Capture: " << sectors << " sectors, " << QString::number(capture.size() / 1e6, 'f', 1)
+        << " MB of T-values (" << SyndromeBatch::name(SyndromeBatch::best()) << " syndromes)\n";
+
+    int cores = static_cast<int>(std::thread::hardware_concurrency());
+    if (cores < 1) cores = 1;
+    QVector<int> threadCounts;
+    for (int threads = 1; threads < cores; threads *= 2) threadCounts.append(threads);
+    threadCounts.append(cores);
+
+    double singleThreadSeconds = 0;
+    for (int threads : threadCounts) {
+        EfmPipeline pipeline(table, threads);
+        size_t position = 0;
+        int good = 0;
+
+        QElapsedTimer timer;
+        timer.start();
+        pipeline.run(
+            [&](uint8_t *buffer, size_t maximum) {
+                size_t bytes = qMin(maximum, capture.size() - position);
+                memcpy(buffer, capture.data() + position, bytes);
+                position += bytes;
+                return bytes;
+            },
+            [&](int32_t lba, const uint8_t *data, bool valid) {
+                int index = lba - firstLba;
+                if (valid && index >= 0 && index < sectors &&
+                    memcmp(data, userData.constData() + index * DataSector::USER_BYTES, DataSector::USER_BYTES) == 0)
+                    good++;
+            });
+        double seconds = static_cast<double>(timer.nsecsElapsed()) / 1e9;
+        if (threads == 1) singleThreadSeconds = seconds;
+
+        double inputRate = capture.size() / seconds / 1e6;
+        double outputRate = static_cast<double>(good) * DataSector::USER_BYTES / seconds / 1e6;
+        out << threads << " threads: " << QString::number(seconds, 'f', 3) << "s, input "
+            << QString::number(inputRate, 'f', 1) << " MB/s, output " << QString::number(outputRate, 'f', 1)
+            << " MB/s, " << QString::number(inputRate / threads, 'f', 1) << " MB/s per core, speedup "
+            << QString::number(singleThreadSeconds / seconds, 'f', 2) << ", " << good << "/" << sectors
+            << " sectors correct\n";
+        if (threads == 1) printStatistics(out, pipeline.statistics());
+    }
+
+    return 0;
+}
+
+// Check the vector syndrome code and batched CIRC decoder against the scalar
+// reference, bit for bit, on the frames of a capture (or a synthesized one)
+static int commandCircTest(const QStringList &arguments, const EfmCodeTable &table, int sectors, double errorRate) {
+    QTextStream out(stdout);
+
+    std::vector<uint8_t> capture;
+    if (arguments.count() == 2) {
+        QFile file(arguments.at(1));
+        if (!file.open(QIODevice::ReadOnly)) {
+            qWarning() << "Could not open capture:" << arguments.at(1);
+            return 1;
+        }
+        QByteArray data = file.read(CIRC_TEST_BYTES);
+        capture.assign(data.constData(), data.constData() + data.size());
+    } else {
+        QByteArray userData(static_cast<qsizetype>(sectors) * DataSector::USER_BYTES, 0);
+        QRandomGenerator random(415);
+        random.fillRange(reinterpret_cast<quint32 *>(userData.data()), userData.size() / 4);
+        capture = synthesizeCapture(table, userData, 0, errorRate);
+    }
+
+    std::vector<ChannelFrame> channelFrames;
+    EfmDemodulator::findFrames(table, capture.data(), capture.size(), 0, capture.size(), 0, &channelFrames);
+    int count = static_cast<int>(channelFrames.size());
+    if (count == 0) {
+        qWarning() << "No frames found in the capture";
+        return 1;
+    }
+    std::vector<EfmFrame> frames;
+    for (const ChannelFrame &channelFrame : channelFrames) frames.push_back(channelFrame.frame);
+    out << "Frames: " << count << "\n";
+
+    bool passed = true;
+
+    // Syndromes of each frame's 32 symbols, for each implementation
+    std::vector<uint8_t> symbols(static_cast<size_t>(count) * 32);
+    for (int frame = 0; frame < count; frame++) {
+        for (int index = 0; index < 32; index++) symbols[static_cast<size_t>(index) * count + frame] = frames[frame].symbols[index];
+    }
+    std::vector<uint8_t> reference(static_cast<size_t>(count) * ReedSolomon::PARITY_SYMBOLS);
+    SyndromeBatch::syndromes(SyndromeBatch::Scalar, symbols.data(), 32, count, reference.data());
+
+    const SyndromeBatch::Implementation implementations[] = {
+        SyndromeBatch::Scalar, SyndromeBatch::Ssse3, SyndromeBatch::Avx2, SyndromeBatch::Neon
+    };
+    for (SyndromeBatch::Implementation implementation : implementations) {
+        if (!SyndromeBatch::isSupported(implementation)) continue;
+
+        std::vector<uint8_t> syndromes(reference.size());
+        QElapsedTimer timer;
+        timer.start();
+        SyndromeBatch::syndromes(implementation, symbols.data(), 32, count, syndromes.data());
+        double seconds = static_cast<double>(timer.nsecsElapsed()) / 1e9;
+
+        bool matches = syndromes == reference;
+        passed = passed && matches;
+        out << "Syndromes (" << SyndromeBatch::name(implementation) << "): "
+            << QString::number(count / seconds / 1e6, 'f', 1) << " M codewords/s, "
+            << (matches ? "matches" : "DIFFERS FROM") << " scalar\n";
+    }
+
+    // The whole CIRC decoder, one frame at a time and batched
+    std::vector<CircFrame> scalarOutput(frames.size());
+    std::vector<CircFrame> batchOutput(frames.size());
+    CircDecoder::Statistics scalarStatistics;
+    CircDecoder::Statistics batchStatistics;
+    memset(&scalarStatistics, 0, sizeof(scalarStatistics));
+    memset(&batchStatistics, 0, sizeof(batchStatistics));
+
+    CircDecoder scalarDecoder;
+    QElapsedTimer timer;
+    timer.start();
+    for (int frame = 0; frame < count; frame++) scalarDecoder.push(frames[frame], &scalarOutput[frame], &scalarStatistics);
+    double scalarSeconds = static_cast<double>(timer.nsecsElapsed()) / 1e9;
+
+    CircDecoder batchDecoder;
+    timer.restart();
+    batchDecoder.pushFrames(frames.data(), count, batchOutput.data(), &batchStatistics);
+    double batchSeconds = static_cast<double>(timer.nsecsElapsed()) / 1e9;
+
+    int differences = 0;
+    for (int frame = 0; frame < count; frame++) {
+        if (memcmp(scalarOutput[frame].data, batchOutput[frame].data, sizeof(scalarOutput[frame].data)) != 0 ||
+            scalarOutput[frame].erasures != batchOutput[frame].erasures)
+            differences++;
+    }
+    bool statisticsMatch = memcmp(&scalarStatistics, &batchStatistics, sizeof(scalarStatistics)) == 0;
+    passed = passed && differences == 0 && statisticsMatch;
+
+    out << "CIRC: scalar " << QString::number(count / scalarSeconds / 1e3, 'f', 1) << " k frames/s, batched ("
+        << SyndromeBatch::name(SyndromeBatch::best()) << ") " << QString::number(count / batchSeconds / 1e3, 'f', 1)
+        << " k frames/s, " << differences << " frames differ, statistics "
+        << (statisticsMatch ? "match" : "differ") << "\n";
+    out << "C1: " << scalarStatistics.c1Corrected << " symbols corrected, " << scalarStatistics.c1Failed << " failed\n";
+    out << "C2: " << scalarStatistics.c2Corrected << " symbols corrected, " << scalarStatistics.c2Failed << " failed\n";
+    out << (passed ? "PASSED\n" : "FAILED\n");
+
+    return passed ? 0 : 1;
+}
+
+// Print the mean, percentiles and worst case of a set of times (in nS)
+static void printLatencies(QTextStream &out, const char *name, std::vector<int64_t> &latencies) {
+    std::sort(latencies.begin(), latencies.end());
+    double total = 0;
+    for (int64_t latency : latencies) total += static_cast<double>(latency);
+
+    auto percentile = [&latencies](double fraction) {
+        size_t index = static_cast<size_t>(fraction * static_cast<double>(latencies.size() - 1));
+        return QString::number(static_cast<double>(latencies[index]) / 1000.0, 'f', 1);
+    };
+    out << "  " << name << ": mean " << QString::number(total / latencies.size() / 1000.0, 'f', 1) << " uS, 99% "
+        << percentile(0.99) << " uS, 99.9% " << percentile(0.999) << " uS, worst "
+        << QString::number(static_cast<double>(latencies.back()) / 1000.0, 'f', 1) << " uS\n";
+}
+
+// Measure how late read requests are answered (one every JITTER_PERIOD_US,
+// as the Pico makes them when streaming) while other threads load every
+// core and the storage, with or without the real-time mode (--realtime)
+static int commandJitterTest(const QStringList &arguments, int seconds, int realtimeCore, int stressThreads) {
+    QTextStream out(stdout);
+
+    if (arguments.count() != 2) {
+        qWarning() << "jitter-test needs an image";
+        return 1;
+    }
+
+    // Start the stress first, so its threads don't inherit the serving core
+    // and priority: CPU threads spinning, and a thread writing and syncing a
+    // scratch file beside the image (as SD card writeback would)
+    std::atomic<bool> stopping{false};
+    std::vector<std::thread> stress;
+    if (stressThreads < 0) stressThreads = static_cast<int>(std::thread::hardware_concurrency());
+    for (int thread = 0; thread < stressThreads; thread++) {
+        stress.emplace_back([&stopping]() {
+            volatile uint64_t value = 0;
+            while (!stopping.load(std::memory_order_relaxed)) value = value * 6364136223846793005ULL + 1;
+        });
+    }
+    QString scratchTemplate = QFileInfo(arguments.at(1)).absolutePath() + "/jitter-test-XXXXXX";
+    stress.emplace_back([&stopping, scratchTemplate]() {
+        QTemporaryFile scratch(scratchTemplate);
+        if (!scratch.open()) {
+            qWarning() << "Failed to create the scratch file for the storage stress:" << scratchTemplate;
+            return;
+        }
+        QByteArray block(1024 * 1024, '\x55');
+        while (!stopping.load(std::memory_order_relaxed)) {
+            if (scratch.size() >= JITTER_SCRATCH_BYTES) scratch.seek(0);
+            scratch.write(block);
+            scratch.flush();
+#ifdef Q_OS_UNIX
+            fsync(scratch.handle());
+#endif
+        }
+    });
+
+    // Enter real-time mode before opening the image, so the mapped image is
+    // locked
+    if (realtimeCore >= 0 && !RealTime::enable(realtimeCore))
+        qWarning() << "Real-time mode is incomplete (run as root?)";
+
+    EfmData efmData;
+    efmData.setMapBackingFiles(realtimeCore >= 0);
+    bool opened = efmData.openEfmData(arguments.at(1)) && efmData.sectorCount() != 0;
+
+    // The results are kept in preallocated buffers, so the measuring loop
+    // doesn't allocate them
+    size_t requests = static_cast<size_t>(seconds) * 1000000 / JITTER_PERIOD_US;
+    std::vector<int64_t> wakeLatencies(requests);
+    std::vector<int64_t> responseLatencies(requests);
+    size_t lateResponses = 0;
+
+    if (opened) {
+        uint32_t sectorCount = efmData.sectorCount();
+        QRandomGenerator random(415);
+        auto start = std::chrono::steady_clock::now();
+        for (size_t request = 0; request < requests; request++) {
+            auto due = start + std::chrono::microseconds(static_cast<int64_t>(request) * JITTER_PERIOD_US);
+            std::this_thread::sleep_until(due);
+            auto woken = std::chrono::steady_clock::now();
+
+            uint32_t sector = random.bounded(sectorCount);
+            for (uint32_t offset = 0; offset < JITTER_READ_SECTORS && sector + offset < sectorCount; offset++)
+                efmData.getEfmSectorData(sector + offset);
+            auto answered = std::chrono::steady_clock::now();
+
+            wakeLatencies[request] = std::chrono::duration_cast<std::chrono::nanoseconds>(woken - due).count();
+            responseLatencies[request] = std::chrono::duration_cast<std::chrono::nanoseconds>(answered - due).count();
+            if (answered - due > std::chrono::microseconds(JITTER_PERIOD_US)) lateResponses++;
+        }
+    }
+
+    stopping = true;
+    for (std::thread &thread : stress) thread.join();
+
+    if (!opened) {
+        qWarning() << "Failed to open image:" << arguments.at(1);
+        return 1;
+    }
+
+    out << arguments.at(1) << ": " << requests << " requests of " << JITTER_READ_SECTORS << " sectors over "
+        << seconds << " s with " << stressThreads << " CPU stress threads and a storage stress thread, "
+        << (realtimeCore >= 0 ? QString("real-time on core %1").arg(realtimeCore) : QString("normal scheduling"))
+        << "\n";
+    printLatencies(out, "wake-up ", wakeLatencies);
+    printLatencies(out, "response", responseLatencies);
+    out << "  responses later than the request period: " << lateResponses << "\n";
+    return 0;
+}
+
+#ifdef Q_OS_UNIX
+// A simulated Pico for serve-bench.  It talks to vp415-host's link code
+// (PicoLink and PicoComs, on the host's event loop) through a pseudo-terminal,
+// framing its requests as picom.c does: the length, a sequence number, then
+// the request, which is resent with the same sequence number if the link is
+// silent for SERVE_ATTEMPT_MS.  A request's bytes are paced at the link's baud
+// rate (if given), so the host sees frames arrive a part at a time.
+class BenchPico {
+public:
+    explicit BenchPico(int baudRate) : m_baudRate(baudRate) {}
+    ~BenchPico() {
+        if (m_fd >= 0) ::close(m_fd);
+    }
+
+    // Open the pseudo-terminal and return the device the host should open
+    QString open() {
+        m_fd = posix_openpt(O_RDWR | O_NOCTTY);
+        if (m_fd < 0 || grantpt(m_fd) != 0 || unlockpt(m_fd) != 0) return QString();
+
+        struct termios attributes;
+        if (tcgetattr(m_fd, &attributes) == 0) {
+            cfmakeraw(&attributes);
+            tcsetattr(m_fd, TCSANOW, &attributes);
+        }
+        return QString::fromLocal8Bit(ptsname(m_fd));
+    }
+
+    // Send a request and wait for its reply.  Returns false if there was no
+    // reply within SERVE_TIMEOUT_MS.
+    bool transfer(const QByteArray &request, QByteArray *reply) {
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(SERVE_TIMEOUT_MS);
+        uint8_t sequence = ++m_sequence;
+        QByteArray header(3, 0x00);
+        header[0] = static_cast<char>((request.size() >> 8) & 0xFF);
+        header[1] = static_cast<char>(request.size() & 0xFF);
+        header[2] = static_cast<char>(sequence);
+
+        while (std::chrono::steady_clock::now() < deadline) {
+            if (!writeAll(header)) return false;
+            if (m_baudRate > 0)
+                std::this_thread::sleep_for(std::chrono::microseconds(request.size() * 10000000LL / m_baudRate));
+            if (!writeAll(request)) return false;
+            if (receiveReply(sequence, reply)) return true;
+
+            // Lost or late; resend once the link is quiet
+            m_resends++;
+            char discard[256];
+            while (readWithin(discard, sizeof(discard), SERVE_RESYNC_QUIET_MS) > 0) {}
+        }
+        return false;
+    }
+
+    int resends() const { return m_resends; }
+
+private:
+    int m_baudRate;
+    int m_fd = -1;
+    uint8_t m_sequence = 0;
+    int m_resends = 0;
+
+    bool writeAll(const QByteArray &data) {
+        qsizetype written = 0;
+        while (written < data.size()) {
+            ssize_t result = ::write(m_fd, data.constData() + written, static_cast<size_t>(data.size() - written));
+            if (result < 0) return false;
+            written += result;
+        }
+        return true;
+    }
+
+    // Read what is available, waiting up to timeoutMs for something to arrive
+    // (returns 0 on timeout)
+    ssize_t readWithin(char *buffer, size_t length, int timeoutMs) {
+        struct pollfd descriptor{m_fd, POLLIN, 0};
+        if (poll(&descriptor, 1, timeoutMs) <= 0) return 0;
+        return ::read(m_fd, buffer, length);
+    }
+
+    // Read exactly length bytes; the link may be silent for SERVE_ATTEMPT_MS
+    // between them
+    bool readExactly(char *buffer, qsizetype length) {
+        qsizetype received = 0;
+        while (received < length) {
+            ssize_t result = readWithin(buffer + received, static_cast<size_t>(length - received), SERVE_ATTEMPT_MS);
+            if (result <= 0) return false;
+            received += result;
+        }
+        return true;
+    }
+
+    // Receive replies until the one for this request arrives (replies with
+    // another sequence number answered an earlier attempt)
+    bool receiveReply(uint8_t sequence, QByteArray *reply) {
+        while (true) {
+            char header[3];
+            if (!readExactly(header, 3)) return false;
+            qsizetype length = (static_cast<uint8_t>(header[0]) << 8) | static_cast<uint8_t>(header[1]);
+            reply->resize(length);
+            if (!readExactly(reply->data(), length)) return false;
+            if (static_cast<uint8_t>(header[2]) == sequence) return true;
+        }
+    }
+};
+
+// Append a uint32_t big-endian to a request
+static void appendUint32(QByteArray *data, uint32_t value) {
+    data->append(static_cast<char>((value >> 24) & 0xFF));
+    data->append(static_cast<char>((value >> 16) & 0xFF));
+    data->append(static_cast<char>((value >> 8) & 0xFF));
+    data->append(static_cast<char>(value & 0xFF));
+}
+#endif
+
+// Serve simulated units through the host's link code (a PicoLink per unit,
+// all served from one event loop with a shared EfmData and cache, as
+// vp415-host does).  Each unit is a simulated Pico on its own thread and
+// pseudo-terminal, asking for sectors (with prefetch hints) at a fixed rate.
+// The number of units is doubled up to maxUnits; served sectors keep up with
+// the demand until the storage (or the serving thread) runs out of bandwidth.
+static int commandServeBench(const QStringList &arguments, int maxUnits, int seconds, int unitRate, int baudRate) {
+    QTextStream out(stdout);
+
+    if (arguments.count() != 2) {
+        qWarning() << "serve-bench needs an image";
+        return 1;
+    }
+
+#ifndef Q_OS_UNIX
+    Q_UNUSED(maxUnits);
+    Q_UNUSED(seconds);
+    Q_UNUSED(unitRate);
+    Q_UNUSED(baudRate);
+    qWarning() << "serve-bench needs pseudo-terminals";
+    return 1;
+#else
+    Metrics metrics;
+    EfmData efmData;
+    efmData.setMetrics(&metrics);
+    if (!efmData.openEfmData(arguments.at(1)) || efmData.sectorCount() == 0) {
+        qWarning() << "Failed to open image:" << arguments.at(1);
+        return 1;
+    }
+    uint32_t sectorCount = efmData.sectorCount();
+    auto interval = std::chrono::nanoseconds(1000000000LL / unitRate);
+
+    // The host's side: PIC_READ_SECTORS and PIC_PREFETCH_HINT, answered as
+    // MainWindow answers them
+    auto serve = [&efmData](PicoLink *link, const QByteArray &data) {
+        uint8_t command = data.isEmpty() ? 0 : static_cast<uint8_t>(data[0]);
+        if (data.size() < 7 || (command != 0x08 && command != 0x0A)) {
+            link->writeData(QByteArray());
+            return;
+        }
+        uint32_t startSector = (static_cast<uint32_t>(static_cast<uint8_t>(data[2])) << 24) |
+                               (static_cast<uint32_t>(static_cast<uint8_t>(data[3])) << 16) |
+                               (static_cast<uint32_t>(static_cast<uint8_t>(data[4])) << 8) |
+                               static_cast<uint32_t>(static_cast<uint8_t>(data[5]));
+        uint8_t numberOfSectors = static_cast<uint8_t>(data[6]);
+
+        if (command == 0x0A) {
+            link->writeData(QByteArray(1, 0x00));
+            QTimer::singleShot(0, link, [&efmData, startSector, numberOfSectors]() {
+                efmData.prefetch(startSector, numberOfSectors);
+            });
+            return;
+        }
+
+        QByteArray sectorData;
+        for (uint32_t sector = startSector; sector < startSector + numberOfSectors; sector++) {
+            QByteArray efmSectorData = efmData.getEfmSectorData(sector);
+            if (efmSectorData.size() != 256) {
+                sectorData.clear();
+                break;
+            }
+            sectorData.append(efmSectorData);
+        }
+        link->writeData(sectorData);
+    };
+
+    out << arguments.at(1) << ": " << sectorCount << " sectors, each unit reading " << unitRate
+        << " sectors/s in runs of " << SERVE_RUN_SECTORS << " over a "
+        << (baudRate > 0 ? QString("%1 baud").arg(baudRate) : QString("unpaced")) << " link\n";
+    out << "units  demand (sectors/s)  served (sectors/s)  served/demand  worst lateness (ms)  cache hits"
+           "  resends\n";
+
+    for (int units = 1; units <= maxUnits; units *= 2) {
+        struct Unit {
+            std::unique_ptr<BenchPico> pico;
+            std::unique_ptr<PicoLink> link;
+            uint64_t served;
+            std::chrono::nanoseconds worstLateness;
+            bool failed;
+        };
+        std::vector<Unit> unitStates(static_cast<size_t>(units));
+        for (int unit = 0; unit < units; unit++) {
+            Unit &state = unitStates[unit];
+            state.pico = std::make_unique<BenchPico>(baudRate);
+            state.link = std::make_unique<PicoLink>(unit);
+            state.link->setMetrics(&metrics);
+            QString deviceName = state.pico->open();
+            if (deviceName.isEmpty() || !state.link->open(deviceName)) {
+                qWarning() << "Failed to open a pseudo-terminal for unit" << unit;
+                return 1;
+            }
+            QObject::connect(state.link.get(), &PicoLink::dataReceived, state.link.get(), serve);
+            state.served = 0;
+            state.worstLateness = std::chrono::nanoseconds(0);
+            state.failed = false;
+        }
+
+        efmData.setCacheExtents(units * SERVE_CACHE_EXTENTS_PER_UNIT);
+        uint64_t hits = metrics.efmCacheHits.value();
+        uint64_t misses = metrics.efmCacheMisses.value();
+        auto start = std::chrono::steady_clock::now();
+        auto end = start + std::chrono::seconds(seconds);
+
+        // Each Pico seeks (with a prefetch hint) at the start of each run and
+        // hints again every extent
+        std::atomic<int> running{units};
+        std::vector<std::thread> picos;
+        for (int unit = 0; unit < units; unit++) {
+            picos.emplace_back([&, unit]() {
+                Unit &state = unitStates[unit];
+                QRandomGenerator random(415 + unit);
+                auto due = start + interval * unit / units;  // Stagger the first requests
+                uint32_t sector = 0;
+                uint32_t runSectors = 0;
+                QByteArray reply;
+
+                while (due < end && !state.failed) {
+                    std::this_thread::sleep_until(due);
+
+                    bool hint = false;
+                    if (runSectors == 0 || sector >= sectorCount) {
+                        sector = random.bounded(sectorCount);
+                        runSectors = SERVE_RUN_SECTORS;
+                        hint = true;
+                    } else if (sector % EfmData::PREFETCH_SECTORS == 0) {
+                        hint = true;
+                    }
+                    if (hint) {
+                        // [1] LUN, [2-5] sector, [6] sectors, [7-18] the Pico's prefetch counters
+                        QByteArray request(1, 0x0A);
+                        request.append('\0');
+                        appendUint32(&request, sector);
+                        request.append(static_cast<char>(EfmData::PREFETCH_SECTORS));
+                        request.append(QByteArray(12, 0x00));
+                        if (!state.pico->transfer(request, &reply)) state.failed = true;
+                    }
+
+                    QByteArray request(1, 0x08);
+                    request.append('\0');
+                    appendUint32(&request, sector);
+                    request.append('\x01');
+                    if (!state.pico->transfer(request, &reply) || reply.size() != 256) state.failed = true;
+
+                    sector++;
+                    runSectors--;
+                    state.served++;
+                    auto lateness = std::chrono::steady_clock::now() - due;
+                    if (lateness > state.worstLateness) state.worstLateness = lateness;
+                    due += interval;
+                }
+                running--;
+            });
+        }
+
+        // Serve the links until every Pico has finished
+        QEventLoop loop;
+        QTimer doneTimer;
+        QObject::connect(&doneTimer, &QTimer::timeout, &loop, [&loop, &running]() {
+            if (running == 0) loop.quit();
+        });
+        doneTimer.start(10);
+        loop.exec();
+        for (std::thread &thread : picos) thread.join();
+
+        double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        double demand = static_cast<double>(units) * unitRate;
+        uint64_t served = 0;
+        int resends = 0;
+        std::chrono::nanoseconds worstLateness(0);
+        for (Unit &state : unitStates) {
+            if (state.failed) {
+                qWarning() << "A unit's request went unanswered:" << arguments.at(1);
+                return 1;
+            }
+            served += state.served;
+            resends += state.pico->resends();
+            if (state.worstLateness > worstLateness) worstLateness = state.worstLateness;
+        }
+        double servedRate = static_cast<double>(served) / elapsed;
+        hits = metrics.efmCacheHits.value() - hits;
+        misses = metrics.efmCacheMisses.value() - misses;
+
+        out << QString("%1  %2  %3  %4%  %5  %6%  %7\n")
+                   .arg(units, 5)
+                   .arg(demand, 18, 'f', 0)
+                   .arg(servedRate, 18, 'f', 0)
+                   .arg(100.0 * servedRate / demand, 12, 'f', 1)
+                   .arg(std::chrono::duration<double, std::milli>(worstLateness).count(), 19, 'f', 1)
+                   .arg(hits + misses ? 100.0 * hits / (hits + misses) : 0.0, 9, 'f', 1)
+                   .arg(resends, 8);
+        out.flush();
+    }
+
+    return 0;
+#endif
+}
+
+int main(int argc, char *argv[]) {
+    QCoreApplication app(argc, argv);
+
+    // Set application name and version
+    QCoreApplication::setApplicationName("vp415-efmtool");
+    QCoreApplication::setApplicationVersion(
+            QString("Branch: %1 / Commit: %2").arg(APP_BRANCH, APP_COMMIT));
+    QCoreApplication::setOrganizationDomain("domesday86.com");
+
+    // Set up the command line parser
+    QCommandLineParser parser;
+    parser.setApplicationDescription(
+            "vp415-efmtool - EFM data image tool for the VP415 Emulator\n"
+            "\n"
+            "Commands:\n"
+            "  compress <image.dat> <image.efmz>  Convert a flat image to a seekable compressed image\n"
+            "  import <image> <manifest.vpcm>     Add an image to a chunk store (--store) and write its manifest\n"
+            "  bench <image>...                   Benchmark sector reads from flat, compressed or manifest images\n"
+            "  decode <capture.efm> <image.dat>   Decode a raw EFM capture (T-values) to an image\n"
+            "  decode-bench                       Benchmark EFM decoding across 1 to all cores\n"
+            "  circ-test [capture.efm]            Check the vector CIRC decoder against the scalar one\n"
+            "  jitter-test <image>                Measure read response times under CPU and storage stress\n"
+            "  serve-bench <image>                Benchmark serving 1 to --units simulated Picos over the host's link\n"
+            "\n"
+            "(c)2025 Simon Inns\n"
+            "GPLv3 Open-Source - github: https://github.com/simoninns/efm-tools");
+    parser.addHelpOption();
+    parser.addVersionOption();
+
+    // -- General options --
+
+    QCommandLineOption chunkSectorsOption(QStringList() << "chunk-sectors",
+        QCoreApplication::translate("main", "Sectors per compressed chunk (default 64)"),
+        QCoreApplication::translate("main", "sectors"), "64");
+    parser.addOption(chunkSectorsOption);
+
+    QCommandLineOption levelOption(QStringList() << "level",
+        QCoreApplication::translate("main", "zlib compression level 0-9 (default 6)"),
+        QCoreApplication::translate("main", "level"), "-1");
+    parser.addOption(levelOption);
+
+    QCommandLineOption storeOption(QStringList() << "store",
+        QCoreApplication::translate("main", "Chunk store directory for import"),
+        QCoreApplication::translate("main", "directory"));
+    parser.addOption(storeOption);
+
+    QCommandLineOption readsOption(QStringList() << "reads",
+        QCoreApplication::translate("main", "Sector reads per benchmark (default 100000)"),
+        QCoreApplication::translate("main", "reads"), "100000");
+    parser.addOption(readsOption);
+
+    // -- EFM decoding options --
+
+    QCommandLineOption efmTableOption(QStringList() << "efm-table",
+        QCoreApplication::translate("main", "EFM code table file, one 14 bit code per line (default ECMA-130 Annex D)"),
+        QCoreApplication::translate("main", "file"));
+    parser.addOption(efmTableOption);
+
+    QCommandLineOption syntheticTableOption(QStringList() << "synthetic-table",
+        QCoreApplication::translate("main", "Benchmark decode-bench with a synthetic EFM code table"));
+    parser.addOption(syntheticTableOption);
+
+    QCommandLineOption threadsOption(QStringList() << "threads",
+        QCoreApplication::translate("main", "Decoding threads (default one per core)"),
+        QCoreApplication::translate("main", "threads"), "0");
+    parser.addOption(threadsOption);
+
+    QCommandLineOption firstLbaOption(QStringList() << "first-lba",
+        QCoreApplication::translate("main", "LBA of the first image sector (default the first decoded)"),
+        QCoreApplication::translate("main", "lba"));
+    parser.addOption(firstLbaOption);
+
+    QCommandLineOption sectorsOption(QStringList() << "sectors",
+        QCoreApplication::translate("main", "Sectors in the decode benchmark capture (default 4000)"),
+        QCoreApplication::translate("main", "sectors"), "4000");
+    parser.addOption(sectorsOption);
+
+    QCommandLineOption errorRateOption(QStringList() << "error-rate",
+        QCoreApplication::translate("main", "Fraction of T-values corrupted in synthesized captures (default 0)"),
+        QCoreApplication::translate("main", "rate"), "0");
+    parser.addOption(errorRateOption);
+
+    // -- Jitter test options --
+
+    QCommandLineOption durationOption(QStringList() << "duration",
+        QCoreApplication::translate("main", "Jitter test (or serve-bench step) duration in seconds (default 10)"),
+        QCoreApplication::translate("main", "seconds"), "10");
+    parser.addOption(durationOption);
+
+    QCommandLineOption realtimeOption(QStringList() << "realtime",
+        QCoreApplication::translate("main", "Run the jitter test's serving thread in real-time mode on a core"),
+        QCoreApplication::translate("main", "core"), "-1");
+    parser.addOption(realtimeOption);
+
+    QCommandLineOption stressOption(QStringList() << "stress",
+        QCoreApplication::translate("main", "Jitter test CPU stress threads (default one per core)"),
+        QCoreApplication::translate("main", "threads"), "-1");
+    parser.addOption(stressOption);
+
+    // -- Serving benchmark options --
+
+    QCommandLineOption unitsOption(QStringList() << "units",
+        QCoreApplication::translate("main", "Most units served by serve-bench (default 16)"),
+        QCoreApplication::translate("main", "units"), "16");
+    parser.addOption(unitsOption);
+
+    QCommandLineOption unitRateOption(QStringList() << "unit-rate",
+        QCoreApplication::translate("main", "Sectors per second read by each serve-bench unit (default 1000)"),
+        QCoreApplication::translate("main", "sectors"), "1000");
+    parser.addOption(unitRateOption);
+
+    QCommandLineOption baudOption(QStringList() << "baud",
+        QCoreApplication::translate("main", "Baud rate serve-bench requests are paced at, 0 for none (default 115200)"),
+        QCoreApplication::translate("main", "baud"), "115200");
+    parser.addOption(baudOption);
+
+    // -- Positional arguments --
+    parser.addPositionalArgument("command",
+        QCoreApplication::translate("main",
+                                    "index, compress, import, bench, decode, decode-bench, circ-test, jitter-test "
+                                    "or serve-bench"));
+
+    // Process the command line options and arguments given by the user
+    parser.process(app);
+
+    QStringList positionalArguments = parser.positionalArguments();
+    if (positionalArguments.isEmpty()) {
+        qWarning() << "You must specify a command";
+        return 1;
+    }
+
+    QString command = positionalArguments.at(0);
+    if (command == "index") return commandIndex(positionalArguments);
+    if (command == "compress") {
+        uint32_t chunkSectors = parser.value(chunkSectorsOption).toUInt();
+        return commandCompress(positionalArguments, chunkSectors, parser.value(levelOption).toInt());
+    }
+    if (command == "import") {
+        return commandImport(positionalArguments, parser.value(storeOption), parser.value(levelOption).toInt());
+    }
+    if (command == "bench") {
+        uint32_t reads = parser.value(readsOption).toUInt();
+        if (reads == 0) reads = 1;
+        return commandBench(positionalArguments, reads);
+    }
+    if (command == "jitter-test") {
+        int seconds = parser.value(durationOption).toInt();
+        if (seconds < 1) seconds = 1;
+        return commandJitterTest(positionalArguments, seconds, parser.value(realtimeOption).toInt(),
+                                 parser.value(stressOption).toInt());
+    }
+    if (command == "serve-bench") {
+        int seconds = parser.value(durationOption).toInt();
+        if (seconds < 1) seconds = 1;
+        return commandServeBench(positionalArguments, qMax(parser.value(unitsOption).toInt(), 1), seconds,
+                                 qMax(parser.value(unitRateOption).toInt(), 1),
+                                 qMax(parser.value(baudOption).toInt(), 0));
+    }
+    if (command == "decode" || command == "decode-bench" || command == "circ-test") {
+        EfmCodeTable table;
+        if (parser.isSet(efmTableOption)) {
+            if (!loadCodeTable(parser.value(efmTableOption), &table)) return 1;
+        } else {
+            uint16_t codes[256];
+            if (command == "decode-bench" && parser.isSet(syntheticTableOption))
+                EfmCodeTable::syntheticCodes(codes);
+            else
+                EfmCodeTable::annexDCodes(codes);
+            table.setCodes(codes);
+        }
+
+        if (command == "decode")
+            return commandDecode(positionalArguments, table, parser.value(threadsOption).toInt(),
+                                 parser.value(firstLbaOption));
+
+        int sectors = parser.value(sectorsOption).toInt();
+        if (sectors < 1) sectors = 1;
+        if (command == "circ-test")
+            return commandCircTest(positionalArguments, table, sectors, parser.value(errorRateOption).toDouble());
+        return commandDecodeBench(table, sectors, parser.value(errorRateOption).toDouble());
+    }
+
+    qWarning() << "Unknown command:" << command;
+    return 1;
+}
@@ -0,0 +1,207 @@
+/************************************************************************
+
+    extentindex.cpp
+
+    VP415-host - A host application for the VP415 Emulator
+    VP415-Emulator
+    Copyright (C) 2025 Simon Inns
+
+    This file is part of VP415-Emulator.
+
+    This is free software: you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Email: simon.inns@gmail.com
+
+************************************************************************/
+
+#include "extentindex.h"
+
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QDebug>
+#include <QFileInfo>
+#include <QSaveFile>
+
+// Sidecar file header
+static const quint32 INDEX_MAGIC = 0x56504958;  // "VPIX"
+static const quint32 INDEX_VERSION = 1;
+static const int CHECKSUM_LENGTH = 32;          // Blake2b-256
+
+ExtentIndex::ExtentIndex(QObject *parent) : QObject(parent) {
+    m_isValid = false;
+    m_imageFile = nullptr;
+    m_imageSize = 0;
+}
+
+ExtentIndex::~ExtentIndex() {}
+
+// The index for "disc.dat" is kept in "disc.dat.idx"
+QString ExtentIndex::indexFilename(QString imageFilename) {
+    return imageFilename + ".idx";
+}
+
+// Build the index for an image and save it next to the image
+bool ExtentIndex::create(QString imageFilename) {
+    QFile imageFile(imageFilename);
+    if (!imageFile.open(QIODevice::ReadOnly)) {
+        qDebug() << "ExtentIndex::create() - Failed to open image: " << imageFilename;
+        return false;
+    }
+
+    ExtentIndex index;
+    index.m_imageFile = &imageFile;
+    index.m_imageSize = imageFile.size();
+    if (!index.build()) return false;
+
+    QString filename = indexFilename(imageFilename);
+    if (!index.save(filename)) {
+        qDebug() << "ExtentIndex::create() - Failed to save index: " << filename;
+        return false;
+    }
+    return true;
+}
+
+// Open the (stored) index for an image.  A missing or out of date index isn't
+// rebuilt here, so verification is unavailable until it is built offline.
+bool ExtentIndex::open(QFile *imageFile, QString imageFilename) {
+    close();
+    m_imageFile = imageFile;
+    m_imageSize = imageFile->size();
+
+    QString filename = indexFilename(imageFilename);
+    QFileInfo imageInfo(imageFilename);
+    QFileInfo indexInfo(filename);
+
+    if (indexInfo.exists() && indexInfo.lastModified() >= imageInfo.lastModified() && load(filename)) {
+        qDebug() << "ExtentIndex::open() - Loaded index: " << filename << "with" << m_checksums.size() << "extents";
+        m_isValid = true;
+        return true;
+    }
+
+    qDebug() << "ExtentIndex::open() - No up to date index for: " << imageFilename
+             << "(build it with vp415-efmtool index)";
+    m_checksums.clear();
+    return false;
+}
+
+void ExtentIndex::close() {
+    m_isValid = false;
+    m_imageFile = nullptr;
+    m_checksums.clear();
+}
+
+// Checksum an extent of the image (the last extent may be short)
+QByteArray ExtentIndex::extentChecksum(uint32_t extent, uint32_t *sectorsRead) {
+    m_imageFile->seek(static_cast<qint64>(extent) * EXTENT_SECTORS * 256);
+    QByteArray data = m_imageFile->read(static_cast<qint64>(EXTENT_SECTORS) * 256);
+    *sectorsRead = static_cast<uint32_t>(data.size() / 256);
+
+    return QCryptographicHash::hash(data, QCryptographicHash::Blake2b_256);
+}
+
+bool ExtentIndex::build() {
+    uint32_t extents = static_cast<uint32_t>((m_imageSize + (EXTENT_SECTORS * 256) - 1) / (EXTENT_SECTORS * 256));
+    uint32_t sectorsRead;
+
+    m_checksums.resize(extents);
+    for (uint32_t extent = 0; extent < extents; extent++)
+        m_checksums[extent] = extentChecksum(extent, &sectorsRead);
+
+    return true;
+}
+
+bool ExtentIndex::load(QString filename) {
+    QFile file(filename);
+    if (!file.open(QIODevice::ReadOnly)) return false;
+
+    QDataStream stream(&file);
+    quint32 magic, version, extentSectors, extents;
+    qint64 imageSize;
+    stream >> magic >> version >> extentSectors >> imageSize >> extents;
+
+    if (magic != INDEX_MAGIC || version != INDEX_VERSION || extentSectors != EXTENT_SECTORS ||
+        imageSize != m_imageSize) {
+        qDebug() << "ExtentIndex::load() - Index does not match the image: " << filename;
+        return false;
+    }
+
+    m_checksums.resize(extents);
+    for (quint32 extent = 0; extent < extents; extent++) {
+        m_checksums[extent].resize(CHECKSUM_LENGTH);
+        if (stream.readRawData(m_checksums[extent].data(), CHECKSUM_LENGTH) != CHECKSUM_LENGTH) {
+            m_checksums.clear();
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// The index is written to a temporary file and renamed over the old one, so
+// a reader never sees a partial index
+bool ExtentIndex::save(QString filename) {
+    QSaveFile file(filename);
+    if (!file.open(QIODevice::WriteOnly)) return false;
+
+    QDataStream stream(&file);
+    stream << INDEX_MAGIC << INDEX_VERSION << static_cast<quint32>(EXTENT_SECTORS) << m_imageSize
+           << static_cast<quint32>(m_checksums.size());
+    for (const QByteArray &checksum : m_checksums) stream.writeRawData(checksum.constData(), checksum.size());
+
+    if (stream.status() != QDataStream::Ok) {
+        file.cancelWriting();
+        return false;
+    }
+    return file.commit();
+}
+
+// Verify a range of sectors against the index.  Each extent that overlaps the
+// range is re-read and checked; on failure firstBadSector is set to the first
+// sector of the range within the failing extent (or the first sector beyond the
+// end of the image).
+bool ExtentIndex::verify(uint32_t startSector, uint32_t numberOfSectors, uint32_t *firstBadSector) {
+    if (!m_isValid || numberOfSectors == 0) {
+        *firstBadSector = startSector;
+        return m_isValid;
+    }
+
+    uint64_t endSector = static_cast<uint64_t>(startSector) + numberOfSectors;  // Exclusive
+    uint32_t firstExtent = startSector / EXTENT_SECTORS;
+    uint32_t lastExtent = static_cast<uint32_t>((endSector - 1) / EXTENT_SECTORS);
+
+    for (uint32_t extent = firstExtent; extent <= lastExtent; extent++) {
+        uint32_t extentStart = extent * EXTENT_SECTORS;
+        uint32_t rangeStart = (extentStart > startSector) ? extentStart : startSector;
+        uint32_t sectorsRead = 0;
+
+        if (extent >= static_cast<uint32_t>(m_checksums.size())) {
+            *firstBadSector = rangeStart;
+            return false;
+        }
+
+        if (extentChecksum(extent, &sectorsRead) != m_checksums[extent]) {
+            *firstBadSector = rangeStart;
+            return false;
+        }
+
+        // The range runs off the end of the image?
+        if (sectorsRead < EXTENT_SECTORS && static_cast<uint64_t>(extentStart) + sectorsRead < endSector) {
+            *firstBadSector = extentStart + sectorsRead;
+            if (*firstBadSector < rangeStart) *firstBadSector = rangeStart;
+            return false;
+        }
+    }
+
+    return true;
+}
@@ -0,0 +1,75 @@
+/************************************************************************
+
+    extentindex.h
+
+    VP415-host - A host application for the VP415 Emulator
+    VP415-Emulator
+    Copyright (C) 2025 Simon Inns
+
+    This file is part of VP415-Emulator.
+
+    This is free software: you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Email: simon.inns@gmail.com
+
+************************************************************************/
+
+#ifndef EXTENTINDEX_H
+#define EXTENTINDEX_H
+
+#include <QObject>
+#include <QString>
+#include <QByteArray>
+#include <QVector>
+#include <QFile>
+
+// Per-extent checksum index of an EFM data (.dat) image.  The index is kept in
+// a sidecar file next to the image and is built offline (vp415-efmtool index),
+// as hashing a whole disc image takes far too long to do when a disc is
+// opened.  It allows a range of sectors to be verified on the Pi without
+// sending any data across the link to the Pico.
+class ExtentIndex : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit ExtentIndex(QObject *parent = nullptr);
+    ~ExtentIndex();
+
+    // Sectors covered by each checksum (matches the EfmData prefetch extent)
+    static const uint32_t EXTENT_SECTORS = 64;
+
+    // Build and save the index of an image
+    static bool create(QString imageFilename);
+
+    bool open(QFile *imageFile, QString imageFilename);
+    void close();
+    bool isValid() const { return m_isValid; }
+
+    bool verify(uint32_t startSector, uint32_t numberOfSectors, uint32_t *firstBadSector);
+
+private:
+    bool m_isValid;
+    QFile *m_imageFile;
+    qint64 m_imageSize;
+    QVector<QByteArray> m_checksums;
+
+    static QString indexFilename(QString imageFilename);
+    QByteArray extentChecksum(uint32_t extent, uint32_t *sectorsRead);
+    bool build();
+    bool load(QString filename);
+    bool save(QString filename);
+};
+
+#endif // EXTENTINDEX_H
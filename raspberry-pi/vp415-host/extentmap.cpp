@@ -0,0 +1,79 @@
+/************************************************************************
+
+    extentmap.cpp
+
+    VP415-host - A host application for the VP415 Emulator
+    VP415-Emulator
+    Copyright (C) 2025 Simon Inns
+
+    This file is part of VP415-Emulator.
+
+    This is free software: you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Email: simon.inns@gmail.com
+
+************************************************************************/
+
+#include "extentmap.h"
+
+#include <algorithm>
+
+// Add an extent (in any order).  Returns false if it is empty or overlaps an
+// existing extent.
+bool ExtentMap::add(const Extent &extent) {
+    if (extent.sectors == 0) return false;
+
+    auto next = std::upper_bound(m_extents.begin(), m_extents.end(), extent.startSector,
+                                 [](uint32_t sector, const Extent &other) { return sector < other.startSector; });
+
+    uint64_t end = static_cast<uint64_t>(extent.startSector) + extent.sectors;
+    if (next != m_extents.end() && end > next->startSector) return false;
+    if (next != m_extents.begin()) {
+        const Extent &previous = *(next - 1);
+        if (static_cast<uint64_t>(previous.startSector) + previous.sectors > extent.startSector) return false;
+    }
+
+    m_extents.insert(next, extent);
+    return true;
+}
+
+// Index of the extent holding a sector, or -1 if the sector is in a hole (or
+// beyond the last extent)
+int ExtentMap::find(uint32_t sector) const {
+    int index = findFrom(sector);
+    if (index < 0 || m_extents.at(index).startSector > sector) return -1;
+    return index;
+}
+
+// Index of the extent holding a sector or, if the sector is in a hole, the
+// next extent after it.  Returns -1 if there are no extents from the sector on.
+int ExtentMap::findFrom(uint32_t sector) const {
+    auto next = std::upper_bound(m_extents.begin(), m_extents.end(), sector,
+                                 [](uint32_t value, const Extent &extent) { return value < extent.startSector; });
+
+    if (next != m_extents.begin()) {
+        const Extent &previous = *(next - 1);
+        if (static_cast<uint64_t>(previous.startSector) + previous.sectors > sector)
+            return static_cast<int>(next - 1 - m_extents.begin());
+    }
+
+    if (next == m_extents.end()) return -1;
+    return static_cast<int>(next - m_extents.begin());
+}
+
+// The sector after the last extent (the size of the disc)
+uint32_t ExtentMap::endSector() const {
+    if (m_extents.isEmpty()) return 0;
+    return m_extents.last().startSector + m_extents.last().sectors;
+}
@@ -0,0 +1,61 @@
+/************************************************************************
+
+    extentmap.h
+
+    VP415-host - A host application for the VP415 Emulator
+    VP415-Emulator
+    Copyright (C) 2025 Simon Inns
+
+    This file is part of VP415-Emulator.
+
+    This is free software: you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Email: simon.inns@gmail.com
+
+************************************************************************/
+
+#ifndef EXTENTMAP_H
+#define EXTENTMAP_H
+
+#include <QVector>
+
+// Map from disc sectors (SCSI LBAs) to sectors of the backing files that hold
+// them.  Each extent is a run of disc sectors stored contiguously in one
+// backing file; disc sectors between extents are holes (not captured).
+// Extents are kept sorted so a lookup is a binary search.
+class ExtentMap
+{
+public:
+    struct Extent {
+        uint32_t startSector;    // First disc sector
+        uint32_t sectors;
+        int backingFile;         // Index of the backing file
+        uint32_t backingSector;  // Sector of the backing file holding startSector
+    };
+
+    bool add(const Extent &extent);
+    void clear() { m_extents.clear(); }
+    bool isEmpty() const { return m_extents.isEmpty(); }
+    int count() const { return static_cast<int>(m_extents.size()); }
+    const Extent &at(int index) const { return m_extents.at(index); }
+
+    int find(uint32_t sector) const;
+    int findFrom(uint32_t sector) const;
+    uint32_t endSector() const;
+
+private:
+    QVector<Extent> m_extents;
+};
+
+#endif // EXTENTMAP_H
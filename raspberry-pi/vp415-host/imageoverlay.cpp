@@ -0,0 +1,205 @@
+/************************************************************************
+
+    imageoverlay.cpp
+
+    VP415-host - A host application for the VP415 Emulator
+    VP415-Emulator
+    Copyright (C) 2025 Simon Inns
+
+    This file is part of VP415-Emulator.
+
+    This is free software: you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Email: simon.inns@gmail.com
+
+************************************************************************/
+
+#include "imageoverlay.h"
+
+#include <QDebug>
+#include <QtEndian>
+#include <unistd.h>
+
+// Header magic and version
+static const quint32 OVERLAY_MAGIC = 0x56504F56;  // "VPOV"
+static const quint32 OVERLAY_VERSION = 1;
+
+ImageOverlay::ImageOverlay(QObject *parent) : QObject(parent) {
+    m_imageSectors = 0;
+    m_overlaidSectors = 0;
+    m_dataOffset = HEADER_LENGTH;
+    m_dirtyFirst = -1;
+    m_dirtyLast = -1;
+}
+
+ImageOverlay::~ImageOverlay() {
+    close();
+}
+
+// Open (or create) the overlay for an image of the given size.  An overlay
+// made for a different image size can't be used and is discarded.
+bool ImageOverlay::open(QString overlayFilename, uint32_t imageSectors) {
+    close();
+
+    m_imageSectors = imageSectors;
+    qint64 bitmapLength = ((static_cast<qint64>(imageSectors) + 7) / 8 + 255) / 256 * 256;
+    m_dataOffset = HEADER_LENGTH + bitmapLength;
+
+    m_overlayFile.setFileName(overlayFilename);
+    if (!m_overlayFile.open(QIODevice::ReadWrite)) {
+        qDebug() << "ImageOverlay::open() - Failed to open overlay: " << overlayFilename;
+        return false;
+    }
+
+    QByteArray header = m_overlayFile.read(HEADER_LENGTH);
+    const uchar *headerData = reinterpret_cast<const uchar *>(header.constData());
+    if (header.size() != HEADER_LENGTH || qFromBigEndian<quint32>(headerData) != OVERLAY_MAGIC ||
+        qFromBigEndian<quint32>(headerData + 4) != OVERLAY_VERSION ||
+        qFromBigEndian<quint32>(headerData + 8) != imageSectors) {
+        if (m_overlayFile.size() != 0)
+            qDebug() << "ImageOverlay::open() - Overlay doesn't match the image, discarding it: " << overlayFilename;
+        if (!writeEmpty()) {
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    QByteArray bitmap = m_overlayFile.read((static_cast<qint64>(imageSectors) + 7) / 8);
+    if (bitmap.size() != (static_cast<qint64>(imageSectors) + 7) / 8) {
+        qDebug() << "ImageOverlay::open() - Overlay bitmap is truncated: " << overlayFilename;
+        close();
+        return false;
+    }
+
+    m_present = QBitArray::fromBits(bitmap.constData(), imageSectors);
+    m_overlaidSectors = static_cast<uint32_t>(m_present.count(true));
+    qDebug() << "ImageOverlay::open() - Overlay holds" << m_overlaidSectors << "written sectors";
+    return true;
+}
+
+void ImageOverlay::close() {
+    if (!m_overlayFile.isOpen()) return;
+
+    sync();
+    m_overlayFile.close();
+    m_present.clear();
+    m_overlaidSectors = 0;
+}
+
+// Write an empty overlay: the header and a clear bitmap.  Truncating the file
+// drops every written sector at once, whatever the size of the overlay.
+bool ImageOverlay::writeEmpty() {
+    QByteArray header(HEADER_LENGTH, 0x00);
+    uchar *headerData = reinterpret_cast<uchar *>(header.data());
+    qToBigEndian<quint32>(OVERLAY_MAGIC, headerData);
+    qToBigEndian<quint32>(OVERLAY_VERSION, headerData + 4);
+    qToBigEndian<quint32>(m_imageSectors, headerData + 8);
+
+    if (!m_overlayFile.resize(0) || !m_overlayFile.seek(0) || m_overlayFile.write(header) != HEADER_LENGTH ||
+        !m_overlayFile.resize(m_dataOffset) || !m_overlayFile.flush() ||
+        fsync(m_overlayFile.handle()) != 0) {
+        qDebug() << "ImageOverlay::writeEmpty() - Failed to write overlay: " << m_overlayFile.fileName();
+        return false;
+    }
+
+    m_present = QBitArray(static_cast<qsizetype>(m_imageSectors));
+    m_overlaidSectors = 0;
+    m_dirtyFirst = -1;
+    m_dirtyLast = -1;
+    return true;
+}
+
+// Discard every write and return the image to its pristine state
+bool ImageOverlay::reset() {
+    if (!m_overlayFile.isOpen()) return false;
+    return writeEmpty();
+}
+
+// True if the overlay holds any sector of the range (false for the whole
+// range means it can be read straight from the image)
+bool ImageOverlay::containsAny(uint32_t startSector, uint32_t numberOfSectors) const {
+    if (m_overlaidSectors == 0) return false;
+
+    for (uint32_t sector = startSector; sector < startSector + numberOfSectors; sector++) {
+        if (contains(sector)) return true;
+    }
+    return false;
+}
+
+// Read a sector held by the overlay (returns an empty array on failure)
+QByteArray ImageOverlay::readSector(uint32_t sector) {
+    if (!contains(sector) || !m_overlayFile.seek(m_dataOffset + static_cast<qint64>(sector) * 256))
+        return QByteArray();
+
+    QByteArray sectorData = m_overlayFile.read(256);
+    if (sectorData.size() != 256) return QByteArray();
+    return sectorData;
+}
+
+// Write sectors to the overlay.  The bitmap is only written to the file (and
+// the sectors made durable) by the next sync.
+bool ImageOverlay::writeSectors(uint32_t startSector, const QByteArray &sectorData) {
+    uint32_t numberOfSectors = static_cast<uint32_t>(sectorData.size() / 256);
+    if (!m_overlayFile.isOpen() || static_cast<uint64_t>(startSector) + numberOfSectors > m_imageSectors)
+        return false;
+
+    if (!m_overlayFile.seek(m_dataOffset + static_cast<qint64>(startSector) * 256) ||
+        m_overlayFile.write(sectorData) != sectorData.size()) {
+        qDebug() << "ImageOverlay::writeSectors() - Failed to write overlay at sector" << startSector;
+        return false;
+    }
+
+    for (uint32_t sector = startSector; sector < startSector + numberOfSectors; sector++) {
+        if (m_present.testBit(sector)) continue;
+        m_present.setBit(sector);
+        m_overlaidSectors++;
+    }
+
+    qint64 first = startSector / 8;
+    qint64 last = (startSector + numberOfSectors - 1) / 8;
+    if (m_dirtyFirst < 0 || first < m_dirtyFirst) m_dirtyFirst = first;
+    if (last > m_dirtyLast) m_dirtyLast = last;
+    return true;
+}
+
+// Write the changed part of the bitmap and sync the overlay.  Bitmap bits can
+// reach the disc before the sectors they cover, so callers must keep the
+// writes (in the sector journal) until the sync has returned.
+bool ImageOverlay::sync() {
+    if (!m_overlayFile.isOpen()) return false;
+
+    if (m_dirtyFirst >= 0) {
+        QByteArray bitmap = bitmapBytes(m_dirtyFirst, m_dirtyLast);
+        if (!m_overlayFile.seek(HEADER_LENGTH + m_dirtyFirst) || m_overlayFile.write(bitmap) != bitmap.size()) {
+            qDebug() << "ImageOverlay::sync() - Failed to write overlay bitmap: " << m_overlayFile.fileName();
+            return false;
+        }
+    }
+
+    if (!m_overlayFile.flush() || fsync(m_overlayFile.handle()) != 0) {
+        qDebug() << "ImageOverlay::sync() - Failed to sync overlay: " << m_overlayFile.fileName();
+        return false;
+    }
+
+    m_dirtyFirst = -1;
+    m_dirtyLast = -1;
+    return true;
+}
+
+// Bytes first to last of the bitmap as stored in the file (bit 0 of byte 0
+// is sector 0, matching QBitArray's layout)
+QByteArray ImageOverlay::bitmapBytes(qint64 first, qint64 last) const {
+    return QByteArray(m_present.bits() + first, static_cast<qsizetype>(last - first + 1));
+}
@@ -0,0 +1,83 @@
+/************************************************************************
+
+    imageoverlay.h
+
+    VP415-host - A host application for the VP415 Emulator
+    VP415-Emulator
+    Copyright (C) 2025 Simon Inns
+
+    This file is part of VP415-Emulator.
+
+    This is free software: you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Email: simon.inns@gmail.com
+
+************************************************************************/
+
+#ifndef IMAGEOVERLAY_H
+#define IMAGEOVERLAY_H
+
+#include <QObject>
+#include <QString>
+#include <QByteArray>
+#include <QBitArray>
+#include <QFile>
+
+// Copy-on-write overlay for a read-only image.  Written sectors are stored in
+// a sparse overlay file and a bitmap (held in memory) records which sectors
+// the overlay holds; every other sector is read from the untouched image.
+// Discarding the overlay returns the image to its pristine state.
+//
+// The overlay file is a 256 byte header ("VPOV", version and the image size
+// in sectors), the bitmap (padded to a whole number of sectors) and then a
+// slot for every sector of the image.  Only the slots that have been written
+// take up space on the disc.
+class ImageOverlay : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit ImageOverlay(QObject *parent = nullptr);
+    ~ImageOverlay();
+
+    bool open(QString overlayFilename, uint32_t imageSectors);
+    void close();
+    bool isOpen() const { return m_overlayFile.isOpen(); }
+
+    bool contains(uint32_t sector) const { return sector < m_imageSectors && m_present.testBit(sector); }
+    bool containsAny(uint32_t startSector, uint32_t numberOfSectors) const;
+    uint32_t overlaidSectors() const { return m_overlaidSectors; }
+
+    QByteArray readSector(uint32_t sector);
+    bool writeSectors(uint32_t startSector, const QByteArray &sectorData);
+    bool sync();
+    bool reset();
+
+private:
+    QFile m_overlayFile;
+    QBitArray m_present;
+    uint32_t m_imageSectors;
+    uint32_t m_overlaidSectors;
+    qint64 m_dataOffset;
+
+    // Range of bitmap bytes changed since the last sync
+    qint64 m_dirtyFirst;
+    qint64 m_dirtyLast;
+
+    static const int HEADER_LENGTH = 256;
+    QByteArray bitmapBytes(qint64 first, qint64 last) const;
+    bool writeEmpty();
+};
+
+#endif // IMAGEOVERLAY_H
@@ -0,0 +1,174 @@
+/************************************************************************
+
+    latencyprofile.cpp
+
+    VP415-host - A host application for the VP415 Emulator
+    VP415-Emulator
+    Copyright (C) 2025 Simon Inns
+
+    This file is part of VP415-Emulator.
+
+    This is free software: you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Email: simon.inns@gmail.com
+
+************************************************************************/
+
+#include "latencyprofile.h"
+#include <QDebug>
+#include <QFile>
+#include <QTextStream>
+
+static uint32_t readUint32(const QByteArray &data, int position) {
+    return (static_cast<uint32_t>(static_cast<uint8_t>(data[position])) << 24) |
+           (static_cast<uint32_t>(static_cast<uint8_t>(data[position + 1])) << 16) |
+           (static_cast<uint32_t>(static_cast<uint8_t>(data[position + 2])) << 8) |
+           static_cast<uint32_t>(static_cast<uint8_t>(data[position + 3]));
+}
+
+static uint64_t readUint64(const QByteArray &data, int position) {
+    return (static_cast<uint64_t>(readUint32(data, position)) << 32) | readUint32(data, position + 4);
+}
+
+LatencyProfile::LatencyProfile(QObject *parent) : QObject(parent) {
+    m_droppedCount = 0;
+    m_resetCount = 0;
+    m_resetLastTime = 0;
+    m_resetMaximumTime = 0;
+    m_isComplete = false;
+}
+
+LatencyProfile::~LatencyProfile() {}
+
+// Add a PIC_PUT_PROFILE frame to the profile.  The Pico sends one frame per
+// opcode; returns true once the last frame has been received.
+bool LatencyProfile::addFrame(const QByteArray &data) {
+    const int slotLength = 8 + (PHASES * (12 + (BUCKETS * 4)));
+
+    if (data.size() < HEADER_LENGTH) {
+        qDebug() << "LatencyProfile::addFrame() - Frame too short: " << data.size();
+        return false;
+    }
+
+    uint8_t slotNumber = static_cast<uint8_t>(data[1]);
+    uint8_t slotsUsed = static_cast<uint8_t>(data[2]);
+
+    // The first frame starts a new profile
+    if (slotNumber == 0) {
+        m_slots.clear();
+        m_isComplete = false;
+    }
+    m_droppedCount = readUint32(data, 4);
+    m_resetCount = readUint32(data, 8);
+    m_resetLastTime = readUint32(data, 12);
+    m_resetMaximumTime = readUint32(data, 16);
+
+    if (slotsUsed != 0) {
+        if (data.size() < HEADER_LENGTH + slotLength || slotNumber != m_slots.size()) {
+            qDebug() << "LatencyProfile::addFrame() - Invalid frame for slot " << slotNumber;
+            return false;
+        }
+
+        Slot slot;
+        int position = HEADER_LENGTH;
+        slot.opCode = static_cast<uint8_t>(data[position]);
+        slot.count = readUint32(data, position + 4);
+        position += 8;
+
+        for (int phase = 0; phase < PHASES; phase++) {
+            slot.totalTime[phase] = readUint64(data, position);
+            slot.maximumTime[phase] = readUint32(data, position + 8);
+            position += 12;
+            for (int bucket = 0; bucket < BUCKETS; bucket++) {
+                slot.histogram[phase][bucket] = readUint32(data, position);
+                position += 4;
+            }
+        }
+
+        m_slots.append(slot);
+    }
+
+    m_isComplete = (slotNumber + 1 >= slotsUsed);
+    return m_isComplete;
+}
+
+QString LatencyProfile::phaseName(int phase) {
+    switch (phase) {
+        case 0: return "Command";
+        case 1: return "Data";
+        case 2: return "Status";
+        case 3: return "Pi link";
+        default: return "Unknown";
+    }
+}
+
+// Bucket 0 is 0uS, bucket n is 2^(n-1) to (2^n)-1 uS
+QString LatencyProfile::bucketName(int bucket) {
+    if (bucket == 0) return "0us";
+    if (bucket == BUCKETS - 1) return QString(">=%1us").arg(1u << (bucket - 1));
+    return QString("<%1us").arg(1u << bucket);
+}
+
+// Show the profile in the debug output
+void LatencyProfile::showProfile() {
+    qDebug() << "LatencyProfile::showProfile() - Latency profile:";
+    for (const Slot &slot : m_slots) {
+        qDebug().noquote() << QString("  Opcode 0x%1 - %2 commands")
+                                  .arg(slot.opCode, 2, 16, QChar('0'))
+                                  .arg(slot.count);
+        for (int phase = 0; phase < PHASES; phase++) {
+            double mean = slot.count ? static_cast<double>(slot.totalTime[phase]) / slot.count : 0.0;
+            qDebug().noquote() << QString("    %1: mean %2us max %3us")
+                                      .arg(phaseName(phase), -8)
+                                      .arg(mean, 0, 'f', 1)
+                                      .arg(slot.maximumTime[phase]);
+        }
+    }
+    if (m_droppedCount != 0)
+        qDebug() << "  Commands not profiled (no free slot): " << m_droppedCount;
+    if (m_resetCount != 0)
+        qDebug().noquote() << QString("  Host resets: %1 - reset to ready last %2us max %3us")
+                                  .arg(m_resetCount)
+                                  .arg(m_resetLastTime)
+                                  .arg(m_resetMaximumTime);
+}
+
+// Export the profile as CSV (one row per opcode and phase)
+bool LatencyProfile::exportCsv(QString filename) {
+    QFile file(filename);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Text)) {
+        qDebug() << "LatencyProfile::exportCsv() - Failed to open file: " << filename;
+        return false;
+    }
+
+    QTextStream stream(&file);
+    stream << "opcode,phase,count,total_us,max_us";
+    for (int bucket = 0; bucket < BUCKETS; bucket++) stream << "," << bucketName(bucket);
+    stream << "\n";
+
+    for (const Slot &slot : m_slots) {
+        for (int phase = 0; phase < PHASES; phase++) {
+            stream << QString("0x%1").arg(slot.opCode, 2, 16, QChar('0')) << ","
+                   << phaseName(phase) << "," << slot.count << ","
+                   << slot.totalTime[phase] << "," << slot.maximumTime[phase];
+            for (int bucket = 0; bucket < BUCKETS; bucket++)
+                stream << "," << slot.histogram[phase][bucket];
+            stream << "\n";
+        }
+    }
+
+    file.close();
+    qDebug() << "LatencyProfile::exportCsv() - Profile exported to: " << filename;
+    return true;
+}
@@ -0,0 +1,76 @@
+/************************************************************************
+
+    latencyprofile.h
+
+    VP415-host - A host application for the VP415 Emulator
+    VP415-Emulator
+    Copyright (C) 2025 Simon Inns
+
+    This file is part of VP415-Emulator.
+
+    This is free software: you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Email: simon.inns@gmail.com
+
+************************************************************************/
+
+#ifndef LATENCYPROFILE_H
+#define LATENCYPROFILE_H
+
+#include <QObject>
+#include <QString>
+#include <QByteArray>
+#include <QVector>
+
+// Per-opcode latency profile uploaded by the Pico (see profile.c)
+class LatencyProfile : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit LatencyProfile(QObject *parent = nullptr);
+    ~LatencyProfile();
+
+    // Must match profile.h on the Pico
+    static const int PHASES = 4;
+    static const int BUCKETS = 20;
+    static const int HEADER_LENGTH = 20;
+
+    struct Slot {
+        uint8_t opCode;
+        uint32_t count;
+        uint64_t totalTime[PHASES];
+        uint32_t maximumTime[PHASES];
+        uint32_t histogram[PHASES][BUCKETS];
+    };
+
+    bool addFrame(const QByteArray &data);
+    bool isComplete() const { return m_isComplete; }
+
+    void showProfile();
+    bool exportCsv(QString filename);
+
+    static QString phaseName(int phase);
+    static QString bucketName(int bucket);
+
+private:
+    QVector<Slot> m_slots;
+    uint32_t m_droppedCount;
+    uint32_t m_resetCount;
+    uint32_t m_resetLastTime;
+    uint32_t m_resetMaximumTime;
+    bool m_isComplete;
+};
+
+#endif // LATENCYPROFILE_H
@@ -0,0 +1,469 @@
+/************************************************************************
+
+    lunimages.cpp
+
+    VP415-host - A host application for the VP415 Emulator
+    VP415-Emulator
+    Copyright (C) 2025 Simon Inns
+
+    This file is part of VP415-Emulator.
+
+    This is free software: you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Email: simon.inns@gmail.com
+
+************************************************************************/
+
+#include "lunimages.h"
+
+#include <QDir>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <unistd.h>
+
+LunImages::LunImages(QObject *parent) : QObject(parent) {
+    for (int lunNumber = 0; lunNumber < MAX_LUNS; lunNumber++) {
+        m_imageFile[lunNumber] = nullptr;
+        m_overlay[lunNumber] = nullptr;
+    }
+    m_metrics = nullptr;
+    m_journalRecords = 0;
+    m_applyQueueSectors = 0;
+
+    m_applyTimer.setInterval(APPLY_INTERVAL_MS);
+    connect(&m_applyTimer, &QTimer::timeout, this, &LunImages::applyJournal);
+}
+
+LunImages::~LunImages() {
+    closeDirectory();
+}
+
+void LunImages::setMetrics(Metrics *metrics) {
+    m_metrics = metrics;
+    m_journal.setMetrics(metrics);
+}
+
+// Open a LUN directory.  Images that exist are opened straight away; images
+// for the other LUNs are created when the host formats them.  Writes left in
+// the journal by the last run are replayed into the images.
+//
+// With an overlay directory the images are only read; writes are kept in
+// copy-on-write overlays (so the images can be on read-only media).
+bool LunImages::openDirectory(QString directoryName, QString overlayDirectoryName) {
+    closeDirectory();
+
+    if (!QDir(directoryName).exists()) {
+        qDebug() << "LunImages::openDirectory() - LUN directory does not exist: " << directoryName;
+        return false;
+    }
+    if (!overlayDirectoryName.isEmpty() && !QDir(overlayDirectoryName).exists()) {
+        qDebug() << "LunImages::openDirectory() - Overlay directory does not exist: " << overlayDirectoryName;
+        return false;
+    }
+    m_directoryName = directoryName;
+    m_overlayDirectoryName = overlayDirectoryName;
+
+    for (uint8_t lunNumber = 0; lunNumber < MAX_LUNS; lunNumber++) {
+        if (QFileInfo::exists(imageFilename(lunNumber)) && openImage(lunNumber)) {
+            qDebug() << "LunImages::openDirectory() - LUN" << lunNumber << "image contains"
+                     << m_imageFile[lunNumber]->size() / 256 << "sectors";
+        }
+    }
+
+    QList<SectorJournal::Record> replayRecords;
+    QString journalDirectoryName = hasOverlays() ? m_overlayDirectoryName : m_directoryName;
+    if (!m_journal.open(journalDirectoryName + "/scsi.wal", &replayRecords)) {
+        qDebug() << "LunImages::openDirectory() - Failed to open the sector journal";
+        closeDirectory();
+        return false;
+    }
+
+    if (!replayRecords.isEmpty()) {
+        qDebug() << "LunImages::openDirectory() - Replaying" << replayRecords.size() << "journaled writes";
+        bool replayed = true;
+        for (const SectorJournal::Record &record : replayRecords) {
+            if (!applyRecord(record)) {
+                replayed = false;
+                break;
+            }
+        }
+
+        // The journal is the only copy of these writes, so it's kept unless
+        // every record reached the images
+        if (!replayed || !syncImages() || !m_journal.checkpoint()) {
+            qDebug() << "LunImages::openDirectory() - Failed to replay the sector journal";
+            m_journal.close();
+            closeDirectory();
+            return false;
+        }
+    }
+
+    updateOverlayMetrics();
+    return true;
+}
+
+void LunImages::closeDirectory() {
+    if (m_journal.isOpen()) {
+        flushJournal();
+        m_journal.close();
+    }
+
+    for (int lunNumber = 0; lunNumber < MAX_LUNS; lunNumber++) {
+        if (m_overlay[lunNumber] != nullptr) {
+            m_overlay[lunNumber]->close();
+            delete m_overlay[lunNumber];
+            m_overlay[lunNumber] = nullptr;
+        }
+
+        if (m_imageFile[lunNumber] == nullptr) continue;
+        m_imageFile[lunNumber]->close();
+        delete m_imageFile[lunNumber];
+        m_imageFile[lunNumber] = nullptr;
+    }
+    m_directoryName.clear();
+    m_overlayDirectoryName.clear();
+}
+
+bool LunImages::hasImage(uint8_t lunNumber) const {
+    return lunNumber < MAX_LUNS && m_imageFile[lunNumber] != nullptr;
+}
+
+// The BeebSCSI file names for a LUN
+QString LunImages::imageFilename(uint8_t lunNumber) const {
+    return QString("%1/scsi%2.dat").arg(m_directoryName).arg(lunNumber);
+}
+
+QString LunImages::descriptorFilename(uint8_t lunNumber) const {
+    return QString("%1/scsi%2.dsc").arg(m_directoryName).arg(lunNumber);
+}
+
+QString LunImages::overlayFilename(uint8_t lunNumber) const {
+    return QString("%1/scsi%2.ovl").arg(m_overlayDirectoryName).arg(lunNumber);
+}
+
+bool LunImages::openImage(uint8_t lunNumber) {
+    QFile *imageFile = new QFile(imageFilename(lunNumber));
+    if (!imageFile->open(hasOverlays() ? QIODevice::ReadOnly : QIODevice::ReadWrite)) {
+        qDebug() << "LunImages::openImage() - Failed to open LUN image: " << imageFile->fileName();
+        delete imageFile;
+        return false;
+    }
+
+    if (hasOverlays()) {
+        ImageOverlay *overlay = new ImageOverlay();
+        if (!overlay->open(overlayFilename(lunNumber), static_cast<uint32_t>(imageFile->size() / 256))) {
+            qDebug() << "LunImages::openImage() - Failed to open overlay for LUN" << lunNumber;
+            delete overlay;
+            delete imageFile;
+            return false;
+        }
+        m_overlay[lunNumber] = overlay;
+    }
+
+    m_imageFile[lunNumber] = imageFile;
+    return true;
+}
+
+// Discard the overlays (and any journaled writes not yet in them), returning
+// every image to its pristine state
+bool LunImages::resetOverlays() {
+    if (!hasOverlays()) return false;
+
+    m_applyQueue.clear();
+    m_journaledSectors.clear();
+    m_applyQueueSectors = 0;
+    m_journalRecords = 0;
+    m_applyTimer.stop();
+    if (!m_journal.checkpoint()) return false;
+
+    bool reset = true;
+    for (int lunNumber = 0; lunNumber < MAX_LUNS; lunNumber++) {
+        if (m_overlay[lunNumber] != nullptr && !m_overlay[lunNumber]->reset()) reset = false;
+    }
+
+    if (m_metrics) m_metrics->journalPendingSectors.set(0);
+    updateOverlayMetrics();
+    qDebug() << "LunImages::resetOverlays() - LUN images reset to pristine";
+    return reset;
+}
+
+void LunImages::updateOverlayMetrics() {
+    if (!m_metrics) return;
+
+    int64_t overlaidSectors = 0;
+    for (int lunNumber = 0; lunNumber < MAX_LUNS; lunNumber++) {
+        if (m_overlay[lunNumber] != nullptr) overlaidSectors += m_overlay[lunNumber]->overlaidSectors();
+    }
+    m_metrics->overlaySectors.set(overlaidSectors);
+}
+
+// Get the 22 byte descriptor for a LUN.  If the image has no .dsc file one is
+// made from the image size (and saved) as BeebSCSI does.
+QByteArray LunImages::descriptor(uint8_t lunNumber) {
+    if (!hasImage(lunNumber)) return QByteArray();
+
+    QFile descriptorFile(descriptorFilename(lunNumber));
+    if (descriptorFile.open(QIODevice::ReadOnly)) {
+        QByteArray descriptorData = descriptorFile.read(22);
+        if (descriptorData.size() == 22) return descriptorData;
+        qDebug() << "LunImages::descriptor() - Descriptor is too short: " << descriptorFile.fileName();
+    }
+
+    QByteArray descriptorData = descriptorFromSize(m_imageFile[lunNumber]->size());
+    qDebug() << "LunImages::descriptor() - Creating descriptor for LUN" << lunNumber << "from the image size";
+    if (!hasOverlays()) writeDescriptor(lunNumber, descriptorData);
+    return descriptorData;
+}
+
+bool LunImages::writeDescriptor(uint8_t lunNumber, const QByteArray &descriptor) {
+    if (lunNumber >= MAX_LUNS || m_directoryName.isEmpty() || descriptor.size() != 22) return false;
+
+    // The LUN directory is read-only when overlays are in use
+    if (hasOverlays()) {
+        qDebug() << "LunImages::writeDescriptor() - Descriptors can't be changed when using overlays";
+        return false;
+    }
+
+    // The descriptor is replaced atomically (so a power cut leaves either the
+    // old or the new descriptor)
+    QSaveFile descriptorFile(descriptorFilename(lunNumber));
+    if (!descriptorFile.open(QIODevice::WriteOnly) || descriptorFile.write(descriptor) != 22 ||
+        !descriptorFile.commit()) {
+        qDebug() << "LunImages::writeDescriptor() - Failed to write descriptor: " << descriptorFile.fileName();
+        return false;
+    }
+
+    return true;
+}
+
+// Build a descriptor for an image of the given size (ACB-4000 geometry: 256
+// byte blocks, 33 sectors per track and up to 16 heads)
+QByteArray LunImages::descriptorFromSize(qint64 imageSize) const {
+    QByteArray descriptorData(22, 0x00);
+    uint32_t tracks = static_cast<uint32_t>(imageSize / (33 * 256));
+    uint32_t heads = 16;
+
+    while ((tracks % heads != 0) && heads != 1) heads--;
+    uint32_t cylinders = tracks / heads;
+
+    // Mode Select Parameter List (ACB-4000 manual figure 5-18)
+    descriptorData[3] = 8; // Length of Extent Descriptor List
+
+    // Extent Descriptor List (ACB-4000 manual figure 5-19)
+    descriptorData[10] = 1; // Block size = 256
+
+    // Drive Parameter List (ACB-4000 manual figure 5-20)
+    descriptorData[12] = 1; // List format code
+    descriptorData[13] = static_cast<char>((cylinders >> 8) & 0xFF);
+    descriptorData[14] = static_cast<char>(cylinders & 0xFF);
+    descriptorData[15] = static_cast<char>(heads);
+    descriptorData[17] = static_cast<char>(128); // Reduced write current cylinder
+    descriptorData[19] = static_cast<char>(128); // Write pre-compensation cylinder
+    descriptorData[21] = 1; // Step pulse output rate code
+
+    return descriptorData;
+}
+
+// Read sectors from a LUN image (returns an empty array if they can't be read)
+QByteArray LunImages::readSectors(uint8_t lunNumber, uint32_t startSector, uint32_t numberOfSectors) {
+    if (!hasImage(lunNumber)) return QByteArray();
+
+    QFile *imageFile = m_imageFile[lunNumber];
+    qint64 length = static_cast<qint64>(numberOfSectors) * 256;
+    if (!imageFile->seek(static_cast<qint64>(startSector) * 256)) return QByteArray();
+
+    QByteArray sectorData = imageFile->read(length);
+    if (sectorData.size() != length) return QByteArray();
+
+    // Sectors written since the image was pristine are in the overlay
+    ImageOverlay *overlay = m_overlay[lunNumber];
+    if (overlay != nullptr && overlay->containsAny(startSector, numberOfSectors)) {
+        for (uint32_t sector = 0; sector < numberOfSectors; sector++) {
+            if (!overlay->contains(startSector + sector)) continue;
+            QByteArray overlaidData = overlay->readSector(startSector + sector);
+            if (overlaidData.isEmpty()) return QByteArray();
+            sectorData.replace(static_cast<qsizetype>(sector) * 256, 256, overlaidData);
+        }
+    }
+
+    // Sectors that are still in the journal are newer than the image
+    if (!m_journaledSectors.isEmpty()) {
+        for (uint32_t sector = 0; sector < numberOfSectors; sector++) {
+            auto journaled = m_journaledSectors.constFind(sectorKey(lunNumber, startSector + sector));
+            if (journaled != m_journaledSectors.constEnd())
+                sectorData.replace(static_cast<qsizetype>(sector) * 256, 256, journaled.value());
+        }
+    }
+
+    return sectorData;
+}
+
+// Write sectors to a LUN image.  The sectors are appended to the journal and
+// applied to the image later.  If commit is set (at the end of the Pico's
+// WRITE command) the journal is synced before returning, which makes every
+// write since the last commit durable with a single fsync.
+bool LunImages::writeSectors(uint8_t lunNumber, uint32_t startSector, const QByteArray &sectorData,
+                             bool commit) {
+    if (!hasImage(lunNumber)) return false;
+
+    // Writes must stay within the formatted image
+    qint64 position = static_cast<qint64>(startSector) * 256;
+    if (position + sectorData.size() > m_imageFile[lunNumber]->size()) {
+        qDebug() << "LunImages::writeSectors() - Write past the end of LUN" << lunNumber << "at sector" << startSector;
+        return false;
+    }
+
+    if (!m_journal.append(lunNumber, startSector, sectorData)) return false;
+    if (commit && !m_journal.commit()) return false;
+
+    // Serve the sectors from memory until they have been applied
+    uint32_t numberOfSectors = static_cast<uint32_t>(sectorData.size() / 256);
+    for (uint32_t sector = 0; sector < numberOfSectors; sector++)
+        m_journaledSectors.insert(sectorKey(lunNumber, startSector + sector),
+                                  sectorData.mid(static_cast<qsizetype>(sector) * 256, 256));
+
+    m_applyQueue.append(SectorJournal::Record{lunNumber, startSector, sectorData});
+    m_applyQueueSectors += numberOfSectors;
+    m_journalRecords++;
+    m_lastWriteTimer.start();
+    if (m_metrics) m_metrics->journalPendingSectors.set(m_applyQueueSectors);
+    if (!m_applyTimer.isActive()) m_applyTimer.start();
+
+    return true;
+}
+
+// Background pass: apply some journal records to the images and, once writes
+// have stopped, sync the images and empty the journal
+void LunImages::applyJournal() {
+    if (m_journal.hasUncommitted() && m_journal.uncommittedAgeMs() >= COMMIT_INTERVAL_MS) m_journal.commit();
+
+    // A record that can't be applied stays queued (and in the journal) and is
+    // retried on the next pass
+    for (int count = 0; count < APPLY_RECORDS && !m_applyQueue.isEmpty(); count++) {
+        if (!applyRecord(m_applyQueue.first())) break;
+        m_applyQueueSectors -= static_cast<int>(m_applyQueue.takeFirst().sectorData.size() / 256);
+    }
+    if (m_metrics) m_metrics->journalPendingSectors.set(m_applyQueueSectors);
+
+    if (!m_applyQueue.isEmpty()) return;
+    updateOverlayMetrics();
+    if (m_lastWriteTimer.elapsed() < CHECKPOINT_IDLE_MS && m_journalRecords < CHECKPOINT_RECORDS) return;
+
+    if (syncImages() && m_journal.checkpoint()) {
+        m_journaledSectors.clear();
+        m_journalRecords = 0;
+        m_applyTimer.stop();
+    }
+}
+
+// Write a journal record to its image or overlay (which isn't synced)
+bool LunImages::applyRecord(const SectorJournal::Record &record) {
+    if (!hasImage(record.lunNumber)) return false;
+
+    if (m_overlay[record.lunNumber] != nullptr)
+        return m_overlay[record.lunNumber]->writeSectors(record.startSector, record.sectorData);
+
+    QFile *imageFile = m_imageFile[record.lunNumber];
+    if (!imageFile->seek(static_cast<qint64>(record.startSector) * 256) ||
+        imageFile->write(record.sectorData) != record.sectorData.size()) {
+        qDebug() << "LunImages::applyRecord() - Failed to write LUN" << record.lunNumber
+                 << "at sector" << record.startSector;
+        return false;
+    }
+
+    return true;
+}
+
+bool LunImages::syncImages() {
+    for (int lunNumber = 0; lunNumber < MAX_LUNS; lunNumber++) {
+        if (m_overlay[lunNumber] != nullptr) {
+            if (!m_overlay[lunNumber]->sync()) return false;
+            continue;
+        }
+
+        if (m_imageFile[lunNumber] == nullptr) continue;
+        if (!m_imageFile[lunNumber]->flush() || fsync(m_imageFile[lunNumber]->handle()) != 0) {
+            qDebug() << "LunImages::syncImages() - Failed to sync LUN" << lunNumber;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Apply everything in the journal to the images straight away and empty it
+bool LunImages::flushJournal() {
+    m_journal.commit();
+    while (!m_applyQueue.isEmpty()) {
+        if (!applyRecord(m_applyQueue.first())) break;
+        m_applyQueueSectors -= static_cast<int>(m_applyQueue.takeFirst().sectorData.size() / 256);
+    }
+    if (m_metrics) m_metrics->journalPendingSectors.set(m_applyQueueSectors);
+
+    // Unapplied records keep the journal from being emptied
+    if (!m_applyQueue.isEmpty()) {
+        qDebug() << "LunImages::flushJournal() -" << m_applyQueue.size() << "journaled writes could not be applied";
+        return false;
+    }
+    if (!syncImages() || !m_journal.checkpoint()) return false;
+    m_journaledSectors.clear();
+    m_journalRecords = 0;
+    m_applyTimer.stop();
+    return true;
+}
+
+// Check that a range of sectors can be read from a LUN image
+bool LunImages::verifySectors(uint8_t lunNumber, uint32_t startSector, uint32_t numberOfSectors,
+                              uint32_t *firstBadSector) {
+    *firstBadSector = startSector;
+    if (!hasImage(lunNumber)) return false;
+
+    uint32_t imageSectors = static_cast<uint32_t>(m_imageFile[lunNumber]->size() / 256);
+    if (static_cast<uint64_t>(startSector) + numberOfSectors <= imageSectors) return true;
+
+    *firstBadSector = (startSector > imageSectors) ? startSector : imageSectors;
+    return false;
+}
+
+// Format a LUN image: the image is recreated with the number of sectors given
+// by the descriptor.  As with the original FatFS f_expand based format the
+// space is only allocated, so the fill pattern isn't written.
+bool LunImages::format(uint8_t lunNumber, uint32_t numberOfSectors) {
+    if (lunNumber >= MAX_LUNS || m_directoryName.isEmpty()) return false;
+
+    if (hasOverlays()) {
+        qDebug() << "LunImages::format() - LUN images can't be formatted when using overlays";
+        return false;
+    }
+
+    // Journaled writes belong to the old image
+    if (!flushJournal()) return false;
+
+    if (m_imageFile[lunNumber] != nullptr) {
+        m_imageFile[lunNumber]->close();
+        delete m_imageFile[lunNumber];
+        m_imageFile[lunNumber] = nullptr;
+    }
+
+    QFile imageFile(imageFilename(lunNumber));
+    if (!imageFile.open(QIODevice::WriteOnly | QIODevice::Truncate) ||
+        !imageFile.resize(static_cast<qint64>(numberOfSectors) * 256)) {
+        qDebug() << "LunImages::format() - Failed to create LUN image: " << imageFile.fileName();
+        return false;
+    }
+    imageFile.close();
+
+    qDebug() << "LunImages::format() - LUN" << lunNumber << "formatted with" << numberOfSectors << "sectors";
+    return openImage(lunNumber);
+}
@@ -0,0 +1,133 @@
+/************************************************************************
+
+    lunimages.h
+
+    VP415-host - A host application for the VP415 Emulator
+    VP415-Emulator
+    Copyright (C) 2025 Simon Inns
+
+    This file is part of VP415-Emulator.
+
+    This is free software: you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Email: simon.inns@gmail.com
+
+************************************************************************/
+
+#ifndef LUNIMAGES_H
+#define LUNIMAGES_H
+
+#include <QObject>
+#include <QString>
+#include <QByteArray>
+#include <QFile>
+#include <QHash>
+#include <QList>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <QDebug>
+
+#include "metrics.h"
+#include "sectorjournal.h"
+#include "imageoverlay.h"
+
+// Read/write hard disc images for fixed (ADFS Winchester) emulation.  A LUN
+// directory holds up to eight images in the BeebSCSI layout: scsiN.dat is the
+// image of LUN N and scsiN.dsc is its 22 byte ACB-4000 drive descriptor.
+//
+// Writes go through a sector journal (scsi.wal in the LUN directory) so that
+// a power cut can't leave an image half written.  Journaled sectors are kept
+// in memory (and served to reads) until they have been applied to the images
+// in the background.
+//
+// If an overlay directory is given the images are opened read-only and writes
+// go to a copy-on-write overlay (scsiN.ovl, with the journal, in the overlay
+// directory).  Resetting the overlays returns every image to its pristine
+// state without copying anything.
+class LunImages : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit LunImages(QObject *parent = nullptr);
+    ~LunImages();
+
+    static const int MAX_LUNS = 8;
+
+    bool openDirectory(QString directoryName, QString overlayDirectoryName = QString());
+    void closeDirectory();
+
+    bool hasOverlays() const { return !m_overlayDirectoryName.isEmpty(); }
+    bool resetOverlays();
+
+    bool hasImage(uint8_t lunNumber) const;
+    QByteArray descriptor(uint8_t lunNumber);
+    bool writeDescriptor(uint8_t lunNumber, const QByteArray &descriptor);
+
+    QByteArray readSectors(uint8_t lunNumber, uint32_t startSector, uint32_t numberOfSectors);
+    bool writeSectors(uint8_t lunNumber, uint32_t startSector, const QByteArray &sectorData,
+                      bool commit);
+    bool verifySectors(uint8_t lunNumber, uint32_t startSector, uint32_t numberOfSectors,
+                       uint32_t *firstBadSector);
+    bool format(uint8_t lunNumber, uint32_t numberOfSectors);
+
+    void setMetrics(Metrics *metrics);
+
+    // Journal records applied to the images per background pass and the
+    // interval between passes
+    static const int APPLY_RECORDS = 64;
+    static const int APPLY_INTERVAL_MS = 20;
+
+    // Longest time a write is left uncommitted (if the Pico never ends the
+    // command)
+    static const int COMMIT_INTERVAL_MS = 100;
+
+    // The images are synced and the journal emptied once writes have stopped
+    // for CHECKPOINT_IDLE_MS (or the journal holds CHECKPOINT_RECORDS)
+    static const int CHECKPOINT_IDLE_MS = 500;
+    static const int CHECKPOINT_RECORDS = 4096;
+
+private slots:
+    void applyJournal();
+
+private:
+    QString m_directoryName;
+    QString m_overlayDirectoryName;
+    QFile *m_imageFile[MAX_LUNS];
+    ImageOverlay *m_overlay[MAX_LUNS];
+    Metrics *m_metrics;
+
+    SectorJournal m_journal;
+    QList<SectorJournal::Record> m_applyQueue;  // Journaled, not yet applied
+    QHash<quint64, QByteArray> m_journaledSectors;  // Latest journaled data by (LUN, sector)
+    QTimer m_applyTimer;
+    QElapsedTimer m_lastWriteTimer;
+    int m_journalRecords;      // Records since the last checkpoint
+    int m_applyQueueSectors;   // Sectors waiting to be applied
+
+    QString imageFilename(uint8_t lunNumber) const;
+    QString descriptorFilename(uint8_t lunNumber) const;
+    QString overlayFilename(uint8_t lunNumber) const;
+    bool openImage(uint8_t lunNumber);
+    QByteArray descriptorFromSize(qint64 imageSize) const;
+    bool applyRecord(const SectorJournal::Record &record);
+    bool syncImages();
+    bool flushJournal();
+    void updateOverlayMetrics();
+    static quint64 sectorKey(uint8_t lunNumber, uint32_t sector) {
+        return (static_cast<quint64>(lunNumber) << 32) | sector;
+    }
+};
+
+#endif // LUNIMAGES_H
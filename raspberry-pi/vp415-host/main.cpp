@@ -33,6 +33,13 @@
 #include "mainwindow.h"
 
 int main(int argc, char *argv[]) {
+    // A daemon has no display, so it needs Qt's offscreen platform (this has
+    // to be chosen before the application is created)
+    for (int argument = 1; argument < argc; argument++) {
+        if (qstrcmp(argv[argument], "--daemon") == 0 && qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM"))
+            qputenv("QT_QPA_PLATFORM", "offscreen");
+    }
+
     QApplication app(argc, argv);
 
     // Set application name and version
@@ -57,9 +64,85 @@ int main(int argc, char *argv[]) {
         QCoreApplication::translate("main", "file"));
     parser.addOption(jsonFileOption);
 
+    // Add an option for specifying the Pico's debug UART (trace decoding)
+    QCommandLineOption debugPortOption(QStringList() << "d" << "debug-port",
+        QCoreApplication::translate("main", "Specify the serial port device connected to the Pico's debug UART"),
+        QCoreApplication::translate("main", "device"));
+    parser.addOption(debugPortOption);
+
+    // Add an option for specifying the CSV file the latency profile is exported to
+    QCommandLineOption profileFileOption(QStringList() << "p" << "profile",
+        QCoreApplication::translate("main", "Specify the CSV file to export the Pico latency profile to"),
+        QCoreApplication::translate("main", "file"));
+    parser.addOption(profileFileOption);
+
+    // Add an option for specifying the VCD file the SCSI bus capture is written to
+    QCommandLineOption captureFileOption(QStringList() << "c" << "capture",
+        QCoreApplication::translate("main", "Specify the VCD file to write the SCSI bus capture to"),
+        QCoreApplication::translate("main", "file"));
+    parser.addOption(captureFileOption);
+
+    // Add an option for specifying the SCSI bus capture trigger conditions
+    QCommandLineOption captureTriggerOption(QStringList() << "t" << "capture-trigger",
+        QCoreApplication::translate("main", "Specify the SCSI bus capture trigger mask (1 = DMA timeout, 2 = reset, 4 = check condition, default 3)"),
+        QCoreApplication::translate("main", "mask"), "3");
+    parser.addOption(captureTriggerOption);
+
+    // Add an option for specifying the Chrome/Perfetto JSON trace file
+    QCommandLineOption traceFileOption(QStringList() << "trace",
+        QCoreApplication::translate("main", "Specify the Chrome/Perfetto JSON file to write a timeline trace to"),
+        QCoreApplication::translate("main", "file"));
+    parser.addOption(traceFileOption);
+
+    // Add an option for serving metrics (Prometheus text format)
+    QCommandLineOption metricsOption(QStringList() << "metrics",
+        QCoreApplication::translate("main", "Serve Prometheus metrics on a port (localhost), address:port or Unix socket path"),
+        QCoreApplication::translate("main", "address"));
+    parser.addOption(metricsOption);
+
+    // Add an option for serving ADFS hard disc images (fixed emulation)
+    QCommandLineOption lunDirectoryOption(QStringList() << "f" << "fixed",
+        QCoreApplication::translate("main", "Serve read/write ADFS hard disc images (scsiN.dat/.dsc) from a LUN directory instead of a LaserDisc"),
+        QCoreApplication::translate("main", "directory"));
+    parser.addOption(lunDirectoryOption);
+
+    // Add options for keeping the LUN images pristine (copy-on-write overlays)
+    QCommandLineOption overlayDirectoryOption(QStringList() << "o" << "overlay",
+        QCoreApplication::translate("main", "Open the LUN images read-only and keep writes in copy-on-write overlays (scsiN.ovl) in a directory"),
+        QCoreApplication::translate("main", "directory"));
+    parser.addOption(overlayDirectoryOption);
+
+    QCommandLineOption resetOverlayOption(QStringList() << "reset-overlay",
+        QCoreApplication::translate("main", "Discard the overlays on start (returning the LUN images to their pristine state)"));
+    parser.addOption(resetOverlayOption);
+
+    // Add an option for verifying the disc's EFM data in the background
+    QCommandLineOption backgroundVerifyOption(QStringList() << "background-verify",
+        QCoreApplication::translate("main", "Verify the EFM data in the background at idle priority (bad sectors are reported as media errors) using a number of threads (0 = one per core)"),
+        QCoreApplication::translate("main", "threads"));
+    parser.addOption(backgroundVerifyOption);
+
+    // Add an option for real-time serving
+    QCommandLineOption realtimeOption(QStringList() << "realtime",
+        QCoreApplication::translate("main", "Serve the Pico from a core (ideally isolated with isolcpus=) at SCHED_FIFO priority with memory locked (needs root or CAP_SYS_NICE and CAP_IPC_LOCK)"),
+        QCoreApplication::translate("main", "core"));
+    parser.addOption(realtimeOption);
+
+    // Add an option for the SCSI initiator bridge
+    QCommandLineOption scsiBridgeOption(QStringList() << "scsi-bridge",
+        QCoreApplication::translate("main", "Let a software BBC Micro emulator act as SCSI initiator (LV-DOS emulation) on a port (localhost), address:port or Unix socket path"),
+        QCoreApplication::translate("main", "address"));
+    parser.addOption(scsiBridgeOption);
+
+    // Add an option for running without a window
+    QCommandLineOption daemonOption(QStringList() << "daemon",
+        QCoreApplication::translate("main", "Run without a window (as a service, for example when serving several units)"));
+    parser.addOption(daemonOption);
+
     // -- Positional arguments --
     parser.addPositionalArgument("serialport",
-        QCoreApplication::translate("main", "Specify serial port device to use"));
+        QCoreApplication::translate("main", "Specify serial port device to use (one per VP415 unit served)"),
+        "serialport...");
     
     // Process the command line options and arguments given by the user
     parser.process(app);
@@ -67,19 +150,52 @@ int main(int argc, char *argv[]) {
     // Get the JSON file argument from the parser
     QString jsonFilename = parser.value(jsonFileOption);
 
-    // Get the filename arguments from the parser
-    QString serialDeviceName;
-    QStringList positionalArguments = parser.positionalArguments();
+    // Get the debug port argument from the parser
+    QString debugDeviceName = parser.value(debugPortOption);
+
+    // Get the profile file argument from the parser
+    QString profileFilename = parser.value(profileFileOption);
+
+    // Get the capture arguments from the parser
+    QString captureFilename = parser.value(captureFileOption);
+    uint8_t captureTriggerMask = static_cast<uint8_t>(parser.value(captureTriggerOption).toUInt());
+
+    // Get the trace file argument from the parser
+    QString traceFilename = parser.value(traceFileOption);
+
+    // Get the metrics address argument from the parser
+    QString metricsAddress = parser.value(metricsOption);
+
+    // Get the LUN directory argument from the parser
+    QString lunDirectory = parser.value(lunDirectoryOption);
+
+    // Get the overlay arguments from the parser
+    QString overlayDirectory = parser.value(overlayDirectoryOption);
+    bool resetOverlay = parser.isSet(resetOverlayOption);
+
+    // Get the background verification threads from the parser (-1 = off)
+    int verifyThreads = parser.isSet(backgroundVerifyOption) ? parser.value(backgroundVerifyOption).toInt() : -1;
+
+    // Get the real-time core from the parser (-1 = off)
+    int realtimeCore = parser.isSet(realtimeOption) ? parser.value(realtimeOption).toInt() : -1;
+
+    // Get the SCSI bridge address from the parser
+    QString bridgeAddress = parser.value(scsiBridgeOption);
+
+    // Get the serial devices (one per unit) from the parser
+    QStringList serialDeviceNames = parser.positionalArguments();
 
-    if (positionalArguments.count() != 1) {
+    if (serialDeviceNames.isEmpty()) {
         qWarning() << "You must specify the serial device name";
         return 1;
     }
-    serialDeviceName = positionalArguments.at(0);
 
     // Get on with the main window
-    MainWindow mainWindow(nullptr, serialDeviceName, jsonFilename);
-    mainWindow.show();
+    MainWindow mainWindow(nullptr, serialDeviceNames, jsonFilename, debugDeviceName, profileFilename,
+                          captureFilename, captureTriggerMask, traceFilename, metricsAddress,
+                          lunDirectory, overlayDirectory, resetOverlay, verifyThreads,
+                          realtimeCore, bridgeAddress);
+    if (!parser.isSet(daemonOption)) mainWindow.show();
 
     return app.exec();
 }
@@ -27,10 +27,16 @@
 
 #include "mainwindow.h"
 #include "./ui_mainwindow.h"
+#include "realtime.h"
 
 // https://doc.qt.io/vscodeext/vscodeext-tutorials-qt-widgets.html
 
-MainWindow::MainWindow(QWidget *parent, QString serialDeviceName, QString jsonFilename)
+MainWindow::MainWindow(QWidget *parent, QStringList serialDeviceNames, QString jsonFilename,
+                       QString debugDeviceName, QString profileFilename,
+                       QString captureFilename, uint8_t captureTriggerMask,
+                       QString traceFilename, QString metricsAddress, QString lunDirectory,
+                       QString overlayDirectory, bool resetOverlay, int verifyThreads,
+                       int realtimeCore, QString bridgeAddress)
     : QMainWindow(parent), ui(new Ui::MainWindow) {
     ui->setupUi(this);
 
@@ -38,37 +44,143 @@ MainWindow::MainWindow(QWidget *parent, QString serialDeviceName, QString jsonFi
     statusBar = new QStatusBar();
     setStatusBar(statusBar);
 
-    // Connect the PicoComs dataReceived signal to the MainWindow slot
-    connect(&m_picoComs, &PicoComs::dataReceived, this, [this](const QByteArray &data) {
-        commandReceived(data);
-    });
+    // Metrics are always collected, but only served if requested
+    m_efmData.setMetrics(&m_metrics);
+    m_lunImages.setMetrics(&m_metrics);
+    m_verifier.setMetrics(&m_metrics);
+    m_metricsServer = nullptr;
+    m_scsiBridge = nullptr;
+    if (metricsAddress != "") {
+        m_metricsServer = new MetricsServer(&m_metrics, this);
+        m_metricsServer->listen(metricsAddress);
+    }
 
-    // Open the serial port
-    if (!m_picoComs.openSerialPort(serialDeviceName)) {
-        qDebug() << "MainWindow::MainWindow() - Failed to open serial port: " << serialDeviceName;
-        exit(EXIT_FAILURE);
+    // The Pico is served from this (the GUI) thread.  In real-time mode it is
+    // pinned to a core at SCHED_FIFO priority and memory is locked before
+    // any disc is opened, so the mapped images are locked too.
+    if (realtimeCore >= 0) {
+        if (!RealTime::enable(realtimeCore))
+            qDebug() << "MainWindow::MainWindow() - Real-time mode is incomplete; serving may be descheduled";
+        m_efmData.setMapBackingFiles(true);
+    }
+
+    // Open a link to the Pico of each unit.  The units share the disc data
+    // (and its caches), but each has its own mount state and requests.
+    for (const QString &serialDeviceName : serialDeviceNames) {
+        PicoLink *link = new PicoLink(static_cast<int>(m_links.size()), this);
+        link->setMetrics(&m_metrics);
+        connect(link, &PicoLink::dataReceived, this, &MainWindow::commandReceived);
+        if (!link->open(serialDeviceName)) {
+            qDebug() << "MainWindow::MainWindow() - Failed to open serial port: " << serialDeviceName;
+            exit(EXIT_FAILURE);
+        }
+        m_links.append(link);
+    }
+    m_link = m_links.first();
+
+    // Every unit reading the disc keeps its own prefetched extents in the
+    // shared cache
+    m_efmData.setCacheExtents(static_cast<int>(m_links.size()) * CACHE_EXTENTS_PER_UNIT);
+
+    // Open the trace file (optional) and merge the Pico's trace records into it
+    if (traceFilename != "") {
+        m_tracer.openTrace(traceFilename);
+        connect(&m_traceDecoder, &TraceDecoder::traceEventReceived, &m_tracer, &Tracer::picoTraceEvent);
     }
 
-    // Open the initial disc
-    if (jsonFilename != "") {
+    // Open the Pico debug port (optional - only used for decoding debug output)
+    if (debugDeviceName != "") {
+        if (!m_traceDecoder.openSerialPort(debugDeviceName)) {
+            qDebug() << "MainWindow::MainWindow() - Failed to open debug port: " << debugDeviceName;
+        }
+    }
+
+    // Serve hard disc images from a LUN directory (fixed emulation) or open
+    // the initial disc (LV-DOS emulation).  The Pico is told which, in case it
+    // started before the Pi.
+    m_verifyThreads = verifyThreads;
+    m_fixedEmulation = (lunDirectory != "");
+    queueEmulationMode();
+    if (m_fixedEmulation) {
+        // The units would write over each other's LUN images
+        if (m_links.size() > 1) {
+            qDebug() << "MainWindow::MainWindow() - Fixed emulation can only serve one unit";
+            exit(EXIT_FAILURE);
+        }
+        if (!m_lunImages.openDirectory(lunDirectory, overlayDirectory)) {
+            qDebug() << "MainWindow::MainWindow() - Failed to open LUN directory: " << lunDirectory;
+            exit(EXIT_FAILURE);
+        }
+        if (resetOverlay && !m_lunImages.resetOverlays()) {
+            qDebug() << "MainWindow::MainWindow() - Failed to reset the LUN image overlays";
+            exit(EXIT_FAILURE);
+        }
+        for (uint8_t lunNumber = 0; lunNumber < LunImages::MAX_LUNS; lunNumber++) queueDiscEvent(lunNumber);
+    } else if (jsonFilename != "") {
         openDisc(jsonFilename);
     } else {
-        qDebug() << "MainWindow::MainWindow() - For BETA you must specify a JSON filename";
+        qDebug() << "MainWindow::MainWindow() - For BETA you must specify a JSON filename (or a LUN directory)";
         exit(EXIT_FAILURE);
     }
 
+    // Let a software BBC be the SCSI initiator too (LV-DOS emulation only, as
+    // the bridge serves the disc rather than the LUN images)
+    if (bridgeAddress != "") {
+        if (m_fixedEmulation) {
+            qDebug() << "MainWindow::MainWindow() - The SCSI bridge is only available in LV-DOS emulation";
+        } else {
+            m_scsiBridge = new ScsiBridge(&m_efmData, &m_verifier, &m_metrics, this);
+            m_scsiBridge->setDisc(discDescriptor(0));
+            m_scsiBridge->listen(bridgeAddress);
+        }
+    }
+
     // Initial command states
-    m_mountState = false;
+    m_profileFilename = profileFilename;
+    m_captureFilename = captureFilename;
+    m_captureTriggerMask = captureTriggerMask;
 }
 
 MainWindow::~MainWindow() { delete ui; }
 
 void MainWindow::on_pushButton_clicked() {
-    qDebug() << "MainWindow::on_pushButton_clicked() - Button clicked";
+    // Requests can only be sent to the Pico in reply to its next poll
+    qDebug() << "MainWindow::on_pushButton_clicked() - Requesting latency profile from Pico";
+    m_links.first()->queueRequest(QByteArray(1, 0x01)); // PIQ_GET_PROFILE
+}
+
+void MainWindow::on_pushButtonArmCapture_clicked() {
+    qDebug() << "MainWindow::on_pushButtonArmCapture_clicked() - Arming SCSI bus capture with trigger mask: "
+             << m_captureTriggerMask;
+    QByteArray request(1, 0x03); // PIQ_ARM_CAPTURE
+    request.append(static_cast<char>(m_captureTriggerMask));
+    m_links.first()->queueRequest(request);
+}
+
+void MainWindow::on_pushButtonGetCapture_clicked() {
+    qDebug() << "MainWindow::on_pushButtonGetCapture_clicked() - Requesting SCSI bus capture from Pico";
+    m_links.first()->queueRequest(QByteArray(1, 0x04)); // PIQ_GET_CAPTURE
+}
+
+void MainWindow::on_pushButtonResetImages_clicked() {
+    if (!m_lunImages.hasOverlays()) {
+        qDebug() << "MainWindow::on_pushButtonResetImages_clicked() - LUN images aren't using overlays";
+        return;
+    }
+
+    // The Pico is sent a disc event for every LUN so that it drops any
+    // sectors it has buffered from the old contents
+    qDebug() << "MainWindow::on_pushButtonResetImages_clicked() - Resetting LUN images to pristine";
+    m_lunImages.resetOverlays();
+    for (uint8_t lunNumber = 0; lunNumber < LunImages::MAX_LUNS; lunNumber++) queueDiscEvent(lunNumber);
 }
 
-void MainWindow::commandReceived(const QByteArray &data) {
+// Commands are handled one at a time (from any unit); m_link is the unit
+// being served
+void MainWindow::commandReceived(PicoLink *link, const QByteArray &data) {
+    m_link = link;
     uint8_t command = static_cast<uint8_t>(data[0]);
+    int64_t startTime = m_tracer.now();
 
     // Process the command
     switch(command) {
@@ -88,14 +200,68 @@ void MainWindow::commandReceived(const QByteArray &data) {
             qDebug() << "MainWindow::dataReceived() - Command received: PIC_GET_USER_CODE";
             commandGetUserCode();
             break;
+        case 0x05: // PIC_POLL:
+            commandPoll(data, startTime);
+            break;
+        case 0x06: // PIC_PUT_PROFILE:
+            qDebug() << "MainWindow::dataReceived() - Command received: PIC_PUT_PROFILE";
+            commandPutProfile(data);
+            break;
+        case 0x07: // PIC_PUT_CAPTURE:
+            commandPutCapture(data);
+            break;
+        case 0x08: // PIC_READ_SECTORS:
+            commandReadSectors(data);
+            break;
+        case 0x09: // PIC_GET_DISC_DESCRIPTOR:
+            qDebug() << "MainWindow::dataReceived() - Command received: PIC_GET_DISC_DESCRIPTOR";
+            commandGetDiscDescriptor(data);
+            break;
+        case 0x0A: // PIC_PREFETCH_HINT:
+            commandPrefetchHint(data);
+            break;
+        case 0x0B: // PIC_VERIFY_SECTORS:
+            qDebug() << "MainWindow::dataReceived() - Command received: PIC_VERIFY_SECTORS";
+            commandVerifySectors(data);
+            break;
+        case 0x0C: // PIC_GET_EMULATION_MODE:
+            qDebug() << "MainWindow::dataReceived() - Command received: PIC_GET_EMULATION_MODE";
+            commandGetEmulationMode();
+            break;
+        case 0x0D: // PIC_WRITE_SECTORS:
+            commandWriteSectors(data);
+            break;
+        case 0x0E: // PIC_FORMAT_LUN:
+            qDebug() << "MainWindow::dataReceived() - Command received: PIC_FORMAT_LUN";
+            commandFormatLun(data);
+            break;
+        case 0x0F: // PIC_WRITE_DESCRIPTOR:
+            qDebug() << "MainWindow::dataReceived() - Command received: PIC_WRITE_DESCRIPTOR";
+            commandWriteDescriptor(data);
+            break;
+        case 0x10: // PIC_RESUME_SESSION:
+            qDebug() << "MainWindow::dataReceived() - Command received: PIC_RESUME_SESSION";
+            commandResumeSession(data);
+            break;
         default:
             qDebug() << "MainWindow::dataReceived() - Unknown command: " << data[0];
             break;
     }
+
+    int64_t endTime = m_tracer.now();
+    m_tracer.complete(Tracer::CATEGORY_PROTOCOL, QString("PIC 0x%1").arg(command, 2, 16, QChar('0')),
+                      startTime, endTime);
+    m_metrics.recordCommand(command, endTime - startTime);
+
+    int pendingRequests = 0;
+    for (const PicoLink *unitLink : m_links) pendingRequests += unitLink->pendingRequests();
+    m_metrics.pendingPicoRequests.set(pendingRequests);
 }
 
 // Open the disc specified by the JSON filename
 bool MainWindow::openDisc(QString jsonFilename) {
+    m_verifier.stop();
+
     if (!m_metadata.loadMetadata(jsonFilename)) {
         qDebug() << "MainWindow::openDisc() - Failed to load metadata for: " << jsonFilename;
         return false;
@@ -106,55 +272,527 @@ bool MainWindow::openDisc(QString jsonFilename) {
     // Get the EFM data filename from the metadata
     QString efmDataFilename = m_metadata.getAivData();
 
-    // The EFM data file is relative to the JSON file, so we need to extract the path
+    // The EFM data files are relative to the JSON file, so we need to extract the path
     QFileInfo jsonFileInfo(jsonFilename);
     efmDataFilename = jsonFileInfo.path() + "/" + efmDataFilename;
 
-    if (!m_efmData.openEfmData(efmDataFilename)) {
+    // The data is either a single file starting at the data offset or a list
+    // of extents (for partially captured or multi-part discs)
+    QVector<EfmData::Part> parts;
+    for (const Metadata::AivExtent &extent : m_metadata.getAivExtents()) {
+        parts.append(EfmData::Part{jsonFileInfo.path() + "/" + extent.data, extent.sector, extent.sectors,
+                                   extent.dataSector});
+    }
+    if (parts.isEmpty()) parts.append(EfmData::Part{efmDataFilename, m_metadata.getAivDataOffset(), 0, 0});
+
+    if (!m_efmData.openEfmData(parts)) {
         qDebug() << "MainWindow::openDisc() - Failed to open EFM data file: " << efmDataFilename;
+        queueDiscEvent(0);
         return false;
     }
 
+    // Check the whole disc in the background (the serving path refuses any
+    // sectors found to be bad)
+    if (m_verifyThreads >= 0) {
+        if (m_efmData.hasExtentIndex())
+            m_verifier.start(parts, m_efmData.extentMap(), m_verifyThreads);
+        else
+            qDebug() << "MainWindow::openDisc() - EFM data has no checksums; background verification is disabled";
+    }
+
+    queueDiscEvent(0);
     return true;
 }
 
+// Tell the Pico which emulation mode to use (0 = fixed, 1 = LV-DOS).  The
+// request goes to every unit unless a link is given.
+void MainWindow::queueEmulationMode(PicoLink *link) {
+    QByteArray request(1, 0x06); // PIQ_EMULATION_MODE
+    request.append(static_cast<char>(m_fixedEmulation ? 0x00 : 0x01));
+    if (link != nullptr) {
+        link->queueRequest(request);
+        return;
+    }
+    for (PicoLink *unitLink : m_links) unitLink->queueRequest(request);
+}
+
+// Push the current disc state for a LUN to the Pico (on mount, eject or disc
+// change) so that its LUN table never has to ask for it across the link.  The
+// event goes to every unit unless a link is given.
+void MainWindow::queueDiscEvent(uint8_t lunNumber, PicoLink *link) {
+    QByteArray request(1, 0x05); // PIQ_DISC_EVENT
+    request.append(static_cast<char>(lunNumber));
+    request.append(discDescriptor(lunNumber));
+    if (link != nullptr) {
+        link->queueRequest(request);
+    } else {
+        for (PicoLink *unitLink : m_links) unitLink->queueRequest(request);
+    }
+    if (m_scsiBridge != nullptr && !m_fixedEmulation && lunNumber == 0) m_scsiBridge->setDisc(discDescriptor(0));
+    qDebug() << "MainWindow::queueDiscEvent() - Disc event queued for LUN " << lunNumber
+             << " data present: " << static_cast<bool>(request[2]);
+}
+
+// Build the disc descriptor response: [0] data present, [1-22] LUN
+// descriptor, [23-27] user code.  In LV-DOS emulation the descriptor is built
+// from the metadata's DSC section; in fixed emulation it is the image's .dsc
+// (and there is no user code).  If there is no data everything after the
+// first byte is zero.  The LV-DOS disc is only on LUN 0 (disc events are
+// pushed for LUN 0 only, so no other LUN may hold it).
+QByteArray MainWindow::discDescriptor(uint8_t lunNumber) {
+    QByteArray response(28, 0x00);
+
+    if (m_fixedEmulation) {
+        QByteArray descriptor = m_lunImages.descriptor(lunNumber);
+        if (descriptor.size() != 22) return response;
+        response[0] = 0x01;
+        response.replace(1, 22, descriptor);
+        return response;
+    }
+
+    if (lunNumber != 0 || !m_efmData.hasEfmData()) return response;
+
+    response[0] = 0x01;
+
+    // Mode Select Parameter List (ACB-4000 manual figure 5-18)
+    response[1 + 3] = 8; // Length of Extent Descriptor List
+
+    // Extent Descriptor List (ACB-4000 manual figure 5-19)
+    response[1 + 4] = static_cast<char>(m_metadata.getDscDensityCode());
+    response[1 + 9] = 0x00; // Block size MSB
+    response[1 + 10] = static_cast<char>((m_metadata.getDscBlockSize() >> 8) & 0xFF);
+    response[1 + 11] = static_cast<char>(m_metadata.getDscBlockSize() & 0xFF);
+
+    // Drive Parameter List (ACB-4000 manual figure 5-20)
+    response[1 + 12] = static_cast<char>(m_metadata.getDscListFormatCode());
+    response[1 + 13] = static_cast<char>((m_metadata.getDscCylinderCount() >> 8) & 0xFF);
+    response[1 + 14] = static_cast<char>(m_metadata.getDscCylinderCount() & 0xFF);
+    response[1 + 15] = static_cast<char>(m_metadata.getDscDataHeadCount());
+    response[1 + 16] = static_cast<char>((m_metadata.getDscReducedWriteCurrentCylinder() >> 8) & 0xFF);
+    response[1 + 17] = static_cast<char>(m_metadata.getDscReducedWriteCurrentCylinder() & 0xFF);
+    response[1 + 18] = static_cast<char>((m_metadata.getDscWritePrecompensationCylinder() >> 8) & 0xFF);
+    response[1 + 19] = static_cast<char>(m_metadata.getDscWritePrecompensationCylinder() & 0xFF);
+    response[1 + 20] = static_cast<char>(m_metadata.getDscLandingZonePosition());
+    response[1 + 21] = static_cast<char>(m_metadata.getDscStepPulseOutputRateCode());
+
+    // User code (as sent by PIC_GET_USER_CODE)
+    QByteArray userCode = m_metadata.getAivUserCode().toUtf8().left(5);
+    response.replace(23, userCode.size(), userCode);
+
+    return response;
+}
+
 // Commands ---------------------------------------------------------------
 
 
 void MainWindow::commandSetMountState(uint8_t state) {
     bool newState = (state == 0x01) ? true : false;
-    if (m_mountState != newState) {
-        m_mountState = newState;
+    if (m_link->mountState() != newState) {
+        m_link->setMountState(newState);
         qDebug() << "MainWindow::commandSetMountState() - State: " << state;
-        m_picoComs.writeData(QByteArray(1, 0x01));
+        m_link->writeData(QByteArray(1, 0x01));
     } else {
         qDebug() << "MainWindow::commandSetMountState() - State already set to: " << state;
-        m_picoComs.writeData(QByteArray(1, 0x00));
+        m_link->writeData(QByteArray(1, 0x00));
     }
 }
 
 void MainWindow::commandGetMountState() {
-    if (m_mountState == false) {
+    if (m_link->mountState() == false) {
         qDebug() << "MainWindow::commandGetMountState() - EFM data is not mounted";
-        m_picoComs.writeData(QByteArray(1, 0x00));
+        m_link->writeData(QByteArray(1, 0x00));
     } else {
         qDebug() << "MainWindow::commandGetMountState() - EFM data is mounted";
-        m_picoComs.writeData(QByteArray(1, 0x01));
+        m_link->writeData(QByteArray(1, 0x01));
     }    
 }
 
 void MainWindow::commandGetEfmDataPresent() {
     if (m_efmData.hasEfmData()) {
         qDebug() << "MainWindow::commandGetEfmDataPresent() - EFM data is present";
-        m_picoComs.writeData(QByteArray(1, 0x01));
+        m_link->writeData(QByteArray(1, 0x01));
     } else {
         qDebug() << "MainWindow::commandGetEfmDataPresent() - EFM data is not present";
-        m_picoComs.writeData(QByteArray(1, 0x00));
+        m_link->writeData(QByteArray(1, 0x00));
     }
 }
 
 void MainWindow::commandGetUserCode() {
     QString userCode = m_metadata.getAivUserCode();
     qDebug() << "MainWindow::commandGetUserCode() - User code: " << userCode;
-    m_picoComs.writeData(userCode.toUtf8());
-}
\ No newline at end of file
+    m_link->writeData(userCode.toUtf8());
+}
+
+// The Pico polls whilst the SCSI bus is idle; reply with any pending request.
+// The poll also carries the Pico's timestamps used for clock offset estimation.
+void MainWindow::commandPoll(const QByteArray &data, int64_t receiveTime) {
+    // Requests are sent one per poll; the Pico polls again straight away
+    // whilst requests are pending
+    if (!m_link->hasPendingRequest()) {
+        m_link->writeData(QByteArray(1, 0x00)); // PIQ_NONE
+    } else {
+        QByteArray request = m_link->takeRequest();
+        qDebug() << "MainWindow::commandPoll() - Sending request: " << static_cast<uint8_t>(request[0]);
+        m_link->writeData(request);
+    }
+    int64_t sendTime = m_tracer.now();
+
+    // Only the first unit's clock is tracked (its Pico's trace is the one merged)
+    if (data.size() >= 13 && m_link == m_links.first()) {
+        auto readUint32 = [&data](int position) {
+            return (static_cast<uint32_t>(static_cast<uint8_t>(data[position])) << 24) |
+                   (static_cast<uint32_t>(static_cast<uint8_t>(data[position + 1])) << 16) |
+                   (static_cast<uint32_t>(static_cast<uint8_t>(data[position + 2])) << 8) |
+                   static_cast<uint32_t>(static_cast<uint8_t>(data[position + 3]));
+        };
+        m_tracer.pollReceived(readUint32(1), readUint32(5), readUint32(9), receiveTime, sendTime);
+    }
+}
+
+void MainWindow::commandPutProfile(const QByteArray &data) {
+    m_link->writeData(QByteArray(1, 0x00)); // PIR_OK
+
+    // The profile and capture are collected from the first unit only
+    if (m_link != m_links.first()) return;
+    if (m_latencyProfile.addFrame(data)) {
+        m_latencyProfile.showProfile();
+        if (m_profileFilename != "") m_latencyProfile.exportCsv(m_profileFilename);
+    }
+}
+
+// The capture is sent in several frames (and is sent without being requested
+// when a trigger condition is met)
+void MainWindow::commandPutCapture(const QByteArray &data) {
+    m_link->writeData(QByteArray(1, 0x00)); // PIR_OK
+
+    if (m_link != m_links.first()) return;
+    if (m_busCapture.addFrame(data)) {
+        m_busCapture.showCapture();
+        if (m_captureFilename != "") m_busCapture.writeVcd(m_captureFilename);
+    }
+}
+
+// Read sectors from the EFM data or LUN image (the reply is empty if the
+// sectors can't be read, or reports the first bad sector)
+void MainWindow::commandReadSectors(const QByteArray &data) {
+    if (data.size() < 7) {
+        qDebug() << "MainWindow::commandReadSectors() - Invalid request length: " << data.size();
+        m_link->writeData(QByteArray());
+        return;
+    }
+
+    uint8_t lunNumber = static_cast<uint8_t>(data[1]);
+    uint32_t startSector = (static_cast<uint32_t>(static_cast<uint8_t>(data[2])) << 24) |
+                           (static_cast<uint32_t>(static_cast<uint8_t>(data[3])) << 16) |
+                           (static_cast<uint32_t>(static_cast<uint8_t>(data[4])) << 8) |
+                           static_cast<uint32_t>(static_cast<uint8_t>(data[5]));
+    uint8_t numberOfSectors = static_cast<uint8_t>(data[6]);
+
+    QByteArray sectorData;
+    if (m_fixedEmulation) {
+        int64_t startTime = m_tracer.now();
+        sectorData = m_lunImages.readSectors(lunNumber, startSector, numberOfSectors);
+        if (m_tracer.isTracing()) {
+            m_tracer.complete(Tracer::CATEGORY_DISC_IO, "LunImages::readSectors", startTime, m_tracer.now(),
+                              QJsonObject{{"lun", lunNumber}, {"sector", static_cast<qint64>(startSector)}});
+        }
+
+        if (sectorData.size() != numberOfSectors * 256) {
+            qDebug() << "MainWindow::commandReadSectors() - Failed to read sector " << startSector << " for LUN " << lunNumber;
+            m_metrics.sectorReadErrors.add();
+            sectorData.clear();
+        } else {
+            m_metrics.sectorsServed.add(numberOfSectors);
+        }
+        m_link->writeData(sectorData);
+        return;
+    }
+
+    // Sectors that failed background verification aren't served; the reply is
+    // [0] 0x01 (bad sector), [1-4] first bad sector, which the Pico reports as
+    // a media error.  (A 5 byte reply can't be mistaken for sector data.)
+    m_verifier.noteActivity();
+    uint32_t firstBadSector = startSector;
+    if (m_verifier.isBad(startSector, numberOfSectors, &firstBadSector)) {
+        qDebug() << "MainWindow::commandReadSectors() - Sector" << firstBadSector
+                 << "failed background verification for LUN " << lunNumber;
+        m_metrics.sectorReadErrors.add();
+        QByteArray badSectorReply(5, 0x01);
+        badSectorReply[1] = static_cast<char>((firstBadSector >> 24) & 0xFF);
+        badSectorReply[2] = static_cast<char>((firstBadSector >> 16) & 0xFF);
+        badSectorReply[3] = static_cast<char>((firstBadSector >> 8) & 0xFF);
+        badSectorReply[4] = static_cast<char>(firstBadSector & 0xFF);
+        m_link->writeData(badSectorReply);
+        return;
+    }
+
+    for (uint32_t sector = startSector; sector < startSector + numberOfSectors; sector++) {
+        int64_t startTime = m_tracer.now();
+        QByteArray efmSectorData = m_efmData.getEfmSectorData(sector);
+        if (m_tracer.isTracing()) {
+            m_tracer.complete(Tracer::CATEGORY_DISC_IO, "EfmData::getEfmSectorData", startTime, m_tracer.now(),
+                              QJsonObject{{"sector", static_cast<qint64>(sector)}});
+        }
+
+        if (efmSectorData.size() != 256) {
+            qDebug() << "MainWindow::commandReadSectors() - Failed to read sector " << sector << " for LUN " << lunNumber;
+            m_metrics.sectorReadErrors.add();
+            m_link->writeData(QByteArray());
+            return;
+        }
+        sectorData.append(efmSectorData);
+    }
+
+    m_link->writeData(sectorData);
+    m_metrics.sectorsServed.add(numberOfSectors);
+    m_tracer.instant(Tracer::CATEGORY_PROTOCOL, "Sectors sent",
+                     QJsonObject{{"startSector", static_cast<qint64>(startSector)}, {"sectors", numberOfSectors}});
+}
+
+// The Pico hints at sectors it expects to be read soon (on SEEK and after a
+// READ).  Reply straight away and cache the extent once the reply has gone.
+//
+// Request: [1] LUN, [2-5] start sector, [6] sectors, then the Pico's prefetch
+// counters: [7-10] hints, [11-14] sectors prefetched, [15-18] prefetched
+// sectors used
+void MainWindow::commandPrefetchHint(const QByteArray &data) {
+    m_link->writeData(QByteArray(1, 0x00));
+
+    if (data.size() < 19) {
+        qDebug() << "MainWindow::commandPrefetchHint() - Invalid request length: " << data.size();
+        return;
+    }
+
+    auto readUint32 = [&data](int position) {
+        return (static_cast<uint32_t>(static_cast<uint8_t>(data[position])) << 24) |
+               (static_cast<uint32_t>(static_cast<uint8_t>(data[position + 1])) << 16) |
+               (static_cast<uint32_t>(static_cast<uint8_t>(data[position + 2])) << 8) |
+               static_cast<uint32_t>(static_cast<uint8_t>(data[position + 3]));
+    };
+    uint32_t startSector = readUint32(2);
+    uint8_t numberOfSectors = static_cast<uint8_t>(data[6]);
+
+    m_metrics.prefetchHints.add();
+    m_metrics.picoPrefetchHints.set(readUint32(7));
+    m_metrics.picoPrefetchedSectors.set(readUint32(11));
+    m_metrics.picoPrefetchUsedSectors.set(readUint32(15));
+
+    // LUN images are read through the OS page cache, so there's nothing to do
+    if (m_fixedEmulation) return;
+
+    m_verifier.noteActivity();
+    QTimer::singleShot(0, this, [this, startSector, numberOfSectors]() {
+        int64_t startTime = m_tracer.now();
+        m_efmData.prefetch(startSector, numberOfSectors);
+        m_tracer.complete(Tracer::CATEGORY_DISC_IO, "EfmData::prefetch", startTime, m_tracer.now(),
+                          QJsonObject{{"sector", static_cast<qint64>(startSector)}});
+    });
+}
+
+// Verify a range of sectors against the extent index of the EFM data (or, in
+// fixed emulation, that the sectors are present in the LUN image)
+//
+// Request: [1] LUN, [2-5] start sector, [6-9] number of sectors
+// Response: [0] result (0 = passed, 1 = failed, 2 = could not verify),
+//           [1-4] first bad sector
+void MainWindow::commandVerifySectors(const QByteArray &data) {
+    QByteArray response(5, 0x00);
+
+    if (data.size() < 10) {
+        qDebug() << "MainWindow::commandVerifySectors() - Invalid request length: " << data.size();
+        response[0] = 0x02;
+        m_link->writeData(response);
+        return;
+    }
+
+    auto readUint32 = [&data](int position) {
+        return (static_cast<uint32_t>(static_cast<uint8_t>(data[position])) << 24) |
+               (static_cast<uint32_t>(static_cast<uint8_t>(data[position + 1])) << 16) |
+               (static_cast<uint32_t>(static_cast<uint8_t>(data[position + 2])) << 8) |
+               static_cast<uint32_t>(static_cast<uint8_t>(data[position + 3]));
+    };
+    uint32_t startSector = readUint32(2);
+    uint32_t numberOfSectors = readUint32(6);
+    uint32_t firstBadSector = startSector;
+
+    m_verifier.noteActivity();
+    int64_t startTime = m_tracer.now();
+    if (m_fixedEmulation) {
+        // A LUN image has no index; check that the sectors are in the image
+        uint8_t lunNumber = static_cast<uint8_t>(data[1]);
+        response[0] = m_lunImages.verifySectors(lunNumber, startSector, numberOfSectors, &firstBadSector)
+                          ? 0x00 : 0x01;
+    } else if (!m_efmData.hasEfmData()) {
+        qDebug() << "MainWindow::commandVerifySectors() - No EFM data";
+        response[0] = 0x02;
+    } else if (!m_efmData.hasExtentIndex()) {
+        // Without an index (built by vp415-efmtool index) the sectors can't be
+        // checked, so, as before indexes existed, sectors that are on the disc pass
+        qDebug() << "MainWindow::commandVerifySectors() - No extent index for the EFM data; sectors not checked";
+        if (static_cast<uint64_t>(startSector) + numberOfSectors > m_efmData.sectorCount()) {
+            firstBadSector = qMax(startSector, m_efmData.sectorCount());
+            response[0] = 0x01;
+        }
+    } else if (m_efmData.verifySectors(startSector, numberOfSectors, &firstBadSector)) {
+        qDebug() << "MainWindow::commandVerifySectors() - Sectors " << startSector << " to "
+                 << startSector + numberOfSectors - 1 << " verified";
+        response[0] = 0x00;
+    } else {
+        qDebug() << "MainWindow::commandVerifySectors() - Verify failed at sector " << firstBadSector;
+        response[0] = 0x01;
+    }
+    m_tracer.complete(Tracer::CATEGORY_DISC_IO, "EfmData::verifySectors", startTime, m_tracer.now(),
+                      QJsonObject{{"sector", static_cast<qint64>(startSector)},
+                                  {"sectors", static_cast<qint64>(numberOfSectors)}});
+
+    response[1] = static_cast<char>((firstBadSector >> 24) & 0xFF);
+    response[2] = static_cast<char>((firstBadSector >> 16) & 0xFF);
+    response[3] = static_cast<char>((firstBadSector >> 8) & 0xFF);
+    response[4] = static_cast<char>(firstBadSector & 0xFF);
+    m_link->writeData(response);
+}
+
+// Get the LUN descriptor and user code in a single response.  The Pico keeps
+// both in its LUN table, so this is only requested the first time a LUN is
+// checked; after that the table is kept current by PIQ_DISC_EVENT pushes.
+//
+// Response: [0] EFM data present, [1-22] descriptor, [23-27] user code
+void MainWindow::commandGetDiscDescriptor(const QByteArray &data) {
+    uint8_t lunNumber = static_cast<uint8_t>(data.size() > 1 ? data[1] : 0);
+    QByteArray response = discDescriptor(lunNumber);
+
+    if (response[0] == 0x00) {
+        qDebug() << "MainWindow::commandGetDiscDescriptor() - No data present for LUN " << lunNumber;
+        m_link->writeData(QByteArray(1, 0x00));
+        return;
+    }
+
+    qDebug() << "MainWindow::commandGetDiscDescriptor() - Descriptor sent for LUN " << lunNumber;
+    m_link->writeData(response);
+}
+
+void MainWindow::commandGetEmulationMode() {
+    qDebug() << "MainWindow::commandGetEmulationMode() - Fixed emulation: " << m_fixedEmulation;
+    m_link->writeData(QByteArray(1, m_fixedEmulation ? 0x00 : 0x01));
+}
+
+// Write sectors to a LUN image (fixed emulation only; the LaserDisc is read
+// only).  The reply is sent once the sectors are in the journal; the last
+// write of a SCSI command is flagged so that the journal is committed (synced)
+// before the Pico reports the command complete.
+//
+// Request: [1] LUN, [2-5] start sector, [6] sectors, [7] flags (bit 0 = last
+//          write of the command), [8...] sector data
+// Response: [0] result (0 = written, 1 = failed)
+void MainWindow::commandWriteSectors(const QByteArray &data) {
+    if (data.size() < 8 || data.size() != 8 + static_cast<uint8_t>(data[6]) * 256) {
+        qDebug() << "MainWindow::commandWriteSectors() - Invalid request length: " << data.size();
+        m_metrics.sectorWriteErrors.add();
+        m_link->writeData(QByteArray(1, 0x01));
+        return;
+    }
+
+    uint8_t lunNumber = static_cast<uint8_t>(data[1]);
+    uint32_t startSector = (static_cast<uint32_t>(static_cast<uint8_t>(data[2])) << 24) |
+                           (static_cast<uint32_t>(static_cast<uint8_t>(data[3])) << 16) |
+                           (static_cast<uint32_t>(static_cast<uint8_t>(data[4])) << 8) |
+                           static_cast<uint32_t>(static_cast<uint8_t>(data[5]));
+    uint8_t numberOfSectors = static_cast<uint8_t>(data[6]);
+    bool commit = (static_cast<uint8_t>(data[7]) & 0x01) != 0;
+
+    int64_t startTime = m_tracer.now();
+    bool written = m_fixedEmulation && m_lunImages.writeSectors(lunNumber, startSector, data.mid(8), commit);
+    m_tracer.complete(Tracer::CATEGORY_DISC_IO, "LunImages::writeSectors", startTime, m_tracer.now(),
+                      QJsonObject{{"lun", lunNumber}, {"sector", static_cast<qint64>(startSector)},
+                                  {"sectors", numberOfSectors}});
+
+    if (!written) {
+        qDebug() << "MainWindow::commandWriteSectors() - Failed to write sector " << startSector << " for LUN " << lunNumber;
+        m_metrics.sectorWriteErrors.add();
+        m_link->writeData(QByteArray(1, 0x01));
+        return;
+    }
+
+    m_metrics.sectorsWritten.add(numberOfSectors);
+    m_link->writeData(QByteArray(1, 0x00));
+}
+
+// Format (recreate) a LUN image with the number of sectors given by its
+// descriptor (the Pico asks for the LUN's descriptor again when it restarts
+// the LUN)
+//
+// Request: [1] LUN, [2] fill pattern, [3-6] sectors
+// Response: [0] result (0 = formatted, 1 = failed)
+void MainWindow::commandFormatLun(const QByteArray &data) {
+    if (data.size() < 7 || !m_fixedEmulation) {
+        qDebug() << "MainWindow::commandFormatLun() - Format is not possible";
+        m_link->writeData(QByteArray(1, 0x01));
+        return;
+    }
+
+    uint8_t lunNumber = static_cast<uint8_t>(data[1]);
+    uint32_t numberOfSectors = (static_cast<uint32_t>(static_cast<uint8_t>(data[3])) << 24) |
+                               (static_cast<uint32_t>(static_cast<uint8_t>(data[4])) << 16) |
+                               (static_cast<uint32_t>(static_cast<uint8_t>(data[5])) << 8) |
+                               static_cast<uint32_t>(static_cast<uint8_t>(data[6]));
+
+    if (!m_lunImages.format(lunNumber, numberOfSectors)) {
+        m_link->writeData(QByteArray(1, 0x01));
+        return;
+    }
+    m_link->writeData(QByteArray(1, 0x00));
+}
+
+// Write the 22 byte descriptor (drive geometry) for a LUN image
+//
+// Request: [1] LUN, [2-23] descriptor
+// Response: [0] result (0 = written, 1 = failed)
+void MainWindow::commandWriteDescriptor(const QByteArray &data) {
+    if (data.size() != 24 || !m_fixedEmulation ||
+        !m_lunImages.writeDescriptor(static_cast<uint8_t>(data[1]), data.mid(2))) {
+        qDebug() << "MainWindow::commandWriteDescriptor() - Failed to write descriptor";
+        m_link->writeData(QByteArray(1, 0x01));
+        return;
+    }
+    m_link->writeData(QByteArray(1, 0x00));
+}
+
+// The Pico starts a session when it boots and resumes it after the link has
+// dropped.  A session the link doesn't hold (the Pico, or this host,
+// restarted) takes the Pico's mount state and the emulation mode and LUN
+// state are pushed again; a resumed session keeps everything, including the
+// requests still queued for the Pico.
+//
+// Request: [1-4] Pico session id, [5] mount state
+// Response: [0-3] Pi session id, [4] 1 if the session was resumed, 0 if it is new
+void MainWindow::commandResumeSession(const QByteArray &data) {
+    if (data.size() != 6) {
+        qDebug() << "MainWindow::commandResumeSession() - Invalid request";
+        m_link->writeData(QByteArray());
+        return;
+    }
+
+    uint32_t picoSessionId = (static_cast<uint32_t>(static_cast<uint8_t>(data[1])) << 24) |
+                             (static_cast<uint32_t>(static_cast<uint8_t>(data[2])) << 16) |
+                             (static_cast<uint32_t>(static_cast<uint8_t>(data[3])) << 8) |
+                             static_cast<uint32_t>(static_cast<uint8_t>(data[4]));
+
+    bool resumed = m_link->resumeSession(picoSessionId);
+    if (resumed) {
+        m_metrics.sessionResumes.add();
+    } else {
+        m_link->setMountState(data[5] != 0);
+        queueEmulationMode(m_link);
+        uint8_t luns = m_fixedEmulation ? LunImages::MAX_LUNS : 1;
+        for (uint8_t lunNumber = 0; lunNumber < luns; lunNumber++) queueDiscEvent(lunNumber, m_link);
+    }
+
+    uint32_t sessionId = m_link->sessionId();
+    QByteArray response(5, 0x00);
+    response[0] = static_cast<char>((sessionId >> 24) & 0xFF);
+    response[1] = static_cast<char>((sessionId >> 16) & 0xFF);
+    response[2] = static_cast<char>((sessionId >> 8) & 0xFF);
+    response[3] = static_cast<char>(sessionId & 0xFF);
+    response[4] = static_cast<char>(resumed ? 0x01 : 0x00);
+    m_link->writeData(response);
+}
@@ -31,10 +31,23 @@
 #include <QDebug>
 #include <QMainWindow>
 #include <QFileInfo>
+#include <QList>
+#include <QStringList>
+#include <QVector>
+#include <QTimer>
 
-#include "picocoms.h"
+#include "picolink.h"
 #include "metadata.h"
 #include "efmdata.h"
+#include "backgroundverifier.h"
+#include "lunimages.h"
+#include "tracedecoder.h"
+#include "latencyprofile.h"
+#include "buscapture.h"
+#include "tracer.h"
+#include "metrics.h"
+#include "metricsserver.h"
+#include "scsibridge.h"
 
 QT_BEGIN_NAMESPACE
 namespace Ui {
@@ -46,30 +59,71 @@ class MainWindow : public QMainWindow {
     Q_OBJECT
 
 public:
-    MainWindow(QWidget *parent = nullptr, QString serialDeviceName = "", QString jsonFilename = "");
+    MainWindow(QWidget *parent = nullptr, QStringList serialDeviceNames = QStringList(), QString jsonFilename = "",
+               QString debugDeviceName = "", QString profileFilename = "",
+               QString captureFilename = "", uint8_t captureTriggerMask = 0,
+               QString traceFilename = "", QString metricsAddress = "",
+               QString lunDirectory = "", QString overlayDirectory = "",
+               bool resetOverlay = false, int verifyThreads = -1, int realtimeCore = -1,
+               QString bridgeAddress = "");
     ~MainWindow();
 
 private slots:
     void on_pushButton_clicked();
-    void commandReceived(const QByteArray &data);
+    void on_pushButtonArmCapture_clicked();
+    void on_pushButtonGetCapture_clicked();
+    void on_pushButtonResetImages_clicked();
+    void commandReceived(PicoLink *link, const QByteArray &data);
 
 private:
     Ui::MainWindow *ui;
 
     QStatusBar *statusBar;
-    PicoComs m_picoComs;
+    QVector<PicoLink *> m_links;
+    PicoLink *m_link;  // The unit whose command is being handled
     Metadata m_metadata;
     EfmData m_efmData;
+    LunImages m_lunImages;
+    TraceDecoder m_traceDecoder;
+    LatencyProfile m_latencyProfile;
+    BusCapture m_busCapture;
+    Tracer m_tracer;
+    Metrics m_metrics;
+    MetricsServer *m_metricsServer;
+    BackgroundVerifier m_verifier;
+    ScsiBridge *m_scsiBridge;
 
     bool openDisc(QString jsonFilename);
+    void queueEmulationMode(PicoLink *link = nullptr);
+    void queueDiscEvent(uint8_t lunNumber, PicoLink *link = nullptr);
+    QByteArray discDescriptor(uint8_t lunNumber);
+
+    // Prefetched extents kept in the shared EFM data cache for each unit
+    static const int CACHE_EXTENTS_PER_UNIT = 2;
 
     // Command variables
-    bool m_mountState;
+    bool m_fixedEmulation;  // Serving hard disc images rather than a LaserDisc
+    QString m_profileFilename;
+    QString m_captureFilename;
+    uint8_t m_captureTriggerMask;
+    int m_verifyThreads;  // Background verification threads (0 = one per core, -1 = off)
 
     // Commands
     void commandSetMountState(uint8_t state);
     void commandGetMountState();
     void commandGetEfmDataPresent();
     void commandGetUserCode();
+    void commandPoll(const QByteArray &data, int64_t receiveTime);
+    void commandPutProfile(const QByteArray &data);
+    void commandPutCapture(const QByteArray &data);
+    void commandReadSectors(const QByteArray &data);
+    void commandGetDiscDescriptor(const QByteArray &data);
+    void commandPrefetchHint(const QByteArray &data);
+    void commandVerifySectors(const QByteArray &data);
+    void commandGetEmulationMode();
+    void commandWriteSectors(const QByteArray &data);
+    void commandFormatLun(const QByteArray &data);
+    void commandWriteDescriptor(const QByteArray &data);
+    void commandResumeSession(const QByteArray &data);
 };
 #endif  // MAINWINDOW_H
@@ -82,6 +82,16 @@ bool Metadata::loadMetadata(QString metadataFile) {
     m_aivDataOffset = aiv["dataOffset"].toInt();
     m_aivUserCode = aiv["userCode"].toString();
 
+    m_aivExtents.clear();
+    const QJsonArray extents = aiv["extents"].toArray();
+    for (const QJsonValue &value : extents) {
+        QJsonObject extent = value.toObject();
+        m_aivExtents.append(AivExtent{static_cast<uint32_t>(extent["sector"].toInteger()),
+                                      static_cast<uint32_t>(extent["sectors"].toInteger()),
+                                      extent["data"].toString(),
+                                      static_cast<uint32_t>(extent["dataSector"].toInteger())});
+    }
+
     qDebug() << "Metadata::loadMetadata() - Metadata loaded successfully for" << m_aivDisplayName;
 
     return true;
@@ -107,4 +117,8 @@ void Metadata::showMetadata() {
     qDebug() << "    Data: " << m_aivData;
     qDebug() << "    Data Offset: " << m_aivDataOffset;
     qDebug() << "    User Code: " << m_aivUserCode;
+    for (const AivExtent &extent : m_aivExtents) {
+        qDebug() << "    Extent: sector" << extent.sector << "sectors" << extent.sectors << "from" << extent.data
+                 << "sector" << extent.dataSector;
+    }
 }
\ No newline at end of file
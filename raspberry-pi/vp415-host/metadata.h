@@ -34,6 +34,8 @@
 #include <QJsonObject>
 #include <QByteArray>
 #include <QJsonDocument>
+#include <QJsonArray>
+#include <QVector>
 
 class Metadata : public QObject
 {
@@ -45,6 +47,15 @@ public:
 
     bool loadMetadata(QString metadataFile);
 
+    // A run of disc sectors held in a data file (aiv.extents).  Discs without
+    // extents are held in aiv.data, starting at disc sector aiv.dataOffset.
+    struct AivExtent {
+        uint32_t sector;
+        uint32_t sectors;     // 0 for the rest of the file
+        QString data;
+        uint32_t dataSector;
+    };
+
     uint16_t getDscDensityCode() const { return m_dscDensityCode; }
     uint16_t getDscBlockSize() const { return m_dscBlockSize; }
     uint16_t getDscListFormatCode() const { return m_dscListFormatCode; }
@@ -61,6 +72,7 @@ public:
     QString getAivData() const { return m_aivData; }
     uint16_t getAivDataOffset() const { return m_aivDataOffset; }
     QString getAivUserCode() const { return m_aivUserCode; }
+    QVector<AivExtent> getAivExtents() const { return m_aivExtents; }
 
     void showMetadata();
 
@@ -81,6 +93,7 @@ private:
     QString m_aivData;
     uint16_t m_aivDataOffset;
     QString m_aivUserCode;
+    QVector<AivExtent> m_aivExtents;
 };
 
 
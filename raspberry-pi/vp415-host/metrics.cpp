@@ -0,0 +1,192 @@
+/************************************************************************
+
+    metrics.cpp
+
+    VP415-host - A host application for the VP415 Emulator
+    VP415-Emulator
+    Copyright (C) 2025 Simon Inns
+
+    This file is part of VP415-Emulator.
+
+    This is free software: you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Email: simon.inns@gmail.com
+
+************************************************************************/
+
+#include "metrics.h"
+
+// Counter -----------------------------------------------------------------
+
+// Threads are given shards round-robin on first use
+int MetricCounter::shardIndex() {
+    static std::atomic<int> nextShard{0};
+    thread_local int shard = nextShard.fetch_add(1, std::memory_order_relaxed) % SHARDS;
+    return shard;
+}
+
+uint64_t MetricCounter::value() const {
+    uint64_t total = 0;
+    for (const Shard &shard : m_shards) total += shard.value.load(std::memory_order_relaxed);
+    return total;
+}
+
+// Histogram ---------------------------------------------------------------
+
+// Values below SUB_BUCKETS have a bucket each; above that the bucket is the
+// octave (position of the top bit) plus the next SUB_BUCKET_BITS bits
+int MetricHistogram::bucketIndex(uint64_t valueUs) {
+    if (valueUs < SUB_BUCKETS) return static_cast<int>(valueUs);
+
+    int topBit = 63 - __builtin_clzll(valueUs);
+    int octave = topBit - SUB_BUCKET_BITS + 1;
+    int subBucket = static_cast<int>((valueUs >> (topBit - SUB_BUCKET_BITS)) & (SUB_BUCKETS - 1));
+    int bucket = (octave * SUB_BUCKETS) + subBucket;
+
+    return bucket < BUCKETS ? bucket : BUCKETS - 1;
+}
+
+// Inclusive upper bound of a bucket in microseconds
+uint64_t MetricHistogram::bucketUpperBound(int bucket) {
+    if (bucket < SUB_BUCKETS) return static_cast<uint64_t>(bucket);
+
+    int octave = bucket / SUB_BUCKETS;
+    int subBucket = bucket % SUB_BUCKETS;
+    int shift = octave - 1;
+    return ((static_cast<uint64_t>(SUB_BUCKETS + subBucket + 1)) << shift) - 1;
+}
+
+void MetricHistogram::record(uint64_t valueUs) {
+    m_buckets[bucketIndex(valueUs)].fetch_add(1, std::memory_order_relaxed);
+    m_count.fetch_add(1, std::memory_order_relaxed);
+    m_sum.fetch_add(valueUs, std::memory_order_relaxed);
+}
+
+// Metrics -----------------------------------------------------------------
+
+Metrics::Metrics(QObject *parent) : QObject(parent) {}
+
+Metrics::~Metrics() {
+    for (std::atomic<MetricHistogram *> &histogram : m_commandLatency) delete histogram.load();
+}
+
+void Metrics::recordCommand(uint8_t command, uint64_t latencyUs) {
+    m_commandCount[command].add();
+
+    MetricHistogram *histogram = m_commandLatency[command].load(std::memory_order_acquire);
+    if (histogram == nullptr) {
+        MetricHistogram *newHistogram = new MetricHistogram;
+        if (m_commandLatency[command].compare_exchange_strong(histogram, newHistogram,
+                                                              std::memory_order_acq_rel)) {
+            histogram = newHistogram;
+        } else {
+            // Another thread installed one first
+            delete newHistogram;
+        }
+    }
+    histogram->record(latencyUs);
+}
+
+// Render the metrics in the Prometheus text exposition format
+QString Metrics::prometheusText() const {
+    QString text;
+
+    auto counter = [&text](QString name, QString help, uint64_t value) {
+        text += QString("# HELP %1 %2\n# TYPE %1 counter\n%1 %3\n").arg(name, help).arg(value);
+    };
+    auto gauge = [&text](QString name, QString help, int64_t value) {
+        text += QString("# HELP %1 %2\n# TYPE %1 gauge\n%1 %3\n").arg(name, help).arg(value);
+    };
+
+    // Per-command metrics
+    text += "# HELP vp415_pico_commands_total Commands received from the Pico\n";
+    text += "# TYPE vp415_pico_commands_total counter\n";
+    for (int command = 0; command < 256; command++) {
+        uint64_t count = m_commandCount[command].value();
+        if (count == 0) continue;
+        text += QString("vp415_pico_commands_total{command=\"0x%1\"} %2\n")
+                    .arg(command, 2, 16, QChar('0')).arg(count);
+    }
+
+    text += "# HELP vp415_pico_command_latency_seconds Time taken to handle a command from the Pico\n";
+    text += "# TYPE vp415_pico_command_latency_seconds histogram\n";
+    for (int command = 0; command < 256; command++) {
+        const MetricHistogram *histogram = m_commandLatency[command].load(std::memory_order_acquire);
+        if (histogram == nullptr) continue;
+
+        // Every bucket boundary is written (even if empty) so the le labels
+        // are the same on every scrape
+        QString label = QString("command=\"0x%1\"").arg(command, 2, 16, QChar('0'));
+        uint64_t cumulative = 0;
+        for (int bucket = 0; bucket < MetricHistogram::BUCKETS - 1; bucket++) {
+            cumulative += histogram->bucketCount(bucket);
+            double upperBound = static_cast<double>(MetricHistogram::bucketUpperBound(bucket) + 1) / 1e6;
+            text += QString("vp415_pico_command_latency_seconds_bucket{%1,le=\"%2\"} %3\n")
+                        .arg(label).arg(upperBound, 0, 'g', 6).arg(cumulative);
+        }
+        text += QString("vp415_pico_command_latency_seconds_bucket{%1,le=\"+Inf\"} %2\n")
+                    .arg(label).arg(histogram->count());
+        text += QString("vp415_pico_command_latency_seconds_sum{%1} %2\n")
+                    .arg(label).arg(static_cast<double>(histogram->sum()) / 1e6, 0, 'g', 9);
+        text += QString("vp415_pico_command_latency_seconds_count{%1} %2\n")
+                    .arg(label).arg(histogram->count());
+    }
+
+    counter("vp415_sectors_served_total", "Sectors served to the Pico", sectorsServed.value());
+    counter("vp415_sector_read_errors_total", "Sector reads that failed", sectorReadErrors.value());
+    counter("vp415_sectors_written_total", "Sectors written to LUN images by the Pico", sectorsWritten.value());
+    counter("vp415_sector_write_errors_total", "Sector writes that failed", sectorWriteErrors.value());
+    counter("vp415_serial_rx_bytes_total", "Bytes received from the Pico", serialRxBytes.value());
+    counter("vp415_serial_tx_bytes_total", "Bytes sent to the Pico", serialTxBytes.value());
+    counter("vp415_serial_rx_frames_total", "Frames received from the Pico", serialRxFrames.value());
+    counter("vp415_serial_tx_frames_total", "Frames sent to the Pico", serialTxFrames.value());
+    counter("vp415_serial_timeouts_total", "Incomplete frames from the Pico", serialTimeouts.value());
+    counter("vp415_serial_resends_total", "Requests resent by the Pico after a link drop (answered again)",
+            serialResends.value());
+    counter("vp415_session_resumes_total", "Pico link sessions resumed after a link drop", sessionResumes.value());
+    counter("vp415_efm_cache_hits_total", "Sector reads served from the prefetched extent", efmCacheHits.value());
+    counter("vp415_efm_cache_misses_total", "Sector reads served from the EFM data file", efmCacheMisses.value());
+    counter("vp415_efm_chunks_decompressed_total", "Compressed EFM data chunks decompressed (chunk cache misses)",
+            efmChunksDecompressed.value());
+    counter("vp415_chunk_cache_hits_total", "Chunk store reads served from the shared chunk cache",
+            chunkCacheHits.value());
+    counter("vp415_chunk_cache_misses_total", "Chunk store reads loaded from the store", chunkCacheMisses.value());
+    counter("vp415_background_verified_sectors_total", "EFM data sectors checked by the background verifier",
+            backgroundVerifiedSectors.value());
+    counter("vp415_background_bad_sectors_total", "EFM data sectors that failed background verification",
+            backgroundBadSectors.value());
+    counter("vp415_prefetch_hints_total", "Prefetch hints received from the Pico", prefetchHints.value());
+    counter("vp415_bridge_commands_total", "SCSI commands executed for bridge initiators",
+            bridgeCommands.value());
+    counter("vp415_journal_writes_total", "Write requests appended to the sector journal (rate gives write IOPS)",
+            journalWrites.value());
+    counter("vp415_journal_commits_total", "Sector journal group commits (fsyncs)", journalCommits.value());
+
+    gauge("vp415_serial_tx_queue_bytes", "Bytes waiting to be sent to the Pico", serialTxQueueBytes.value());
+    gauge("vp415_serial_rx_queue_bytes", "Bytes received but not yet processed", serialRxQueueBytes.value());
+    gauge("vp415_pending_pico_requests", "Requests waiting for the next Pico poll", pendingPicoRequests.value());
+    gauge("vp415_journal_pending_sectors", "Journaled sectors not yet applied to the LUN images",
+          journalPendingSectors.value());
+    gauge("vp415_journal_durability_lag_us", "Time the oldest write waited for the last journal commit (uS)",
+          journalDurabilityLagUs.value());
+    gauge("vp415_overlay_sectors", "LUN image sectors held in copy-on-write overlays", overlaySectors.value());
+    gauge("vp415_pico_prefetch_hints", "Prefetch hints made by the Pico (since it started)",
+          picoPrefetchHints.value());
+    gauge("vp415_pico_prefetched_sectors", "Sectors prefetched by the Pico (since it started)",
+          picoPrefetchedSectors.value());
+    gauge("vp415_pico_prefetch_used_sectors", "Prefetched sectors read by the host (since the Pico started)",
+          picoPrefetchUsedSectors.value());
+
+    return text;
+}
@@ -0,0 +1,154 @@
+/************************************************************************
+
+    metrics.h
+
+    VP415-host - A host application for the VP415 Emulator
+    VP415-Emulator
+    Copyright (C) 2025 Simon Inns
+
+    This file is part of VP415-Emulator.
+
+    This is free software: you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Email: simon.inns@gmail.com
+
+************************************************************************/
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <QObject>
+#include <QString>
+#include <QMap>
+#include <atomic>
+#include <array>
+
+// Runtime metrics for vp415-host, exposed in Prometheus text format by the
+// MetricsServer.  Updates are lock-free (relaxed atomics), so recording a
+// metric never waits for a scrape in progress.
+
+// Monotonic counter.  The count is spread over cache line aligned shards
+// (each thread uses its own shard) so that threads never contend.
+class MetricCounter
+{
+public:
+    void add(uint64_t value = 1) {
+        m_shards[shardIndex()].value.fetch_add(value, std::memory_order_relaxed);
+    }
+    uint64_t value() const;
+
+private:
+    static const int SHARDS = 8;
+    struct alignas(64) Shard {
+        std::atomic<uint64_t> value{0};
+    };
+    Shard m_shards[SHARDS];
+
+    static int shardIndex();
+};
+
+// Gauge (a value that can go up and down)
+class MetricGauge
+{
+public:
+    void set(int64_t value) { m_value.store(value, std::memory_order_relaxed); }
+    int64_t value() const { return m_value.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<int64_t> m_value{0};
+};
+
+// HDR style log-linear latency histogram in microseconds: each power of two
+// is split into SUB_BUCKETS linear buckets, giving a constant relative
+// precision (~25%) from 1uS to ~134 seconds
+class MetricHistogram
+{
+public:
+    static const int SUB_BUCKET_BITS = 2;
+    static const int SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+    static const int OCTAVES = 26;
+    static const int BUCKETS = (OCTAVES * SUB_BUCKETS) + 1;
+
+    void record(uint64_t valueUs);
+
+    uint64_t count() const { return m_count.load(std::memory_order_relaxed); }
+    uint64_t sum() const { return m_sum.load(std::memory_order_relaxed); }
+    uint64_t bucketCount(int bucket) const { return m_buckets[bucket].load(std::memory_order_relaxed); }
+    static uint64_t bucketUpperBound(int bucket);
+
+private:
+    std::array<std::atomic<uint64_t>, BUCKETS> m_buckets{};
+    std::atomic<uint64_t> m_count{0};
+    std::atomic<uint64_t> m_sum{0};
+
+    static int bucketIndex(uint64_t valueUs);
+};
+
+class Metrics : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit Metrics(QObject *parent = nullptr);
+    ~Metrics();
+
+    // Pico command handling
+    void recordCommand(uint8_t command, uint64_t latencyUs);
+
+    MetricCounter sectorsServed;
+    MetricCounter sectorReadErrors;
+    MetricCounter sectorsWritten;
+    MetricCounter sectorWriteErrors;
+    MetricCounter serialRxBytes;
+    MetricCounter serialTxBytes;
+    MetricCounter serialRxFrames;
+    MetricCounter serialTxFrames;
+    MetricCounter serialTimeouts;
+    MetricCounter serialResends;
+    MetricCounter sessionResumes;
+    MetricCounter efmCacheHits;
+    MetricCounter efmCacheMisses;
+    MetricCounter efmChunksDecompressed;
+    MetricCounter chunkCacheHits;
+    MetricCounter chunkCacheMisses;
+    MetricCounter backgroundVerifiedSectors;
+    MetricCounter backgroundBadSectors;
+    MetricCounter prefetchHints;
+    MetricCounter bridgeCommands;
+    MetricCounter journalWrites;
+    MetricCounter journalCommits;
+
+    MetricGauge serialTxQueueBytes;
+    MetricGauge serialRxQueueBytes;
+    MetricGauge pendingPicoRequests;
+    MetricGauge journalPendingSectors;
+    MetricGauge journalDurabilityLagUs;
+    MetricGauge overlaySectors;
+
+    // Prefetch counters reported by the Pico with each hint
+    MetricGauge picoPrefetchHints;
+    MetricGauge picoPrefetchedSectors;
+    MetricGauge picoPrefetchUsedSectors;
+
+    QString prometheusText() const;
+
+private:
+    // Per-command counters and histograms (indexed by command code).  The
+    // histograms are allocated on first use and installed with a
+    // compare-and-swap so no lock is needed.
+    std::array<MetricCounter, 256> m_commandCount;
+    std::array<std::atomic<MetricHistogram *>, 256> m_commandLatency{};
+};
+
+#endif // METRICS_H
@@ -0,0 +1,148 @@
+/************************************************************************
+
+    metricsserver.cpp
+
+    VP415-host - A host application for the VP415 Emulator
+    VP415-Emulator
+    Copyright (C) 2025 Simon Inns
+
+    This file is part of VP415-Emulator.
+
+    This is free software: you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Email: simon.inns@gmail.com
+
+************************************************************************/
+
+#include "metricsserver.h"
+#include <QDebug>
+#include <QTcpSocket>
+#include <QLocalSocket>
+#include <QHostAddress>
+
+MetricsServer::MetricsServer(Metrics *metrics, QObject *parent) : QObject(parent) {
+    m_metrics = metrics;
+    m_tcpServer = nullptr;
+    m_localServer = nullptr;
+}
+
+MetricsServer::~MetricsServer() {
+    close();
+}
+
+// The address is either a Unix socket path (starting with '/'), a port
+// number (bound to localhost) or address:port (e.g. 0.0.0.0:9415 to allow
+// scraping from the LAN)
+bool MetricsServer::listen(QString address) {
+    close();
+
+    if (address.startsWith("/")) {
+        QLocalServer::removeServer(address);
+        m_localServer = new QLocalServer(this);
+        connect(m_localServer, &QLocalServer::newConnection, this, &MetricsServer::newLocalConnection);
+
+        if (!m_localServer->listen(address)) {
+            qDebug() << "MetricsServer::listen() - Failed to listen on socket: " << address
+                     << "- Error:" << m_localServer->errorString();
+            return false;
+        }
+    } else {
+        QHostAddress hostAddress(QHostAddress::LocalHost);
+        QString portString = address;
+
+        int separator = address.lastIndexOf(':');
+        if (separator != -1) {
+            hostAddress = QHostAddress(address.left(separator));
+            portString = address.mid(separator + 1);
+        }
+
+        bool ok;
+        quint16 port = portString.toUShort(&ok);
+        if (!ok || hostAddress.isNull()) {
+            qDebug() << "MetricsServer::listen() - Invalid metrics address: " << address;
+            return false;
+        }
+
+        m_tcpServer = new QTcpServer(this);
+        connect(m_tcpServer, &QTcpServer::newConnection, this, &MetricsServer::newTcpConnection);
+
+        if (!m_tcpServer->listen(hostAddress, port)) {
+            qDebug() << "MetricsServer::listen() - Failed to listen on: " << address
+                     << "- Error:" << m_tcpServer->errorString();
+            return false;
+        }
+    }
+
+    qDebug() << "MetricsServer::listen() - Serving metrics on: " << address;
+    return true;
+}
+
+void MetricsServer::close() {
+    if (m_tcpServer != nullptr) {
+        m_tcpServer->close();
+        delete m_tcpServer;
+        m_tcpServer = nullptr;
+    }
+    if (m_localServer != nullptr) {
+        m_localServer->close();
+        delete m_localServer;
+        m_localServer = nullptr;
+    }
+}
+
+void MetricsServer::newTcpConnection() {
+    while (m_tcpServer->hasPendingConnections()) serveConnection(m_tcpServer->nextPendingConnection());
+}
+
+void MetricsServer::newLocalConnection() {
+    while (m_localServer->hasPendingConnections()) serveConnection(m_localServer->nextPendingConnection());
+}
+
+// Wait for the end of the request headers then send the metrics
+void MetricsServer::serveConnection(QIODevice *socket) {
+    connect(socket, &QIODevice::readyRead, this, [this, socket]() {
+        QByteArray request = socket->property("request").toByteArray() + socket->readAll();
+        if (!request.contains("\r\n\r\n") && !request.contains("\n\n")) {
+            // Don't let a client hold the connection open with a huge request
+            if (request.size() > 8192) {
+                socket->close();
+                socket->deleteLater();
+                return;
+            }
+            socket->setProperty("request", request);
+            return;
+        }
+
+        QByteArray body = m_metrics->prometheusText().toUtf8();
+        QByteArray response = "HTTP/1.0 200 OK\r\n"
+                              "Content-Type: text/plain; version=0.0.4\r\n"
+                              "Content-Length: " + QByteArray::number(body.size()) + "\r\n"
+                              "Connection: close\r\n\r\n";
+        socket->write(response + body);
+
+        // Close once the response has been written
+        if (auto *tcpSocket = qobject_cast<QTcpSocket *>(socket)) {
+            tcpSocket->disconnectFromHost();
+        } else if (auto *localSocket = qobject_cast<QLocalSocket *>(socket)) {
+            localSocket->disconnectFromServer();
+        }
+    });
+
+    // Sockets are deleted when the client disconnects
+    if (auto *tcpSocket = qobject_cast<QTcpSocket *>(socket)) {
+        connect(tcpSocket, &QTcpSocket::disconnected, tcpSocket, &QObject::deleteLater);
+    } else if (auto *localSocket = qobject_cast<QLocalSocket *>(socket)) {
+        connect(localSocket, &QLocalSocket::disconnected, localSocket, &QObject::deleteLater);
+    }
+}
@@ -0,0 +1,64 @@
+/************************************************************************
+
+    metricsserver.h
+
+    VP415-host - A host application for the VP415 Emulator
+    VP415-Emulator
+    Copyright (C) 2025 Simon Inns
+
+    This file is part of VP415-Emulator.
+
+    This is free software: you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Email: simon.inns@gmail.com
+
+************************************************************************/
+
+#ifndef METRICSSERVER_H
+#define METRICSSERVER_H
+
+#include <QObject>
+#include <QString>
+#include <QTcpServer>
+#include <QLocalServer>
+
+#include "metrics.h"
+
+// Minimal HTTP server for Prometheus scraping.  Every request is answered
+// with the current metrics (so GET /metrics works as expected) and the
+// connection is then closed.
+class MetricsServer : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit MetricsServer(Metrics *metrics, QObject *parent = nullptr);
+    ~MetricsServer();
+
+    bool listen(QString address);
+    void close();
+
+private slots:
+    void newTcpConnection();
+    void newLocalConnection();
+
+private:
+    Metrics *m_metrics;
+    QTcpServer *m_tcpServer;
+    QLocalServer *m_localServer;
+
+    void serveConnection(QIODevice *socket);
+};
+
+#endif // METRICSSERVER_H
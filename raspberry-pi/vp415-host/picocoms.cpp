@@ -31,12 +31,19 @@
 PicoComs::PicoComs(QObject *parent) : QObject(parent) {
     m_isSerialPortOpen = false;
     m_serialPortName = "";
+    m_metrics = nullptr;
+    m_sequence = 0;
+    m_hasLastReply = false;
     
     // Initialize the serial port
     m_serialPort = new QSerialPort(this);
     
     // Connect the readyRead signal to our slot
     connect(m_serialPort, &QSerialPort::readyRead, this, &PicoComs::readData);
+
+    m_frameTimer.setSingleShot(true);
+    m_frameTimer.setInterval(FRAME_TIMEOUT_MS);
+    connect(&m_frameTimer, &QTimer::timeout, this, &PicoComs::discardPartialFrame);
 }
 
 PicoComs::~PicoComs() {
@@ -81,53 +88,119 @@ bool PicoComs::openSerialPort(QString serialPortDeviceName) {
 void PicoComs::closeSerialPort() {
     if (m_isSerialPortOpen) {
         m_serialPort->close();
+        m_frameTimer.stop();
+        m_rxBuffer.clear();
         m_isSerialPortOpen = false;
         qDebug() << "PicoComs::closeSerialPort() - Serial port closed:" << m_serialPortName;
     }
 }
 
 // The underlying communication function is simple.  First 2 bytes are received representing
-// a uint16_t length of the data to be sent from the pico.  Then the data is received.  We will then
-// respond with a uint16_t length of the data to be sent.  The data is then sent
-// Note: The maximum length of data that can be sent or received is 512 bytes.
-// Note: The txLength and rxLength do not include the 2 bytes used to represent the length.
+// a uint16_t length of the data to be sent from the pico, followed by a sequence number.  Then the
+// data is received.  We will then respond with a uint16_t length of the data to be sent and the same
+// sequence number.  The data is then sent.  The Pico uses the sequence number to discard replies to
+// requests it has cancelled (when the host resets whilst it is waiting for us).
+// Note: The maximum length of data that can be sent or received is 512 bytes (plus the
+// command header when the Pico writes sectors).
+// Note: The txLength and rxLength do not include the 2 bytes used to represent the length
+// or the sequence number.
+//
+// Bytes are gathered as they arrive (nothing here waits for the serial port)
+// and each whole frame is emitted as a signal to the main window to process.
+// The main window will then respond with the data to be sent back to the pico.
+// Every link is served from the one event loop, so a frame still arriving on
+// one link doesn't stall the others.
 //
-// We will continue to read data until we have received the expected number of bytes, then we will
-// emit a signal to the main window to process the data.  The main window will then respond with the
-// data to be sent back to the pico.
+// If the link drops the Pico resends the request with the same sequence number once the link has
+// been quiet for longer than FRAME_TIMEOUT_MS.  A partial frame is discarded when it times out, and
+// a request that was already answered gets the same reply again (so, for example, a lost reply to a
+// poll doesn't lose the request it carried).
 void PicoComs::readData() {
-    // Read the first 2 bytes to get the length of the data to be received
-    if (m_serialPort->bytesAvailable() < 2) {
-        return;
-    }
-    
-    QByteArray rxData = m_serialPort->read(2);
-    uint16_t rxLength = (static_cast<uint16_t>(rxData[0]) << 8) | static_cast<uint16_t>(rxData[1]);
+    m_rxBuffer.append(m_serialPort->readAll());
+
+    while (m_rxBuffer.size() >= 3) {
+        // The first 3 bytes are the length of the data to be received and the sequence number
+        uint16_t rxLength = (static_cast<uint16_t>(static_cast<uint8_t>(m_rxBuffer[0])) << 8) |
+                            static_cast<uint16_t>(static_cast<uint8_t>(m_rxBuffer[1]));
+        uint8_t sequence = static_cast<uint8_t>(m_rxBuffer[2]);
+
+        if (rxLength > MAX_FRAME_BYTES) {
+            qDebug() << "PicoComs::readData() - Invalid frame length (discarding input until the Pico resends)";
+            m_rxBuffer.clear();
+            m_serialPort->clear(QSerialPort::Input);
+            break;
+        }
 
-    qDebug() << "PicoComs::readData() - Expecting data length: " << rxLength << " rxData[0]: " << static_cast<uint16_t>(rxData[0]) << " rxData[1]: " << static_cast<uint16_t>(rxData[1]);
-    
-    // Read the data
-    while (m_serialPort->bytesAvailable() < rxLength) {
-        if (!m_serialPort->waitForReadyRead(1000)) {
-            qDebug() << "PicoComs::readData() - Timed out waiting for data";
-            return;
+        // Wait (in the event loop) for the rest of the frame
+        if (m_rxBuffer.size() < 3 + rxLength) break;
+
+        QByteArray rxData = m_rxBuffer.mid(3, rxLength);
+        m_rxBuffer.remove(0, 3 + rxLength);
+
+        if (m_metrics) {
+            m_metrics->serialRxBytes.add(3 + rxLength);
+            m_metrics->serialRxFrames.add();
+            m_metrics->serialRxQueueBytes.set(m_rxBuffer.size());
+        }
+
+        // A resent request gets the reply to the original
+        if (m_hasLastReply && sequence == m_sequence && rxData == m_lastRequest) {
+            qDebug() << "PicoComs::readData() - Resending reply to request with sequence: " << sequence;
+            if (m_metrics) m_metrics->serialResends.add();
+            writeFrame(m_lastReply);
+            continue;
         }
+
+        m_sequence = sequence;
+        m_lastRequest = rxData;
+        m_hasLastReply = false;
+
+        // Emit the signal to the main window to process the data
+        emit dataReceived(rxData);
     }
-    
-    rxData = m_serialPort->read(rxLength);
-    
-    // Emit the signal to the main window to process the data
-    emit dataReceived(rxData);
+
+    // The rest of a partial frame has FRAME_TIMEOUT_MS to arrive
+    if (m_rxBuffer.isEmpty())
+        m_frameTimer.stop();
+    else
+        m_frameTimer.start();
+}
+
+// The rest of a frame didn't arrive in time; the Pico will resend it
+void PicoComs::discardPartialFrame() {
+    // Data that is waiting to be read may complete the frame
+    if (m_serialPort->bytesAvailable() > 0) {
+        readData();
+        return;
+    }
+
+    qDebug() << "PicoComs::discardPartialFrame() - Timed out waiting for data (discarding the partial frame)";
+    if (m_metrics) m_metrics->serialTimeouts.add();
+    m_rxBuffer.clear();
 }
 
+// Reply to the last request received from the Pico
 void PicoComs::writeData(QByteArray txData) {
-    // Write the length of the data to be sent
+    m_lastReply = txData;
+    m_hasLastReply = true;
+    writeFrame(txData);
+}
+
+void PicoComs::writeFrame(const QByteArray &txData) {
+    // Write the length of the data to be sent and the sequence number of the request
     uint16_t txLength = txData.length();
     QByteArray txLengthData;
 
     txLengthData.append((txLength >> 8) & 0xFF);
     txLengthData.append(txLength & 0xFF);
+    txLengthData.append(static_cast<char>(m_sequence));
     
     m_serialPort->write(txLengthData);
     m_serialPort->write(txData);
+
+    if (m_metrics) {
+        m_metrics->serialTxBytes.add(3 + txLength);
+        m_metrics->serialTxFrames.add();
+        m_metrics->serialTxQueueBytes.set(m_serialPort->bytesToWrite());
+    }
 }
@@ -31,6 +31,9 @@
 #include <QObject>
 #include <QString>
 #include <QSerialPort>
+#include <QTimer>
+
+#include "metrics.h"
 
 class PicoComs : public QObject
 {
@@ -44,17 +47,42 @@ public:
     void closeSerialPort();
 
     void writeData(QByteArray txData);
+    void setMetrics(Metrics *metrics) { m_metrics = metrics; }
+
+    // Time allowed between the parts of a frame before it is discarded (the
+    // Pico waits longer than this before resending a request)
+    static const int FRAME_TIMEOUT_MS = 20;
+
+    // Longest frame the Pico sends (a longer length means the header was
+    // corrupted)
+    static const int MAX_FRAME_BYTES = 1024;
 
 signals:
     void dataReceived(const QByteArray &data);
 
 private slots:
     void readData();
+    void discardPartialFrame();
 
 private:
     bool m_isSerialPortOpen;
     QString m_serialPortName;
     QSerialPort *m_serialPort;
+    Metrics *m_metrics;
+    uint8_t m_sequence;  // Sequence number of the last request received
+
+    // Bytes received that don't yet make a whole frame (frames are assembled
+    // as they arrive, so a slow frame on one link never holds up the others)
+    QByteArray m_rxBuffer;
+    QTimer m_frameTimer;
+
+    // The last request and its reply (a request the Pico resends is answered
+    // from here rather than being repeated)
+    QByteArray m_lastRequest;
+    QByteArray m_lastReply;
+    bool m_hasLastReply;
+
+    void writeFrame(const QByteArray &txData);
 };
 
 #endif // PICOCOMS_H
\ No newline at end of file
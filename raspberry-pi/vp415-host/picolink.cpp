@@ -0,0 +1,63 @@
+/************************************************************************
+
+    picolink.cpp
+
+    VP415-host - A host application for the VP415 Emulator
+    VP415-Emulator
+    Copyright (C) 2025 Simon Inns
+
+    This file is part of VP415-Emulator.
+
+    This is free software: you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Email: simon.inns@gmail.com
+
+************************************************************************/
+
+#include "picolink.h"
+
+#include <QDebug>
+#include <QRandomGenerator>
+
+PicoLink::PicoLink(int unit, QObject *parent) : QObject(parent) {
+    m_unit = unit;
+    m_mountState = false;
+    m_sessionId = QRandomGenerator::global()->generate();
+    m_picoSessionId = 0;
+    m_hasSession = false;
+
+    connect(&m_picoComs, &PicoComs::dataReceived, this, [this](const QByteArray &data) {
+        emit dataReceived(this, data);
+    });
+}
+
+bool PicoLink::open(QString serialDeviceName) {
+    if (!m_picoComs.openSerialPort(serialDeviceName)) {
+        qDebug() << "PicoLink::open() - Failed to open serial port for unit" << m_unit << ":" << serialDeviceName;
+        return false;
+    }
+
+    qDebug() << "PicoLink::open() - Unit" << m_unit << "on" << serialDeviceName;
+    return true;
+}
+
+bool PicoLink::resumeSession(uint32_t picoSessionId) {
+    if (m_hasSession && picoSessionId == m_picoSessionId) return true;
+
+    qDebug() << "PicoLink::resumeSession() - Unit" << m_unit << "started session"
+             << QString("%1").arg(picoSessionId, 8, 16, QChar('0'));
+    m_picoSessionId = picoSessionId;
+    m_hasSession = true;
+    return false;
+}
@@ -0,0 +1,86 @@
+/************************************************************************
+
+    picolink.h
+
+    VP415-host - A host application for the VP415 Emulator
+    VP415-Emulator
+    Copyright (C) 2025 Simon Inns
+
+    This file is part of VP415-Emulator.
+
+    This is free software: you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Email: simon.inns@gmail.com
+
+************************************************************************/
+
+#ifndef PICOLINK_H
+#define PICOLINK_H
+
+#include <QObject>
+#include <QString>
+#include <QList>
+#include <QByteArray>
+
+#include "picocoms.h"
+#include "metrics.h"
+
+// A link to the Pico of one VP415 unit.  The host can serve several units at
+// once (one serial device each); every link has its own transport, mount
+// state and queue of requests waiting for the Pico's next poll, while the
+// disc data and its caches are shared by all of them.
+class PicoLink : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit PicoLink(int unit, QObject *parent = nullptr);
+
+    bool open(QString serialDeviceName);
+    int unit() const { return m_unit; }
+    void setMetrics(Metrics *metrics) { m_picoComs.setMetrics(metrics); }
+
+    // Reply to the last request received from this unit's Pico
+    void writeData(const QByteArray &txData) { m_picoComs.writeData(txData); }
+
+    // The Pico starts a session when it boots and resumes it after the link
+    // drops.  Returns true if the Pico is resuming the link's session, or
+    // false if the link now holds a new session (the Pico, or this host,
+    // restarted).
+    bool resumeSession(uint32_t picoSessionId);
+    uint32_t sessionId() const { return m_sessionId; }
+
+    bool mountState() const { return m_mountState; }
+    void setMountState(bool mountState) { m_mountState = mountState; }
+
+    // Requests are sent one per poll
+    void queueRequest(const QByteArray &request) { m_pendingRequests.append(request); }
+    bool hasPendingRequest() const { return !m_pendingRequests.isEmpty(); }
+    QByteArray takeRequest() { return m_pendingRequests.takeFirst(); }
+    int pendingRequests() const { return static_cast<int>(m_pendingRequests.size()); }
+
+signals:
+    void dataReceived(PicoLink *link, const QByteArray &data);
+
+private:
+    int m_unit;
+    PicoComs m_picoComs;
+    bool m_mountState;
+    uint32_t m_sessionId;
+    uint32_t m_picoSessionId;
+    bool m_hasSession;
+    QList<QByteArray> m_pendingRequests;
+};
+
+#endif // PICOLINK_H
@@ -0,0 +1,169 @@
+/************************************************************************
+
+    realtime.cpp
+
+    VP415-host - A host application for the VP415 Emulator
+    VP415-Emulator
+    Copyright (C) 2025 Simon Inns
+
+    This file is part of VP415-Emulator.
+
+    This is free software: you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Email: simon.inns@gmail.com
+
+************************************************************************/
+
+#include "realtime.h"
+
+#include <QDebug>
+#include <QFile>
+#include <QtGlobal>
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+#ifdef Q_OS_LINUX
+#include <malloc.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+int RealTime::s_servingCore = -1;
+
+namespace {
+
+// Touch the stack the serving thread will use, so it is resident before the
+// serving starts
+void prefaultStack() {
+    volatile char stack[RealTime::STACK_BYTES];
+    for (size_t offset = 0; offset < RealTime::STACK_BYTES; offset += 1024) stack[offset] = 0;
+}
+
+}
+
+// Put the calling thread into real-time mode.  Every step is attempted; the
+// result is false if any of them failed (most likely for want of root or
+// CAP_SYS_NICE/CAP_IPC_LOCK).
+bool RealTime::enable(int core, int priority) {
+    bool success = lockMemory();
+    if (!pinCurrentThread(core)) success = false;
+    if (!setFifoPriority(priority)) success = false;
+
+    if (!isIsolated(core)) {
+        qDebug() << "RealTime::enable() - Core" << core
+                 << "is not isolated; other threads can still run on it (boot with isolcpus=" << core << ")";
+    }
+    qDebug() << "RealTime::enable() - Serving thread on core" << core << "at SCHED_FIFO priority" << priority
+             << (success ? "" : "(incomplete)");
+    return success;
+}
+
+// Lock all current and future pages of the process and pre-fault the heap
+bool RealTime::lockMemory() {
+#ifdef Q_OS_LINUX
+    // Keep freed memory in the heap (trimming it, or serving large blocks with
+    // mmap, would mean faulting the memory in again)
+    mallopt(M_TRIM_THRESHOLD, -1);
+    mallopt(M_MMAP_MAX, 0);
+
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+        qDebug() << "RealTime::lockMemory() - mlockall failed:" << strerror(errno);
+        return false;
+    }
+
+    long pageSize = sysconf(_SC_PAGESIZE);
+    volatile char *heap = static_cast<volatile char *>(malloc(HEAP_BYTES));
+    if (heap != nullptr) {
+        for (size_t offset = 0; offset < HEAP_BYTES; offset += static_cast<size_t>(pageSize)) heap[offset] = 0;
+        free(const_cast<char *>(heap));
+    }
+    prefaultStack();
+    return true;
+#else
+    qDebug() << "RealTime::lockMemory() - Not supported on this platform";
+    return false;
+#endif
+}
+
+bool RealTime::pinCurrentThread(int core) {
+#ifdef Q_OS_LINUX
+    cpu_set_t cpuSet;
+    CPU_ZERO(&cpuSet);
+    CPU_SET(core, &cpuSet);
+    int result = pthread_setaffinity_np(pthread_self(), sizeof(cpuSet), &cpuSet);
+    if (result != 0) {
+        qDebug() << "RealTime::pinCurrentThread() - Failed to pin to core" << core << ":" << strerror(result);
+        return false;
+    }
+    s_servingCore = core;
+    return true;
+#else
+    Q_UNUSED(core);
+    qDebug() << "RealTime::pinCurrentThread() - Not supported on this platform";
+    return false;
+#endif
+}
+
+bool RealTime::setFifoPriority(int priority) {
+#ifdef Q_OS_LINUX
+    sched_param parameters;
+    memset(&parameters, 0, sizeof(parameters));
+    parameters.sched_priority = priority;
+    int result = pthread_setschedparam(pthread_self(), SCHED_FIFO, &parameters);
+    if (result != 0) {
+        qDebug() << "RealTime::setFifoPriority() - Failed to set SCHED_FIFO:" << strerror(result);
+        return false;
+    }
+    return true;
+#else
+    Q_UNUSED(priority);
+    qDebug() << "RealTime::setFifoPriority() - Not supported on this platform";
+    return false;
+#endif
+}
+
+// Is the core in the kernel's isolated list (a comma separated list of cores
+// and ranges such as "2-3")?
+bool RealTime::isIsolated(int core) {
+    QFile isolated("/sys/devices/system/cpu/isolated");
+    if (!isolated.open(QIODevice::ReadOnly)) return false;
+
+    const QList<QByteArray> ranges = isolated.readAll().trimmed().split(',');
+    for (const QByteArray &range : ranges) {
+        QList<QByteArray> bounds = range.split('-');
+        bool firstOk = false, lastOk = false;
+        int first = bounds.first().toInt(&firstOk);
+        int last = bounds.last().toInt(&lastOk);
+        if (firstOk && lastOk && core >= first && core <= last) return true;
+    }
+    return false;
+}
+
+void RealTime::leaveServingCore() {
+#ifdef Q_OS_LINUX
+    if (s_servingCore < 0) return;
+
+    cpu_set_t cpuSet;
+    CPU_ZERO(&cpuSet);
+    long cores = sysconf(_SC_NPROCESSORS_CONF);
+    for (int core = 0; core < cores && core < CPU_SETSIZE; core++) {
+        if (core != s_servingCore) CPU_SET(core, &cpuSet);
+    }
+    if (CPU_COUNT(&cpuSet) > 0) pthread_setaffinity_np(pthread_self(), sizeof(cpuSet), &cpuSet);
+#endif
+}
@@ -0,0 +1,65 @@
+/************************************************************************
+
+    realtime.h
+
+    VP415-host - A host application for the VP415 Emulator
+    VP415-Emulator
+    Copyright (C) 2025 Simon Inns
+
+    This file is part of VP415-Emulator.
+
+    This is free software: you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Email: simon.inns@gmail.com
+
+************************************************************************/
+
+#ifndef REALTIME_H
+#define REALTIME_H
+
+#include <cstddef>
+
+// Real-time serving (Linux only).  The thread serving the Pico is pinned to a
+// core (ideally one taken away from the scheduler with isolcpus=) and run
+// SCHED_FIFO, and the process's memory is locked.  The heap is pre-faulted
+// and never handed back to the kernel, so the buffers the serving path
+// allocates come from memory that is already resident and locked; images
+// mapped after memory is locked are locked as well.
+class RealTime
+{
+public:
+    // SCHED_FIFO priority of the serving thread.  This is below the kernel's
+    // threaded interrupt handlers (50), so the UART and SD card interrupts
+    // still get serviced.
+    static const int FIFO_PRIORITY = 40;
+
+    // Heap and stack pre-faulted when memory is locked
+    static const size_t HEAP_BYTES = 64 * 1024 * 1024;
+    static const size_t STACK_BYTES = 256 * 1024;
+
+    static bool enable(int core, int priority = FIFO_PRIORITY);
+    static bool lockMemory();
+    static bool pinCurrentThread(int core);
+    static bool setFifoPriority(int priority);
+    static bool isIsolated(int core);
+
+    // Move the calling thread (started by the serving thread, so sharing its
+    // core) onto the other cores
+    static void leaveServingCore();
+
+private:
+    static int s_servingCore;
+};
+
+#endif // REALTIME_H
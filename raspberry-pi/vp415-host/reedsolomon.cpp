@@ -0,0 +1,204 @@
+/************************************************************************
+
+    reedsolomon.cpp
+
+    VP415-host - A host application for the VP415 Emulator
+    VP415-Emulator
+    Copyright (C) 2025 Simon Inns
+
+    This file is part of VP415-Emulator.
+
+    This is free software: you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Email: simon.inns@gmail.com
+
+************************************************************************/
+
+#include "reedsolomon.h"
+
+#include <cstring>
+
+namespace {
+
+// Exponent and logarithm tables for GF(256) with the polynomial 0x11D (the
+// exponent table is doubled so a product never needs a modulo)
+struct GaloisTables {
+    uint8_t exponent[512];
+    int logarithm[256];
+
+    GaloisTables() {
+        int value = 1;
+        for (int index = 0; index < 255; index++) {
+            exponent[index] = static_cast<uint8_t>(value);
+            exponent[index + 255] = static_cast<uint8_t>(value);
+            logarithm[value] = index;
+            value <<= 1;
+            if (value & 0x100) value ^= 0x11D;
+        }
+        exponent[510] = exponent[0];
+        exponent[511] = exponent[1];
+        logarithm[0] = -1;
+    }
+};
+
+const GaloisTables &tables() {
+    static const GaloisTables galoisTables;
+    return galoisTables;
+}
+
+// Evaluate a polynomial (lowest degree first) at x
+uint8_t evaluate(const uint8_t *polynomial, int degree, uint8_t x) {
+    uint8_t result = 0;
+    for (int index = degree; index >= 0; index--)
+        result = static_cast<uint8_t>(ReedSolomon::multiply(result, x) ^ polynomial[index]);
+    return result;
+}
+
+}
+
+ReedSolomon::ReedSolomon(int length) {
+    m_length = length;
+}
+
+uint8_t ReedSolomon::multiply(uint8_t a, uint8_t b) {
+    if (a == 0 || b == 0) return 0;
+    return tables().exponent[tables().logarithm[a] + tables().logarithm[b]];
+}
+
+uint8_t ReedSolomon::divide(uint8_t a, uint8_t b) {
+    if (a == 0 || b == 0) return 0;
+    return tables().exponent[tables().logarithm[a] - tables().logarithm[b] + 255];
+}
+
+uint8_t ReedSolomon::power(int exponent) {
+    exponent %= 255;
+    if (exponent < 0) exponent += 255;
+    return tables().exponent[exponent];
+}
+
+int ReedSolomon::logarithm(uint8_t value) {
+    return tables().logarithm[value];
+}
+
+void ReedSolomon::syndromes(const uint8_t *codeword, uint8_t *syndromes) const {
+    for (int root = 0; root < PARITY_SYMBOLS; root++) {
+        uint8_t x = power(root);
+        uint8_t syndrome = 0;
+        for (int index = 0; index < m_length; index++)
+            syndrome = static_cast<uint8_t>(multiply(syndrome, x) ^ codeword[index]);
+        syndromes[root] = syndrome;
+    }
+}
+
+// Errors and erasures decoding: Berlekamp-Massey (started from the erasure
+// locator), a Chien search for the error positions and Forney's algorithm
+// for the values
+int ReedSolomon::decode(uint8_t *codeword, const int *erasures, int erasureCount,
+                        const uint8_t *knownSyndromes) const {
+    uint8_t syndrome[PARITY_SYMBOLS];
+    if (knownSyndromes)
+        memcpy(syndrome, knownSyndromes, sizeof(syndrome));
+    else
+        syndromes(codeword, syndrome);
+
+    bool valid = true;
+    for (int root = 0; root < PARITY_SYMBOLS; root++) {
+        if (syndrome[root] != 0) valid = false;
+    }
+    if (valid) return 0;
+    if (erasureCount > PARITY_SYMBOLS) return -1;
+
+    // Error locator, starting with the erasures
+    uint8_t locator[PARITY_SYMBOLS + 2] = {1};
+    for (int erasure = 0; erasure < erasureCount; erasure++) {
+        uint8_t x = power(m_length - 1 - erasures[erasure]);
+        for (int index = PARITY_SYMBOLS; index > 0; index--)
+            locator[index] = static_cast<uint8_t>(locator[index] ^ multiply(x, locator[index - 1]));
+    }
+
+    uint8_t previous[PARITY_SYMBOLS + 2];
+    memcpy(previous, locator, sizeof(previous));
+    int errors = erasureCount;
+
+    for (int step = erasureCount; step < PARITY_SYMBOLS; step++) {
+        uint8_t discrepancy = 0;
+        for (int index = 0; index <= step; index++)
+            discrepancy = static_cast<uint8_t>(discrepancy ^ multiply(locator[index], syndrome[step - index]));
+
+        // previous = x * previous
+        memmove(previous + 1, previous, PARITY_SYMBOLS + 1);
+        previous[0] = 0;
+        if (discrepancy == 0) continue;
+
+        uint8_t updated[PARITY_SYMBOLS + 2];
+        for (int index = 0; index < PARITY_SYMBOLS + 2; index++)
+            updated[index] = static_cast<uint8_t>(locator[index] ^ multiply(discrepancy, previous[index]));
+
+        if (2 * errors <= step + erasureCount) {
+            errors = step + 1 + erasureCount - errors;
+            for (int index = 0; index < PARITY_SYMBOLS + 2; index++)
+                previous[index] = divide(locator[index], discrepancy);
+        }
+        memcpy(locator, updated, sizeof(locator));
+    }
+
+    if (2 * (errors - erasureCount) + erasureCount > PARITY_SYMBOLS) return -1;
+
+    // Chien search
+    int positions[PARITY_SYMBOLS];
+    int found = 0;
+    for (int index = 0; index < m_length; index++) {
+        if (evaluate(locator, PARITY_SYMBOLS, power(-(m_length - 1 - index))) != 0) continue;
+        if (found == PARITY_SYMBOLS) return -1;
+        positions[found++] = index;
+    }
+    if (found != errors) return -1;
+
+    // Error evaluator (syndromes times locator, mod x^4) and the formal
+    // derivative of the locator
+    uint8_t evaluator[PARITY_SYMBOLS] = {0};
+    for (int degree = 0; degree < PARITY_SYMBOLS; degree++) {
+        for (int index = 0; index <= degree; index++)
+            evaluator[degree] = static_cast<uint8_t>(evaluator[degree] ^
+                                                     multiply(syndrome[degree - index], locator[index]));
+    }
+    uint8_t derivative[PARITY_SYMBOLS + 1] = {0};
+    for (int index = 1; index <= PARITY_SYMBOLS; index += 2) derivative[index - 1] = locator[index];
+
+    uint8_t corrected[MAX_LENGTH];
+    memcpy(corrected, codeword, static_cast<size_t>(m_length));
+    for (int error = 0; error < found; error++) {
+        uint8_t x = power(m_length - 1 - positions[error]);
+        uint8_t xInverse = divide(1, x);
+        uint8_t denominator = evaluate(derivative, PARITY_SYMBOLS - 1, xInverse);
+        if (denominator == 0) return -1;
+
+        uint8_t value = divide(multiply(x, evaluate(evaluator, PARITY_SYMBOLS - 1, xInverse)), denominator);
+        corrected[positions[error]] = static_cast<uint8_t>(corrected[positions[error]] ^ value);
+    }
+
+    // Guard against a miscorrection
+    syndromes(corrected, syndrome);
+    for (int root = 0; root < PARITY_SYMBOLS; root++) {
+        if (syndrome[root] != 0) return -1;
+    }
+
+    memcpy(codeword, corrected, static_cast<size_t>(m_length));
+    return found;
+}
+
+void ReedSolomon::encode(uint8_t *codeword, const int *parityPositions) const {
+    for (int index = 0; index < PARITY_SYMBOLS; index++) codeword[parityPositions[index]] = 0;
+    decode(codeword, parityPositions, PARITY_SYMBOLS);
+}
@@ -0,0 +1,72 @@
+/************************************************************************
+
+    reedsolomon.h
+
+    VP415-host - A host application for the VP415 Emulator
+    VP415-Emulator
+    Copyright (C) 2025 Simon Inns
+
+    This file is part of VP415-Emulator.
+
+    This is free software: you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Email: simon.inns@gmail.com
+
+************************************************************************/
+
+#ifndef REEDSOLOMON_H
+#define REEDSOLOMON_H
+
+#include <cstdint>
+
+// Shortened Reed-Solomon codes over GF(256) with four parity symbols, as used
+// by the CIRC C1 (32,28) and C2 (28,24) codes.  The field polynomial is
+// x^8 + x^4 + x^3 + x^2 + 1 and the generator roots are a^0 to a^3.  Symbol i
+// of an n symbol codeword has the locator a^(n-1-i), so the parity symbols
+// can be anywhere in the codeword.
+class ReedSolomon
+{
+public:
+    static const int PARITY_SYMBOLS = 4;
+    static const int MAX_LENGTH = 255;
+
+    explicit ReedSolomon(int length);
+
+    int length() const { return m_length; }
+
+    // Correct a codeword in place.  Erasures are the positions of symbols
+    // known to be bad.  Returns the number of symbols corrected, or -1 if
+    // the codeword can't be corrected (it is left unchanged).  The codeword's
+    // syndromes can be passed in if they are already known.
+    int decode(uint8_t *codeword, const int *erasures, int erasureCount,
+               const uint8_t *knownSyndromes = nullptr) const;
+
+    // Fill in the parity symbols at the given positions (by decoding them
+    // as erasures)
+    void encode(uint8_t *codeword, const int *parityPositions) const;
+
+    // Syndromes (zero for a valid codeword)
+    void syndromes(const uint8_t *codeword, uint8_t *syndromes) const;
+
+    // GF(256) arithmetic
+    static uint8_t multiply(uint8_t a, uint8_t b);
+    static uint8_t divide(uint8_t a, uint8_t b);
+    static uint8_t power(int exponent);
+    static int logarithm(uint8_t value);
+
+private:
+    int m_length;
+};
+
+#endif // REEDSOLOMON_H
@@ -0,0 +1,394 @@
+/************************************************************************
+
+    scsibridge.cpp
+
+    VP415-host - A host application for the VP415 Emulator
+    VP415-Emulator
+    Copyright (C) 2025 Simon Inns
+
+    This file is part of VP415-Emulator.
+
+    This is free software: you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Email: simon.inns@gmail.com
+
+************************************************************************/
+
+#include "scsibridge.h"
+
+#include <QDebug>
+#include <QTcpSocket>
+#include <QLocalSocket>
+#include <QHostAddress>
+
+namespace {
+
+// The longest request is a group 6 CDB and the F-code buffer
+const int MAX_REQUEST_BYTES = 6 + ScsiBridge::FCODE_BYTES;
+
+uint32_t cdbByte(const QByteArray &cdb, int index) {
+    return static_cast<uint32_t>(static_cast<uint8_t>(cdb[index]));
+}
+
+QByteArray frameLength(uint32_t length) {
+    QByteArray data(4, 0x00);
+    data[0] = static_cast<char>((length >> 24) & 0xFF);
+    data[1] = static_cast<char>((length >> 16) & 0xFF);
+    data[2] = static_cast<char>((length >> 8) & 0xFF);
+    data[3] = static_cast<char>(length & 0xFF);
+    return data;
+}
+
+}
+
+ScsiBridge::ScsiBridge(EfmData *efmData, BackgroundVerifier *verifier, Metrics *metrics, QObject *parent)
+    : QObject(parent) {
+    m_efmData = efmData;
+    m_verifier = verifier;
+    m_metrics = metrics;
+    m_tcpServer = nullptr;
+    m_localServer = nullptr;
+}
+
+ScsiBridge::~ScsiBridge() {
+    close();
+}
+
+// The address is either a Unix socket path (starting with '/'), a port
+// number (bound to localhost) or address:port
+bool ScsiBridge::listen(QString address) {
+    close();
+
+    if (address.startsWith("/")) {
+        QLocalServer::removeServer(address);
+        m_localServer = new QLocalServer(this);
+        connect(m_localServer, &QLocalServer::newConnection, this, &ScsiBridge::newLocalConnection);
+
+        if (!m_localServer->listen(address)) {
+            qDebug() << "ScsiBridge::listen() - Failed to listen on socket: " << address
+                     << "- Error:" << m_localServer->errorString();
+            return false;
+        }
+    } else {
+        QHostAddress hostAddress(QHostAddress::LocalHost);
+        QString portString = address;
+
+        int separator = address.lastIndexOf(':');
+        if (separator != -1) {
+            hostAddress = QHostAddress(address.left(separator));
+            portString = address.mid(separator + 1);
+        }
+
+        bool ok;
+        quint16 port = portString.toUShort(&ok);
+        if (!ok || hostAddress.isNull()) {
+            qDebug() << "ScsiBridge::listen() - Invalid bridge address: " << address;
+            return false;
+        }
+
+        m_tcpServer = new QTcpServer(this);
+        connect(m_tcpServer, &QTcpServer::newConnection, this, &ScsiBridge::newTcpConnection);
+
+        if (!m_tcpServer->listen(hostAddress, port)) {
+            qDebug() << "ScsiBridge::listen() - Failed to listen on: " << address
+                     << "- Error:" << m_tcpServer->errorString();
+            return false;
+        }
+    }
+
+    qDebug() << "ScsiBridge::listen() - SCSI initiator bridge on: " << address;
+    return true;
+}
+
+void ScsiBridge::close() {
+    if (m_tcpServer != nullptr) {
+        m_tcpServer->close();
+        delete m_tcpServer;
+        m_tcpServer = nullptr;
+    }
+    if (m_localServer != nullptr) {
+        m_localServer->close();
+        delete m_localServer;
+        m_localServer = nullptr;
+    }
+}
+
+void ScsiBridge::newTcpConnection() {
+    while (m_tcpServer->hasPendingConnections()) {
+        QTcpSocket *socket = m_tcpServer->nextPendingConnection();
+        socket->setSocketOption(QAbstractSocket::LowDelayOption, 1);
+        serveConnection(socket);
+    }
+}
+
+void ScsiBridge::newLocalConnection() {
+    while (m_localServer->hasPendingConnections()) serveConnection(m_localServer->nextPendingConnection());
+}
+
+void ScsiBridge::serveConnection(QIODevice *socket) {
+    Session session;
+    for (int lunNumber = 0; lunNumber < MAX_LUNS; lunNumber++) {
+        session.sense[lunNumber] = Sense{false, false, 0, 0, 0};
+        session.started[lunNumber] = true;
+    }
+    m_sessions.insert(socket, session);
+    qDebug() << "ScsiBridge::serveConnection() - Initiator connected";
+
+    connect(socket, &QIODevice::readyRead, this, [this, socket]() {
+        Session &session = m_sessions[socket];
+        session.rxData.append(socket->readAll());
+
+        // Answer every complete request received
+        while (session.rxData.size() >= 4) {
+            uint32_t length = (cdbByte(session.rxData, 0) << 24) | (cdbByte(session.rxData, 1) << 16) |
+                              (cdbByte(session.rxData, 2) << 8) | cdbByte(session.rxData, 3);
+            if (length > static_cast<uint32_t>(MAX_REQUEST_BYTES)) {
+                qDebug() << "ScsiBridge::serveConnection() - Request too long: " << length;
+                socket->close();
+                return;
+            }
+            if (session.rxData.size() < 4 + static_cast<qsizetype>(length)) break;
+
+            QByteArray reply;
+            command(session, session.rxData.mid(4, length), &reply);
+            session.rxData.remove(0, 4 + length);
+            socket->write(frameLength(static_cast<uint32_t>(reply.size())) + reply);
+        }
+    });
+
+    // Sessions end (and sockets are deleted) when the initiator disconnects
+    auto disconnected = [this, socket]() {
+        m_sessions.remove(socket);
+        socket->deleteLater();
+        qDebug() << "ScsiBridge::serveConnection() - Initiator disconnected";
+    };
+    if (auto *tcpSocket = qobject_cast<QTcpSocket *>(socket)) {
+        connect(tcpSocket, &QTcpSocket::disconnected, this, disconnected);
+    } else if (auto *localSocket = qobject_cast<QLocalSocket *>(socket)) {
+        connect(localSocket, &QLocalSocket::disconnected, this, disconnected);
+    }
+}
+
+// Execute a request and build the reply (empty if the command isn't
+// recognised).  Returns false if there was no reply.
+bool ScsiBridge::command(Session &session, const QByteArray &request, QByteArray *reply) {
+    reply->clear();
+    if (request.isEmpty()) return false;
+
+    // CDB length from the command group (6 is the LV-DOS group)
+    uint8_t opCode = static_cast<uint8_t>(request[0]);
+    int cdbLength;
+    switch (opCode >> 5) {
+        case 0:
+        case 6:
+            cdbLength = 6;
+            break;
+        case 1:
+            cdbLength = 10;
+            break;
+        default:
+            return false;
+    }
+    if (request.size() < cdbLength) return false;
+
+    QByteArray cdb = request.left(cdbLength);
+    uint8_t lunNumber = static_cast<uint8_t>((cdbByte(cdb, 1) & 0xE0) >> 5);
+    QByteArray dataIn;
+    uint8_t status;
+
+    switch (opCode) {
+        case 0x00: // TEST UNIT READY
+        case 0x01: // REZERO UNIT
+            status = commandTestUnitReady(session, lunNumber);
+            break;
+        case 0x03: // REQUEST SENSE
+            status = commandRequestSense(session, lunNumber, &dataIn);
+            break;
+        case 0x08: // READ (6)
+            status = commandRead6(session, lunNumber, cdb, &dataIn);
+            break;
+        case 0x0B: // SEEK
+            status = commandSeek(session, lunNumber, cdb);
+            break;
+        case 0x1A: // MODE SENSE
+            status = commandModeSense(session, lunNumber, cdb, &dataIn);
+            break;
+        case 0x1B: // START/STOP UNIT
+            status = commandStartStop(session, lunNumber, cdb);
+            break;
+        case 0x2F: // VERIFY
+            status = commandVerify(session, lunNumber, cdb);
+            break;
+        case 0xCA: // WRITE F-CODE
+            status = commandWriteFcode(session, lunNumber, request.mid(cdbLength));
+            break;
+        case 0xC8: // READ F-CODE
+            status = commandReadFcode(session, lunNumber, &dataIn);
+            break;
+        default:
+            qDebug() << "ScsiBridge::command() - Unsupported command: " << opCode;
+            return false;
+    }
+
+    if (m_metrics) m_metrics->bridgeCommands.add();
+    reply->append(static_cast<char>(status));
+    reply->append('\0'); // Message: command complete
+    if (status == 0x00) reply->append(dataIn);
+    return true;
+}
+
+// Only LUN 0 (the disc) is served in LV-DOS emulation
+bool ScsiBridge::isAvailable(uint8_t lunNumber) const {
+    return lunNumber == 0 && m_efmData->hasEfmData() && m_discDescriptor.size() == 28 && m_discDescriptor[0] != 0;
+}
+
+// Record the sense data for a failed command and return the CHECK status
+uint8_t ScsiBridge::fail(Session &session, uint8_t lunNumber, uint8_t errorClass, uint8_t errorCode,
+                         bool validAddress, uint32_t logicalBlockAddress) {
+    session.sense[lunNumber] = Sense{true, validAddress, errorClass, errorCode, logicalBlockAddress};
+    return static_cast<uint8_t>((lunNumber << 5) | 0x02);
+}
+
+uint8_t ScsiBridge::commandTestUnitReady(Session &session, uint8_t lunNumber) {
+    if (!session.started[lunNumber] || !isAvailable(lunNumber)) return fail(session, lunNumber, 0x00, 0x02);
+    return 0x00;
+}
+
+// Four bytes of sense data (in the ACB-4000 format), clearing the error
+uint8_t ScsiBridge::commandRequestSense(Session &session, uint8_t lunNumber, QByteArray *dataIn) {
+    Sense &sense = session.sense[lunNumber];
+    *dataIn = QByteArray(4, 0x00);
+    if (sense.error) {
+        (*dataIn)[0] = static_cast<char>((sense.validAddress ? 0x80 : 0x00) | ((sense.errorClass & 0x07) << 4) |
+                                         (sense.errorCode & 0x0F));
+        (*dataIn)[1] = static_cast<char>((sense.logicalBlockAddress >> 16) & 0x1F);
+        (*dataIn)[2] = static_cast<char>((sense.logicalBlockAddress >> 8) & 0xFF);
+        (*dataIn)[3] = static_cast<char>(sense.logicalBlockAddress & 0xFF);
+    }
+
+    sense = Sense{false, false, 0, 0, 0};
+    return 0x00;
+}
+
+// Read blocks of the disc.  A stopped LUN is started (as the Adaptec adapter,
+// and so the Pico, does) and sectors that failed background verification
+// are reported as an uncorrectable data error.
+uint8_t ScsiBridge::commandRead6(Session &session, uint8_t lunNumber, const QByteArray &cdb, QByteArray *dataIn) {
+    if (!isAvailable(lunNumber)) return fail(session, lunNumber, 0x02, 0x1C);
+    session.started[lunNumber] = true;
+
+    uint32_t logicalBlockAddress = ((cdbByte(cdb, 1) & 0x1F) << 16) | (cdbByte(cdb, 2) << 8) | cdbByte(cdb, 3);
+    uint32_t numberOfBlocks = cdbByte(cdb, 4);
+    if (numberOfBlocks == 0) numberOfBlocks = 256;
+
+    m_verifier->noteActivity();
+    uint32_t firstBadBlock = logicalBlockAddress;
+    if (m_verifier->isBad(logicalBlockAddress, numberOfBlocks, &firstBadBlock)) {
+        if (m_metrics) m_metrics->sectorReadErrors.add();
+        return fail(session, lunNumber, 0x01, 0x11, true, firstBadBlock);
+    }
+
+    m_efmData->prefetch(logicalBlockAddress, numberOfBlocks);
+    dataIn->reserve(static_cast<qsizetype>(numberOfBlocks) * 256);
+    for (uint32_t block = 0; block < numberOfBlocks; block++) {
+        QByteArray sectorData = m_efmData->getEfmSectorData(logicalBlockAddress + block);
+        if (sectorData.size() != 256) {
+            if (m_metrics) m_metrics->sectorReadErrors.add();
+            dataIn->clear();
+            return fail(session, lunNumber, 0x00, 0x04);
+        }
+        dataIn->append(sectorData);
+    }
+
+    if (m_metrics) m_metrics->sectorsServed.add(numberOfBlocks);
+    return 0x00;
+}
+
+// A seek is a prefetch hint
+uint8_t ScsiBridge::commandSeek(Session &session, uint8_t lunNumber, const QByteArray &cdb) {
+    if (!session.started[lunNumber] || !isAvailable(lunNumber)) return fail(session, lunNumber, 0x00, 0x02);
+
+    uint32_t logicalBlockAddress = ((cdbByte(cdb, 1) & 0x1F) << 16) | (cdbByte(cdb, 2) << 8) | cdbByte(cdb, 3);
+    m_verifier->noteActivity();
+    m_efmData->prefetch(logicalBlockAddress, EfmData::PREFETCH_SECTORS);
+    return 0x00;
+}
+
+// The 22 byte drive descriptor
+uint8_t ScsiBridge::commandModeSense(Session &session, uint8_t lunNumber, const QByteArray &cdb,
+                                     QByteArray *dataIn) {
+    if (cdbByte(cdb, 4) != 22 || !isAvailable(lunNumber)) return fail(session, lunNumber, 0x02, 0x24);
+
+    *dataIn = m_discDescriptor.mid(1, 22);
+    return 0x00;
+}
+
+uint8_t ScsiBridge::commandStartStop(Session &session, uint8_t lunNumber, const QByteArray &cdb) {
+    if (cdbByte(cdb, 4) == 0) {
+        session.started[lunNumber] = false;
+        return 0x00;
+    }
+
+    if (!isAvailable(lunNumber)) return fail(session, lunNumber, 0x02, 0x24);
+    session.started[lunNumber] = true;
+    return 0x00;
+}
+
+// Verify blocks against the EFM data's checksums
+uint8_t ScsiBridge::commandVerify(Session &session, uint8_t lunNumber, const QByteArray &cdb) {
+    if (!session.started[lunNumber] || !isAvailable(lunNumber))
+        return static_cast<uint8_t>((lunNumber << 5) | 0x02);
+
+    uint32_t logicalBlockAddress = (cdbByte(cdb, 2) << 24) | (cdbByte(cdb, 3) << 16) | (cdbByte(cdb, 4) << 8) |
+                                   cdbByte(cdb, 5);
+    uint32_t numberOfBlocks = (cdbByte(cdb, 7) << 8) | cdbByte(cdb, 8);
+    if (numberOfBlocks == 0) numberOfBlocks = 65536;
+
+    // The LUN size is heads x cylinders x 33 sectors (from the descriptor)
+    uint32_t lunSizeInSectors = cdbByte(m_discDescriptor, 1 + 15) *
+                                ((cdbByte(m_discDescriptor, 1 + 13) << 8) | cdbByte(m_discDescriptor, 1 + 14)) * 33;
+    if (logicalBlockAddress >= lunSizeInSectors)
+        return fail(session, lunNumber, 0x02, 0x21, true, logicalBlockAddress);
+
+    m_verifier->noteActivity();
+    if (!m_efmData->hasExtentIndex()) {
+        // As MainWindow::commandVerifySectors(): without an index, in range sectors pass
+        qDebug() << "ScsiBridge::commandVerify() - No extent index for the EFM data; sectors not checked";
+        return 0x00;
+    }
+
+    uint32_t firstBadSector = logicalBlockAddress;
+    if (!m_efmData->verifySectors(logicalBlockAddress, numberOfBlocks, &firstBadSector))
+        return fail(session, lunNumber, 0x01, 0x11, true, firstBadSector);
+    return 0x00;
+}
+
+// F-codes are logged (there's no player to send them to)
+uint8_t ScsiBridge::commandWriteFcode(Session &session, uint8_t lunNumber, const QByteArray &dataOut) {
+    if (!session.started[lunNumber] || !isAvailable(lunNumber)) return fail(session, lunNumber, 0x02, 0x02);
+
+    int length = static_cast<int>(dataOut.indexOf('\r'));
+    if (length < 0) length = static_cast<int>(dataOut.size());
+    qDebug() << "ScsiBridge::commandWriteFcode() - F-code: " << dataOut.left(length);
+    return 0x00;
+}
+
+// There is no F-code reply, so the response is just a CR
+uint8_t ScsiBridge::commandReadFcode(Session &session, uint8_t lunNumber, QByteArray *dataIn) {
+    if (!session.started[lunNumber] || !isAvailable(lunNumber)) return fail(session, lunNumber, 0x02, 0x02);
+
+    *dataIn = QByteArray(FCODE_BYTES, 0x00);
+    (*dataIn)[0] = 0x0D;
+    return 0x00;
+}
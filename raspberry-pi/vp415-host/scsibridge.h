@@ -0,0 +1,121 @@
+/************************************************************************
+
+    scsibridge.h
+
+    VP415-host - A host application for the VP415 Emulator
+    VP415-Emulator
+    Copyright (C) 2025 Simon Inns
+
+    This file is part of VP415-Emulator.
+
+    This is free software: you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Email: simon.inns@gmail.com
+
+************************************************************************/
+
+#ifndef SCSIBRIDGE_H
+#define SCSIBRIDGE_H
+
+#include <QObject>
+#include <QString>
+#include <QByteArray>
+#include <QHash>
+#include <QTcpServer>
+#include <QLocalServer>
+
+#include "efmdata.h"
+#include "backgroundverifier.h"
+#include "metrics.h"
+
+// Socket bridge that lets a software BBC Micro emulator be the SCSI
+// initiator, bypassing the Pico, so the serving path can be driven much
+// faster than a real BBC drives it.  The bridge implements the LV-DOS
+// commands of the Pico's SCSI target (scsi.c) against the same EFM data,
+// background verifier and disc descriptor as the Pico links.  As on the
+// Pico, F-codes are accepted and READ F-CODE replies with an empty (CR)
+// response.
+//
+// Each request is a frame of [0-3] length (big-endian), then the CDB (6 or 10
+// bytes) followed by any data out (the 256 byte F-code buffer for WRITE
+// F-CODE).  Each reply is [0-3] length, [4] status, [5] message, then any
+// data in.  A command the target doesn't recognise gets an empty reply (the
+// Pico goes straight to bus free).
+//
+// Each connection is an initiator, with its own sense data and started LUNs.
+class ScsiBridge : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit ScsiBridge(EfmData *efmData, BackgroundVerifier *verifier, Metrics *metrics,
+                        QObject *parent = nullptr);
+    ~ScsiBridge();
+
+    static const int MAX_LUNS = 8;
+    static const int FCODE_BYTES = 256;
+
+    bool listen(QString address);
+    void close();
+
+    // The disc descriptor (as sent to the Pico in a disc event: [0] data
+    // present, [1-22] LUN descriptor, [23-27] user code) of LUN 0
+    void setDisc(const QByteArray &discDescriptor) { m_discDescriptor = discDescriptor; }
+
+private slots:
+    void newTcpConnection();
+    void newLocalConnection();
+
+private:
+    struct Sense {
+        bool error;
+        bool validAddress;
+        uint8_t errorClass;
+        uint8_t errorCode;
+        uint32_t logicalBlockAddress;
+    };
+
+    struct Session {
+        QByteArray rxData;
+        Sense sense[MAX_LUNS];
+        bool started[MAX_LUNS];
+    };
+
+    EfmData *m_efmData;
+    BackgroundVerifier *m_verifier;
+    Metrics *m_metrics;
+    QTcpServer *m_tcpServer;
+    QLocalServer *m_localServer;
+    QHash<QIODevice *, Session> m_sessions;
+    QByteArray m_discDescriptor;
+
+    void serveConnection(QIODevice *socket);
+    bool command(Session &session, const QByteArray &request, QByteArray *reply);
+
+    bool isAvailable(uint8_t lunNumber) const;
+    uint8_t fail(Session &session, uint8_t lunNumber, uint8_t errorClass, uint8_t errorCode,
+                 bool validAddress = false, uint32_t logicalBlockAddress = 0);
+
+    uint8_t commandTestUnitReady(Session &session, uint8_t lunNumber);
+    uint8_t commandRequestSense(Session &session, uint8_t lunNumber, QByteArray *dataIn);
+    uint8_t commandRead6(Session &session, uint8_t lunNumber, const QByteArray &cdb, QByteArray *dataIn);
+    uint8_t commandSeek(Session &session, uint8_t lunNumber, const QByteArray &cdb);
+    uint8_t commandModeSense(Session &session, uint8_t lunNumber, const QByteArray &cdb, QByteArray *dataIn);
+    uint8_t commandStartStop(Session &session, uint8_t lunNumber, const QByteArray &cdb);
+    uint8_t commandVerify(Session &session, uint8_t lunNumber, const QByteArray &cdb);
+    uint8_t commandWriteFcode(Session &session, uint8_t lunNumber, const QByteArray &dataOut);
+    uint8_t commandReadFcode(Session &session, uint8_t lunNumber, QByteArray *dataIn);
+};
+
+#endif // SCSIBRIDGE_H
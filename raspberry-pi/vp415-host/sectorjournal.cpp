@@ -0,0 +1,187 @@
+/************************************************************************
+
+    sectorjournal.cpp
+
+    VP415-host - A host application for the VP415 Emulator
+    VP415-Emulator
+    Copyright (C) 2025 Simon Inns
+
+    This file is part of VP415-Emulator.
+
+    This is free software: you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Email: simon.inns@gmail.com
+
+************************************************************************/
+
+#include "sectorjournal.h"
+
+#include <QDebug>
+#include <QtEndian>
+#include <array>
+#include <unistd.h>
+
+// Record header magic
+static const quint32 JOURNAL_MAGIC = 0x5650574A;  // "VPWJ"
+
+SectorJournal::SectorJournal(QObject *parent) : QObject(parent) {
+    m_uncommitted = false;
+    m_metrics = nullptr;
+}
+
+SectorJournal::~SectorJournal() {
+    close();
+}
+
+// Open the journal.  Any complete records left by the last run (which weren't
+// applied to the images before it stopped) are returned for replay, and a
+// torn record at the end is discarded.
+bool SectorJournal::open(QString journalFilename, QList<Record> *replayRecords) {
+    close();
+
+    m_journalFile.setFileName(journalFilename);
+    if (!m_journalFile.open(QIODevice::ReadWrite)) {
+        qDebug() << "SectorJournal::open() - Failed to open journal: " << journalFilename;
+        return false;
+    }
+
+    if (!readRecords(replayRecords)) {
+        qDebug() << "SectorJournal::open() - Discarding torn record at the end of the journal";
+        m_journalFile.resize(m_journalFile.pos());
+    }
+    m_journalFile.seek(m_journalFile.size());
+
+    if (!replayRecords->isEmpty())
+        qDebug() << "SectorJournal::open() - Journal contains" << replayRecords->size() << "records to replay";
+    return true;
+}
+
+void SectorJournal::close() {
+    if (!m_journalFile.isOpen()) return;
+
+    commit();
+    m_journalFile.close();
+}
+
+// Read the records from the start of the journal.  Returns false if reading
+// stopped at an incomplete or corrupt record (the file position is left at
+// the end of the last good record).
+bool SectorJournal::readRecords(QList<Record> *records) {
+    m_journalFile.seek(0);
+
+    while (!m_journalFile.atEnd()) {
+        qint64 recordStart = m_journalFile.pos();
+        QByteArray header = m_journalFile.read(HEADER_LENGTH);
+
+        const uchar *headerData = reinterpret_cast<const uchar *>(header.constData());
+        if (header.size() != HEADER_LENGTH || qFromBigEndian<quint32>(headerData) != JOURNAL_MAGIC) {
+            m_journalFile.seek(recordStart);
+            return false;
+        }
+
+        Record record;
+        record.lunNumber = headerData[4];
+        record.startSector = qFromBigEndian<quint32>(headerData + 8);
+        record.sectorData = m_journalFile.read(static_cast<qint64>(headerData[5]) * 256);
+
+        uint32_t crc = crc32(header.left(12));
+        if (record.sectorData.size() != headerData[5] * 256 ||
+            crc32(record.sectorData, crc) != qFromBigEndian<quint32>(headerData + 12)) {
+            m_journalFile.seek(recordStart);
+            return false;
+        }
+
+        records->append(record);
+    }
+
+    return true;
+}
+
+// Append a write to the journal.  The record isn't durable until the next
+// commit.
+bool SectorJournal::append(uint8_t lunNumber, uint32_t startSector, const QByteArray &sectorData) {
+    if (!m_journalFile.isOpen()) return false;
+
+    QByteArray record(HEADER_LENGTH, 0x00);
+    uchar *headerData = reinterpret_cast<uchar *>(record.data());
+    qToBigEndian<quint32>(JOURNAL_MAGIC, headerData);
+    headerData[4] = lunNumber;
+    headerData[5] = static_cast<uchar>(sectorData.size() / 256);
+    qToBigEndian<quint32>(startSector, headerData + 8);
+    qToBigEndian<quint32>(crc32(sectorData, crc32(record.left(12))), headerData + 12);
+    record.append(sectorData);
+
+    // The record is written with a single write() so that a power cut can
+    // only tear the last record
+    if (m_journalFile.write(record) != record.size() || !m_journalFile.flush()) {
+        qDebug() << "SectorJournal::append() - Failed to write to the journal";
+        return false;
+    }
+
+    if (!m_uncommitted) {
+        m_uncommitted = true;
+        m_uncommittedTimer.start();
+    }
+    if (m_metrics) m_metrics->journalWrites.add();
+    return true;
+}
+
+// Make the appended records durable (group commit: a single fsync covers
+// every record since the last commit)
+bool SectorJournal::commit() {
+    if (!m_uncommitted) return true;
+
+    if (!m_journalFile.flush() || fsync(m_journalFile.handle()) != 0) {
+        qDebug() << "SectorJournal::commit() - Failed to sync the journal";
+        return false;
+    }
+
+    if (m_metrics) {
+        m_metrics->journalCommits.add();
+        m_metrics->journalDurabilityLagUs.set(m_uncommittedTimer.nsecsElapsed() / 1000);
+    }
+    m_uncommitted = false;
+    return true;
+}
+
+// Empty the journal once every record has been applied to (and synced with)
+// the images
+bool SectorJournal::checkpoint() {
+    if (!m_journalFile.isOpen()) return false;
+
+    if (!m_journalFile.resize(0) || !m_journalFile.seek(0) || fsync(m_journalFile.handle()) != 0) {
+        qDebug() << "SectorJournal::checkpoint() - Failed to empty the journal";
+        return false;
+    }
+
+    m_uncommitted = false;
+    return true;
+}
+
+// CRC-32 (IEEE 802.3)
+uint32_t SectorJournal::crc32(const QByteArray &data, uint32_t crc) {
+    static const std::array<uint32_t, 256> table = []() {
+        std::array<uint32_t, 256> crcTable{};
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t value = i;
+            for (int bit = 0; bit < 8; bit++) value = (value & 1) ? (value >> 1) ^ 0xEDB88320 : value >> 1;
+            crcTable[i] = value;
+        }
+        return crcTable;
+    }();
+
+    crc = ~crc;
+    for (char byte : data) crc = table[(crc ^ static_cast<uint8_t>(byte)) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
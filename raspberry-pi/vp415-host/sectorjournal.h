@@ -0,0 +1,86 @@
+/************************************************************************
+
+    sectorjournal.h
+
+    VP415-host - A host application for the VP415 Emulator
+    VP415-Emulator
+    Copyright (C) 2025 Simon Inns
+
+    This file is part of VP415-Emulator.
+
+    This is free software: you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Email: simon.inns@gmail.com
+
+************************************************************************/
+
+#ifndef SECTORJOURNAL_H
+#define SECTORJOURNAL_H
+
+#include <QObject>
+#include <QString>
+#include <QByteArray>
+#include <QFile>
+#include <QList>
+#include <QElapsedTimer>
+
+#include "metrics.h"
+
+// Write-ahead log of sector writes to the LUN images.  Writes are appended to
+// the journal and made durable in groups (one fsync per commit rather than
+// per sector); the LUN images are updated afterwards.  After a power cut the
+// committed records are replayed into the images on the next start.
+//
+// Each record is a 16 byte header ("VPWJ", LUN, sector count, start sector
+// and a CRC-32 of the header and data) followed by the sectors.  A torn
+// record at the end of the journal fails its CRC and is discarded.
+class SectorJournal : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit SectorJournal(QObject *parent = nullptr);
+    ~SectorJournal();
+
+    struct Record {
+        uint8_t lunNumber;
+        uint32_t startSector;
+        QByteArray sectorData;
+    };
+
+    bool open(QString journalFilename, QList<Record> *replayRecords);
+    void close();
+    bool isOpen() const { return m_journalFile.isOpen(); }
+
+    bool append(uint8_t lunNumber, uint32_t startSector, const QByteArray &sectorData);
+    bool commit();
+    bool checkpoint();
+
+    bool hasUncommitted() const { return m_uncommitted; }
+    qint64 uncommittedAgeMs() const { return m_uncommitted ? m_uncommittedTimer.elapsed() : 0; }
+
+    void setMetrics(Metrics *metrics) { m_metrics = metrics; }
+
+private:
+    QFile m_journalFile;
+    bool m_uncommitted;
+    QElapsedTimer m_uncommittedTimer;
+    Metrics *m_metrics;
+
+    static const int HEADER_LENGTH = 16;
+    static uint32_t crc32(const QByteArray &data, uint32_t crc = 0);
+    bool readRecords(QList<Record> *records);
+};
+
+#endif // SECTORJOURNAL_H
@@ -0,0 +1,234 @@
+/************************************************************************
+
+    syndromebatch.cpp
+
+    VP415-host - A host application for the VP415 Emulator
+    VP415-Emulator
+    Copyright (C) 2025 Simon Inns
+
+    This file is part of VP415-Emulator.
+
+    This is free software: you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Email: simon.inns@gmail.com
+
+************************************************************************/
+
+
+#include "syndromebatch.h"
+#include "reedsolomon.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SYNDROMEBATCH_X86
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#define SYNDROMEBATCH_NEON
+#endif
+
+namespace {
+
+// Products of a^j (j = 1 to 3) with each low and high nibble
+struct NibbleTables {
+    alignas(16) uint8_t low[ReedSolomon::PARITY_SYMBOLS][16];
+    alignas(16) uint8_t high[ReedSolomon::PARITY_SYMBOLS][16];
+
+    NibbleTables() {
+        for (int root = 0; root < ReedSolomon::PARITY_SYMBOLS; root++) {
+            for (int nibble = 0; nibble < 16; nibble++) {
+                low[root][nibble] = ReedSolomon::multiply(ReedSolomon::power(root), static_cast<uint8_t>(nibble));
+                high[root][nibble] = ReedSolomon::multiply(ReedSolomon::power(root), static_cast<uint8_t>(nibble << 4));
+            }
+        }
+    }
+};
+
+const NibbleTables &nibbleTables() {
+    static const NibbleTables tables;
+    return tables;
+}
+
+// The reference: Horner's rule, one codeword at a time (the same arithmetic
+// as ReedSolomon::syndromes)
+void syndromesScalar(const uint8_t *symbols, int length, int first, int count, uint8_t *syndromes) {
+    for (int codeword = first; codeword < count; codeword++) {
+        for (int root = 0; root < ReedSolomon::PARITY_SYMBOLS; root++) {
+            uint8_t x = ReedSolomon::power(root);
+            uint8_t syndrome = 0;
+            for (int index = 0; index < length; index++)
+                syndrome = static_cast<uint8_t>(ReedSolomon::multiply(syndrome, x) ^ symbols[index * count + codeword]);
+            syndromes[root * count + codeword] = syndrome;
+        }
+    }
+}
+
+#ifdef SYNDROMEBATCH_X86
+
+__attribute__((target("ssse3")))
+int syndromesSsse3(const uint8_t *symbols, int length, int first, int count, uint8_t *syndromes) {
+    const NibbleTables &tables = nibbleTables();
+    const __m128i mask = _mm_set1_epi8(0x0F);
+    __m128i low[ReedSolomon::PARITY_SYMBOLS];
+    __m128i high[ReedSolomon::PARITY_SYMBOLS];
+    for (int root = 1; root < ReedSolomon::PARITY_SYMBOLS; root++) {
+        low[root] = _mm_load_si128(reinterpret_cast<const __m128i *>(tables.low[root]));
+        high[root] = _mm_load_si128(reinterpret_cast<const __m128i *>(tables.high[root]));
+    }
+
+    int codeword = first;
+    for (; codeword + 16 <= count; codeword += 16) {
+        __m128i syndrome[ReedSolomon::PARITY_SYMBOLS];
+        for (int root = 0; root < ReedSolomon::PARITY_SYMBOLS; root++) syndrome[root] = _mm_setzero_si128();
+
+        for (int index = 0; index < length; index++) {
+            __m128i symbol = _mm_loadu_si128(reinterpret_cast<const __m128i *>(symbols + index * count + codeword));
+            syndrome[0] = _mm_xor_si128(syndrome[0], symbol);
+            for (int root = 1; root < ReedSolomon::PARITY_SYMBOLS; root++) {
+                __m128i lowNibbles = _mm_and_si128(syndrome[root], mask);
+                __m128i highNibbles = _mm_and_si128(_mm_srli_epi16(syndrome[root], 4), mask);
+                __m128i product = _mm_xor_si128(_mm_shuffle_epi8(low[root], lowNibbles),
+                                                _mm_shuffle_epi8(high[root], highNibbles));
+                syndrome[root] = _mm_xor_si128(product, symbol);
+            }
+        }
+
+        for (int root = 0; root < ReedSolomon::PARITY_SYMBOLS; root++)
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(syndromes + root * count + codeword), syndrome[root]);
+    }
+    return codeword;
+}
+
+__attribute__((target("avx2")))
+int syndromesAvx2(const uint8_t *symbols, int length, int first, int count, uint8_t *syndromes) {
+    const NibbleTables &tables = nibbleTables();
+    const __m256i mask = _mm256_set1_epi8(0x0F);
+    __m256i low[ReedSolomon::PARITY_SYMBOLS];
+    __m256i high[ReedSolomon::PARITY_SYMBOLS];
+    for (int root = 1; root < ReedSolomon::PARITY_SYMBOLS; root++) {
+        low[root] = _mm256_broadcastsi128_si256(_mm_load_si128(reinterpret_cast<const __m128i *>(tables.low[root])));
+        high[root] = _mm256_broadcastsi128_si256(_mm_load_si128(reinterpret_cast<const __m128i *>(tables.high[root])));
+    }
+
+    int codeword = first;
+    for (; codeword + 32 <= count; codeword += 32) {
+        __m256i syndrome[ReedSolomon::PARITY_SYMBOLS];
+        for (int root = 0; root < ReedSolomon::PARITY_SYMBOLS; root++) syndrome[root] = _mm256_setzero_si256();
+
+        for (int index = 0; index < length; index++) {
+            __m256i symbol = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(symbols + index * count + codeword));
+            syndrome[0] = _mm256_xor_si256(syndrome[0], symbol);
+            for (int root = 1; root < ReedSolomon::PARITY_SYMBOLS; root++) {
+                __m256i lowNibbles = _mm256_and_si256(syndrome[root], mask);
+                __m256i highNibbles = _mm256_and_si256(_mm256_srli_epi16(syndrome[root], 4), mask);
+                __m256i product = _mm256_xor_si256(_mm256_shuffle_epi8(low[root], lowNibbles),
+                                                   _mm256_shuffle_epi8(high[root], highNibbles));
+                syndrome[root] = _mm256_xor_si256(product, symbol);
+            }
+        }
+
+        for (int root = 0; root < ReedSolomon::PARITY_SYMBOLS; root++)
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(syndromes + root * count + codeword), syndrome[root]);
+    }
+
+    return codeword;
+}
+
+#endif
+
+#ifdef SYNDROMEBATCH_NEON
+
+int syndromesNeon(const uint8_t *symbols, int length, int first, int count, uint8_t *syndromes) {
+    const NibbleTables &tables = nibbleTables();
+    const uint8x16_t mask = vdupq_n_u8(0x0F);
+    uint8x16_t low[ReedSolomon::PARITY_SYMBOLS];
+    uint8x16_t high[ReedSolomon::PARITY_SYMBOLS];
+    for (int root = 1; root < ReedSolomon::PARITY_SYMBOLS; root++) {
+        low[root] = vld1q_u8(tables.low[root]);
+        high[root] = vld1q_u8(tables.high[root]);
+    }
+
+    int codeword = first;
+    for (; codeword + 16 <= count; codeword += 16) {
+        uint8x16_t syndrome[ReedSolomon::PARITY_SYMBOLS];
+        for (int root = 0; root < ReedSolomon::PARITY_SYMBOLS; root++) syndrome[root] = vdupq_n_u8(0);
+
+        for (int index = 0; index < length; index++) {
+            uint8x16_t symbol = vld1q_u8(symbols + index * count + codeword);
+            syndrome[0] = veorq_u8(syndrome[0], symbol);
+            for (int root = 1; root < ReedSolomon::PARITY_SYMBOLS; root++) {
+                uint8x16_t product = veorq_u8(vqtbl1q_u8(low[root], vandq_u8(syndrome[root], mask)),
+                                              vqtbl1q_u8(high[root], vshrq_n_u8(syndrome[root], 4)));
+                syndrome[root] = veorq_u8(product, symbol);
+            }
+        }
+
+        for (int root = 0; root < ReedSolomon::PARITY_SYMBOLS; root++)
+            vst1q_u8(syndromes + root * count + codeword, syndrome[root]);
+    }
+    return codeword;
+}
+
+#endif
+
+}
+
+bool SyndromeBatch::isSupported(Implementation implementation) {
+    switch (implementation) {
+    case Scalar:
+        return true;
+#ifdef SYNDROMEBATCH_X86
+    case Ssse3:
+        return __builtin_cpu_supports("ssse3");
+    case Avx2:
+        return __builtin_cpu_supports("avx2");
+#endif
+#ifdef SYNDROMEBATCH_NEON
+    case Neon:
+        return true;
+#endif
+    default:
+        return false;
+    }
+}
+
+SyndromeBatch::Implementation SyndromeBatch::best() {
+    static const Implementation implementation = isSupported(Avx2) ? Avx2 :
+                                                 isSupported(Ssse3) ? Ssse3 :
+                                                 isSupported(Neon) ? Neon : Scalar;
+    return implementation;
+}
+
+const char *SyndromeBatch::name(Implementation implementation) {
+    switch (implementation) {
+    case Ssse3: return "SSSE3";
+    case Avx2: return "AVX2";
+    case Neon: return "NEON";
+    default: return "scalar";
+    }
+}
+
+// Codewords left over from the vector versions (fewer than a vector) are
+// done by a narrower version or the reference
+void SyndromeBatch::syndromes(Implementation implementation, const uint8_t *symbols, int length, int count,
+                              uint8_t *syndromes) {
+    int done = 0;
+#ifdef SYNDROMEBATCH_X86
+    if (implementation == Avx2) done = syndromesAvx2(symbols, length, done, count, syndromes);
+    if (implementation == Avx2 || implementation == Ssse3) done = syndromesSsse3(symbols, length, done, count, syndromes);
+#endif
+#ifdef SYNDROMEBATCH_NEON
+    if (implementation == Neon) done = syndromesNeon(symbols, length, done, count, syndromes);
+#endif
+    syndromesScalar(symbols, length, done, count, syndromes);
+}
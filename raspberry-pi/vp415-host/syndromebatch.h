@@ -0,0 +1,61 @@
+/************************************************************************
+
+    syndromebatch.h
+
+    VP415-host - A host application for the VP415 Emulator
+    VP415-Emulator
+    Copyright (C) 2025 Simon Inns
+
+    This file is part of VP415-Emulator.
+
+    This is free software: you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Email: simon.inns@gmail.com
+
+************************************************************************/
+
+
+#ifndef SYNDROMEBATCH_H
+#define SYNDROMEBATCH_H
+
+#include <cstdint>
+
+// Reed-Solomon syndromes (for the four parity symbol CIRC codes) of many
+// codewords at once.  Codewords are stored symbol-major: symbol i of
+// codeword f is at symbols[i * count + f], and syndrome j of codeword f is
+// written to syndromes[j * count + f].  The vector versions process 16 (or
+// 32) codewords per instruction, multiplying by the constant a^j with two
+// 16 entry table lookups (one per nibble).
+class SyndromeBatch
+{
+public:
+    enum Implementation {
+        Scalar,
+        Ssse3,
+        Avx2,
+        Neon
+    };
+
+    static bool isSupported(Implementation implementation);
+    static Implementation best();
+    static const char *name(Implementation implementation);
+
+    static void syndromes(Implementation implementation, const uint8_t *symbols, int length, int count,
+                          uint8_t *syndromes);
+    static void syndromes(const uint8_t *symbols, int length, int count, uint8_t *syndromes) {
+        SyndromeBatch::syndromes(best(), symbols, length, count, syndromes);
+    }
+};
+
+#endif // SYNDROMEBATCH_H
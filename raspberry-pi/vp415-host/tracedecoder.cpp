@@ -0,0 +1,185 @@
+/************************************************************************
+
+    tracedecoder.cpp
+
+    VP415-host - A host application for the VP415 Emulator
+    VP415-Emulator
+    Copyright (C) 2025 Simon Inns
+
+    This file is part of VP415-Emulator.
+
+    This is free software: you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Email: simon.inns@gmail.com
+
+************************************************************************/
+
+#include "tracedecoder.h"
+#include <QDebug>
+
+// Trace record framing (must match debug.c on the Pico)
+static const uint8_t TRACE_MARKER = 0xFE;
+static const int TRACE_RECORD_LENGTH = 12;
+static const int TRACE_FRAME_LENGTH = 1 + TRACE_RECORD_LENGTH + 1;
+
+TraceDecoder::TraceDecoder(QObject *parent) : QObject(parent) {
+    m_isSerialPortOpen = false;
+    m_serialPortName = "";
+
+    // Initialize the serial port
+    m_serialPort = new QSerialPort(this);
+
+    // Connect the readyRead signal to our slot
+    connect(m_serialPort, &QSerialPort::readyRead, this, &TraceDecoder::readData);
+}
+
+TraceDecoder::~TraceDecoder() {
+    if (m_isSerialPortOpen) {
+        closeSerialPort();
+    }
+
+    delete m_serialPort;
+}
+
+bool TraceDecoder::openSerialPort(QString serialPortDeviceName) {
+    if (m_isSerialPortOpen) {
+        closeSerialPort();
+    }
+
+    m_serialPortName = serialPortDeviceName;
+
+    // Configure the serial port (the Pico's stdio UART settings)
+    m_serialPort->setPortName(m_serialPortName);
+    m_serialPort->setBaudRate(QSerialPort::Baud115200);
+    m_serialPort->setDataBits(QSerialPort::Data8);
+    m_serialPort->setParity(QSerialPort::NoParity);
+    m_serialPort->setStopBits(QSerialPort::OneStop);
+    m_serialPort->setFlowControl(QSerialPort::NoFlowControl);
+
+    if (m_serialPort->open(QIODevice::ReadOnly)) {
+        m_isSerialPortOpen = true;
+        qDebug() << "TraceDecoder::openSerialPort() - Debug port opened:" << m_serialPortName;
+    } else {
+        qDebug() << "TraceDecoder::openSerialPort() - Failed to open debug port:" << m_serialPortName
+                 << "- Error:" << m_serialPort->errorString();
+        return false;
+    }
+
+    m_buffer.clear();
+    m_textLine.clear();
+    return true;
+}
+
+void TraceDecoder::closeSerialPort() {
+    if (m_isSerialPortOpen) {
+        m_serialPort->close();
+        m_isSerialPortOpen = false;
+        qDebug() << "TraceDecoder::closeSerialPort() - Debug port closed:" << m_serialPortName;
+    }
+}
+
+void TraceDecoder::readData() {
+    decodeData(m_serialPort->readAll());
+}
+
+// Split the incoming stream into text lines and binary trace records.  Text is
+// always 7-bit ASCII (debugPrintf() replaces other bytes) so a marker byte can
+// only be the start of a trace frame; if the checksum of a frame is bad (i.e. we
+// started listening part way through a frame) the marker is discarded and
+// decoding resynchronises on the next one.
+void TraceDecoder::decodeData(const QByteArray &data) {
+    m_buffer.append(data);
+
+    int position = 0;
+    while (position < m_buffer.size()) {
+        uint8_t byte = static_cast<uint8_t>(m_buffer[position]);
+
+        if (byte != TRACE_MARKER) {
+            if (byte == '\n') {
+                qDebug().noquote() << "Pico:" << QString::fromLatin1(m_textLine).trimmed();
+                m_textLine.clear();
+            } else if (byte != '\r') {
+                m_textLine.append(static_cast<char>(byte));
+            }
+            position++;
+            continue;
+        }
+
+        // Wait for the rest of the frame
+        if (m_buffer.size() - position < TRACE_FRAME_LENGTH) break;
+
+        const uint8_t *frame = reinterpret_cast<const uint8_t *>(m_buffer.constData()) + position + 1;
+        uint8_t checksum = 0;
+        for (int i = 0; i < TRACE_RECORD_LENGTH; i++) checksum ^= frame[i];
+
+        if (checksum != frame[TRACE_RECORD_LENGTH]) {
+            position++;
+            continue;
+        }
+
+        uint32_t timestamp = frame[0] | (frame[1] << 8) | (frame[2] << 16) |
+                             (static_cast<uint32_t>(frame[3]) << 24);
+        uint16_t eventId = frame[4] | (frame[5] << 8);
+        uint16_t arg0 = frame[6] | (frame[7] << 8);
+        uint32_t arg1 = frame[8] | (frame[9] << 8) | (frame[10] << 16) |
+                        (static_cast<uint32_t>(frame[11]) << 24);
+
+        qDebug().noquote() << QString("Pico: [%1] %2")
+                                  .arg(timestamp, 10)
+                                  .arg(decodeTraceEvent(eventId, arg0, arg1));
+        emit traceEventReceived(timestamp, eventId, arg0, arg1);
+
+        position += TRACE_FRAME_LENGTH;
+    }
+
+    m_buffer.remove(0, position);
+}
+
+// Decode a trace record to text (event IDs must match debug.h on the Pico)
+QString TraceDecoder::decodeTraceEvent(uint16_t eventId, uint16_t arg0, uint32_t arg1) {
+    static const char *phaseNames[] = {"Data out", "Data in", "Command",
+                                       "Status", "Message out", "Message in"};
+
+    switch (eventId) {
+        case 0x01: // TRACE_SCSI_BUSFREE
+            return "SCSI State: Bus Free";
+        case 0x02: // TRACE_SCSI_SELECTED
+            return QString("SCSI State: Selected by host ID %1").arg(arg0);
+        case 0x03: // TRACE_SCSI_PHASE
+            if (arg0 < 6) return QString("SCSI State: Information transfer phase: %1").arg(phaseNames[arg0]);
+            return QString("SCSI State: Information transfer phase: %1 (invalid)").arg(arg0);
+        case 0x04: // TRACE_SCSI_CDB
+            return QString("SCSI Commands: CDB[%1] = %2 %3 %4 %5").arg(arg0)
+                .arg((arg1 >> 24) & 0xFF, 2, 16, QChar('0'))
+                .arg((arg1 >> 16) & 0xFF, 2, 16, QChar('0'))
+                .arg((arg1 >> 8) & 0xFF, 2, 16, QChar('0'))
+                .arg(arg1 & 0xFF, 2, 16, QChar('0'));
+        case 0x05: // TRACE_SCSI_BLOCK
+            return QString("SCSI Commands: Block %1 transferred (last byte index %2)").arg(arg1).arg(arg0);
+        case 0x06: // TRACE_SCSI_STATUS
+            return QString("SCSI State: Status. Status byte = %1").arg(arg0);
+        case 0x07: // TRACE_SCSI_MESSAGE
+            return QString("SCSI State: Message In. Message byte = %1").arg(arg0);
+        case 0x08: // TRACE_SCSI_RESET
+            return "SCSI State: Resetting SCSI emulation";
+        case 0x10: // TRACE_PICOM_REQUEST
+            return QString("Picom: Request command 0x%1 (%2 bytes)").arg(arg1, 2, 16, QChar('0')).arg(arg0);
+        case 0x11: // TRACE_PICOM_RESPONSE
+            return QString("Picom: Response (%1 bytes)").arg(arg0);
+        case 0x7F: // TRACE_DROPPED
+            return QString("Trace: %1 records dropped (trace ring full)").arg(arg1);
+        default:
+            return QString("Unknown trace event 0x%1 arg0 = %2 arg1 = %3").arg(eventId, 2, 16, QChar('0')).arg(arg0).arg(arg1);
+    }
+}
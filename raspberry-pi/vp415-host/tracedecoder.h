@@ -0,0 +1,68 @@
+/************************************************************************
+
+    tracedecoder.h
+
+    VP415-host - A host application for the VP415 Emulator
+    VP415-Emulator
+    Copyright (C) 2025 Simon Inns
+
+    This file is part of VP415-Emulator.
+
+    This is free software: you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Email: simon.inns@gmail.com
+
+************************************************************************/
+
+#ifndef TRACEDECODER_H
+#define TRACEDECODER_H
+
+#include <QObject>
+#include <QString>
+#include <QByteArray>
+#include <QSerialPort>
+
+// Decodes the Pico's debug UART output.  The stream contains plain text (from
+// debugPrintf()) interleaved with framed binary trace records (from
+// debugTrace()) which are decoded to text here rather than on the Pico.
+class TraceDecoder : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit TraceDecoder(QObject *parent = nullptr);
+    ~TraceDecoder();
+
+    bool openSerialPort(QString serialPortDeviceName);
+    void closeSerialPort();
+
+    void decodeData(const QByteArray &data);
+    static QString decodeTraceEvent(uint16_t eventId, uint16_t arg0, uint32_t arg1);
+
+signals:
+    void traceEventReceived(uint32_t timestamp, uint16_t eventId, uint16_t arg0, uint32_t arg1);
+
+private slots:
+    void readData();
+
+private:
+    bool m_isSerialPortOpen;
+    QString m_serialPortName;
+    QSerialPort *m_serialPort;
+
+    QByteArray m_buffer;
+    QByteArray m_textLine;
+};
+
+#endif // TRACEDECODER_H
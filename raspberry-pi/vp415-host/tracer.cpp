@@ -0,0 +1,326 @@
+/************************************************************************
+
+    tracer.cpp
+
+    VP415-host - A host application for the VP415 Emulator
+    VP415-Emulator
+    Copyright (C) 2025 Simon Inns
+
+    This file is part of VP415-Emulator.
+
+    This is free software: you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Email: simon.inns@gmail.com
+
+************************************************************************/
+
+#include "tracer.h"
+#include "tracedecoder.h"
+#include <QDebug>
+#include <QJsonDocument>
+
+// Number of clock samples used for the offset estimate (the sample with the
+// shortest round trip gives the best estimate)
+static const int CLOCK_SAMPLE_WINDOW = 16;
+
+// Process and thread IDs used in the trace
+static const int PID_PICO = 1;
+static const int PID_HOST = 2;
+static const int TID_PICO_SCSI = 1;
+static const int TID_PICO_LINK = 2;
+static const int TID_HOST_MAIN = 1;
+
+Tracer::Tracer(QObject *parent) : QObject(parent) {
+    m_isTracing = false;
+    m_hasEvents = false;
+    m_lastPicoTime = 0;
+    m_hasPicoTime = false;
+    m_pendingPicoSendTime = 0;
+    m_pendingHostReceiveTime = 0;
+    m_pendingHostSendTime = 0;
+    m_hasPendingPoll = false;
+    m_clockOffset = 0;
+    m_hasClockOffset = false;
+    m_picoCommandOpen = false;
+    m_picoLinkOpen = false;
+
+    m_timer.start();
+}
+
+Tracer::~Tracer() {
+    closeTrace();
+}
+
+// The trace is written as it is collected, in the JSON array form of the
+// trace event format (which allows the closing bracket to be missing, so the
+// trace is still readable if the host doesn't exit cleanly)
+bool Tracer::openTrace(QString filename) {
+    closeTrace();
+
+    m_traceFile.setFileName(filename);
+    if (!m_traceFile.open(QIODevice::WriteOnly | QIODevice::Text)) {
+        qDebug() << "Tracer::openTrace() - Failed to open trace file: " << filename;
+        return false;
+    }
+
+    m_traceFile.write("[");
+    m_isTracing = true;
+    m_hasEvents = false;
+    m_picoCommandOpen = false;
+    m_picoLinkOpen = false;
+
+    // Name the processes and threads
+    auto metadata = [this](int pid, int tid, QString type, QString name) {
+        QJsonObject event;
+        event["ph"] = "M";
+        event["pid"] = pid;
+        event["tid"] = tid;
+        event["name"] = type;
+        event["args"] = QJsonObject{{"name", name}};
+        writeEvent(event);
+    };
+    metadata(PID_PICO, 0, "process_name", "Pico (PicoSCSI)");
+    metadata(PID_PICO, TID_PICO_SCSI, "thread_name", "SCSI");
+    metadata(PID_PICO, TID_PICO_LINK, "thread_name", "Pi link");
+    metadata(PID_HOST, 0, "process_name", "Pi (vp415-host)");
+    metadata(PID_HOST, TID_HOST_MAIN, "thread_name", "Main");
+
+    qDebug() << "Tracer::openTrace() - Tracing to: " << filename;
+    return true;
+}
+
+void Tracer::closeTrace() {
+    if (!m_isTracing) return;
+
+    // Anything still waiting for a clock offset is written unadjusted
+    for (const PicoEvent &event : m_pendingPicoEvents) writePicoEvent(event);
+    m_pendingPicoEvents.clear();
+
+    m_traceFile.write("\n]\n");
+    m_traceFile.close();
+    m_isTracing = false;
+    qDebug() << "Tracer::closeTrace() - Trace closed";
+}
+
+void Tracer::writeEvent(const QJsonObject &event) {
+    m_traceFile.write(m_hasEvents ? ",\n" : "\n");
+    m_traceFile.write(QJsonDocument(event).toJson(QJsonDocument::Compact));
+    m_hasEvents = true;
+}
+
+// Record a complete (duration) event on the host
+void Tracer::complete(QString category, QString name, int64_t startTime, int64_t endTime,
+                      QJsonObject args) {
+    if (!m_isTracing) return;
+
+    QJsonObject event;
+    event["ph"] = "X";
+    event["cat"] = category;
+    event["name"] = name;
+    event["pid"] = PID_HOST;
+    event["tid"] = TID_HOST_MAIN;
+    event["ts"] = static_cast<qint64>(startTime);
+    event["dur"] = static_cast<qint64>(endTime - startTime);
+    if (!args.isEmpty()) event["args"] = args;
+    writeEvent(event);
+}
+
+// Record an instant event on the host
+void Tracer::instant(QString category, QString name, QJsonObject args) {
+    if (!m_isTracing) return;
+
+    QJsonObject event;
+    event["ph"] = "i";
+    event["s"] = "t";
+    event["cat"] = category;
+    event["name"] = name;
+    event["pid"] = PID_HOST;
+    event["tid"] = TID_HOST_MAIN;
+    event["ts"] = static_cast<qint64>(now());
+    if (!args.isEmpty()) event["args"] = args;
+    writeEvent(event);
+}
+
+// The Pico's microsecond timer is 32 bits and wraps every ~71 minutes; extend
+// it to 64 bits using the last Pico time seen (polls are never more than a few
+// seconds apart, and trace records are never far behind)
+int64_t Tracer::extendPicoTime(uint32_t picoTime) {
+    if (!m_hasPicoTime) {
+        m_lastPicoTime = picoTime;
+        m_hasPicoTime = true;
+        return m_lastPicoTime;
+    }
+
+    int64_t extendedTime = m_lastPicoTime + static_cast<int32_t>(picoTime - static_cast<uint32_t>(m_lastPicoTime));
+    if (extendedTime > m_lastPicoTime) m_lastPicoTime = extendedTime;
+    return extendedTime;
+}
+
+// Clock offset estimation.  Each poll from the Pico carries the time it was
+// sent (t1) and the send and receive times of the previous poll.  Together
+// with the host's receive (t2) and reply (t3) times for the previous poll this
+// gives the usual NTP style estimate:
+//
+//   offset = ((t1 - t2) + (t4 - t3)) / 2, delay = (t4 - t1) - (t3 - t2)
+//
+// UART and USB latencies are asymmetric and jittery, so the sample with the
+// smallest delay in the recent window is used.
+void Tracer::pollReceived(uint32_t picoSendTime, uint32_t previousPicoSendTime,
+                          uint32_t previousPicoReceiveTime, int64_t hostReceiveTime,
+                          int64_t hostSendTime) {
+    // Complete the previous exchange
+    if (m_hasPendingPoll && m_hasPicoTime &&
+        static_cast<uint32_t>(m_pendingPicoSendTime) == previousPicoSendTime) {
+        int64_t t1 = m_pendingPicoSendTime;
+        int64_t t4 = t1 + static_cast<uint32_t>(previousPicoReceiveTime - previousPicoSendTime);
+        int64_t t2 = m_pendingHostReceiveTime;
+        int64_t t3 = m_pendingHostSendTime;
+
+        ClockSample sample;
+        sample.offset = ((t1 - t2) + (t4 - t3)) / 2;
+        sample.delay = (t4 - t1) - (t3 - t2);
+
+        m_clockSamples.append(sample);
+        if (m_clockSamples.size() > CLOCK_SAMPLE_WINDOW) m_clockSamples.removeFirst();
+
+        const ClockSample *best = &m_clockSamples.first();
+        for (const ClockSample &candidate : m_clockSamples) {
+            if (candidate.delay < best->delay) best = &candidate;
+        }
+        m_clockOffset = best->offset;
+
+        if (!m_hasClockOffset) {
+            m_hasClockOffset = true;
+            qDebug() << "Tracer::pollReceived() - Pico clock offset: " << m_clockOffset
+                     << "us (delay" << best->delay << "us)";
+
+            for (const PicoEvent &event : m_pendingPicoEvents) writePicoEvent(event);
+            m_pendingPicoEvents.clear();
+        }
+    }
+
+    // Remember this exchange until the Pico reports when it completed
+    m_pendingPicoSendTime = extendPicoTime(picoSendTime);
+    m_pendingHostReceiveTime = hostReceiveTime;
+    m_pendingHostSendTime = hostSendTime;
+    m_hasPendingPoll = true;
+}
+
+// Merge a trace record from the Pico into the trace
+void Tracer::picoTraceEvent(uint32_t timestamp, uint16_t eventId, uint16_t arg0, uint32_t arg1) {
+    if (!m_isTracing) return;
+
+    PicoEvent event = {timestamp, eventId, arg0, arg1};
+    if (!m_hasClockOffset) {
+        m_pendingPicoEvents.append(event);
+        return;
+    }
+
+    writePicoEvent(event);
+}
+
+// Every B event is matched by an E event on the same track: a span that is
+// still open when the next one starts, or when the bus is reset or goes free,
+// is closed first (the Pico marks a failed or cancelled link request in its
+// response record)
+void Tracer::writePicoEvent(const PicoEvent &picoEvent) {
+    QJsonObject event;
+    event["pid"] = PID_PICO;
+    event["tid"] = TID_PICO_SCSI;
+    event["cat"] = "pico";
+    event["ts"] = static_cast<qint64>(extendPicoTime(picoEvent.timestamp) - m_clockOffset);
+
+    auto closeSpan = [this, &event](int tid, bool *open, QJsonObject args) {
+        if (!*open) return;
+        QJsonObject end;
+        end["pid"] = PID_PICO;
+        end["tid"] = tid;
+        end["cat"] = "pico";
+        end["ts"] = event["ts"];
+        end["ph"] = "E";
+        if (!args.isEmpty()) end["args"] = args;
+        writeEvent(end);
+        *open = false;
+    };
+
+    // Event IDs must match debug.h on the Pico
+    switch (picoEvent.eventId) {
+        case 0x04: // TRACE_SCSI_CDB
+            // The first CDB record starts the command
+            if (picoEvent.arg0 != 0) return;
+            closeSpan(TID_PICO_SCSI, &m_picoCommandOpen, QJsonObject{{"incomplete", true}});
+            event["ph"] = "B";
+            event["name"] = scsiCommandName(picoEvent.arg1 >> 24);
+            event["args"] = QJsonObject{{"cdb", QString("%1").arg(picoEvent.arg1, 8, 16, QChar('0'))}};
+            m_picoCommandOpen = true;
+            break;
+
+        case 0x07: // TRACE_SCSI_MESSAGE
+            // The message in phase ends the command
+            closeSpan(TID_PICO_SCSI, &m_picoCommandOpen, QJsonObject());
+            return;
+
+        case 0x01: // TRACE_SCSI_BUSFREE
+        case 0x08: // TRACE_SCSI_RESET
+            // A command cut short by a reset (or an unexpected bus free) ends here
+            closeSpan(TID_PICO_SCSI, &m_picoCommandOpen, QJsonObject{{"incomplete", true}});
+            event["ph"] = "i";
+            event["s"] = "t";
+            event["name"] = TraceDecoder::decodeTraceEvent(picoEvent.eventId, picoEvent.arg0, picoEvent.arg1);
+            break;
+
+        case 0x10: // TRACE_PICOM_REQUEST
+            closeSpan(TID_PICO_LINK, &m_picoLinkOpen, QJsonObject{{"incomplete", true}});
+            event["ph"] = "B";
+            event["tid"] = TID_PICO_LINK;
+            event["name"] = QString("Pi link 0x%1").arg(picoEvent.arg1, 2, 16, QChar('0'));
+            event["args"] = QJsonObject{{"length", picoEvent.arg0}};
+            m_picoLinkOpen = true;
+            break;
+
+        case 0x11: // TRACE_PICOM_RESPONSE (arg1 set if the request failed)
+            closeSpan(TID_PICO_LINK, &m_picoLinkOpen,
+                      (picoEvent.arg1 != 0) ? QJsonObject{{"failed", true}} : QJsonObject{{"length", picoEvent.arg0}});
+            return;
+
+        default:
+            event["ph"] = "i";
+            event["s"] = "t";
+            event["name"] = TraceDecoder::decodeTraceEvent(picoEvent.eventId, picoEvent.arg0, picoEvent.arg1);
+            event["args"] = QJsonObject{{"arg0", picoEvent.arg0}, {"arg1", static_cast<qint64>(picoEvent.arg1)}};
+            break;
+    }
+
+    writeEvent(event);
+}
+
+QString Tracer::scsiCommandName(uint8_t opCode) {
+    switch (opCode) {
+        case 0x00: return "TEST UNIT READY";
+        case 0x01: return "REZERO UNIT";
+        case 0x03: return "REQUEST SENSE";
+        case 0x04: return "FORMAT";
+        case 0x08: return "READ6";
+        case 0x0A: return "WRITE6";
+        case 0x0B: return "SEEK";
+        case 0x0F: return "TRANSLATE";
+        case 0x15: return "MODE SELECT";
+        case 0x1A: return "MODE SENSE";
+        case 0x1B: return "START STOP";
+        case 0x2F: return "VERIFY";
+        case 0xC8: return "READ F-CODE";
+        case 0xCA: return "WRITE F-CODE";
+        default: return QString("SCSI 0x%1").arg(opCode, 2, 16, QChar('0'));
+    }
+}
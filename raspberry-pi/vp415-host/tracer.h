@@ -0,0 +1,121 @@
+/************************************************************************
+
+    tracer.h
+
+    VP415-host - A host application for the VP415 Emulator
+    VP415-Emulator
+    Copyright (C) 2025 Simon Inns
+
+    This file is part of VP415-Emulator.
+
+    This is free software: you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Email: simon.inns@gmail.com
+
+************************************************************************/
+
+#ifndef TRACER_H
+#define TRACER_H
+
+#include <QObject>
+#include <QString>
+#include <QFile>
+#include <QJsonObject>
+#include <QElapsedTimer>
+#include <QVector>
+
+// Timeline tracer writing Chrome/Perfetto JSON (open the file in
+// https://ui.perfetto.dev or chrome://tracing).
+//
+// Host events are timestamped with a monotonic clock.  Pico trace records
+// (from the TraceDecoder) are converted to host time using the clock offset
+// estimated from the timestamps carried by the Pico's idle polls.
+class Tracer : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit Tracer(QObject *parent = nullptr);
+    ~Tracer();
+
+    bool openTrace(QString filename);
+    void closeTrace();
+    bool isTracing() const { return m_isTracing; }
+
+    // Host time in uS since the tracer was created
+    int64_t now() const { return m_timer.nsecsElapsed() / 1000; }
+
+    // Categories used for host events
+    static constexpr const char *CATEGORY_PROTOCOL = "protocol";
+    static constexpr const char *CATEGORY_DISC_IO = "disc-io";
+    static constexpr const char *CATEGORY_VIDEO = "video";
+
+    void complete(QString category, QString name, int64_t startTime, int64_t endTime,
+                  QJsonObject args = QJsonObject());
+    void instant(QString category, QString name, QJsonObject args = QJsonObject());
+
+    void pollReceived(uint32_t picoSendTime, uint32_t previousPicoSendTime,
+                      uint32_t previousPicoReceiveTime, int64_t hostReceiveTime,
+                      int64_t hostSendTime);
+
+    bool hasClockOffset() const { return m_hasClockOffset; }
+    int64_t clockOffset() const { return m_clockOffset; }
+
+public slots:
+    void picoTraceEvent(uint32_t timestamp, uint16_t eventId, uint16_t arg0, uint32_t arg1);
+
+private:
+    struct ClockSample {
+        int64_t offset;  // Pico time - host time
+        int64_t delay;   // Round trip time less the Pi's processing time
+    };
+
+    struct PicoEvent {
+        uint32_t timestamp;
+        uint16_t eventId;
+        uint16_t arg0;
+        uint32_t arg1;
+    };
+
+    bool m_isTracing;
+    bool m_hasEvents;
+    QFile m_traceFile;
+    QElapsedTimer m_timer;
+
+    // Clock offset estimation
+    int64_t m_lastPicoTime;  // Last Pico time seen (extended to 64 bits)
+    bool m_hasPicoTime;
+    int64_t m_pendingPicoSendTime;
+    int64_t m_pendingHostReceiveTime;
+    int64_t m_pendingHostSendTime;
+    bool m_hasPendingPoll;
+    QVector<ClockSample> m_clockSamples;
+    int64_t m_clockOffset;
+    bool m_hasClockOffset;
+
+    // Pico events received before the clock offset is known
+    QVector<PicoEvent> m_pendingPicoEvents;
+
+    // Open (B without E) spans on the Pico tracks, so a span cut short by a
+    // reset or a failed link request can be closed
+    bool m_picoCommandOpen;
+    bool m_picoLinkOpen;
+
+    int64_t extendPicoTime(uint32_t picoTime);
+    void writePicoEvent(const PicoEvent &event);
+    void writeEvent(const QJsonObject &event);
+    static QString scsiCommandName(uint8_t opCode);
+};
+
+#endif // TRACER_H